@@ -0,0 +1,96 @@
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "page_table.h"
+#include "params.h"
+
+/**
+ * Lookup latency of the buffer page table
+ *
+ * @note It compares PageTable with the structure it
+ *       replaced: a heap-allocated unordered_map per table.
+ *       The table is filled like a full buffer pool, and
+ *       looked up in random order with 90% of hits.
+ */
+
+static const int NTABLES = 4;
+static const int NLOOKUPS = 20000000;
+
+struct Key {
+  int       table_id;
+  pagenum_t page_number;
+};
+
+template <typename F>
+static double measure(const std::vector<Key> &keys, F lookup) {
+  uint64_t found = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < NLOOKUPS; i++) {
+    const Key &key = keys[i % keys.size()];
+    found += lookup(key.table_id, key.page_number);
+  }
+  auto end = std::chrono::steady_clock::now();
+  if (found == 0) printf("\n");
+  return std::chrono::duration<double, std::nano>(end - begin).count() /
+         NLOOKUPS;
+}
+
+static void bench(int npages) {
+  std::mt19937_64 rng(0);
+  std::vector<Key> mapped;
+  for (int i = 0; i < npages; i++) {
+    mapped.push_back({3 + static_cast<int>(rng() % NTABLES), rng() % (1 << 24)});
+  }
+
+  std::vector<Key> keys;
+  for (int i = 0; i < 1 << 20; i++) {
+    if (rng() % 10 != 0) {
+      keys.push_back(mapped[rng() % mapped.size()]);
+    } else {
+      keys.push_back({3 + static_cast<int>(rng() % NTABLES), rng() % (1 << 24)});
+    }
+  }
+
+  /*
+   * vector<unordered_map *>
+   */
+  using HashTable = std::unordered_map<pagenum_t, frameid_t>;
+  std::vector<HashTable *> buffer_mapping(3 + NTABLES, nullptr);
+  for (int i = 3; i < 3 + NTABLES; i++) buffer_mapping[i] = new HashTable();
+  for (int i = 0; i < npages; i++) {
+    buffer_mapping[mapped[i].table_id]->insert(
+        std::make_pair(mapped[i].page_number, static_cast<frameid_t>(i)));
+  }
+  double unordered_ns = measure(keys, [&](int table_id, pagenum_t pn) {
+    HashTable *ht = buffer_mapping[table_id];
+    const auto &value = ht->find(pn);
+    return value != ht->end() ? 1 : 0;
+  });
+  for (HashTable *ht : buffer_mapping) delete ht;
+
+  /*
+   * PageTable
+   */
+  PageTable table(npages);
+  for (int i = 0; i < npages; i++) {
+    table.insert(mapped[i].table_id, mapped[i].page_number,
+                 static_cast<frameid_t>(i));
+  }
+  double flat_ns = measure(keys, [&](int table_id, pagenum_t pn) {
+    return table.find(table_id, pn) != FRAME_INVALID ? 1 : 0;
+  });
+
+  printf("%10d %20.2f %20.2f\n", npages, unordered_ns, flat_ns);
+}
+
+int main() {
+  printf("%10s %20s %20s\n", "pages", "unordered_map(ns)", "PageTable(ns)");
+  bench(BUFFER_SIZE / BUFFER_PARTITIONS);
+  bench(BUFFER_SIZE);
+  bench(16 * BUFFER_SIZE);
+  bench(256 * BUFFER_SIZE);
+  return 0;
+}
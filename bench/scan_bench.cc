@@ -0,0 +1,124 @@
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "buffer.h"
+#include "file.h"
+#include "heap.h"
+#include "scan.h"
+
+/**
+ * Throughput of heap scans with predicates
+ *
+ * @note The filter kernels are measured alone over column
+ *       arrays, then a heap file of 100-byte records is
+ *       scanned with a predicate keeping about 1% of them,
+ *       once per record with getRecord and once with a
+ *       HeapScan per instruction set.
+ */
+
+static const size_t NVALUES = 1 << 22;
+static const int    NROUNDS = 50;
+static const int    NRECORDS = 1000000;
+
+static const char *SIMD_NAMES[] = {"scalar", "sse", "avx2"};
+
+template <typename F>
+static double measure(F run) {
+  auto begin = std::chrono::steady_clock::now();
+  run();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+static void benchKernels() {
+  std::mt19937_64 rng(0);
+  std::vector<int32_t> ints(NVALUES);
+  std::vector<int64_t> longs(NVALUES);
+  for (size_t i = 0; i < NVALUES; i++) {
+    ints[i] = static_cast<int32_t>(rng() % 1000);
+    longs[i] = static_cast<int64_t>(rng() % 1000);
+  }
+  std::vector<uint64_t> bits(NVALUES / 64);
+
+  printf("%10s %15s %15s\n", "kernel", "int32(GB/s)", "int64(GB/s)");
+  for (int simd = SIMD_SCALAR; simd <= ScanKernel::detect(); simd++) {
+    double t32 = measure([&]() {
+      for (int r = 0; r < NROUNDS; r++) {
+        bits.assign(bits.size(), ~0ULL);
+        ScanKernel::filter(simd, SCAN_INT32,
+                           reinterpret_cast<const char *>(ints.data()),
+                           NVALUES, 100, 109, bits.data());
+      }
+    });
+    double t64 = measure([&]() {
+      for (int r = 0; r < NROUNDS; r++) {
+        bits.assign(bits.size(), ~0ULL);
+        ScanKernel::filter(simd, SCAN_INT64,
+                           reinterpret_cast<const char *>(longs.data()),
+                           NVALUES, 100, 109, bits.data());
+      }
+    });
+    printf("%10s %15.2f %15.2f\n", SIMD_NAMES[simd],
+           NROUNDS * NVALUES * sizeof(int32_t) / t32 / 1e9,
+           NROUNDS * NVALUES * sizeof(int64_t) / t64 / 1e9);
+  }
+}
+
+static void benchHeapScan() {
+  const char *path = "scan_bench.db";
+  remove(path);
+  PageManager *dmgr = new DiskManager();
+  BufferManager *bmgr = new BufferManager(dmgr, REPLACER_CLOCK, 65536);
+  int table_id = bmgr->openDatabase(path);
+  HeapFile heap(bmgr, table_id);
+
+  std::mt19937_64 rng(0);
+  std::vector<RecordId> rids(NRECORDS);
+  std::string record(100, 'x');
+  for (int i = 0; i < NRECORDS; i++) {
+    int64_t value = static_cast<int64_t>(rng() % 10000);
+    memcpy(&record[0], &value, sizeof(value));
+    heap.insertRecord(record.data(), record.size(), &rids[i]);
+  }
+
+  printf("\n%10s %15s %15s\n", "scan", "rows(M/s)", "matches");
+  size_t matches = 0;
+  double t = measure([&]() {
+    std::string r;
+    for (const RecordId &rid : rids) {
+      heap.getRecord(rid, &r);
+      int64_t value;
+      memcpy(&value, r.data(), sizeof(value));
+      matches += value < 100;
+    }
+  });
+  printf("%10s %15.2f %15zu\n", "getRecord", NRECORDS / t / 1e6, matches);
+
+  for (int simd = SIMD_SCALAR; simd <= ScanKernel::detect(); simd++) {
+    matches = 0;
+    t = measure([&]() {
+      HeapScan scan(bmgr, table_id, {{0, SCAN_INT64}}, {{0, PRED_LT, 100, 0}},
+                    simd);
+      ColumnBatch batch;
+      while (scan.next(&batch) == HEAP_SUCCESS) {
+        matches += batch.size;
+      }
+    });
+    printf("%10s %15.2f %15zu\n", SIMD_NAMES[simd], NRECORDS / t / 1e6,
+           matches);
+  }
+
+  delete bmgr;
+  delete dmgr;
+  remove(path);
+}
+
+int main() {
+  benchKernels();
+  benchHeapScan();
+  return 0;
+}
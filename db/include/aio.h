@@ -0,0 +1,56 @@
+#ifndef __AIO_H__
+#define __AIO_H__
+
+#include <condition_variable>
+#include <cinttypes>
+#include <mutex>
+#include <unordered_map>
+#include "file.h"
+#include "page.h"
+#include "params.h"
+
+typedef uint64_t ioticket_t;
+
+class IOBackend;
+
+/**
+ * DiskManager with batched asynchronous page I/O
+ *
+ * @example AsyncDiskManager *dmgr = new AsyncDiskManager();
+ *          ioticket_t ticket = dmgr->submitWrites(ios, n);
+ *          ...
+ *          dmgr->wait(ticket);
+ *
+ * @note It submits a whole batch with io_uring in one
+ *       system call, and a reaper thread completes it. If
+ *       io_uring is not available, a pool of threads runs
+ *       pread/pwrite instead. The pages of a batch must
+ *       stay alive until it completes. It is thread-safe.
+ */
+class AsyncDiskManager : public DiskManager {
+ private:
+  IOBackend                  *backend;
+  std::mutex                  ticket_latch;
+  std::condition_variable     ticket_cv;
+  std::unordered_map<ioticket_t, size_t> pending;
+  ioticket_t                  next_ticket;
+
+ private:
+  ioticket_t __submit(const PageIO *ios, size_t n, bool write);
+  void       __complete(ioticket_t ticket, size_t n);
+
+ public:
+  AsyncDiskManager(int queue_depth = AIO_QUEUE_DEPTH, bool use_uring = true,
+                   int io_mode = IO_BUFFERED);
+  ~AsyncDiskManager() override;
+  void readPages(const PageIO *ios, size_t n) override;
+  void writePages(const PageIO *ios, size_t n) override;
+
+  ioticket_t submitReads(const PageIO *ios, size_t n);
+  ioticket_t submitWrites(const PageIO *ios, size_t n);
+  bool       poll(ioticket_t ticket);
+  void       wait(ioticket_t ticket);
+  bool       isUringEnabled() const;
+};
+
+#endif /* __AIO_H__ */
@@ -0,0 +1,68 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cinttypes>
+#include <cstddef>
+#include "page.h"
+
+/**
+ * Arena flags
+ *
+ * @note ARENA_HUGE_PAGES backs the arena with huge pages.
+ *       ARENA_NUMA_INTERLEAVE spreads it over the online
+ *       NUMA nodes.
+ */
+#define ARENA_HUGE_PAGES      (1)
+#define ARENA_NUMA_INTERLEAVE (2)
+
+/**
+ * Backing memory of an arena
+ */
+#define ARENA_BACKING_NORMAL  (0)
+#define ARENA_BACKING_THP     (1)
+#define ARENA_BACKING_HUGETLB (2)
+#define ARENA_BACKING_HEAP    (3)
+
+/**
+ * Page frames of a buffer pool in one mapping
+ *
+ * @example FrameArena arena(nframes, ARENA_HUGE_PAGES);
+ *          Page *frame = arena.getFrame(i);
+ *
+ * @note With ARENA_HUGE_PAGES, it first maps reserved huge
+ *       pages (MAP_HUGETLB). If none are available, it maps
+ *       normal memory and asks for transparent huge pages,
+ *       which the kernel may or may not grant. Memory is
+ *       only committed when a frame is first touched, so
+ *       frames reserved for growth cost nothing until used.
+ *       If no mapping can be made, the frames are allocated
+ *       from the heap, aligned to PAGE_SIZE.
+ */
+class FrameArena {
+ public:
+  static constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+
+ private:
+  void  *mapping;
+  size_t mapping_size;
+  Page  *frames;
+  size_t nframes;
+  int    backing;
+
+ private:
+  bool __map(size_t size, bool hugetlb);
+  bool __allocate(size_t size);
+  void __interleave();
+
+ public:
+  FrameArena(size_t nframes, int flags = ARENA_HUGE_PAGES);
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+  ~FrameArena();
+  bool   isValid() const { return frames != nullptr; }
+  Page  *getFrame(size_t i) const { return &frames[i]; }
+  size_t getFrameCount() const { return nframes; }
+  int    getBacking() const { return backing; }
+};
+
+#endif /* __ARENA_H__ */
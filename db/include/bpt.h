@@ -0,0 +1,111 @@
+#ifndef __BPT_H__
+#define __BPT_H__
+
+#include <atomic>
+#include <cinttypes>
+#include <shared_mutex>
+#include <vector>
+#include "buffer.h"
+#include "page.h"
+
+#define BPT_SUCCESS   (1)
+#define BPT_NOTFOUND  (-1)
+#define BPT_DUPLICATE (-2)
+#define BPT_ALLOCFAIL (-3)
+#define BPT_NOFRAME   (-4)
+#define BPT_NOTEMPTY  (-5)
+
+/**
+ * Key-value pair of a B+ tree
+ */
+class BptRecord {
+ public:
+  bptkey_t key;
+  bptval_t value;
+};
+
+/**
+ * Bulk load settings
+ *
+ * @note Nodes are filled to `fill_factor` of their capacity,
+ *       which leaves room for inserts after the load. It is
+ *       kept between half and full.
+ */
+class BulkLoadOptions {
+ public:
+  double fill_factor = 0.9;
+};
+
+/**
+ * Disk-based B+ tree of unique keys
+ *
+ * @example BPlusTree tree(bmgr, table_id);
+ *          tree.insert(42, value);
+ *          tree.find(42, &value);
+ *          tree.scan(0, 100, &records);
+ *          tree.remove(42);
+ *          tree.bulkLoad(sorted_records, n);
+ *
+ * @note The nodes are pages of the table, accessed in place
+ *       through page guards of the buffer manager. A table
+ *       holds one tree, whose root is root_page_number of
+ *       the header page. A node is split when it overflows,
+ *       and merged with or refilled from a sibling when it
+ *       falls below half full.
+ *
+ *       Readers use optimistic lock coupling: they pin the
+ *       nodes without latching them and validate the version
+ *       of each node after reading it, starting over if a
+ *       writer got in between. A writer whose change stays
+ *       within one leaf latches only that leaf, and shares
+ *       the tree latch with other such writers. A writer that
+ *       splits or merges nodes takes the tree latch
+ *       exclusively.
+ */
+class BPlusTree {
+ private:
+  class Step {
+   public:
+    pagenum_t page_number;
+    uint32_t  index;
+  };
+  class NodeWriteGuard;
+
+ private:
+  BufferManager         *bmgr;
+  int                    table_id;
+  std::atomic<pagenum_t> root;
+  std::shared_mutex      latch;
+
+ private:
+  int  __findLeafOptimistic(bptkey_t key,
+                            BufferManager::OptimisticPageGuard *leaf,
+                            uint64_t *version, uint32_t *depth);
+  BufferManager::ReadPageGuard __findLeaf(bptkey_t key,
+                                          std::vector<Step> *path);
+  void __setRoot(BufferManager::WritePageGuard &hguard,
+                 pagenum_t page_number);
+  int  __insertAndSplit(bptkey_t key, bptval_t value);
+  int  __removeAndMerge(bptkey_t key);
+  void __insertIntoParent(const std::vector<Step> &path,
+                          std::vector<NodeWriteGuard> &guards,
+                          pagenum_t left, bptkey_t key, pagenum_t right,
+                          std::vector<NodeWriteGuard> &spares,
+                          BufferManager::WritePageGuard &hguard);
+  int  __rebalance(std::vector<Step> &path, bptkey_t key);
+  uint64_t __nextVersion(pagenum_t page_number);
+
+ public:
+  BPlusTree(BufferManager *bmgr, int table_id);
+  BPlusTree(const BPlusTree &) = delete;
+  BPlusTree &operator=(const BPlusTree &) = delete;
+  int      insert(bptkey_t key, bptval_t value);
+  int      find(bptkey_t key, bptval_t *value);
+  int      remove(bptkey_t key);
+  size_t   scan(bptkey_t begin, bptkey_t end, std::vector<BptRecord> *records);
+  int      bulkLoad(const BptRecord *records, size_t n,
+                    const BulkLoadOptions &opts = BulkLoadOptions());
+  uint32_t getHeight();
+};
+
+#endif /* __BPT_H__ */
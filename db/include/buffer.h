@@ -1,64 +1,392 @@
 #ifndef __BUFFER_H__
 #define __BUFFER_H__
 
+#include "arena.h"
 #include "page.h"
 #include "file.h"
+#include "page_table.h"
 #include "params.h"
+#include "replacer.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 #include <vector>
-#include <unordered_map>
 
 #define TID_INVALID (-1)
 
+/**
+ * Access hints
+ *
+ * @note ACCESS_SEQUENTIAL recycles a small ring of frames
+ *       for bulk scans. ACCESS_ONCE loads the page as the
+ *       next victim. Neither promotes a page on a hit.
+ */
+#define ACCESS_NORMAL     (0)
+#define ACCESS_SEQUENTIAL (1)
+#define ACCESS_ONCE       (2)
+
+/**
+ * Background writer settings
+ *
+ * @note Every round, the writer cleans dirty frames among
+ *       the next `lookahead` victims of the replacement
+ *       policy. Once the dirty frames exceed the high
+ *       watermark (a fraction of the pool), it keeps
+ *       cleaning further along the order until they drop
+ *       below the low watermark. It writes at most
+ *       `max_pages` per round.
+ */
+class BackgroundWriterOptions {
+ public:
+  int    interval_ms = 20;
+  int    max_pages = 128;
+  int    lookahead = 64;
+  double low_watermark = 0.1;
+  double high_watermark = 0.3;
+};
+
+/**
+ * Read-ahead settings
+ *
+ * @note After `trigger` reads of consecutive pages of a
+ *       table, the next `window` pages are prefetched in
+ *       the background. The window is refilled whenever
+ *       the reads have consumed half of it.
+ */
+class ReadAheadOptions {
+ public:
+  int window = 32;
+  int trigger = 4;
+};
+
+/**
+ * Checkpointer settings
+ *
+ * @note Every interval, each open table is checkpointed.
+ */
+class CheckpointOptions {
+ public:
+  int interval_ms = 1000;
+};
+
+/**
+ * Buffer statistics
+ */
+class BufferStats {
+ public:
+  uint64_t capacity = 0;
+  uint64_t misses = 0;
+  uint64_t dirty_pages = 0;
+  uint64_t dirty_evictions = 0;
+  uint64_t background_writes = 0;
+  uint64_t checkpoints = 0;
+  uint64_t prefetches = 0;
+  uint64_t prefetch_hits = 0;
+  uint64_t prefetch_waste = 0;
+};
+
 /**
  * PageManager Decorator
  * 
  * @example PageManager *dmgr = new DiskManager();
  *          PageManager *bmgr = new BufferManager(dmgr);
+ *          PageManager *bmgr = new BufferManager(dmgr, REPLACER_2Q);
+ *          PageManager *bmgr = new BufferManager(dmgr, REPLACER_CLOCK,
+ *                                                capacity, max_capacity);
+ *          PageManager *bmgr = new BufferManager(dmgr, REPLACER_CLOCK,
+ *                                                capacity, max_capacity,
+ *                                                ARENA_NUMA_INTERLEAVE);
+ *
+ * @note It is thread-safe. The page table is split into
+ *       hash partitions with their own latches, and each
+ *       frame has a reader/writer latch and an atomic pin
+ *       count. openDatabase must not race with other calls.
+ *
+ *       The frames live in a FrameArena apart from their
+ *       metadata, so the lookups on the metadata don't
+ *       drag page data through the cache, and the frames
+ *       can be backed by huge pages.
+ *
+ *       If the page manager logs a table, a page image is
+ *       logged when its write guard is released, and the
+ *       log is flushed up to it before it is written back.
+ *       sync then only flushes the log.
  */
 class BufferManager : public PageManager {
+ public:
+  class PageGuard;
+  class ReadPageGuard;
+  class WritePageGuard;
+  class OptimisticPageGuard;
+
  private:
   class BufferedPage {
    public:
-    Page          frame;
-    int           table_id;
-    pagenum_t     page_number;
-    bool          is_dirty;
-    int           pins;
-    BufferedPage *lru_prev;
-    BufferedPage *lru_next;
+    Page             *frame;
+    int               table_id;
+    pagenum_t         page_number;
+    std::atomic<bool> is_dirty;
+    std::atomic<int>  pins;
+    std::atomic<bool> in_ring;
+    std::atomic<bool> prefetched;
+    std::atomic<bool> is_valid;
+    lsn_t             page_lsn;
+    std::shared_mutex latch;
 
    public:
     BufferedPage();
   };
-  using HashTable = std::unordered_map<pagenum_t, BufferedPage *>;
+  class BufferTag {
+   public:
+    int       table_id;
+    pagenum_t page_number;
+
+   public:
+    uint64_t hash() const { return PageTable::hash(table_id, page_number); }
+  };
+  class BufferPartition {
+   public:
+    std::mutex latch;
+    PageTable  table;
+  };
+  class ReadAheadState {
+   public:
+    std::mutex latch;
+    pagenum_t  last_page;
+    pagenum_t  run;
+    pagenum_t  ahead;
+
+   public:
+    ReadAheadState() : last_page(PN_INVALID), run(0), ahead(PN_INVALID) {}
+  };
+  class PrefetchRequest {
+   public:
+    int       table_id;
+    pagenum_t begin;
+    pagenum_t end;
+    int       hint;
+  };
+
+ private:
+  static const size_t PREFETCH_QUEUE_CAPACITY = 64;
 
  private:
-  std::vector<HashTable *>  buffer_mapping;
-  BufferedPage  *buffer_pool;
-  PageManager   *dmgr;
-  BufferedPage  *lru_head;
-  BufferedPage  *lru_tail;
-  uint64_t       size;
-  uint64_t       capacity;
+  BufferPartition buffer_mapping[BUFFER_PARTITIONS];
+  BufferedPage   *buffer_pool;
+  FrameArena     *arena;
+  PageManager    *dmgr;
+  Replacer       *replacer;
+  std::mutex      free_latch;
+  std::vector<BufferedPage *> free_frames;
+  std::vector<BufferedPage *> headers;
+  std::mutex      ring_latch;
+  BufferedPage   *ring[BUFFER_RING_SIZE];
+  int             ring_cursor;
+  std::atomic<uint64_t> capacity;
+  uint64_t        max_capacity;
+  std::mutex      resize_latch;
+  std::shared_mutex direct_latch;
+
+  std::atomic<uint64_t> ndirty;
+  std::atomic<uint64_t> nmisses;
+  std::atomic<uint64_t> ndirty_evictions;
+  std::atomic<uint64_t> nbackground_writes;
+  std::atomic<uint64_t> ncheckpoints;
+  std::atomic<uint64_t> nprefetches;
+  std::atomic<uint64_t> nprefetch_hits;
+  std::atomic<uint64_t> nprefetch_waste;
+
+  std::thread             writer;
+  std::mutex              writer_latch;
+  std::condition_variable writer_cv;
+  bool                    writer_stop;
+  BackgroundWriterOptions writer_opts;
+
+  std::thread             checkpointer;
+  std::mutex              checkpointer_latch;
+  std::condition_variable checkpointer_cv;
+  bool                    checkpointer_stop;
+  CheckpointOptions       checkpointer_opts;
+
+  std::vector<ReadAheadState *> readaheads;
+  std::atomic<bool>             readahead_enabled;
+  ReadAheadOptions              readahead_opts;
+  std::thread                   prefetcher;
+  std::mutex                    prefetcher_latch;
+  std::condition_variable       prefetcher_cv;
+  bool                          prefetcher_stop;
+  std::deque<PrefetchRequest>   prefetch_queue;
 
  private:
-  HashTable    *__getBufferMapper(int table_id);
-  BufferedPage *__findBufferedPage(int table_id, pagenum_t page_number);
-  BufferedPage *__acquireBufferedPage(int table_id, pagenum_t page_number);
-  void          __releaseBufferedPage(BufferedPage *pbpg);
-  void          __lruLink(BufferedPage *pbpg);
-  void          __lruUnlink(BufferedPage *pbpg);
-  BufferedPage *__lruVictim();
+  BufferPartition *__getBufferPartition(const BufferTag &tag);
+  BufferedPage    *__findBufferedPage(const BufferTag &tag);
+  BufferedPage    *__acquireBufferedPage(int table_id, pagenum_t page_number,
+                                         int hint, bool prefetch = false);
+  void             __acquireBufferedPages(const BufferTag *tags, size_t n,
+                                          int hint, bool prefetch,
+                                          BufferedPage **pbpgs);
+  void             __touchBufferedPage(BufferedPage *pbpg, int hint,
+                                       bool prefetch);
+  BufferedPage    *__mapBufferedPage(const BufferTag &tag, int hint,
+                                     bool prefetch, int *slot, bool *load);
+  void             __admitBufferedPage(BufferedPage *pbpg, int hint, int slot);
+  void             __releaseBufferedPage(BufferedPage *pbpg);
+  BufferedPage    *__claimVictim(bool clean_only = false);
+  BufferedPage    *__claimRingFrame(int *slot);
+  void             __pushRingFrame(int slot, BufferedPage *pbpg);
+  void             __adoptRingFrame(BufferedPage *pbpg, bool cold);
+  bool             __flushBufferedPage(BufferedPage *pbpg);
+  uint64_t         __writeBack(std::vector<BufferedPage *> &pbpgs, bool wait);
+  bool             __flushCluster(BufferedPage *pbpg);
+  bool             __retireBufferedPage(BufferedPage *pbpg);
+  void             __markDirty(BufferedPage *pbpg);
+  frameid_t        __getFrameId(BufferedPage *pbpg);
+  WritePageGuard   __fetchHeaderWrite(int table_id);
+  void             __runBackgroundWriter();
+  uint64_t         __cleanAhead(uint64_t lookahead, uint64_t max_pages);
+  void             __runCheckpointer();
+  void             __detectReadAhead(int table_id, pagenum_t page_number,
+                                     int hint);
+  void             __runPrefetcher();
 
  public:
   BufferManager() = delete;
-  BufferManager(PageManager *dmgr);
+  BufferManager(PageManager *dmgr, int replacer_type = REPLACER_CLOCK,
+                uint64_t capacity = BUFFER_SIZE, uint64_t max_capacity = 0,
+                int arena_flags = ARENA_HUGE_PAGES);
   ~BufferManager() override;
   int       openDatabase(const std::string &path) override;
   pagenum_t allocPage(int table_id) override;
   void      freePage(int table_id, pagenum_t page_number) override;
+  size_t    allocPages(int table_id, size_t n, pagenum_t *page_numbers) override;
+  void      freePages(int table_id, const pagenum_t *page_numbers,
+                      size_t n) override;
   void      readPage(int table_id, pagenum_t page_number, Page *dest) override;
+  void      readPage(int table_id, pagenum_t page_number, Page *dest, int hint);
   void      writePage(int table_id, pagenum_t page_number, const Page *src) override;
+  void      readPages(const PageIO *ios, size_t n) override;
+  void      readPages(const PageIO *ios, size_t n, int hint);
+  void      writePages(const PageIO *ios, size_t n) override;
+  void      prefetchPages(int table_id, const pagenum_t *page_numbers,
+                          size_t n) override;
+  void      flush(int table_id) override;
+  void      sync(int table_id) override;
+  void      checkpoint(int table_id);
+  uint64_t  resize(uint64_t capacity);
+
+  ReadPageGuard       fetchPageRead(int table_id, pagenum_t page_number,
+                                    int hint = ACCESS_NORMAL);
+  WritePageGuard      fetchPageWrite(int table_id, pagenum_t page_number);
+  OptimisticPageGuard fetchPageOptimistic(int table_id,
+                                          pagenum_t page_number);
+  ReadPageGuard       fetchPageIfBuffered(int table_id, pagenum_t page_number);
+
+  void        startBackgroundWriter(
+             const BackgroundWriterOptions &opts = BackgroundWriterOptions());
+  void        stopBackgroundWriter();
+  void        startCheckpointer(
+             const CheckpointOptions &opts = CheckpointOptions());
+  void        stopCheckpointer();
+  void        startReadAhead(const ReadAheadOptions &opts = ReadAheadOptions());
+  void        stopReadAhead();
+  BufferStats getStats();
+};
+
+/**
+ * Pinned page handle
+ *
+ * @note The buffered page stays pinned and latched while
+ *       the guard is alive, so its frame can be accessed
+ *       in place without copying. It is unlatched and
+ *       unpinned on destruction. A guard is invalid if
+ *       every frame was pinned.
+ */
+class BufferManager::PageGuard {
+ protected:
+  static constexpr int LATCH_SHARED = 0;
+  static constexpr int LATCH_EXCLUSIVE = 1;
+  static constexpr int LATCH_NONE = 2;
+
+ protected:
+  BufferManager *bmgr;
+  BufferedPage  *pbpg;
+  int            mode;
+
+ protected:
+  PageGuard(BufferManager *bmgr, BufferedPage *pbpg, int mode);
+
+ public:
+  PageGuard();
+  PageGuard(const PageGuard &) = delete;
+  PageGuard(PageGuard &&other) noexcept;
+  PageGuard &operator=(const PageGuard &) = delete;
+  PageGuard &operator=(PageGuard &&other) noexcept;
+  ~PageGuard();
+
+  void      release();
+  bool      isValid() const { return pbpg != nullptr; }
+  int       getTableId() const { return pbpg->table_id; }
+  pagenum_t getPageNumber() const { return pbpg->page_number; }
+};
+
+/**
+ * Pinned page handle for reading
+ */
+class BufferManager::ReadPageGuard : public PageGuard {
+  friend class BufferManager;
+
+ private:
+  ReadPageGuard(BufferManager *bmgr, BufferedPage *pbpg)
+      : PageGuard(bmgr, pbpg, LATCH_SHARED) {}
+
+ public:
+  ReadPageGuard() = default;
+  const Page *get() const { return pbpg->frame; }
+  const Page *operator->() const { return get(); }
+  const Page &operator*() const { return *get(); }
+};
+
+/**
+ * Pinned page handle for writing
+ *
+ * @note The page is marked dirty when it is fetched, and
+ *       logged when it is released.
+ */
+class BufferManager::WritePageGuard : public PageGuard {
+  friend class BufferManager;
+
+ private:
+  WritePageGuard(BufferManager *bmgr, BufferedPage *pbpg)
+      : PageGuard(bmgr, pbpg, LATCH_EXCLUSIVE) {}
+
+ public:
+  WritePageGuard() = default;
+  Page *get() const { return pbpg->frame; }
+  Page *operator->() const { return get(); }
+  Page &operator*() const { return *get(); }
+};
+
+/**
+ * Pinned page handle for optimistic reading
+ *
+ * @note The page is pinned but not latched. It may change
+ *       under the reader, who validates what it read.
+ */
+class BufferManager::OptimisticPageGuard : public PageGuard {
+  friend class BufferManager;
+
+ private:
+  OptimisticPageGuard(BufferManager *bmgr, BufferedPage *pbpg)
+      : PageGuard(bmgr, pbpg, LATCH_NONE) {}
+
+ public:
+  OptimisticPageGuard() = default;
+  const Page *get() const { return pbpg->frame; }
+  const Page *operator->() const { return get(); }
+  const Page &operator*() const { return *get(); }
 };
 
 
@@ -1,10 +1,15 @@
 #ifndef __FILE_H__
 #define __FILE_H__
 
+#include <atomic>
 #include <cinttypes>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include "page.h"
+#include "wal.h"
 
 #define F_SUCCESS      (1)
 #define F_OPENFAIL     (-1)
@@ -12,36 +17,145 @@
 #define F_TRUNCATEFAIL (-3)
 #define F_VALIDATEFAIL (-4)
 
+#define SYNC_GROUP (0)
+#define SYNC_WRITE (1)
+
+#define IO_BUFFERED (0)
+#define IO_DIRECT   (1)
+
+#define LOG_NONE (0)
+#define LOG_WAL  (1)
+
+/**
+ * Page I/O request of a batch
+ *
+ * @note The page is only read from for writes.
+ */
+class PageIO {
+ public:
+  int       fd;
+  pagenum_t page_number;
+  Page     *page;
+};
+
 class PageManager {
  public:
   virtual ~PageManager() = default;
   virtual int       openDatabase(const std::string &path) = 0;
   virtual pagenum_t allocPage(int fd) = 0;
   virtual void      freePage(int fd, pagenum_t page_number) = 0;
+  virtual size_t    allocPages(int fd, size_t n, pagenum_t *page_numbers);
+  virtual void      freePages(int fd, const pagenum_t *page_numbers, size_t n);
   virtual void      readPage(int fd, pagenum_t page_number, Page *dest) = 0;
   virtual void      writePage(int fd, pagenum_t page_number, const Page *src) = 0;
+  virtual void      readPages(const PageIO *ios, size_t n);
+  virtual void      writePages(const PageIO *ios, size_t n);
+  virtual void      prefetchPages(int fd, const pagenum_t *page_numbers,
+                                  size_t n);
+  virtual void      flush(int fd) = 0;
+  virtual void      sync(int fd) = 0;
+  virtual void      barrier(int fd);
+  virtual size_t    getIOAlignment() const;
+  virtual lsn_t     logPage(int fd, pagenum_t page_number, const Page *page);
+  virtual bool      flushLog(int fd, lsn_t lsn);
+  virtual bool      isLogged(int fd) const;
+  virtual lsn_t     getLogEnd(int fd);
+  virtual void      truncateLog(int fd, lsn_t lsn);
 };
 
+/**
+ * Page manager on database files
+ *
+ * @example PageManager *dmgr = new DiskManager();
+ *          PageManager *dmgr = new DiskManager(SYNC_WRITE);
+ *          PageManager *dmgr = new DiskManager(SYNC_GROUP, IO_DIRECT);
+ *          PageManager *dmgr = new DiskManager(SYNC_GROUP, IO_BUFFERED, LOG_WAL);
+ *
+ * @note With SYNC_GROUP, writes reach the page cache only
+ *       and become durable at sync. Concurrent syncs of a
+ *       file are committed together by one fdatasync. With
+ *       SYNC_WRITE, every write is durable on return.
+ *
+ *       IO_DIRECT bypasses the page cache with O_DIRECT, so
+ *       pages are only cached by the buffer pool. Pages must
+ *       then be aligned to getIOAlignment(); a misaligned
+ *       page goes through an aligned bounce page.
+ *
+ *       LOG_WAL keeps a write-ahead log next to each file
+ *       (<path>.wal). Page images are logged by the caller
+ *       with logPage, and a page must not be written before
+ *       its record is flushed. openDatabase replays the log
+ *       onto the file before opening it, from the checkpoint
+ *       in the header page.
+ */
 class DiskManager : public PageManager {
  private:
   static const int FDS_DEFAULT_CAPACITY = 10;
 
+ private:
+  class SyncState {
+   public:
+    std::mutex              latch;
+    std::condition_variable cv;
+    uint64_t                requested;
+    uint64_t                completed;
+    bool                    syncing;
+
+   public:
+    SyncState() : requested(0), completed(0), syncing(false) {}
+  };
+
  private:
   std::vector<int> fds;
+  int              sync_mode;
+  int              io_mode;
+  int              log_mode;
+  std::mutex       sync_latch;
+  std::unordered_map<int, SyncState *> sync_states;
+  std::atomic<uint64_t> nsyncs;
+  std::atomic<uint64_t> nerrors;
+  std::unordered_map<int, LogManager *> logs;
 
  private:
   bool __fileExists(const std::string &path);
   int  __openExistingDatabaseFile(const std::string &path);
   int  __createDatabaseFile(const std::string &path);
+  int  __getOpenFlags() const;
+  int  __open(const std::string &path, int flags);
+  void __barrier(int fd);
+  lsn_t __recover(const std::string &path);
+  LogManager *__getLog(int fd) const;
+  void __transferPages(const PageIO *ios, size_t n, bool write);
+
+ protected:
+  bool __isAligned(const Page *page) const;
 
  public:
-  DiskManager();
+  DiskManager(int sync_mode = SYNC_GROUP, int io_mode = IO_BUFFERED,
+              int log_mode = LOG_NONE);
   ~DiskManager() override;
   int       openDatabase(const std::string &path) override;
   pagenum_t allocPage(int fd) override;
   void      freePage(int fd, pagenum_t page_number) override;
+  size_t    allocPages(int fd, size_t n, pagenum_t *page_numbers) override;
+  void      freePages(int fd, const pagenum_t *page_numbers, size_t n) override;
   void      readPage(int fd, pagenum_t page_number, Page *dest) override;
   void      writePage(int fd, pagenum_t page_number, const Page *src) override;
+  void      readPages(const PageIO *ios, size_t n) override;
+  void      writePages(const PageIO *ios, size_t n) override;
+  void      prefetchPages(int fd, const pagenum_t *page_numbers,
+                          size_t n) override;
+  void      flush(int fd) override;
+  void      sync(int fd) override;
+  void      barrier(int fd) override;
+  size_t    getIOAlignment() const override;
+  lsn_t     logPage(int fd, pagenum_t page_number, const Page *page) override;
+  bool      flushLog(int fd, lsn_t lsn) override;
+  bool      isLogged(int fd) const override;
+  lsn_t     getLogEnd(int fd) override;
+  void      truncateLog(int fd, lsn_t lsn) override;
+  uint64_t  getSyncCount() const { return nsyncs; }
+  uint64_t  getIOErrorCount() const { return nerrors; }
 };
 
 #endif /* __FILE_H__ */
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef __FSM_H__
+#define __FSM_H__
+
+#include <cinttypes>
+#include "file.h"
+#include "page.h"
+
+/**
+ * Bitmap free-space map of a database file
+ *
+ * @example HeaderPage *phpg = hpg.getHeaderPage();
+ *          FreeSpaceMap fsm(pmgr, fd, phpg);
+ *          pagenum_t first = fsm.alloc(16);
+ *          fsm.free(first, 16);
+ *
+ * @note It works on a header page owned by the caller, who
+ *       writes it back after a change. Bitmap pages are
+ *       read and written through the page manager. Groups
+ *       before fsm_cursor are full, and so are the pages of
+ *       the cursor group before fsm_hint, so a single page
+ *       is found in O(1) amortized time. An extent never
+ *       crosses groups. If no group has room, the file
+ *       grows doubly without writing the new pages, except
+ *       for the bitmap pages of new groups. It is not
+ *       thread-safe; the header must be latched.
+ *
+ *       The bitmap pages are listed in the header, so a
+ *       file has at most FSM_MAX_GROUPS groups, or
+ *       FSM_MAX_PAGES pages: 7,839,744 pages (29.9 GiB) with
+ *       4096-byte pages, and 4 times as much each time
+ *       PAGE_SIZE doubles. The last growth stops there, and
+ *       allocations fail once it is full.
+ */
+class FreeSpaceMap {
+ private:
+  PageManager *pmgr;
+  int          fd;
+  HeaderPage  *phpg;
+
+ private:
+  pagenum_t __getGroup(pagenum_t page_number) const;
+  pagenum_t __getGroupBegin(pagenum_t group) const;
+  pagenum_t __getGroupEnd(pagenum_t group) const;
+  uint64_t *__loadBitmap(pagenum_t group, Page *pg);
+  void      __storeBitmap(pagenum_t group, Page *pg);
+  pagenum_t __allocInGroup(pagenum_t group, pagenum_t npages);
+  pagenum_t __allocExisting(pagenum_t npages);
+  bool      __extend(pagenum_t number_of_pages);
+
+ public:
+  FreeSpaceMap(PageManager *pmgr, int fd, HeaderPage *phpg);
+  bool      init(pagenum_t number_of_pages);
+  bool      upgrade();
+  pagenum_t alloc(pagenum_t npages = 1);
+  void      free(pagenum_t page_number, pagenum_t npages = 1);
+  size_t    allocMany(size_t n, pagenum_t *page_numbers);
+  void      freeMany(const pagenum_t *page_numbers, size_t n);
+  bool      isAllocated(pagenum_t page_number);
+  pagenum_t getFreePages() const;
+};
+
+#endif /* __FSM_H__ */
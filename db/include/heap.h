@@ -0,0 +1,90 @@
+#ifndef __HEAP_H__
+#define __HEAP_H__
+
+#include <cinttypes>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "buffer.h"
+#include "page.h"
+
+#define HEAP_SUCCESS   (1)
+#define HEAP_NOTFOUND  (-1)
+#define HEAP_TOOLARGE  (-2)
+#define HEAP_ALLOCFAIL (-3)
+#define HEAP_NOFRAME   (-4)
+
+/**
+ * Address of a record of a heap file
+ */
+class RecordId {
+ public:
+  pagenum_t page_number;
+  uint32_t  slot;
+};
+
+/**
+ * Heap file of variable-length records
+ *
+ * @example HeapFile heap(bmgr, table_id);
+ *          heap.insertRecord(data, length, &rid);
+ *          heap.getRecord(rid, &record);
+ *          heap.updateRecord(rid, data, length);
+ *          heap.deleteRecord(rid);
+ *
+ * @note The records are kept in slotted pages of the table,
+ *       accessed in place through page guards of the buffer
+ *       manager. A table holds one heap file, whose pages
+ *       are listed in the header page. A record keeps its
+ *       RecordId for its lifetime: a record that outgrows
+ *       its page leaves a forwarding address behind.
+ *
+ *       Heap pages are sorted into HEAP_FREE_CLASSES lists
+ *       by their free space, so an insert takes the first
+ *       page of the smallest class with enough room instead
+ *       of searching the pages. A page is compacted when a
+ *       record fits in its free space but not in the gap
+ *       between the slots and the records.
+ *
+ *       Readers only latch the pages they read. Writers are
+ *       serialized by the heap latch, and latch one page at
+ *       a time, except a forwarding page before the page its
+ *       record moved to, like readers do.
+ */
+class HeapFile {
+ public:
+  static constexpr uint32_t MAX_RECORD_SIZE =
+      PAGE_SIZE - SlottedPage::HEADER_SIZE - sizeof(SlottedPage::Slot);
+
+ private:
+  BufferManager *bmgr;
+  int            table_id;
+  std::mutex     latch;
+
+ private:
+  int  __insert(const char *data, uint32_t length, uint16_t flags,
+                RecordId *rid);
+  int  __newPage(pagenum_t *page_number);
+  int  __readHeads(pagenum_t *heads);
+  bool __pinLinks(pagenum_t page_number, const SlottedPage *page,
+                  pagenum_t head,
+                  std::vector<BufferManager::OptimisticPageGuard> *pins);
+  void __link(pagenum_t page_number, uint32_t free_class);
+  void __unlink(pagenum_t page_number);
+  void __reclassify(pagenum_t page_number, uint32_t free_class);
+  int  __locate(const RecordId &rid, RecordId *forward);
+  int  __replace(const RecordId &rid, const char *data, uint32_t length,
+                 uint16_t flags);
+  int  __erase(const RecordId &rid);
+
+ public:
+  HeapFile(BufferManager *bmgr, int table_id);
+  HeapFile(const HeapFile &) = delete;
+  HeapFile &operator=(const HeapFile &) = delete;
+  int insertRecord(const char *data, uint32_t length, RecordId *rid);
+  int getRecord(const RecordId &rid, std::string *record);
+  int updateRecord(const RecordId &rid, const char *data, uint32_t length);
+  int deleteRecord(const RecordId &rid);
+};
+
+#endif /* __HEAP_H__ */
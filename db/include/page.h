@@ -2,13 +2,24 @@
 #define __PAGE_H__
 
 #include <cinttypes>
+#include <cstddef>
 #include "params.h"
 
 #define PN_HEADER (0)
 #define PN_INVALID (0)
 #define PN_EOFREE (0)
 
+#define FSM_INLINE_PAGES (8192)
+#define FSM_GROUP_PAGES  (PAGE_SIZE * 8)
+#define FSM_MAX_GROUPS   (240)
+#define FSM_MAX_PAGES \
+  (FSM_INLINE_PAGES + (FSM_MAX_GROUPS - 1) * FSM_GROUP_PAGES)
+
+#define HEAP_FREE_CLASSES (8)
+
 typedef uint64_t pagenum_t;
+typedef int64_t  bptkey_t;
+typedef uint64_t bptval_t;
 
 /**
  * Supported types of pages
@@ -17,6 +28,9 @@ class Page;
 class HeaderPage;
 class FreePage;
 class AllocPage;
+class LeafPage;
+class InternalPage;
+class SlottedPage;
 
 /**
  * Page
@@ -29,31 +43,110 @@ class alignas(PAGE_SIZE) Page {
   inline HeaderPage *getHeaderPage() {
     return reinterpret_cast<HeaderPage *>(this);
   }
+  inline const HeaderPage *getHeaderPage() const {
+    return reinterpret_cast<const HeaderPage *>(this);
+  }
   inline FreePage *getFreePage() {
     return reinterpret_cast<FreePage *>(this);
   }
   inline AllocPage *getAllocPage() {
     return reinterpret_cast<AllocPage *>(this);
   }
+  inline LeafPage *getLeafPage() {
+    return reinterpret_cast<LeafPage *>(this);
+  }
+  inline const LeafPage *getLeafPage() const {
+    return reinterpret_cast<const LeafPage *>(this);
+  }
+  inline InternalPage *getInternalPage() {
+    return reinterpret_cast<InternalPage *>(this);
+  }
+  inline const InternalPage *getInternalPage() const {
+    return reinterpret_cast<const InternalPage *>(this);
+  }
+  inline SlottedPage *getSlottedPage() {
+    return reinterpret_cast<SlottedPage *>(this);
+  }
+  inline const SlottedPage *getSlottedPage() const {
+    return reinterpret_cast<const SlottedPage *>(this);
+  }
 };
 
 /**
  * Header page
+ *
+ * @note Free pages are tracked by a bitmap free-space map.
+ *       Pages are split into groups: group 0 holds the
+ *       first FSM_INLINE_PAGES pages and its bitmap is
+ *       inlined here. Each next group holds FSM_GROUP_PAGES
+ *       pages, and its bitmap page is fsm_pages[group]. A
+ *       set bit is an allocated page. fsm_free counts the
+ *       free pages of each group.
+ *
+ *       free_page_number and high_water_mark are only used
+ *       by older files, which chain free pages instead
+ *       (MAGIC_NUMBER_V1, MAGIC_NUMBER_V2). They are
+ *       upgraded when opened.
+ *
+ *       checkpoint_lsn is the LSN of the last checkpoint of
+ *       a logged file. Every change logged before it is on
+ *       disk, so recovery starts there.
+ *
+ *       page_size is the page size the file was created
+ *       with. The page size is fixed per build (PAGE_SIZE),
+ *       so a file is only opened by a build of the same
+ *       size, and openDatabase fails with F_VALIDATEFAIL
+ *       otherwise. The fields up to it don't depend on the
+ *       page size, so any build can read it.
+ *       It is 0 in files from before it was recorded,
+ *       which always have 4096-byte pages. Older files
+ *       hold garbage there, and get it set when upgraded.
+ *
+ *       root_page_number is the root of the B+ tree of the
+ *       file, or PN_INVALID if the tree is empty.
+ *
+ *       The heap file of the file chains its pages from
+ *       heap_first_page_number to heap_last_page_number.
+ *       heap_free_lists[c] is the first heap page of free
+ *       space class c, which holds the pages with at least
+ *       c / HEAP_FREE_CLASSES of a page free.
  */
 class alignas(PAGE_SIZE) HeaderPage {
  public:
-  static constexpr uint64_t MAGIC_NUMBER = 0x12341234;
+  static constexpr uint64_t MAGIC_NUMBER = 0x12341236;
+  static constexpr uint64_t MAGIC_NUMBER_V1 = 0x12341234;
+  static constexpr uint64_t MAGIC_NUMBER_V2 = 0x12341235;
+  static constexpr uint64_t LEGACY_PAGE_SIZE = 4096;
 
  public:
-  uint64_t magic_number;
+  uint64_t  magic_number;
   pagenum_t free_page_number;
   pagenum_t number_of_pages;
+  pagenum_t high_water_mark;
+  pagenum_t fsm_groups;
+  pagenum_t fsm_cursor;
+  pagenum_t fsm_hint;
+  uint64_t  fsm_inline[FSM_INLINE_PAGES / 64];
+  pagenum_t fsm_pages[FSM_MAX_GROUPS];
+  uint32_t  fsm_free[FSM_MAX_GROUPS];
+  uint64_t  checkpoint_lsn;
+  uint64_t  page_size;
+  pagenum_t root_page_number;
+  pagenum_t heap_first_page_number;
+  pagenum_t heap_last_page_number;
+  pagenum_t heap_free_lists[HEAP_FREE_CLASSES];
 
  public:
   HeaderPage() = delete;
   HeaderPage(bool debug) {}
 };
 
+static_assert(sizeof(HeaderPage) == PAGE_SIZE,
+              "The header page must fit in a page");
+static_assert(offsetof(HeaderPage, page_size) + sizeof(uint64_t) <=
+                  HeaderPage::LEGACY_PAGE_SIZE,
+              "The page size must be readable by every build");
+
 /**
  * Free page
  */
@@ -78,4 +171,137 @@ class alignas(PAGE_SIZE) AllocPage {
   AllocPage(bool debug) {}
 };
 
+/**
+ * B+ tree leaf page
+ *
+ * @note The keys are sorted, and values[i] belongs to
+ *       keys[i]. The keys and the values are kept apart so
+ *       that a binary search only touches the keys. Leaves
+ *       are chained in key order by right_sibling_number.
+ *
+ *       Both node pages begin with version, is_leaf and
+ *       number_of_keys. version is odd while the node is
+ *       being written and grows by two on every change, so
+ *       a reader that didn't latch the node can tell whether
+ *       what it read is consistent.
+ */
+class alignas(PAGE_SIZE) LeafPage {
+ public:
+  static constexpr uint32_t CAPACITY =
+      (PAGE_SIZE - sizeof(uint64_t) - 2 * sizeof(uint32_t) -
+       sizeof(pagenum_t)) /
+      (sizeof(bptkey_t) + sizeof(bptval_t));
+
+ public:
+  uint64_t  version;
+  uint32_t  is_leaf;
+  uint32_t  number_of_keys;
+  pagenum_t right_sibling_number;
+  bptkey_t  keys[CAPACITY];
+  bptval_t  values[CAPACITY];
+
+ public:
+  LeafPage() = delete;
+  LeafPage(bool debug) {}
+};
+
+static_assert(sizeof(LeafPage) == PAGE_SIZE, "A leaf must fit in a page");
+
+/**
+ * B+ tree internal page
+ *
+ * @note It has number_of_keys + 1 children. The keys of
+ *       children[i] are below keys[i], and the keys of
+ *       children[i + 1] are at or above it.
+ */
+class alignas(PAGE_SIZE) InternalPage {
+ public:
+  static constexpr uint32_t CAPACITY =
+      (PAGE_SIZE - sizeof(uint64_t) - 2 * sizeof(uint32_t) -
+       sizeof(pagenum_t)) /
+      (sizeof(bptkey_t) + sizeof(pagenum_t));
+
+ public:
+  uint64_t  version;
+  uint32_t  is_leaf;
+  uint32_t  number_of_keys;
+  bptkey_t  keys[CAPACITY];
+  pagenum_t children[CAPACITY + 1];
+
+ public:
+  InternalPage() = delete;
+  InternalPage(bool debug) {}
+};
+
+static_assert(sizeof(InternalPage) == PAGE_SIZE,
+              "An internal page must fit in a page");
+
+/**
+ * Slotted page of a heap file
+ *
+ * @note The slot directory grows forward from the header
+ *       and the records grow backward from the end of the
+ *       page, down to free_space_offset. free_space counts
+ *       the gap between them and the holes left by removed
+ *       or shrunk records, which are only reclaimed when the
+ *       page is compacted. A record keeps its slot when it
+ *       is moved within the page. A free slot has offset 0,
+ *       and a record takes at least MIN_RECORD_SIZE bytes,
+ *       so that it can be replaced by a forwarding address.
+ *
+ *       A record that outgrew its page is moved to another
+ *       one and flagged SLOT_MOVED there. Its old slot is
+ *       flagged SLOT_FORWARD and holds its new RecordId.
+ *
+ *       Heap pages are chained in allocation order by
+ *       next_page_number. The pages of a free space class
+ *       are linked by prev_free_number and next_free_number.
+ */
+class alignas(PAGE_SIZE) SlottedPage {
+ public:
+  class Slot {
+   public:
+    uint16_t offset;
+    uint16_t length;
+    uint16_t flags;
+    uint16_t reserved;
+  };
+
+  static constexpr uint16_t SLOT_FORWARD = 1;
+  static constexpr uint16_t SLOT_MOVED = 2;
+  static constexpr uint32_t HEADER_SIZE =
+      3 * sizeof(pagenum_t) + 6 * sizeof(uint32_t);
+  static constexpr uint32_t MIN_RECORD_SIZE = 16;
+  static constexpr uint32_t MAX_SLOTS =
+      (PAGE_SIZE - HEADER_SIZE) / sizeof(Slot);
+
+ public:
+  pagenum_t next_page_number;
+  pagenum_t prev_free_number;
+  pagenum_t next_free_number;
+  uint32_t  number_of_slots;
+  uint32_t  number_of_free_slots;
+  uint32_t  free_space_offset;
+  uint32_t  free_space;
+  uint32_t  free_class;
+  uint32_t  reserved;
+  Slot      slots[MAX_SLOTS];
+
+ public:
+  SlottedPage() = delete;
+  SlottedPage(bool debug) {}
+  inline char *getRecord(uint32_t slot) {
+    return reinterpret_cast<char *>(this) + slots[slot].offset;
+  }
+  inline const char *getRecord(uint32_t slot) const {
+    return reinterpret_cast<const char *>(this) + slots[slot].offset;
+  }
+};
+
+static_assert(sizeof(SlottedPage) == PAGE_SIZE,
+              "A slotted page must fit in a page");
+static_assert(offsetof(SlottedPage, slots) == SlottedPage::HEADER_SIZE,
+              "The slot directory must follow the header");
+static_assert(PAGE_SIZE <= 32768, "Record offsets must fit in 16 bits");
+
 #endif /* __PAGE_H__ */
\ No newline at end of file
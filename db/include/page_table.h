@@ -0,0 +1,65 @@
+#ifndef __PAGE_TABLE_H__
+#define __PAGE_TABLE_H__
+
+#include <cinttypes>
+#include <cstddef>
+#include "page.h"
+#include "replacer.h"
+
+/**
+ * Open-addressing page table
+ *
+ * @note Swiss table layout: a control byte per slot holds
+ *       either EMPTY, DELETED or the low 7 bits of the hash
+ *       (H2). A probe compares a group of 16 control bytes
+ *       at once with SSE2 and only touches the inline
+ *       entries whose H2 matches. The high bits of the hash
+ *       (H1) pick the first group. It is not thread-safe.
+ *
+ * @example PageTable table(BUFFER_SIZE);
+ *          table.insert(table_id, page_number, frame);
+ *          frameid_t frame = table.find(table_id, page_number);
+ */
+class PageTable {
+ private:
+  static constexpr size_t GROUP_WIDTH = 16;
+  static constexpr int8_t CTRL_EMPTY = -128;
+  static constexpr int8_t CTRL_DELETED = -2;
+
+  class Entry {
+   public:
+    pagenum_t page_number;
+    int       table_id;
+    frameid_t frame;
+  };
+
+ private:
+  int8_t *ctrl;
+  Entry  *entries;
+  size_t  capacity;
+  size_t  size;
+  size_t  tombstones;
+
+ private:
+  void   __init(size_t capacity);
+  void   __rehash(size_t capacity);
+  void   __setCtrl(size_t i, int8_t h2);
+  size_t __findSlot(uint64_t hash, int table_id, pagenum_t page_number) const;
+  size_t __findInsertSlot(uint64_t hash) const;
+
+ public:
+  static uint64_t hash(int table_id, pagenum_t page_number);
+
+ public:
+  PageTable(size_t expected = 0);
+  PageTable(const PageTable &) = delete;
+  PageTable &operator=(const PageTable &) = delete;
+  ~PageTable();
+  void      reserve(size_t expected);
+  frameid_t find(int table_id, pagenum_t page_number) const;
+  bool      insert(int table_id, pagenum_t page_number, frameid_t frame);
+  bool      erase(int table_id, pagenum_t page_number);
+  size_t    getSize() const { return size; }
+};
+
+#endif /* __PAGE_TABLE_H__ */
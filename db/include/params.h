@@ -4,11 +4,24 @@
 /**
  * Parameters
  * 
- * @note You can modify parameters in here.
+ * @note You can modify parameters in here. PAGE_SIZE is
+ *       set by the DB_PAGE_SIZE build option. BUFFER_SIZE
+ *       is the default capacity of a buffer pool.
+ *       SCAN_BATCH_SIZE is the number of records a heap scan
+ *       gathers before filtering them.
  */
 
+#ifndef PAGE_SIZE
 #define PAGE_SIZE            (4096)
+#endif
 #define INITIAL_PAGES_NUMBER (256)
 #define BUFFER_SIZE          (2048)
+#define BUFFER_PARTITIONS    (16)
+#define BUFFER_RING_SIZE     (32)
+#define BUFFER_WRITE_CLUSTER (16)
+#define AIO_QUEUE_DEPTH      (128)
+#define AIO_THREADS          (4)
+#define WAL_BUFFER_SIZE      (1 << 20)
+#define SCAN_BATCH_SIZE      (1024)
 
 #endif /* __PARAMS_H__ */
\ No newline at end of file
@@ -0,0 +1,144 @@
+#ifndef __REPLACER_H__
+#define __REPLACER_H__
+
+#include <atomic>
+#include <cinttypes>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#define REPLACER_LRU   (0)
+#define REPLACER_CLOCK (1)
+#define REPLACER_2Q    (2)
+
+#define FRAME_INVALID (UINT32_MAX)
+
+typedef uint32_t frameid_t;
+
+/**
+ * Cache replacement policy over buffer frames
+ *
+ * @note Frames are identified by their index in the
+ *       buffer pool. The policy only decides the order
+ *       of victims. Whether a frame can be evicted is
+ *       decided by the claim callback, which is called
+ *       under the policy's latch. peek visits upcoming
+ *       victims the same way without evicting them. All
+ *       methods are thread-safe.
+ */
+class Replacer {
+ public:
+  using Claim = std::function<bool(frameid_t)>;
+  using Visit = std::function<bool(frameid_t)>;
+
+ public:
+  static Replacer *create(int type, frameid_t capacity);
+
+ public:
+  virtual ~Replacer() = default;
+  virtual void      admit(frameid_t frame, uint64_t tag, bool cold) = 0;
+  virtual void      access(frameid_t frame) = 0;
+  virtual frameid_t victim(const Claim &claim) = 0;
+  virtual void      peek(frameid_t n, const Visit &visit) = 0;
+  virtual void      remove(frameid_t frame) = 0;
+};
+
+/**
+ * LRU (Least Recently Used)
+ */
+class LRUReplacer : public Replacer {
+ private:
+  std::mutex             latch;
+  std::vector<frameid_t> prev;
+  std::vector<frameid_t> next;
+  std::vector<bool>      linked;
+  frameid_t              head;
+  frameid_t              tail;
+
+ private:
+  void __link(frameid_t frame, bool cold);
+  void __unlink(frameid_t frame);
+
+ public:
+  LRUReplacer(frameid_t capacity);
+  void      admit(frameid_t frame, uint64_t tag, bool cold) override;
+  void      access(frameid_t frame) override;
+  frameid_t victim(const Claim &claim) override;
+  void      peek(frameid_t n, const Visit &visit) override;
+  void      remove(frameid_t frame) override;
+};
+
+/**
+ * CLOCK (Second chance)
+ *
+ * @note A hit only sets the reference bit of the frame
+ *       without any latch.
+ */
+class ClockReplacer : public Replacer {
+ private:
+  std::mutex                  latch;
+  std::atomic<uint8_t>       *referenced;
+  std::vector<bool>           present;
+  frameid_t                   hand;
+  frameid_t                   capacity;
+
+ public:
+  ClockReplacer(frameid_t capacity);
+  ~ClockReplacer() override;
+  void      admit(frameid_t frame, uint64_t tag, bool cold) override;
+  void      access(frameid_t frame) override;
+  frameid_t victim(const Claim &claim) override;
+  void      peek(frameid_t n, const Visit &visit) override;
+  void      remove(frameid_t frame) override;
+};
+
+/**
+ * 2Q (Johnson and Shasha, VLDB '94)
+ *
+ * @note A page enters the FIFO queue A1in first. Hits
+ *       there don't promote it, so a sequential scan
+ *       passes through A1in without flushing the hot
+ *       pages in the LRU queue Am. Pages evicted from
+ *       A1in are remembered in the ghost queue A1out,
+ *       and they go to Am when they are loaded again.
+ */
+class TwoQReplacer : public Replacer {
+ private:
+  static constexpr int QUEUE_NONE = 0;
+  static constexpr int QUEUE_A1IN = 1;
+  static constexpr int QUEUE_AM = 2;
+
+ private:
+  std::mutex             latch;
+  std::vector<frameid_t> prev;
+  std::vector<frameid_t> next;
+  std::vector<int>       queue;
+  std::vector<uint64_t>  tags;
+  frameid_t              heads[3];
+  frameid_t              tails[3];
+  frameid_t              sizes[3];
+  frameid_t              kin;
+  frameid_t              kout;
+  std::deque<uint64_t>   a1out;
+  std::unordered_map<uint64_t, int> a1out_counts;
+
+ private:
+  void      __link(int q, frameid_t frame, bool cold);
+  void      __unlink(frameid_t frame);
+  void      __remember(uint64_t tag);
+  bool      __forget(uint64_t tag);
+  frameid_t __victimFrom(int q, const Claim &claim);
+  frameid_t __peekFrom(int q, frameid_t n, const Visit &visit);
+
+ public:
+  TwoQReplacer(frameid_t capacity);
+  void      admit(frameid_t frame, uint64_t tag, bool cold) override;
+  void      access(frameid_t frame) override;
+  frameid_t victim(const Claim &claim) override;
+  void      peek(frameid_t n, const Visit &visit) override;
+  void      remove(frameid_t frame) override;
+};
+
+#endif /* __REPLACER_H__ */
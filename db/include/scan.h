@@ -0,0 +1,135 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <cinttypes>
+#include <vector>
+#include "buffer.h"
+#include "heap.h"
+#include "page.h"
+
+#define SCAN_INT32 (0)
+#define SCAN_INT64 (1)
+
+#define PRED_EQ      (0)
+#define PRED_LT      (1)
+#define PRED_BETWEEN (2)
+
+#define SIMD_AUTO   (-1)
+#define SIMD_SCALAR (0)
+#define SIMD_SSE    (1)
+#define SIMD_AVX2   (2)
+
+/**
+ * Fixed-width integer field of the records of a heap file
+ *
+ * @note The field is at `offset` bytes into a record, and is
+ *       a native-endian SCAN_INT32 or SCAN_INT64.
+ */
+class ScanColumn {
+ public:
+  uint32_t offset;
+  int      type;
+};
+
+/**
+ * Condition on a column of a scan
+ *
+ * @note PRED_EQ keeps values equal to `value`, PRED_LT keeps
+ *       values below it, and PRED_BETWEEN keeps values from
+ *       `value` to `high`, both included.
+ */
+class ScanPredicate {
+ public:
+  uint32_t column;
+  int      op;
+  int64_t  value;
+  int64_t  high;
+};
+
+/**
+ * Records of a scan stored by column
+ *
+ * @note columns[c] holds `size` values of the type of
+ *       column c, and rids[i] is the record of row i.
+ */
+class ColumnBatch {
+ public:
+  size_t                         size = 0;
+  std::vector<RecordId>          rids;
+  std::vector<std::vector<char>> columns;
+
+ public:
+  const int32_t *getInt32(size_t column) const {
+    return reinterpret_cast<const int32_t *>(columns[column].data());
+  }
+  const int64_t *getInt64(size_t column) const {
+    return reinterpret_cast<const int64_t *>(columns[column].data());
+  }
+};
+
+/**
+ * Range filters over column values
+ *
+ * @note A filter clears the bit of each value outside a
+ *       range in a bitmap of the rows, 64 rows per word. It
+ *       has a kernel per instruction set, and the best one
+ *       the CPU supports is picked at run time.
+ */
+class ScanKernel {
+ public:
+  static int  detect();
+  static void filter(int simd, int type, const char *values, size_t n,
+                     int64_t low, int64_t high, uint64_t *bits);
+};
+
+/**
+ * Batch scan of a heap file
+ *
+ * @example HeapScan scan(bmgr, table_id, {{0, SCAN_INT32}},
+ *                        {{0, PRED_LT, 100, 0}});
+ *          ColumnBatch batch;
+ *          while (scan.next(&batch) == HEAP_SUCCESS) {
+ *            const int32_t *values = batch.getInt32(0);
+ *            ...
+ *          }
+ *
+ * @note The pages are read in chain order, a page at a time
+ *       with the sequential access hint, and their records
+ *       are copied into column arrays. The predicates are
+ *       then evaluated a column at a time over the batch,
+ *       and only the rows that pass all of them are kept.
+ *       Records too short for the columns are skipped. A
+ *       forwarded record is read where it moved to and kept
+ *       under its RecordId.
+ *
+ *       A scan isn't a snapshot. It sees each record that
+ *       isn't changed during the scan exactly once.
+ */
+class HeapScan {
+ private:
+  BufferManager             *bmgr;
+  int                        table_id;
+  std::vector<ScanColumn>    columns;
+  std::vector<ScanPredicate> predicates;
+  int                        simd;
+  uint32_t                   min_length;
+  pagenum_t                  next_page_number;
+  bool                       started;
+  std::vector<uint64_t>      bits;
+
+ private:
+  void   __gather(const SlottedPage *page, uint32_t slot, const RecordId &rid,
+                  ColumnBatch *batch);
+  int    __gatherPage(pagenum_t page_number, ColumnBatch *batch);
+  size_t __filter(ColumnBatch *batch);
+
+ public:
+  HeapScan(BufferManager *bmgr, int table_id,
+           const std::vector<ScanColumn>    &columns,
+           const std::vector<ScanPredicate> &predicates = {},
+           int                               simd = SIMD_AUTO);
+  int next(ColumnBatch *batch);
+  int getSimd() const { return simd; }
+};
+
+#endif /* __SCAN_H__ */
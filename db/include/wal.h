@@ -0,0 +1,95 @@
+#ifndef __WAL_H__
+#define __WAL_H__
+
+#include <cinttypes>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "page.h"
+#include "params.h"
+
+#define LSN_INVALID (0)
+#define LSN_MAX     (UINT64_MAX)
+
+typedef uint64_t lsn_t;
+
+/**
+ * Write-ahead log of a database file
+ *
+ * @example LogManager *log = new LogManager(path + ".wal", base_lsn);
+ *          lsn_t lsn = log->append(page_number, &page);
+ *          log->flush(lsn);
+ *
+ * @note A record holds a full page image, so redo is
+ *       idempotent and replays records in order. An LSN is
+ *       the log offset after the end of a record; they keep
+ *       growing when the log is reset. Records are appended
+ *       to a memory buffer and written sequentially. flush
+ *       is a group commit: one write and fdatasync covers
+ *       every record appended so far. A torn tail is
+ *       detected by the checksums and ignored by recovery.
+ *       Records before a checkpoint are dropped by truncate
+ *       and skipped by recovery. It is thread-safe.
+ *
+ *       If a write or fdatasync of the log fails, the log
+ *       fails for good: nothing more is appended, and flush
+ *       returns false, so no page relying on it is written.
+ */
+class LogManager {
+ public:
+  static constexpr uint64_t MAGIC_NUMBER = 0x57414c31;
+
+ private:
+  class LogFileHeader {
+   public:
+    uint64_t magic_number;
+    lsn_t    base_lsn;
+  };
+  class LogRecord {
+   public:
+    lsn_t     lsn;
+    pagenum_t page_number;
+    uint64_t  checksum;
+  };
+
+ private:
+  static constexpr size_t RECORD_SIZE = sizeof(LogRecord) + PAGE_SIZE;
+
+ private:
+  int                     fd;
+  std::mutex              latch;
+  std::condition_variable cv;
+  std::vector<char>       buffer;
+  lsn_t                   base_lsn;
+  lsn_t                   buffered_lsn;
+  lsn_t                   next_lsn;
+  lsn_t                   flushed_lsn;
+  lsn_t                   truncated_lsn;
+  bool                    flushing;
+  bool                    failed;
+
+ private:
+  static uint64_t __checksum(const char *data);
+  static uint64_t __seal(uint64_t checksum, lsn_t lsn, pagenum_t page_number);
+  void            __reset(lsn_t base_lsn);
+  bool            __flush(std::unique_lock<std::mutex> &lock, lsn_t lsn);
+
+ public:
+  static lsn_t recover(const std::string &path, int data_fd,
+                       lsn_t checkpoint_lsn = LSN_INVALID);
+
+ public:
+  LogManager(const std::string &path, lsn_t base_lsn);
+  LogManager(const LogManager &) = delete;
+  LogManager &operator=(const LogManager &) = delete;
+  ~LogManager();
+  bool  isOpen() const { return fd >= 0; }
+  lsn_t append(pagenum_t page_number, const Page *page);
+  bool  flush(lsn_t lsn);
+  void  truncate(lsn_t lsn);
+  lsn_t getNextLsn();
+  lsn_t getFlushedLsn();
+};
+
+#endif /* __WAL_H__ */
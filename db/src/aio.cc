@@ -0,0 +1,653 @@
+#include "aio.h"
+#include <unistd.h>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "optimize.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define AIO_HAS_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+ * Read or write a whole page with pread/pwrite
+ *
+ * @return false if the I/O failed
+ * @note   Short transfers are continued, and a read past the
+ *         end of the file fills the rest of the page with
+ *         zeros.
+ */
+static bool __transferPage(const PageIO &io, bool write) {
+  size_t done = 0;
+  while (done < PAGE_SIZE) {
+    off_t   offset = io.page_number * PAGE_SIZE + done;
+    ssize_t ret = write ? pwrite(io.fd, io.page->data + done,
+                                 PAGE_SIZE - done, offset)
+                        : pread(io.fd, io.page->data + done,
+                                PAGE_SIZE - done, offset);
+    if (unlikely(ret < 0)) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (unlikely(ret == 0)) {
+      if (write) return false;
+      memset(io.page->data + done, 0, PAGE_SIZE - done);
+      return true;
+    }
+    done += static_cast<size_t>(ret);
+  }
+  return true;
+}
+
+/**
+ * I/O backend of AsyncDiskManager
+ *
+ * @note It calls the completion callback once per
+ *       completed page with the ticket of its batch.
+ */
+class IOBackend {
+ public:
+  using Completion = std::function<void(ioticket_t, size_t)>;
+
+ public:
+  virtual ~IOBackend() = default;
+  virtual void submit(ioticket_t ticket, const PageIO *ios, size_t n,
+                      bool write) = 0;
+  virtual bool isUring() const = 0;
+};
+
+/**
+ * Thread pool running pread/pwrite
+ */
+class ThreadPoolBackend : public IOBackend {
+ private:
+  class Task {
+   public:
+    ioticket_t ticket;
+    PageIO     io;
+    bool       write;
+  };
+
+ private:
+  Completion               done;
+  std::mutex               latch;
+  std::condition_variable  cv;
+  std::deque<Task>         tasks;
+  std::vector<std::thread> workers;
+  bool                     stop;
+
+ private:
+  void __run();
+
+ public:
+  ThreadPoolBackend(int nthreads, Completion done);
+  ~ThreadPoolBackend() override;
+  void submit(ioticket_t ticket, const PageIO *ios, size_t n,
+              bool write) override;
+  bool isUring() const override { return false; }
+};
+
+ThreadPoolBackend::ThreadPoolBackend(int nthreads, Completion done)
+    : done(done), stop(false) {
+  for (int i = 0; i < nthreads; i++) {
+    workers.emplace_back(&ThreadPoolBackend::__run, this);
+  }
+}
+
+ThreadPoolBackend::~ThreadPoolBackend() {
+  {
+    std::lock_guard<std::mutex> lock(latch);
+    stop = true;
+  }
+  cv.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPoolBackend::submit(ioticket_t ticket, const PageIO *ios, size_t n,
+                               bool write) {
+  {
+    std::lock_guard<std::mutex> lock(latch);
+    for (size_t i = 0; i < n; i++) {
+      tasks.push_back({ticket, ios[i], write});
+    }
+  }
+  cv.notify_all();
+}
+
+void ThreadPoolBackend::__run() {
+  std::unique_lock<std::mutex> lock(latch);
+  for (;;) {
+    cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+    if (tasks.empty()) return;
+    Task task = tasks.front();
+    tasks.pop_front();
+    lock.unlock();
+
+    __transferPage(task.io, task.write);
+    done(task.ticket, 1);
+
+    lock.lock();
+  }
+}
+
+#ifdef AIO_HAS_URING
+/**
+ * io_uring through raw system calls
+ *
+ * @note Submitters fill the SQ ring under a latch and
+ *       submit a whole batch with one io_uring_enter. A
+ *       reaper thread waits for completions on the CQ ring.
+ *       In-flight requests never exceed the CQ ring, so it
+ *       can't overflow.
+ *
+ *       Each in-flight request has a slot holding its page,
+ *       and the user_data of its SQE is the slot. A request
+ *       the kernel fails, transfers short or doesn't accept
+ *       is done with pread/pwrite instead, so a batch always
+ *       completes.
+ */
+class UringBackend : public IOBackend {
+ private:
+  static constexpr uint64_t USER_DATA_STOP = UINT64_MAX;
+
+  class Request {
+   public:
+    ioticket_t ticket;
+    PageIO     io;
+    bool       write;
+  };
+
+ private:
+  Completion done;
+  int        ring_fd;
+
+  void                *sq_ptr;
+  size_t               sq_len;
+  unsigned            *sq_head;
+  unsigned            *sq_tail;
+  unsigned             sq_mask;
+  unsigned             sq_entries;
+  unsigned            *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t               sqes_len;
+
+  void                *cq_ptr;
+  size_t               cq_len;
+  unsigned            *cq_head;
+  unsigned            *cq_tail;
+  unsigned             cq_mask;
+  unsigned             cq_entries;
+  struct io_uring_cqe *cqes;
+
+  std::mutex              sq_latch;
+  std::condition_variable space_cv;
+  unsigned                inflight;
+  std::vector<Request>    requests;
+  std::vector<unsigned>   free_slots;
+  std::atomic<bool>       stopping;
+  std::thread             reaper;
+
+ private:
+  UringBackend(Completion done)
+      : done(done),
+        ring_fd(-1),
+        sq_ptr(nullptr),
+        sqes(nullptr),
+        cq_ptr(nullptr),
+        inflight(0),
+        stopping(false) {}
+  bool __setup(unsigned entries);
+  void __push(uint8_t opcode, int fd, void *addr, uint64_t off,
+              uint64_t user_data);
+  void __enter(unsigned to_submit);
+  void __cancelUnsubmitted();
+  void __submitLocked(std::unique_lock<std::mutex> &lock, uint8_t opcode,
+                      ioticket_t ticket, const PageIO *ios, size_t n);
+  void __reap();
+
+ public:
+  static UringBackend *create(unsigned entries, Completion done);
+  ~UringBackend() override;
+  void submit(ioticket_t ticket, const PageIO *ios, size_t n,
+              bool write) override;
+  bool isUring() const override { return true; }
+};
+
+static int __ioUringSetup(unsigned entries, struct io_uring_params *p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int __ioUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, nullptr, 0));
+}
+
+static int __ioUringRegister(int fd, unsigned opcode, void *arg,
+                             unsigned nr_args) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+/**
+ * Create an io_uring backend
+ *
+ * @return backend | nullptr if io_uring is not available
+ */
+UringBackend *UringBackend::create(unsigned entries, Completion done) {
+  UringBackend *backend = new UringBackend(done);
+  if (!backend->__setup(entries)) {
+    delete backend;
+    return nullptr;
+  }
+  backend->reaper = std::thread(&UringBackend::__reap, backend);
+  return backend;
+}
+
+bool UringBackend::__setup(unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring_fd = __ioUringSetup(entries, &p);
+  if (ring_fd < 0) return false;
+
+  /*
+   * Check that plain READ and WRITE are supported
+   */
+  {
+    size_t len = sizeof(struct io_uring_probe) +
+                 256 * sizeof(struct io_uring_probe_op);
+    std::vector<char> buf(len, 0);
+    struct io_uring_probe *probe =
+        reinterpret_cast<struct io_uring_probe *>(buf.data());
+    if (__ioUringRegister(ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+        probe->last_op < IORING_OP_WRITE ||
+        !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+        !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+      return false;
+    }
+  }
+
+  sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
+  }
+
+  sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) {
+    sq_ptr = nullptr;
+    return false;
+  }
+  if (single_mmap) {
+    cq_ptr = sq_ptr;
+  } else {
+    cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) {
+      cq_ptr = nullptr;
+      return false;
+    }
+  }
+  sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes_ptr = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes_ptr == MAP_FAILED) {
+    sqes = nullptr;
+    return false;
+  }
+
+  char *sq = static_cast<char *>(sq_ptr);
+  sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+  sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+  sq_entries = p.sq_entries;
+  sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+  sqes = static_cast<struct io_uring_sqe *>(sqes_ptr);
+
+  char *cq = static_cast<char *>(cq_ptr);
+  cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+  cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+  cq_entries = p.cq_entries;
+  cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+
+  requests.resize(cq_entries);
+  for (unsigned i = cq_entries; i > 0; i--) {
+    free_slots.push_back(i - 1);
+  }
+  return true;
+}
+
+UringBackend::~UringBackend() {
+  if (reaper.joinable()) {
+    stopping.store(true);
+    std::unique_lock<std::mutex> lock(sq_latch);
+    __submitLocked(lock, IORING_OP_NOP, USER_DATA_STOP, nullptr, 1);
+    lock.unlock();
+    reaper.join();
+  }
+  if (sqes != nullptr) munmap(sqes, sqes_len);
+  if (cq_ptr != nullptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+  if (sq_ptr != nullptr) munmap(sq_ptr, sq_len);
+  if (ring_fd >= 0) close(ring_fd);
+}
+
+/**
+ * Fill the next SQE
+ *
+ * @note sq_latch must be held, and there must be room.
+ */
+void UringBackend::__push(uint8_t opcode, int fd, void *addr, uint64_t off,
+                          uint64_t user_data) {
+  unsigned tail = *sq_tail;
+  unsigned index = tail & sq_mask;
+  struct io_uring_sqe *sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(addr);
+  sqe->len = addr != nullptr ? PAGE_SIZE : 0;
+  sqe->off = off;
+  sqe->user_data = user_data;
+  sq_array[index] = index;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Submit the filled SQEs
+ *
+ * @note sq_latch must be held. If the kernel refuses them,
+ *       the SQEs it didn't take are done synchronously.
+ */
+void UringBackend::__enter(unsigned to_submit) {
+  while (to_submit > 0) {
+    int ret = __ioUringEnter(ring_fd, to_submit, 0, 0);
+    if (unlikely(ret < 0)) {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        __cancelUnsubmitted();
+        return;
+      }
+      std::this_thread::yield();
+      continue;
+    }
+    to_submit -= static_cast<unsigned>(ret);
+  }
+}
+
+/**
+ * Take back the SQEs the kernel hasn't consumed and do them
+ * with pread/pwrite
+ *
+ * @note sq_latch must be held. Without SQPOLL the kernel
+ *       only reads the SQ ring in io_uring_enter, so the
+ *       tail can be moved back to the head.
+ */
+void UringBackend::__cancelUnsubmitted() {
+  unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *sq_tail;
+  for (unsigned i = head; i != tail; i++) {
+    uint64_t user_data = sqes[sq_array[i & sq_mask]].user_data;
+    if (user_data == USER_DATA_STOP) {
+      continue;
+    }
+    const Request &request = requests[user_data];
+    __transferPage(request.io, request.write);
+    done(request.ticket, 1);
+    free_slots.push_back(static_cast<unsigned>(user_data));
+  }
+  inflight -= tail - head;
+  __atomic_store_n(sq_tail, head, __ATOMIC_RELEASE);
+  space_cv.notify_all();
+}
+
+void UringBackend::__submitLocked(std::unique_lock<std::mutex> &lock,
+                                  uint8_t opcode, ioticket_t ticket,
+                                  const PageIO *ios, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    space_cv.wait(lock, [this]() { return inflight < cq_entries; });
+
+    unsigned used = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    size_t room = sq_entries - used;
+    if (room > cq_entries - inflight) room = cq_entries - inflight;
+    size_t k = n - i < room ? n - i : room;
+
+    for (size_t j = 0; j < k; j++, i++) {
+      if (ios == nullptr) {
+        __push(opcode, -1, nullptr, 0, ticket);
+      } else {
+        const PageIO &io = ios[i];
+        unsigned slot = free_slots.back();
+        free_slots.pop_back();
+        requests[slot] = {ticket, io, opcode == IORING_OP_WRITE};
+        __push(opcode, io.fd, io.page->data, io.page_number * PAGE_SIZE,
+               slot);
+      }
+    }
+    inflight += static_cast<unsigned>(k);
+    __enter(static_cast<unsigned>(k));
+  }
+}
+
+void UringBackend::submit(ioticket_t ticket, const PageIO *ios, size_t n,
+                          bool write) {
+  std::unique_lock<std::mutex> lock(sq_latch);
+  __submitLocked(lock, write ? IORING_OP_WRITE : IORING_OP_READ, ticket, ios,
+                 n);
+}
+
+/**
+ * Main loop of the reaper thread
+ *
+ * @note Completions of the same batch next to each other
+ *       are reported at once. A request that didn't
+ *       transfer the whole page is done again with
+ *       pread/pwrite. The slots are read under sq_latch,
+ *       since their hand-off through the kernel isn't seen
+ *       as a synchronization.
+ */
+void UringBackend::__reap() {
+  bool stop = false;
+  std::vector<std::pair<uint64_t, int32_t>> results;
+  std::vector<std::pair<Request, int32_t>>  completed;
+  while (!stop) {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      if (__ioUringEnter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+          errno != EINTR && stopping.load()) {
+        /* The stop request was refused with the ring */
+        std::lock_guard<std::mutex> lock(sq_latch);
+        stop = inflight == 0;
+      }
+      continue;
+    }
+
+    unsigned count = tail - head;
+    results.clear();
+    for (; head != tail; head++) {
+      const struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+      if (unlikely(cqe->user_data == USER_DATA_STOP)) {
+        stop = true;
+        continue;
+      }
+      results.emplace_back(cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    completed.clear();
+    {
+      std::lock_guard<std::mutex> lock(sq_latch);
+      inflight -= count;
+      for (const auto &result : results) {
+        completed.emplace_back(requests[result.first], result.second);
+        free_slots.push_back(static_cast<unsigned>(result.first));
+      }
+    }
+    space_cv.notify_all();
+
+    ioticket_t ticket = 0;
+    size_t ncompleted = 0;
+    for (const auto &entry : completed) {
+      const Request &request = entry.first;
+      if (unlikely(entry.second != PAGE_SIZE)) {
+        __transferPage(request.io, request.write);
+      }
+      if (ncompleted > 0 && request.ticket != ticket) {
+        done(ticket, ncompleted);
+        ncompleted = 0;
+      }
+      ticket = request.ticket;
+      ncompleted += 1;
+    }
+    if (ncompleted > 0) {
+      done(ticket, ncompleted);
+    }
+  }
+}
+#endif /* AIO_HAS_URING */
+
+/**
+ * @param queue_depth number of requests in flight with io_uring
+ * @param use_uring   try io_uring before the thread pool
+ * @param io_mode     IO_BUFFERED | IO_DIRECT
+ */
+AsyncDiskManager::AsyncDiskManager(int queue_depth, bool use_uring,
+                                   int io_mode)
+    : DiskManager(SYNC_GROUP, io_mode), backend(nullptr), next_ticket(1) {
+  IOBackend::Completion done = [this](ioticket_t ticket, size_t n) {
+    __complete(ticket, n);
+  };
+#ifdef AIO_HAS_URING
+  if (use_uring) {
+    backend = UringBackend::create(static_cast<unsigned>(queue_depth), done);
+  }
+#endif
+  if (backend == nullptr) {
+    backend = new ThreadPoolBackend(AIO_THREADS, done);
+  }
+}
+
+AsyncDiskManager::~AsyncDiskManager() {
+  {
+    std::unique_lock<std::mutex> lock(ticket_latch);
+    ticket_cv.wait(lock, [this]() { return pending.empty(); });
+  }
+  delete backend;
+}
+
+/**
+ * Submit a batch to the backend
+ *
+ * @note With IO_DIRECT, misaligned pages are done right
+ *       away through a bounce page, and the rest is
+ *       submitted.
+ */
+ioticket_t AsyncDiskManager::__submit(const PageIO *ios, size_t n,
+                                      bool write) {
+  std::vector<PageIO> aligned;
+  bool misaligned = false;
+  for (size_t i = 0; i < n && !misaligned; i++) {
+    misaligned = !__isAligned(ios[i].page);
+  }
+  if (unlikely(misaligned)) {
+    for (size_t i = 0; i < n; i++) {
+      const PageIO &io = ios[i];
+      if (__isAligned(io.page)) {
+        aligned.push_back(io);
+      } else if (write) {
+        writePage(io.fd, io.page_number, io.page);
+      } else {
+        readPage(io.fd, io.page_number, io.page);
+      }
+    }
+    ios = aligned.data();
+    n = aligned.size();
+  }
+
+  ioticket_t ticket;
+  {
+    std::lock_guard<std::mutex> lock(ticket_latch);
+    ticket = next_ticket++;
+    if (n > 0) {
+      pending[ticket] = n;
+    }
+  }
+  if (n > 0) {
+    backend->submit(ticket, ios, n, write);
+  }
+  return ticket;
+}
+
+void AsyncDiskManager::__complete(ioticket_t ticket, size_t n) {
+  std::lock_guard<std::mutex> lock(ticket_latch);
+  auto it = pending.find(ticket);
+  assert(it != pending.end() && it->second >= n);
+  it->second -= n;
+  if (it->second == 0) {
+    pending.erase(it);
+    ticket_cv.notify_all();
+  }
+}
+
+/**
+ * Submit a batch of page reads
+ *
+ * @param ios [in] requests
+ * @param n   [in] number of requests
+ * @return ticket to wait for the batch
+ */
+ioticket_t AsyncDiskManager::submitReads(const PageIO *ios, size_t n) {
+  return __submit(ios, n, false);
+}
+
+/**
+ * Submit a batch of page writes
+ *
+ * @param ios [in] requests
+ * @param n   [in] number of requests
+ * @return ticket to wait for the batch
+ */
+ioticket_t AsyncDiskManager::submitWrites(const PageIO *ios, size_t n) {
+  return __submit(ios, n, true);
+}
+
+/**
+ * Check whether a batch has completed
+ */
+bool AsyncDiskManager::poll(ioticket_t ticket) {
+  std::lock_guard<std::mutex> lock(ticket_latch);
+  return pending.find(ticket) == pending.end();
+}
+
+/**
+ * Wait until a batch completes
+ */
+void AsyncDiskManager::wait(ioticket_t ticket) {
+  std::unique_lock<std::mutex> lock(ticket_latch);
+  ticket_cv.wait(lock,
+                 [&]() { return pending.find(ticket) == pending.end(); });
+}
+
+void AsyncDiskManager::readPages(const PageIO *ios, size_t n) {
+  wait(submitReads(ios, n));
+}
+
+void AsyncDiskManager::writePages(const PageIO *ios, size_t n) {
+  wait(submitWrites(ios, n));
+}
+
+bool AsyncDiskManager::isUringEnabled() const { return backend->isUring(); }
@@ -0,0 +1,146 @@
+#include "arena.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#define ARENA_MPOL_INTERLEAVE (3)
+#define NUMA_NODES_MAX        (64)
+
+/**
+ * Map the frames of a pool
+ *
+ * @param nframes number of frames
+ * @param flags   ARENA_HUGE_PAGES | ARENA_NUMA_INTERLEAVE
+ */
+FrameArena::FrameArena(size_t nframes, int flags)
+    : mapping(nullptr),
+      mapping_size(0),
+      frames(nullptr),
+      nframes(nframes),
+      backing(ARENA_BACKING_NORMAL) {
+  static_assert(HUGE_PAGE_SIZE % PAGE_SIZE == 0,
+                "PAGE_SIZE must divide the huge page size");
+  assert(nframes > 0);
+  size_t size = nframes * PAGE_SIZE;
+
+  if ((flags & ARENA_HUGE_PAGES) && __map(size, true)) {
+    backing = ARENA_BACKING_HUGETLB;
+  } else if (__map(size, false)) {
+    /*
+     * Transparent huge pages need 2 MiB aligned ranges, so
+     * the frames start at the first huge page boundary.
+     */
+    if ((flags & ARENA_HUGE_PAGES) &&
+        madvise(frames, size, MADV_HUGEPAGE) == 0) {
+      backing = ARENA_BACKING_THP;
+    }
+  } else if (__allocate(size)) {
+    backing = ARENA_BACKING_HEAP;
+  } else {
+    return;
+  }
+
+  if (flags & ARENA_NUMA_INTERLEAVE) {
+    __interleave();
+  }
+}
+
+FrameArena::~FrameArena() {
+  if (mapping != nullptr) {
+    munmap(mapping, mapping_size);
+  } else {
+    free(frames);
+  }
+}
+
+/**
+ * Map the memory of the frames
+ *
+ * @param  size    size of the frames
+ * @param  hugetlb whether reserved huge pages are used
+ * @return true if it is mapped
+ * @note   A huge page mapping is aligned by the kernel. A
+ *         normal one is made a huge page larger and aligned
+ *         by hand. Huge pages are reserved up front, since
+ *         touching an unreserved one raises SIGBUS when the
+ *         pool is exhausted.
+ */
+bool FrameArena::__map(size_t size, bool hugetlb) {
+  int mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+  size_t length;
+  if (hugetlb) {
+    mflags |= MAP_HUGETLB;
+    length = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  } else {
+    mflags |= MAP_NORESERVE;
+    length = size + HUGE_PAGE_SIZE;
+  }
+
+  void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, mflags, -1, 0);
+  if (p == MAP_FAILED) return false;
+
+  uintptr_t begin = reinterpret_cast<uintptr_t>(p);
+  uintptr_t aligned = (begin + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  mapping = p;
+  mapping_size = length;
+  frames = reinterpret_cast<Page *>(aligned);
+  return true;
+}
+
+/**
+ * Allocate the frames from the heap
+ *
+ * @param  size size of the frames
+ * @return true if they are allocated
+ * @note   It is the fallback when mmap fails, so huge pages
+ *         aren't asked for.
+ */
+bool FrameArena::__allocate(size_t size) {
+  frames = static_cast<Page *>(aligned_alloc(PAGE_SIZE, size));
+  return frames != nullptr;
+}
+
+/**
+ * Interleave the frames over the online NUMA nodes
+ *
+ * @note Workers aren't tied to nodes and any of them may
+ *       touch any frame, so spreading the pages evenly
+ *       keeps one node from serving the whole pool. It is
+ *       best effort and does nothing on a single node.
+ */
+void FrameArena::__interleave() {
+#ifdef SYS_mbind
+  FILE *fp = fopen("/sys/devices/system/node/online", "r");
+  if (fp == nullptr) return;
+  char line[256];
+  if (fgets(line, sizeof(line), fp) == nullptr) {
+    fclose(fp);
+    return;
+  }
+  fclose(fp);
+
+  /*
+   * The list looks like "0-3,5"
+   */
+  unsigned long mask = 0;
+  int nnodes = 0;
+  for (char *p = line; *p != '\0' && *p != '\n';) {
+    long first = strtol(p, &p, 10);
+    long last = first;
+    if (*p == '-') last = strtol(p + 1, &p, 10);
+    for (long node = first; node <= last && node < NUMA_NODES_MAX; node++) {
+      mask |= 1UL << node;
+      nnodes += 1;
+    }
+    if (*p != ',') break;
+    p += 1;
+  }
+  if (nnodes < 2) return;
+
+  syscall(SYS_mbind, frames, nframes * PAGE_SIZE, ARENA_MPOL_INTERLEAVE,
+          &mask, NUMA_NODES_MAX + 1, 0);
+#endif
+}
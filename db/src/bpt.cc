@@ -0,0 +1,1015 @@
+#include "bpt.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include "optimize.h"
+
+#define BULK_LOAD_BATCH (64)
+
+using ReadPageGuard = BufferManager::ReadPageGuard;
+using WritePageGuard = BufferManager::WritePageGuard;
+using OptimisticPageGuard = BufferManager::OptimisticPageGuard;
+
+static inline bool __isLeaf(const Page *pg) {
+  return pg->getLeafPage()->is_leaf;
+}
+
+/**
+ * Index of the first key not less than a key in a leaf
+ *
+ * @note The number of keys is bounded, since an unlatched
+ *       reader may see any value before it validates.
+ */
+static inline uint32_t __keyIndex(const LeafPage *leaf, bptkey_t key) {
+  uint32_t n = std::min(leaf->number_of_keys, LeafPage::CAPACITY);
+  return std::lower_bound(leaf->keys, leaf->keys + n, key) - leaf->keys;
+}
+
+/**
+ * Index of the child of an internal page covering a key
+ */
+static inline uint32_t __childIndex(const InternalPage *node, bptkey_t key) {
+  uint32_t n = std::min(node->number_of_keys, InternalPage::CAPACITY);
+  return std::upper_bound(node->keys, node->keys + n, key) - node->keys;
+}
+
+/**
+ * Version of a node before reading it
+ */
+static inline uint64_t __readVersion(const Page *pg) {
+  return __atomic_load_n(&pg->getLeafPage()->version, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Whether a node is unchanged since its version was read
+ */
+static inline bool __validate(const Page *pg, uint64_t version) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return __atomic_load_n(&pg->getLeafPage()->version, __ATOMIC_RELAXED) ==
+         version;
+}
+
+/**
+ * Exclusive access to a node
+ *
+ * @note The frame latch of the write guard serializes the
+ *       writers of the node. The version is made odd while
+ *       the guard is held, so optimistic readers retry. It
+ *       is only ever raised, even across reuses of the page.
+ */
+class BPlusTree::NodeWriteGuard {
+ private:
+  WritePageGuard guard;
+
+ public:
+  NodeWriteGuard(BufferManager *bmgr, int table_id, pagenum_t page_number)
+      : guard(bmgr->fetchPageWrite(table_id, page_number)) {
+    if (likely(guard.isValid())) {
+      uint64_t *version = &guard->getLeafPage()->version;
+      __atomic_store_n(version, __atomic_load_n(version, __ATOMIC_RELAXED) | 1,
+                       __ATOMIC_RELAXED);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+  }
+  NodeWriteGuard(NodeWriteGuard &&other) = default;
+  NodeWriteGuard(const NodeWriteGuard &) = delete;
+  NodeWriteGuard &operator=(const NodeWriteGuard &) = delete;
+  ~NodeWriteGuard() { release(); }
+
+  void release() {
+    if (guard.isValid()) {
+      uint64_t *version = &guard->getLeafPage()->version;
+      __atomic_store_n(version, __atomic_load_n(version, __ATOMIC_RELAXED) + 1,
+                       __ATOMIC_RELEASE);
+      guard.release();
+    }
+  }
+  bool      isValid() const { return guard.isValid(); }
+  pagenum_t getPageNumber() const { return guard.getPageNumber(); }
+  Page     *get() const { return guard.get(); }
+  Page     *operator->() const { return get(); }
+};
+
+static void __leafInsert(LeafPage *leaf, uint32_t i, bptkey_t key,
+                         bptval_t value) {
+  uint32_t n = leaf->number_of_keys;
+  memmove(&leaf->keys[i + 1], &leaf->keys[i], (n - i) * sizeof(bptkey_t));
+  memmove(&leaf->values[i + 1], &leaf->values[i], (n - i) * sizeof(bptval_t));
+  leaf->keys[i] = key;
+  leaf->values[i] = value;
+  leaf->number_of_keys = n + 1;
+}
+
+static void __leafErase(LeafPage *leaf, uint32_t i) {
+  uint32_t n = leaf->number_of_keys;
+  memmove(&leaf->keys[i], &leaf->keys[i + 1], (n - i - 1) * sizeof(bptkey_t));
+  memmove(&leaf->values[i], &leaf->values[i + 1],
+          (n - i - 1) * sizeof(bptval_t));
+  leaf->number_of_keys = n - 1;
+}
+
+/**
+ * Merge or even out two adjacent leaves
+ *
+ * @param left      left leaf
+ * @param right     right leaf
+ * @param separator [in,out] key between them in the parent
+ * @return true if right was merged into left and is empty
+ */
+static bool __balanceLeaves(LeafPage *left, LeafPage *right,
+                            bptkey_t *separator) {
+  uint32_t a = left->number_of_keys;
+  uint32_t b = right->number_of_keys;
+  if (a + b <= LeafPage::CAPACITY) {
+    memcpy(&left->keys[a], right->keys, b * sizeof(bptkey_t));
+    memcpy(&left->values[a], right->values, b * sizeof(bptval_t));
+    left->number_of_keys = a + b;
+    left->right_sibling_number = right->right_sibling_number;
+    right->number_of_keys = 0;
+    return true;
+  }
+
+  uint32_t nleft = (a + b) / 2;
+  if (a < nleft) {
+    uint32_t k = nleft - a;
+    memcpy(&left->keys[a], right->keys, k * sizeof(bptkey_t));
+    memcpy(&left->values[a], right->values, k * sizeof(bptval_t));
+    memmove(right->keys, &right->keys[k], (b - k) * sizeof(bptkey_t));
+    memmove(right->values, &right->values[k], (b - k) * sizeof(bptval_t));
+  } else {
+    uint32_t k = a - nleft;
+    memmove(&right->keys[k], right->keys, b * sizeof(bptkey_t));
+    memmove(&right->values[k], right->values, b * sizeof(bptval_t));
+    memcpy(right->keys, &left->keys[nleft], k * sizeof(bptkey_t));
+    memcpy(right->values, &left->values[nleft], k * sizeof(bptval_t));
+  }
+  left->number_of_keys = nleft;
+  right->number_of_keys = a + b - nleft;
+  *separator = right->keys[0];
+  return false;
+}
+
+/**
+ * Merge or even out two adjacent internal pages
+ *
+ * @param left      left page
+ * @param right     right page
+ * @param separator [in,out] key between them in the parent
+ * @return true if right was merged into left and is empty
+ * @note   The separator moves down into the merged page,
+ *         or rotates through the parent when evening out.
+ */
+static bool __balanceInternals(InternalPage *left, InternalPage *right,
+                               bptkey_t *separator) {
+  uint32_t a = left->number_of_keys;
+  uint32_t b = right->number_of_keys;
+  uint32_t total = a + b + 1;
+  if (total <= InternalPage::CAPACITY) {
+    left->keys[a] = *separator;
+    memcpy(&left->keys[a + 1], right->keys, b * sizeof(bptkey_t));
+    memcpy(&left->children[a + 1], right->children,
+           (b + 1) * sizeof(pagenum_t));
+    left->number_of_keys = total;
+    right->number_of_keys = 0;
+    return true;
+  }
+
+  uint32_t nleft = total / 2;
+  if (a == nleft) return false;
+  if (a < nleft) {
+    uint32_t k = nleft - a;
+    left->keys[a] = *separator;
+    memcpy(&left->keys[a + 1], right->keys, (k - 1) * sizeof(bptkey_t));
+    memcpy(&left->children[a + 1], right->children, k * sizeof(pagenum_t));
+    *separator = right->keys[k - 1];
+    memmove(right->keys, &right->keys[k], (b - k) * sizeof(bptkey_t));
+    memmove(right->children, &right->children[k],
+            (b - k + 1) * sizeof(pagenum_t));
+    right->number_of_keys = b - k;
+  } else {
+    uint32_t k = a - nleft;
+    memmove(&right->keys[k], right->keys, b * sizeof(bptkey_t));
+    memmove(&right->children[k], right->children, (b + 1) * sizeof(pagenum_t));
+    right->keys[k - 1] = *separator;
+    memcpy(right->keys, &left->keys[nleft + 1], (k - 1) * sizeof(bptkey_t));
+    memcpy(right->children, &left->children[nleft + 1], k * sizeof(pagenum_t));
+    *separator = left->keys[nleft];
+    right->number_of_keys = b + k;
+  }
+  left->number_of_keys = nleft;
+  return false;
+}
+
+/**
+ * Open the tree of a table
+ *
+ * @param bmgr     buffer manager the table is open in
+ * @param table_id table id
+ */
+BPlusTree::BPlusTree(BufferManager *bmgr, int table_id)
+    : bmgr(bmgr), table_id(table_id) {
+  assert(bmgr != nullptr);
+  Page hpg;
+  bmgr->readPage(table_id, PN_HEADER, &hpg);
+  root = hpg.getHeaderPage()->root_page_number;
+}
+
+/**
+ * Descend to the leaf covering a key without latching
+ *
+ * @param  key     [in]  key
+ * @param  leaf    [out] guard of the leaf
+ * @param  version [out] version of the leaf when it was reached
+ * @param  depth   [out] number of internal pages above the leaf
+ * @return BPT_SUCCESS | BPT_NOTFOUND if the tree is empty
+ *         | BPT_NOFRAME
+ * @note   A child is only followed once its parent is
+ *         validated, and the parent is validated again after
+ *         the version of the child is read, so the child was
+ *         still linked at that version. It starts over from
+ *         the root when a node on the way is being written
+ *         or has changed. The caller validates the leaf after
+ *         reading it.
+ */
+int BPlusTree::__findLeafOptimistic(bptkey_t key, OptimisticPageGuard *leaf,
+                                    uint64_t *version, uint32_t *depth) {
+  for (int attempt = 0;; attempt++) {
+    if (attempt > 0) {
+      std::this_thread::yield();
+    }
+    pagenum_t page_number = root;
+    if (page_number == PN_INVALID) {
+      return BPT_NOTFOUND;
+    }
+    OptimisticPageGuard guard =
+        bmgr->fetchPageOptimistic(table_id, page_number);
+    if (unlikely(!guard.isValid())) {
+      return BPT_NOFRAME;
+    }
+    uint64_t v = __readVersion(guard.get());
+    if ((v & 1) || root != page_number) {
+      continue;
+    }
+
+    uint32_t level = 0;
+    bool restart = false;
+    while (!__isLeaf(guard.get())) {
+      const InternalPage *node = guard->getInternalPage();
+      pagenum_t child = node->children[__childIndex(node, key)];
+      if (!__validate(guard.get(), v)) {
+        restart = true;
+        break;
+      }
+      OptimisticPageGuard cguard = bmgr->fetchPageOptimistic(table_id, child);
+      if (unlikely(!cguard.isValid())) {
+        return BPT_NOFRAME;
+      }
+      uint64_t cv = __readVersion(cguard.get());
+      if ((cv & 1) || !__validate(guard.get(), v)) {
+        restart = true;
+        break;
+      }
+      guard = std::move(cguard);
+      v = cv;
+      level += 1;
+    }
+    if (restart) {
+      continue;
+    }
+    *leaf = std::move(guard);
+    *version = v;
+    *depth = level;
+    return BPT_SUCCESS;
+  }
+}
+
+/**
+ * Descend to the leaf covering a key
+ *
+ * @param  key  key
+ * @param  path [out] internal pages on the way and the
+ *              index of the child taken (nullable)
+ * @return guard of the leaf (invalid if every frame is pinned)
+ * @note   The tree must not be empty, and the tree latch
+ *         must be held exclusively.
+ */
+ReadPageGuard BPlusTree::__findLeaf(bptkey_t key, std::vector<Step> *path) {
+  ReadPageGuard guard = bmgr->fetchPageRead(table_id, root);
+  while (likely(guard.isValid()) && !__isLeaf(guard.get())) {
+    const InternalPage *node = guard->getInternalPage();
+    uint32_t i = __childIndex(node, key);
+    if (path != nullptr) {
+      path->push_back({guard.getPageNumber(), i});
+    }
+    guard = bmgr->fetchPageRead(table_id, node->children[i]);
+  }
+  return guard;
+}
+
+/**
+ * Make a page the root
+ *
+ * @param hguard write guard of the header page
+ */
+void BPlusTree::__setRoot(WritePageGuard &hguard, pagenum_t page_number) {
+  root = page_number;
+  hguard->getHeaderPage()->root_page_number = page_number;
+}
+
+/**
+ * Insert a separator above a split
+ *
+ * @param path   internal pages above the split page
+ * @param guards guards of the pages at the end of the path
+ *               that change
+ * @param left   split page
+ * @param key    first key of the new right page
+ * @param right  new right page
+ * @param spares guards of the allocated pages for the splits
+ *               above, and of the new root last
+ * @param hguard guard of the header page if the root splits
+ * @note  A full parent splits in turn and its middle key
+ *        moves up. If the root splits, a new root is made.
+ */
+void BPlusTree::__insertIntoParent(const std::vector<Step> &path,
+                                   std::vector<NodeWriteGuard> &guards,
+                                   pagenum_t left, bptkey_t key,
+                                   pagenum_t right,
+                                   std::vector<NodeWriteGuard> &spares,
+                                   WritePageGuard &hguard) {
+  bptkey_t keys[InternalPage::CAPACITY + 1];
+  pagenum_t children[InternalPage::CAPACITY + 2];
+  size_t s = 0;
+
+  for (size_t j = guards.size(); j-- > 0;) {
+    const Step &step = path[path.size() - guards.size() + j];
+    InternalPage *node = guards[j]->getInternalPage();
+    uint32_t n = node->number_of_keys;
+    uint32_t i = step.index;
+    if (n < InternalPage::CAPACITY) {
+      memmove(&node->keys[i + 1], &node->keys[i], (n - i) * sizeof(bptkey_t));
+      memmove(&node->children[i + 2], &node->children[i + 1],
+              (n - i) * sizeof(pagenum_t));
+      node->keys[i] = key;
+      node->children[i + 1] = right;
+      node->number_of_keys = n + 1;
+      return;
+    }
+
+    memcpy(keys, node->keys, i * sizeof(bptkey_t));
+    keys[i] = key;
+    memcpy(&keys[i + 1], &node->keys[i], (n - i) * sizeof(bptkey_t));
+    memcpy(children, node->children, (i + 1) * sizeof(pagenum_t));
+    children[i + 1] = right;
+    memcpy(&children[i + 2], &node->children[i + 1],
+           (n - i) * sizeof(pagenum_t));
+
+    uint32_t mid = (n + 1) / 2;
+    NodeWriteGuard &sguard = spares[s++];
+    pagenum_t sibling_number = sguard.getPageNumber();
+    InternalPage *sibling = sguard->getInternalPage();
+    sibling->is_leaf = 0;
+    sibling->number_of_keys = n - mid;
+    memcpy(sibling->keys, &keys[mid + 1], (n - mid) * sizeof(bptkey_t));
+    memcpy(sibling->children, &children[mid + 1],
+           (n - mid + 1) * sizeof(pagenum_t));
+    node->number_of_keys = mid;
+    memcpy(node->keys, keys, mid * sizeof(bptkey_t));
+    memcpy(node->children, children, (mid + 1) * sizeof(pagenum_t));
+
+    left = step.page_number;
+    key = keys[mid];
+    right = sibling_number;
+  }
+
+  pagenum_t root_number = spares[s].getPageNumber();
+  InternalPage *node = spares[s]->getInternalPage();
+  node->is_leaf = 0;
+  node->number_of_keys = 1;
+  node->keys[0] = key;
+  node->children[0] = left;
+  node->children[1] = right;
+  __setRoot(hguard, root_number);
+}
+
+/**
+ * Remove a key from an underflowing leaf and fix the underflow
+ *
+ * @param  path internal pages above the leaf and the index
+ *              of the child taken
+ * @param  key  key to remove
+ * @return BPT_SUCCESS | BPT_NOFRAME
+ * @note   The page is merged with a sibling if both fit in
+ *         one page, and refilled from it otherwise. A merge
+ *         removes a key from the parent, which may underflow
+ *         in turn. A root left with a single child is
+ *         replaced by the child. The pages of each level are
+ *         latched before any of them changes. If they can't
+ *         be latched at the leaf, nothing is removed; above
+ *         it, the page is left underflowing, which the tree
+ *         tolerates.
+ */
+int BPlusTree::__rebalance(std::vector<Step> &path, bptkey_t key) {
+  int ret = BPT_NOFRAME;
+  while (!path.empty()) {
+    Step step = path.back();
+    path.pop_back();
+    NodeWriteGuard pguard(bmgr, table_id, step.page_number);
+    if (unlikely(!pguard.isValid())) {
+      return ret;
+    }
+    InternalPage *parent = pguard->getInternalPage();
+
+    uint32_t sep = step.index > 0 ? step.index - 1 : 0;
+    pagenum_t left_number = parent->children[sep];
+    pagenum_t right_number = parent->children[sep + 1];
+    bool collapse = path.empty() && parent->number_of_keys == 1;
+    bool merged;
+    WritePageGuard hguard;
+    {
+      NodeWriteGuard lguard(bmgr, table_id, left_number);
+      NodeWriteGuard rguard(bmgr, table_id, right_number);
+      if (collapse) {
+        hguard = bmgr->fetchPageWrite(table_id, PN_HEADER);
+      }
+      if (unlikely(!lguard.isValid() || !rguard.isValid() ||
+                   (collapse && !hguard.isValid()))) {
+        return ret;
+      }
+      if (ret != BPT_SUCCESS) {
+        LeafPage *leaf = (step.index > 0 ? rguard : lguard)->getLeafPage();
+        __leafErase(leaf, __keyIndex(leaf, key));
+        ret = BPT_SUCCESS;
+      }
+      if (__isLeaf(lguard.get())) {
+        merged = __balanceLeaves(lguard->getLeafPage(), rguard->getLeafPage(),
+                                 &parent->keys[sep]);
+      } else {
+        merged = __balanceInternals(lguard->getInternalPage(),
+                                    rguard->getInternalPage(),
+                                    &parent->keys[sep]);
+      }
+    }
+    if (!merged) return ret;
+
+    uint32_t n = parent->number_of_keys;
+    memmove(&parent->keys[sep], &parent->keys[sep + 1],
+            (n - sep - 1) * sizeof(bptkey_t));
+    memmove(&parent->children[sep + 1], &parent->children[sep + 2],
+            (n - sep - 1) * sizeof(pagenum_t));
+    parent->number_of_keys = n - 1;
+
+    /*
+     * Pages are freed through the header, so it is released
+     * first
+     */
+    if (collapse) {
+      __setRoot(hguard, left_number);
+      hguard.release();
+      pguard.release();
+      bmgr->freePage(table_id, right_number);
+      bmgr->freePage(table_id, step.page_number);
+      return ret;
+    }
+    bmgr->freePage(table_id, right_number);
+    if (path.empty()) return ret;
+    if (parent->number_of_keys >= InternalPage::CAPACITY / 2) return ret;
+  }
+  return ret;
+}
+
+/**
+ * Insert a key
+ *
+ * @param key   key
+ * @param value value
+ * @return BPT_SUCCESS | BPT_DUPLICATE | BPT_ALLOCFAIL | BPT_NOFRAME
+ * @note   If the leaf has room, only the leaf is latched.
+ *         Splits can't happen meanwhile, since they need the
+ *         tree latch exclusively, so the leaf reached still
+ *         covers the key.
+ */
+int BPlusTree::insert(bptkey_t key, bptval_t value) {
+  {
+    std::shared_lock<std::shared_mutex> lock(latch);
+    OptimisticPageGuard leaf;
+    uint64_t version;
+    uint32_t depth;
+    int ret = __findLeafOptimistic(key, &leaf, &version, &depth);
+    if (unlikely(ret == BPT_NOFRAME)) {
+      return ret;
+    }
+    if (ret == BPT_SUCCESS) {
+      NodeWriteGuard guard(bmgr, table_id, leaf.getPageNumber());
+      leaf.release();
+      if (unlikely(!guard.isValid())) {
+        return BPT_NOFRAME;
+      }
+      LeafPage *pleaf = guard->getLeafPage();
+      uint32_t i = __keyIndex(pleaf, key);
+      if (i < pleaf->number_of_keys && pleaf->keys[i] == key) {
+        return BPT_DUPLICATE;
+      }
+      if (pleaf->number_of_keys < LeafPage::CAPACITY) {
+        __leafInsert(pleaf, i, key, value);
+        return BPT_SUCCESS;
+      }
+    }
+  }
+
+  std::unique_lock<std::shared_mutex> lock(latch);
+  return __insertAndSplit(key, value);
+}
+
+/**
+ * Insert a key that may split nodes
+ *
+ * @note The tree latch must be held exclusively. The pages
+ *       of every split are allocated before the tree is
+ *       changed, so a failed allocation leaves it intact.
+ */
+int BPlusTree::__insertAndSplit(bptkey_t key, bptval_t value) {
+  if (root == PN_INVALID) {
+    pagenum_t page_number = bmgr->allocPage(table_id);
+    if (unlikely(page_number == PN_INVALID)) {
+      return BPT_ALLOCFAIL;
+    }
+    NodeWriteGuard guard(bmgr, table_id, page_number);
+    WritePageGuard hguard = bmgr->fetchPageWrite(table_id, PN_HEADER);
+    if (unlikely(!guard.isValid() || !hguard.isValid())) {
+      hguard.release();
+      guard.release();
+      bmgr->freePage(table_id, page_number);
+      return BPT_NOFRAME;
+    }
+    LeafPage *leaf = guard->getLeafPage();
+    leaf->is_leaf = 1;
+    leaf->number_of_keys = 1;
+    leaf->right_sibling_number = PN_INVALID;
+    leaf->keys[0] = key;
+    leaf->values[0] = value;
+    __setRoot(hguard, page_number);
+    return BPT_SUCCESS;
+  }
+
+  std::vector<Step> path;
+  pagenum_t leaf_number;
+  {
+    ReadPageGuard guard = __findLeaf(key, &path);
+    if (unlikely(!guard.isValid())) {
+      return BPT_NOFRAME;
+    }
+    leaf_number = guard.getPageNumber();
+  }
+  NodeWriteGuard guard(bmgr, table_id, leaf_number);
+  if (unlikely(!guard.isValid())) {
+    return BPT_NOFRAME;
+  }
+  LeafPage *leaf = guard->getLeafPage();
+  uint32_t n = leaf->number_of_keys;
+  uint32_t i = __keyIndex(leaf, key);
+  if (i < n && leaf->keys[i] == key) {
+    return BPT_DUPLICATE;
+  }
+  if (n < LeafPage::CAPACITY) {
+    __leafInsert(leaf, i, key, value);
+    return BPT_SUCCESS;
+  }
+
+  /*
+   * The leaf splits, and so does every full page above it.
+   * A new root is needed if they are all full.
+   */
+  size_t nsplits = 1;
+  for (size_t level = path.size(); level-- > 0;) {
+    ReadPageGuard pguard =
+        bmgr->fetchPageRead(table_id, path[level].page_number);
+    if (unlikely(!pguard.isValid())) {
+      return BPT_NOFRAME;
+    }
+    if (pguard->getInternalPage()->number_of_keys < InternalPage::CAPACITY) {
+      break;
+    }
+    nsplits += 1;
+  }
+  size_t npages = nsplits > path.size() ? nsplits + 1 : nsplits;
+  std::vector<pagenum_t> spares(npages);
+  size_t nallocated = bmgr->allocPages(table_id, npages, spares.data());
+  if (unlikely(nallocated < npages)) {
+    bmgr->freePages(table_id, spares.data(), nallocated);
+    return BPT_ALLOCFAIL;
+  }
+
+  /*
+   * Every page that changes is latched before any of them
+   * does. Otherwise a reader could validate a parent that
+   * doesn't cover its split child yet, and running out of
+   * frames halfway would leave the tree half split.
+   */
+  auto invalid = [](const NodeWriteGuard &g) { return !g.isValid(); };
+  size_t nlatched = std::min(nsplits, path.size());
+  std::vector<NodeWriteGuard> guards;
+  guards.reserve(nlatched);
+  for (size_t level = path.size() - nlatched; level < path.size(); level++) {
+    guards.emplace_back(bmgr, table_id, path[level].page_number);
+  }
+  NodeWriteGuard sguard(bmgr, table_id, spares[0]);
+  std::vector<NodeWriteGuard> sguards;
+  sguards.reserve(npages - 1);
+  for (size_t k = 1; k < npages; k++) {
+    sguards.emplace_back(bmgr, table_id, spares[k]);
+  }
+  WritePageGuard hguard;
+  if (npages > nsplits) {
+    hguard = bmgr->fetchPageWrite(table_id, PN_HEADER);
+  }
+  if (unlikely(!sguard.isValid() || (npages > nsplits && !hguard.isValid()) ||
+               std::any_of(guards.begin(), guards.end(), invalid) ||
+               std::any_of(sguards.begin(), sguards.end(), invalid))) {
+    hguard.release();
+    sguards.clear();
+    sguard.release();
+    guards.clear();
+    guard.release();
+    bmgr->freePages(table_id, spares.data(), npages);
+    return BPT_NOFRAME;
+  }
+  LeafPage *sibling = sguard->getLeafPage();
+  uint32_t split = (n + 1) / 2;
+  uint32_t from = i < split ? split - 1 : split;
+  memcpy(sibling->keys, &leaf->keys[from], (n - from) * sizeof(bptkey_t));
+  memcpy(sibling->values, &leaf->values[from], (n - from) * sizeof(bptval_t));
+  sibling->is_leaf = 1;
+  sibling->number_of_keys = n - from;
+  sibling->right_sibling_number = leaf->right_sibling_number;
+  leaf->number_of_keys = from;
+  leaf->right_sibling_number = spares[0];
+  if (i < split) {
+    __leafInsert(leaf, i, key, value);
+  } else {
+    __leafInsert(sibling, i - split, key, value);
+  }
+  bptkey_t separator = sibling->keys[0];
+  sguard.release();
+  guard.release();
+
+  __insertIntoParent(path, guards, leaf_number, separator, spares[0], sguards,
+                     hguard);
+  return BPT_SUCCESS;
+}
+
+/**
+ * Look a key up
+ *
+ * @param key   key
+ * @param value [out] value of the key
+ * @return BPT_SUCCESS | BPT_NOTFOUND | BPT_NOFRAME
+ * @note   No latch is taken. It retries until it reads the
+ *         leaf unchanged.
+ */
+int BPlusTree::find(bptkey_t key, bptval_t *value) {
+  for (;;) {
+    OptimisticPageGuard guard;
+    uint64_t version;
+    uint32_t depth;
+    int ret = __findLeafOptimistic(key, &guard, &version, &depth);
+    if (ret != BPT_SUCCESS) {
+      return ret;
+    }
+    const LeafPage *leaf = guard->getLeafPage();
+    uint32_t i = __keyIndex(leaf, key);
+    bool found = i < leaf->number_of_keys && leaf->keys[i] == key;
+    bptval_t v = found ? leaf->values[i] : 0;
+    if (!__validate(guard.get(), version)) {
+      continue;
+    }
+    if (!found) {
+      return BPT_NOTFOUND;
+    }
+    *value = v;
+    return BPT_SUCCESS;
+  }
+}
+
+/**
+ * Remove a key
+ *
+ * @param key key
+ * @return BPT_SUCCESS | BPT_NOTFOUND | BPT_NOFRAME
+ * @note   If the leaf stays at least half full, only the
+ *         leaf is latched.
+ */
+int BPlusTree::remove(bptkey_t key) {
+  {
+    std::shared_lock<std::shared_mutex> lock(latch);
+    OptimisticPageGuard leaf;
+    uint64_t version;
+    uint32_t depth;
+    int ret = __findLeafOptimistic(key, &leaf, &version, &depth);
+    if (ret != BPT_SUCCESS) {
+      return ret;
+    }
+    NodeWriteGuard guard(bmgr, table_id, leaf.getPageNumber());
+    leaf.release();
+    if (unlikely(!guard.isValid())) {
+      return BPT_NOFRAME;
+    }
+    LeafPage *pleaf = guard->getLeafPage();
+    uint32_t n = pleaf->number_of_keys;
+    uint32_t i = __keyIndex(pleaf, key);
+    if (i >= n || pleaf->keys[i] != key) {
+      return BPT_NOTFOUND;
+    }
+    if (depth > 0 ? n > LeafPage::CAPACITY / 2 : n > 1) {
+      __leafErase(pleaf, i);
+      return BPT_SUCCESS;
+    }
+  }
+
+  std::unique_lock<std::shared_mutex> lock(latch);
+  return __removeAndMerge(key);
+}
+
+/**
+ * Remove a key that may merge nodes
+ *
+ * @note The tree latch must be held exclusively.
+ */
+int BPlusTree::__removeAndMerge(bptkey_t key) {
+  if (root == PN_INVALID) {
+    return BPT_NOTFOUND;
+  }
+
+  std::vector<Step> path;
+  pagenum_t leaf_number;
+  {
+    ReadPageGuard guard = __findLeaf(key, &path);
+    if (unlikely(!guard.isValid())) {
+      return BPT_NOFRAME;
+    }
+    leaf_number = guard.getPageNumber();
+  }
+  NodeWriteGuard guard(bmgr, table_id, leaf_number);
+  if (unlikely(!guard.isValid())) {
+    return BPT_NOFRAME;
+  }
+  LeafPage *leaf = guard->getLeafPage();
+  uint32_t n = leaf->number_of_keys;
+  uint32_t i = __keyIndex(leaf, key);
+  if (i >= n || leaf->keys[i] != key) {
+    return BPT_NOTFOUND;
+  }
+
+  if (path.empty() && n == 1) {
+    WritePageGuard hguard = bmgr->fetchPageWrite(table_id, PN_HEADER);
+    if (unlikely(!hguard.isValid())) {
+      return BPT_NOFRAME;
+    }
+    __leafErase(leaf, i);
+    __setRoot(hguard, PN_INVALID);
+    hguard.release();
+    guard.release();
+    bmgr->freePage(table_id, leaf_number);
+    return BPT_SUCCESS;
+  }
+  if (path.empty() || n - 1 >= LeafPage::CAPACITY / 2) {
+    __leafErase(leaf, i);
+    return BPT_SUCCESS;
+  }
+  guard.release();
+  return __rebalance(path, key);
+}
+
+/**
+ * Read a range of keys
+ *
+ * @param begin   first key of the range
+ * @param end     last key of the range
+ * @param records [out] records in the range, appended in
+ *                key order
+ * @return number of records appended
+ * @note   No latch is taken. Only the leftmost leaf is
+ *         looked up, and the others are reached through the
+ *         sibling chain. A leaf is appended once it is
+ *         validated. If one changed, the scan resumes from
+ *         the root after the last key appended.
+ */
+size_t BPlusTree::scan(bptkey_t begin, bptkey_t end,
+                       std::vector<BptRecord> *records) {
+  if (begin > end) {
+    return 0;
+  }
+  size_t count = 0;
+  std::vector<BptRecord> batch;
+  batch.reserve(LeafPage::CAPACITY);
+  for (;;) {
+    OptimisticPageGuard guard;
+    uint64_t version;
+    uint32_t depth;
+    if (__findLeafOptimistic(begin, &guard, &version, &depth) != BPT_SUCCESS) {
+      return count;
+    }
+    for (;;) {
+      const LeafPage *leaf = guard->getLeafPage();
+      uint32_t n = std::min(leaf->number_of_keys, LeafPage::CAPACITY);
+      bool done = false;
+      batch.clear();
+      for (uint32_t i = __keyIndex(leaf, begin); i < n; i++) {
+        if (leaf->keys[i] > end) {
+          done = true;
+          break;
+        }
+        batch.push_back({leaf->keys[i], leaf->values[i]});
+      }
+      pagenum_t next = leaf->right_sibling_number;
+      if (!__validate(guard.get(), version)) {
+        break;
+      }
+
+      records->insert(records->end(), batch.begin(), batch.end());
+      count += batch.size();
+      if (!batch.empty()) {
+        if (batch.back().key == end) return count;
+        begin = batch.back().key + 1;
+      }
+      if (done || next == PN_INVALID) {
+        return count;
+      }
+      OptimisticPageGuard nguard = bmgr->fetchPageOptimistic(table_id, next);
+      if (unlikely(!nguard.isValid())) {
+        return count;
+      }
+      uint64_t nversion = __readVersion(nguard.get());
+      if ((nversion & 1) || !__validate(guard.get(), version)) {
+        break;
+      }
+      guard = std::move(nguard);
+      version = nversion;
+    }
+    std::this_thread::yield();
+  }
+}
+
+/**
+ * First version of a node written without a node guard
+ *
+ * @note Only a buffered page can be pinned by an optimistic
+ *       reader, so it is the only one whose old version is
+ *       needed to keep versions raising.
+ */
+uint64_t BPlusTree::__nextVersion(pagenum_t page_number) {
+  ReadPageGuard guard = bmgr->fetchPageIfBuffered(table_id, page_number);
+  if (!guard.isValid()) {
+    return 0;
+  }
+  return (guard->getLeafPage()->version | 1) + 1;
+}
+
+/**
+ * Load records into an empty tree
+ *
+ * @param  records records to load
+ * @param  n       number of records
+ * @param  opts    load settings
+ * @return BPT_SUCCESS | BPT_NOTEMPTY | BPT_DUPLICATE | BPT_ALLOCFAIL
+ *         | BPT_NOFRAME
+ * @note   The tree is built bottom-up without splits: the
+ *         leaves are filled in key order, then each level of
+ *         internal pages over the one below. The pages of
+ *         all levels are allocated up front, in as few
+ *         extents as the free space map allows, and written
+ *         around the buffer in batches, so the load is mostly
+ *         sequential writes. Records that aren't sorted by
+ *         key are sorted in memory first. The tree appears at
+ *         once when the root is set at the end.
+ */
+int BPlusTree::bulkLoad(const BptRecord *records, size_t n,
+                        const BulkLoadOptions &opts) {
+  std::unique_lock<std::shared_mutex> lock(latch);
+  if (root != PN_INVALID) {
+    return BPT_NOTEMPTY;
+  }
+  if (n == 0) {
+    return BPT_SUCCESS;
+  }
+
+  auto less = [](const BptRecord &a, const BptRecord &b) {
+    return a.key < b.key;
+  };
+  std::vector<BptRecord> sorted;
+  if (!std::is_sorted(records, records + n, less)) {
+    sorted.assign(records, records + n);
+    std::sort(sorted.begin(), sorted.end(), less);
+    records = sorted.data();
+  }
+  for (size_t i = 1; i < n; i++) {
+    if (records[i - 1].key == records[i].key) {
+      return BPT_DUPLICATE;
+    }
+  }
+
+  /*
+   * Number of pages of each level, from the leaves up. The
+   * entries of a level are spread evenly over its pages.
+   */
+  double fill_factor = std::min(1.0, std::max(0.5, opts.fill_factor));
+  size_t leaf_fill = std::max<size_t>(1, LeafPage::CAPACITY * fill_factor);
+  size_t fanout =
+      std::max<size_t>(2, (InternalPage::CAPACITY + 1) * fill_factor);
+  std::vector<size_t> counts = {(n + leaf_fill - 1) / leaf_fill};
+  while (counts.back() > 1) {
+    counts.push_back((counts.back() + fanout - 1) / fanout);
+  }
+  size_t npages = 0;
+  for (size_t count : counts) {
+    npages += count;
+  }
+
+  std::vector<pagenum_t> page_numbers(npages);
+  size_t nallocated = bmgr->allocPages(table_id, npages, page_numbers.data());
+  if (unlikely(nallocated < npages)) {
+    bmgr->freePages(table_id, page_numbers.data(), nallocated);
+    return BPT_ALLOCFAIL;
+  }
+
+  std::vector<Page> batch(BULK_LOAD_BATCH);
+  std::vector<PageIO> ios;
+  auto newPage = [&](pagenum_t page_number) {
+    if (ios.size() == batch.size()) {
+      bmgr->writePages(ios.data(), ios.size());
+      ios.clear();
+    }
+    Page *pg = &batch[ios.size()];
+    memset(pg->data, 0, PAGE_SIZE);
+    pg->getLeafPage()->version = __nextVersion(page_number);
+    ios.push_back({table_id, page_number, pg});
+    return pg;
+  };
+
+  const pagenum_t *level = page_numbers.data();
+  std::vector<bptkey_t> first_keys(counts[0]);
+  for (size_t i = 0; i < counts[0]; i++) {
+    size_t begin = n * i / counts[0];
+    size_t end = n * (i + 1) / counts[0];
+    LeafPage *leaf = newPage(level[i])->getLeafPage();
+    leaf->is_leaf = 1;
+    leaf->number_of_keys = end - begin;
+    leaf->right_sibling_number =
+        i + 1 < counts[0] ? level[i + 1] : PN_INVALID;
+    for (size_t j = begin; j < end; j++) {
+      leaf->keys[j - begin] = records[j].key;
+      leaf->values[j - begin] = records[j].value;
+    }
+    first_keys[i] = records[begin].key;
+  }
+
+  for (size_t l = 1; l < counts.size(); l++) {
+    const pagenum_t *children = level;
+    size_t nchildren = counts[l - 1];
+    level += nchildren;
+    for (size_t i = 0; i < counts[l]; i++) {
+      size_t begin = nchildren * i / counts[l];
+      size_t end = nchildren * (i + 1) / counts[l];
+      InternalPage *node = newPage(level[i])->getInternalPage();
+      node->is_leaf = 0;
+      node->number_of_keys = end - begin - 1;
+      node->children[0] = children[begin];
+      for (size_t j = begin + 1; j < end; j++) {
+        node->keys[j - begin - 1] = first_keys[j];
+        node->children[j - begin] = children[j];
+      }
+      first_keys[i] = first_keys[begin];
+    }
+  }
+  bmgr->writePages(ios.data(), ios.size());
+
+  WritePageGuard hguard = bmgr->fetchPageWrite(table_id, PN_HEADER);
+  if (unlikely(!hguard.isValid())) {
+    bmgr->freePages(table_id, page_numbers.data(), npages);
+    return BPT_NOFRAME;
+  }
+  __setRoot(hguard, level[0]);
+  return BPT_SUCCESS;
+}
+
+/**
+ * Number of levels of the tree
+ *
+ * @return 0 if it is empty, 1 if the root is a leaf, ...
+ */
+uint32_t BPlusTree::getHeight() {
+  std::shared_lock<std::shared_mutex> lock(latch);
+  if (root == PN_INVALID) {
+    return 0;
+  }
+  uint32_t height = 1;
+  ReadPageGuard guard = bmgr->fetchPageRead(table_id, root);
+  while (guard.isValid() && !__isLeaf(guard.get())) {
+    guard = bmgr->fetchPageRead(table_id,
+                                guard->getInternalPage()->children[0]);
+    height += 1;
+  }
+  return height;
+}
@@ -1,96 +1,390 @@
 #include "buffer.h"
 #include <unistd.h>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <new>
+#include <vector>
 #include "file.h"
+#include "fsm.h"
 #include "optimize.h"
 #include "page.h"
 
 BufferManager::BufferedPage::BufferedPage()
-    : table_id(TID_INVALID),
+    : frame(nullptr),
+      table_id(TID_INVALID),
       page_number(PN_INVALID),
       is_dirty(false),
       pins(0),
-      lru_prev(nullptr),
-      lru_next(nullptr) {}
+      in_ring(false),
+      prefetched(false),
+      is_valid(false),
+      page_lsn(LSN_INVALID) {}
 
-BufferManager::BufferManager(PageManager *dmgr) {
+BufferManager::PageGuard::PageGuard()
+    : bmgr(nullptr), pbpg(nullptr), mode(LATCH_NONE) {}
+
+BufferManager::PageGuard::PageGuard(BufferManager *bmgr, BufferedPage *pbpg,
+                                    int mode)
+    : bmgr(bmgr), pbpg(pbpg), mode(mode) {
+  if (unlikely(pbpg == nullptr)) return;
+  if (mode == LATCH_EXCLUSIVE) {
+    pbpg->latch.lock();
+    bmgr->__markDirty(pbpg);
+  } else if (mode == LATCH_SHARED) {
+    pbpg->latch.lock_shared();
+  } else if (unlikely(!pbpg->is_valid)) {
+    /*
+     * The page is being loaded under the exclusive latch
+     */
+    pbpg->latch.lock_shared();
+    pbpg->latch.unlock_shared();
+  }
+}
+
+BufferManager::PageGuard::PageGuard(PageGuard &&other) noexcept
+    : bmgr(other.bmgr), pbpg(other.pbpg), mode(other.mode) {
+  other.bmgr = nullptr;
+  other.pbpg = nullptr;
+}
+
+BufferManager::PageGuard &BufferManager::PageGuard::operator=(
+    PageGuard &&other) noexcept {
+  if (this != &other) {
+    release();
+    bmgr = other.bmgr;
+    pbpg = other.pbpg;
+    mode = other.mode;
+    other.bmgr = nullptr;
+    other.pbpg = nullptr;
+  }
+  return *this;
+}
+
+BufferManager::PageGuard::~PageGuard() { release(); }
+
+/**
+ * Unlatch and unpin the guarded page
+ *
+ * @note The guard becomes invalid after it. A written page
+ *       is logged before it is unlatched.
+ */
+void BufferManager::PageGuard::release() {
+  if (pbpg != nullptr) {
+    if (mode == LATCH_EXCLUSIVE) {
+      lsn_t lsn =
+          bmgr->dmgr->logPage(pbpg->table_id, pbpg->page_number, pbpg->frame);
+      if (lsn != LSN_INVALID) pbpg->page_lsn = lsn;
+      pbpg->latch.unlock();
+    } else if (mode == LATCH_SHARED) {
+      pbpg->latch.unlock_shared();
+    }
+    bmgr->__releaseBufferedPage(pbpg);
+    bmgr = nullptr;
+    pbpg = nullptr;
+  }
+}
+
+/**
+ * @param dmgr          PageManager to decorate
+ * @param replacer_type REPLACER_LRU | REPLACER_CLOCK | REPLACER_2Q
+ * @param capacity      number of frames
+ * @param max_capacity  number of frames it can grow to
+ *                      (capacity if 0)
+ * @param arena_flags   ARENA_HUGE_PAGES | ARENA_NUMA_INTERLEAVE
+ * @note  The arena is mapped for max_capacity frames, but
+ *        the frames past capacity don't take memory until
+ *        the pool grows into them. If it can't be mapped, the
+ *        pool can't grow past capacity, and std::bad_alloc is
+ *        thrown if capacity frames can't be allocated either.
+ *        An unknown replacer_type falls back to REPLACER_CLOCK.
+ *        Frames are aligned to PAGE_SIZE, which meets the
+ *        alignment of the disk manager (O_DIRECT); a page
+ *        manager asking for more reads and writes them
+ *        through bounce pages.
+ */
+BufferManager::BufferManager(PageManager *dmgr, int replacer_type,
+                             uint64_t capacity, uint64_t max_capacity,
+                             int arena_flags) {
   assert(dmgr != nullptr);
-  buffer_pool = new BufferedPage[BUFFER_SIZE];
+  assert(capacity > 0);
+  if (max_capacity < capacity) max_capacity = capacity;
+  arena = new FrameArena(max_capacity, arena_flags);
+  if (unlikely(!arena->isValid() && max_capacity > capacity)) {
+    delete arena;
+    max_capacity = capacity;
+    arena = new FrameArena(max_capacity, arena_flags);
+  }
+  if (unlikely(!arena->isValid())) {
+    delete arena;
+    throw std::bad_alloc();
+  }
+  buffer_pool = new BufferedPage[max_capacity];
+  for (uint64_t i = 0; i < max_capacity; i++) {
+    buffer_pool[i].frame = arena->getFrame(i);
+  }
   this->dmgr = dmgr;
+  replacer = Replacer::create(replacer_type, max_capacity);
+  if (unlikely(replacer == nullptr)) {
+    replacer = Replacer::create(REPLACER_CLOCK, max_capacity);
+  }
 
-  BufferedPage *alpha = &buffer_pool[0];
-  alpha->table_id = 0;
-  alpha->page_number = PN_INVALID;
-  alpha->is_dirty = false;
-  alpha->pins = 0;
-  alpha->lru_prev = nullptr;
-  alpha->lru_next = nullptr;
-  HashTable *ht = __getBufferMapper(0);
-  ht->insert(std::make_pair(PN_INVALID, alpha));
+  free_frames.reserve(max_capacity);
+  for (uint64_t i = capacity; i-- > 0;) {
+    free_frames.push_back(&buffer_pool[i]);
+  }
+  for (int i = 0; i < BUFFER_PARTITIONS; i++) {
+    buffer_mapping[i].table.reserve(2 * capacity / BUFFER_PARTITIONS);
+  }
+  for (int i = 0; i < BUFFER_RING_SIZE; i++) {
+    ring[i] = nullptr;
+  }
+  ring_cursor = 0;
+  this->capacity = capacity;
+  this->max_capacity = max_capacity;
 
-  lru_head = alpha;
-  lru_tail = alpha;
-  size = 1;
-  capacity = BUFFER_SIZE;
+  ndirty = 0;
+  nmisses = 0;
+  ndirty_evictions = 0;
+  nbackground_writes = 0;
+  ncheckpoints = 0;
+  nprefetches = 0;
+  nprefetch_hits = 0;
+  nprefetch_waste = 0;
+  writer_stop = true;
+  checkpointer_stop = true;
+  readahead_enabled = false;
+  prefetcher_stop = true;
 }
 
 BufferManager::~BufferManager() {
-  for (int i = 0; i < BUFFER_SIZE; i++) {
-    BufferedPage *pbpg = &buffer_pool[i];
-    if (pbpg->is_dirty) {
-      dmgr->writePage(pbpg->table_id, pbpg->page_number, &pbpg->frame);
+  stopReadAhead();
+  stopCheckpointer();
+  stopBackgroundWriter();
+  for (BufferedPage *pbpg : headers) {
+    if (pbpg != nullptr) __releaseBufferedPage(pbpg);
+  }
+  std::vector<BufferedPage *> dirty;
+  for (uint64_t i = 0; i < max_capacity; i++) {
+    if (buffer_pool[i].is_dirty) {
+      dirty.push_back(&buffer_pool[i]);
     }
   }
-  for (HashTable *ht : buffer_mapping) {
-    if (ht) delete ht;
+  __writeBack(dirty, true);
+  for (ReadAheadState *ra : readaheads) {
+    delete ra;
   }
-  delete buffer_pool;
+  delete replacer;
+  delete[] buffer_pool;
+  delete arena;
 }
 
-BufferManager::HashTable *BufferManager::__getBufferMapper(int table_id) {
-  if (unlikely(buffer_mapping.size() <= table_id)) {
-    buffer_mapping.resize(table_id + 1, nullptr);
-    buffer_mapping[table_id] = new HashTable();
-  }
-  return buffer_mapping[table_id];
+BufferManager::BufferPartition *BufferManager::__getBufferPartition(
+    const BufferTag &tag) {
+  size_t h = tag.hash();
+  return &buffer_mapping[(h >> 32) % BUFFER_PARTITIONS];
 }
 
+/**
+ * Find a buffered page and pin it
+ *
+ * @param  tag Identity of the page
+ * @return Pinned buffered page | nullptr
+ * @note   Pins are only taken under the partition latch,
+ *         so a frame with no pins under the latch can be
+ *         evicted safely.
+ */
 BufferManager::BufferedPage *BufferManager::__findBufferedPage(
-    int table_id, pagenum_t page_number) {
-  HashTable *ht = __getBufferMapper(table_id);
-  const auto &value = ht->find(page_number);
-  return value != ht->end() ? value->second : nullptr;
+    const BufferTag &tag) {
+  BufferPartition *part = __getBufferPartition(tag);
+  std::lock_guard<std::mutex> lock(part->latch);
+  frameid_t frame = part->table.find(tag.table_id, tag.page_number);
+  if (frame == FRAME_INVALID) {
+    return nullptr;
+  }
+  buffer_pool[frame].pins += 1;
+  return &buffer_pool[frame];
 }
 
+/**
+ * Pin a buffered page, loading it on a miss
+ *
+ * @param  hint     ACCESS_NORMAL | ACCESS_SEQUENTIAL | ACCESS_ONCE
+ * @param  prefetch whether it is loaded ahead of a read
+ * @return Pinned buffered page | nullptr
+ * @note   It returns nullptr if every frame is pinned.
+ *         The frame is loaded under its exclusive latch,
+ *         so concurrent readers of the same page wait on
+ *         the latch until the content is valid. A prefetch
+ *         only takes free or clean frames and doesn't count
+ *         as an access.
+ */
 BufferManager::BufferedPage *BufferManager::__acquireBufferedPage(
-    int table_id, pagenum_t page_number) {
-  BufferedPage *pbpg = __findBufferedPage(table_id, page_number);
-  if (pbpg == nullptr) {
-    if (size < capacity) {
-      pbpg = &buffer_pool[size++];
+    int table_id, pagenum_t page_number, int hint, bool prefetch) {
+  BufferTag tag = {table_id, page_number};
+  BufferedPage *pbpg = __findBufferedPage(tag);
+  if (pbpg != nullptr) {
+    __touchBufferedPage(pbpg, hint, prefetch);
+    return pbpg;
+  }
+
+  if (!prefetch) {
+    nmisses += 1;
+  }
+  int slot = -1;
+  bool load = false;
+  pbpg = __mapBufferedPage(tag, hint, prefetch, &slot, &load);
+  if (likely(load)) {
+    dmgr->readPage(table_id, page_number, pbpg->frame);
+    __admitBufferedPage(pbpg, hint, slot);
+  }
+  return pbpg;
+}
+
+/**
+ * Pin buffered pages, loading the misses in one batch
+ *
+ * @param tags     [in]  identities of the pages
+ * @param n        [in]  number of pages
+ * @param hint     [in]  ACCESS_NORMAL | ACCESS_SEQUENTIAL | ACCESS_ONCE
+ * @param prefetch [in]  whether they are loaded ahead of a read
+ * @param pbpgs    [out] pinned buffered pages | nullptr
+ * @note  The frames of the misses are claimed and mapped
+ *        first, and stay latched exclusively until the
+ *        batch is read. A page listed twice is pinned twice.
+ */
+void BufferManager::__acquireBufferedPages(const BufferTag *tags, size_t n,
+                                           int hint, bool prefetch,
+                                           BufferedPage **pbpgs) {
+  std::vector<PageIO> ios;
+  std::vector<std::pair<BufferedPage *, int>> loads;
+  for (size_t i = 0; i < n; i++) {
+    BufferedPage *pbpg = __findBufferedPage(tags[i]);
+    if (pbpg != nullptr) {
+      __touchBufferedPage(pbpg, hint, prefetch);
+      pbpgs[i] = pbpg;
+      continue;
+    }
+
+    if (!prefetch) {
+      nmisses += 1;
+    }
+    int slot = -1;
+    bool load = false;
+    pbpg = __mapBufferedPage(tags[i], hint, prefetch, &slot, &load);
+    if (load) {
+      ios.push_back({tags[i].table_id, tags[i].page_number, pbpg->frame});
+      loads.push_back({pbpg, slot});
+    }
+    pbpgs[i] = pbpg;
+  }
+
+  dmgr->readPages(ios.data(), ios.size());
+  for (const auto &load : loads) {
+    __admitBufferedPage(load.first, hint, load.second);
+  }
+}
+
+/**
+ * Account an access to a buffered page
+ */
+void BufferManager::__touchBufferedPage(BufferedPage *pbpg, int hint,
+                                        bool prefetch) {
+  if (prefetch) {
+    return;
+  }
+  if (unlikely(pbpg->prefetched) && pbpg->prefetched.exchange(false)) {
+    nprefetch_hits += 1;
+  }
+  if (hint == ACCESS_NORMAL) {
+    if (unlikely(pbpg->in_ring)) {
+      __adoptRingFrame(pbpg, false);
     } else {
-      pbpg = __lruVictim();
-      __lruUnlink(pbpg);
-      HashTable *ht = __getBufferMapper(pbpg->table_id);
-      ht->erase(pbpg->page_number);
-      if (pbpg->is_dirty) {
-        dmgr->writePage(pbpg->table_id, pbpg->page_number, &pbpg->frame);
+      replacer->access(__getFrameId(pbpg));
+    }
+  }
+}
+
+/**
+ * Claim a frame for a missing page and map it
+ *
+ * @param  tag      [in]  identity of the page
+ * @param  hint     [in]  access hint
+ * @param  prefetch [in]  whether it is loaded ahead of a read
+ * @param  slot     [out] slot of the ring for the frame
+ * @param  load     [out] whether the frame must be loaded
+ * @return Pinned buffered page | nullptr
+ * @note   If the frame must be loaded, it is returned
+ *         latched exclusively, to be read and passed to
+ *         __admitBufferedPage. Otherwise another thread has
+ *         loaded the page in the meantime.
+ */
+BufferManager::BufferedPage *BufferManager::__mapBufferedPage(
+    const BufferTag &tag, int hint, bool prefetch, int *slot, bool *load) {
+  *load = false;
+  BufferedPage *victim = nullptr;
+  if (hint == ACCESS_SEQUENTIAL) {
+    victim = __claimRingFrame(slot);
+  }
+  if (victim == nullptr) {
+    victim = __claimVictim(prefetch);
+  }
+  if (unlikely(victim == nullptr)) {
+    return nullptr;
+  }
+
+  victim->latch.lock();
+  {
+    BufferPartition *part = __getBufferPartition(tag);
+    std::unique_lock<std::mutex> lock(part->latch);
+    frameid_t frame = part->table.find(tag.table_id, tag.page_number);
+    if (unlikely(frame != FRAME_INVALID)) {
+      BufferedPage *pbpg = &buffer_pool[frame];
+      pbpg->pins += 1;
+      lock.unlock();
+
+      victim->latch.unlock();
+      victim->pins -= 1;
+      {
+        std::lock_guard<std::mutex> free_lock(free_latch);
+        free_frames.push_back(victim);
       }
+      __touchBufferedPage(pbpg, hint, prefetch);
+      return pbpg;
     }
-    dmgr->readPage(table_id, page_number, &pbpg->frame);
-    pbpg->table_id = table_id;
-    pbpg->page_number = page_number;
-    pbpg->is_dirty = false;
-    pbpg->pins = 0;
-    HashTable *ht = __getBufferMapper(table_id);
-    ht->insert(std::make_pair(page_number, pbpg));
-  } else {
-    __lruUnlink(pbpg);
+    if (unlikely(victim->prefetched.exchange(prefetch))) {
+      nprefetch_waste += 1;
+    }
+    if (prefetch) {
+      nprefetches += 1;
+    }
+    victim->table_id = tag.table_id;
+    victim->page_number = tag.page_number;
+    victim->in_ring = (hint == ACCESS_SEQUENTIAL);
+    victim->is_valid = false;
+    part->table.insert(tag.table_id, tag.page_number, __getFrameId(victim));
   }
+  *load = true;
+  return victim;
+}
 
-  pbpg->pins += 1;
-  __lruLink(pbpg);
-  return pbpg;
+/**
+ * Unlatch a loaded frame and hand it to the policy
+ */
+void BufferManager::__admitBufferedPage(BufferedPage *pbpg, int hint,
+                                        int slot) {
+  pbpg->is_dirty = false;
+  pbpg->page_lsn = LSN_INVALID;
+  pbpg->is_valid = true;
+  pbpg->latch.unlock();
+
+  if (hint == ACCESS_SEQUENTIAL) {
+    __pushRingFrame(slot, pbpg);
+  } else {
+    replacer->admit(__getFrameId(pbpg),
+                    PageTable::hash(pbpg->table_id, pbpg->page_number),
+                    hint == ACCESS_ONCE);
+  }
 }
 
 void BufferManager::__releaseBufferedPage(BufferedPage *pbpg) {
@@ -98,171 +392,1148 @@ void BufferManager::__releaseBufferedPage(BufferedPage *pbpg) {
 }
 
 /**
- * Link a buffered page to LRU cache
+ * Claim a frame to load a new page into
  *
- * @param pbpg Buffered page to link
- * @note  It appends the page to its head, because
- *        the cache replacement policy is LRU
- *        (Least Recently Used). Head means that
- *        the page is most-recently used. However,
- *        Tail means that the page is least-recently
- *        used.
+ * @param  clean_only whether dirty frames are skipped
+ * @return Unmapped frame pinned once | nullptr
+ * @note   A free frame is used first. Otherwise the
+ *         replacement policy picks an unpinned victim,
+ *         which is unmapped from the page table. If the
+ *         victim is dirty, it is written back first while
+ *         it is still mapped, so no one can read a stale
+ *         copy from disk. Then it is given back to the
+ *         policy as a cold page and the search restarts. If
+ *         victims stay dirty, as when their log failed, it
+ *         gives up after a pool's worth of them.
  */
-void BufferManager::__lruLink(BufferedPage *pbpg) {
-  pbpg->lru_prev = nullptr;
-  pbpg->lru_next = lru_head;
-  lru_head->lru_prev = pbpg;
-  lru_head = pbpg;
+BufferManager::BufferedPage *BufferManager::__claimVictim(bool clean_only) {
+  {
+    std::lock_guard<std::mutex> free_lock(free_latch);
+    if (!free_frames.empty()) {
+      BufferedPage *pbpg = free_frames.back();
+      free_frames.pop_back();
+      pbpg->pins = 1;
+      return pbpg;
+    }
+  }
+
+  for (uint64_t nstuck = 0;;) {
+    bool dirty = false;
+    frameid_t frame = replacer->victim([&](frameid_t frame) {
+      BufferedPage *pbpg = &buffer_pool[frame];
+      if (pbpg->pins > 0) return false;
+
+      BufferTag tag = {pbpg->table_id, pbpg->page_number};
+      BufferPartition *part = __getBufferPartition(tag);
+      std::lock_guard<std::mutex> lock(part->latch);
+      if (unlikely(pbpg->pins > 0)) return false;
+      if (clean_only && pbpg->is_dirty) return false;
+
+      pbpg->pins = 1;
+      dirty = pbpg->is_dirty;
+      if (!dirty) {
+        part->table.erase(tag.table_id, tag.page_number);
+      }
+      return true;
+    });
+    if (unlikely(frame == FRAME_INVALID)) {
+      return nullptr;
+    }
+
+    BufferedPage *pbpg = &buffer_pool[frame];
+    if (likely(!dirty)) {
+      return pbpg;
+    }
+    if (__flushCluster(pbpg)) {
+      ndirty_evictions += 1;
+      writer_cv.notify_one();
+    }
+    bool stuck = pbpg->is_dirty;
+    replacer->admit(frame,
+                    PageTable::hash(pbpg->table_id, pbpg->page_number),
+                    true);
+    pbpg->pins -= 1;
+    if (unlikely(stuck && ++nstuck >= capacity)) {
+      return nullptr;
+    }
+  }
 }
 
 /**
- * Unlink a buffered page from LRU cache
+ * Claim the next frame of the buffer ring
  *
- * @warning Buffer size must be at least 2,
- *          when it is called.
- * @param   pbpg Buffered page to unlink
+ * @param  slot [out] slot of the ring to put the new frame
+ * @return Unmapped frame pinned once | nullptr
+ * @note   The ring keeps the frames recently loaded by
+ *         sequential accesses out of the replacement
+ *         policy, and reuses them in turn. So a bulk scan
+ *         occupies at most BUFFER_RING_SIZE frames. A frame
+ *         that can't be reused is handed over to the policy.
+ */
+BufferManager::BufferedPage *BufferManager::__claimRingFrame(int *slot) {
+  BufferedPage *pbpg;
+  {
+    std::lock_guard<std::mutex> ring_lock(ring_latch);
+    *slot = ring_cursor;
+    ring_cursor = (ring_cursor + 1) % BUFFER_RING_SIZE;
+    pbpg = ring[*slot];
+    ring[*slot] = nullptr;
+  }
+  if (pbpg == nullptr || !pbpg->in_ring) {
+    return nullptr;
+  }
+
+  /*
+   * The frame may have been reused since it was put in
+   * the ring, so check that it still holds the page.
+   */
+  BufferTag tag = {pbpg->table_id, pbpg->page_number};
+  BufferPartition *part = __getBufferPartition(tag);
+  {
+    std::unique_lock<std::mutex> lock(part->latch);
+    frameid_t frame = part->table.find(tag.table_id, tag.page_number);
+    if (frame != __getFrameId(pbpg) || !pbpg->in_ring) {
+      return nullptr;
+    }
+    if (pbpg->pins > 0) {
+      /* In use. Let the replacement policy take it. */
+      lock.unlock();
+      __adoptRingFrame(pbpg, true);
+      return nullptr;
+    }
+    pbpg->pins = 1;
+    if (!pbpg->is_dirty) {
+      part->table.erase(tag.table_id, tag.page_number);
+      return pbpg;
+    }
+  }
+
+  /*
+   * Write the dirty frame back while it is mapped
+   */
+  if (__flushBufferedPage(pbpg)) {
+    ndirty_evictions += 1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(part->latch);
+    if (pbpg->pins == 1 && !pbpg->is_dirty && pbpg->in_ring) {
+      part->table.erase(tag.table_id, tag.page_number);
+      return pbpg;
+    }
+  }
+  __adoptRingFrame(pbpg, true);
+  pbpg->pins -= 1;
+  return nullptr;
+}
+
+/**
+ * Put a frame loaded by a sequential access in the ring
+ */
+void BufferManager::__pushRingFrame(int slot, BufferedPage *pbpg) {
+  {
+    std::lock_guard<std::mutex> ring_lock(ring_latch);
+    if (likely(ring[slot] == nullptr)) {
+      ring[slot] = pbpg;
+      return;
+    }
+  }
+  __adoptRingFrame(pbpg, true);
+}
+
+/**
+ * Hand a ring frame over to the replacement policy
  *
- * @example     head                     tail
- *          X-"[page0]"-[page1]-[page2]-[page3]-X
- *                       head            tail
- *      =>  X-----------[page1]-[page2]-[page3]-X
+ * @param pbpg Ring frame (mapped)
+ * @param cold Whether it is admitted as the next victim
+ * @note  The ring may still point to the frame. It skips
+ *        the frame later because it is no longer in_ring.
+ */
+void BufferManager::__adoptRingFrame(BufferedPage *pbpg, bool cold) {
+  if (pbpg->in_ring.exchange(false)) {
+    replacer->admit(__getFrameId(pbpg),
+                    PageTable::hash(pbpg->table_id, pbpg->page_number),
+                    cold);
+  }
+}
+
+/**
+ * Write a pinned buffered page back if it is dirty
  *
- * @example    head                      tail
- *          X-[page0]-"[page1]"-[page2]-[page3]-X
- *             head                      tail
- *      =>  X-[page0]-----------[page2]-[page3]-X
+ * @param  pbpg Pinned buffered page
+ * @return whether it was written
+ * @note   Its log record is made durable first.
+ */
+bool BufferManager::__flushBufferedPage(BufferedPage *pbpg) {
+  std::shared_lock<std::shared_mutex> lock(pbpg->latch);
+  if (!pbpg->is_dirty) {
+    return false;
+  }
+  if (unlikely(!dmgr->flushLog(pbpg->table_id, pbpg->page_lsn))) {
+    return false;
+  }
+  dmgr->writePage(pbpg->table_id, pbpg->page_number, pbpg->frame);
+  pbpg->is_dirty = false;
+  ndirty -= 1;
+  return true;
+}
+
+/**
+ * Write pinned buffered pages back in one batch
  *
- * @example    head                     tail
- *          X-[page0]-[page1]-[page2]-"[page3]"-X
- *             head            tail
- *      =>  X-[page0]-[page1]-[page2]-----------X
+ * @param  pbpgs [in] pinned buffered pages, sorted by the call
+ * @param  wait  [in] whether busy pages are waited for
+ * @return number of written pages
+ * @note   The dirty pages are sorted by table and page
+ *         number, so the page manager can merge adjacent
+ *         pages into one write. The log of each table is
+ *         flushed up to its last page first, and the pages
+ *         of a table whose log failed stay dirty. A page
+ *         latched exclusively by someone else is written on
+ *         its own afterwards if `wait`, so no latch is
+ *         waited for while others are held.
  */
-void BufferManager::__lruUnlink(BufferedPage *pbpg) {
-  assert(size > 1);
+uint64_t BufferManager::__writeBack(std::vector<BufferedPage *> &pbpgs,
+                                    bool wait) {
+  std::sort(pbpgs.begin(), pbpgs.end(), [](BufferedPage *a, BufferedPage *b) {
+    return a->table_id != b->table_id ? a->table_id < b->table_id
+                                      : a->page_number < b->page_number;
+  });
 
-  BufferedPage *prev = pbpg->lru_prev;
-  BufferedPage *next = pbpg->lru_next;
+  std::vector<PageIO> ios;
+  std::vector<BufferedPage *> latched, busy, durable;
+  for (BufferedPage *pbpg : pbpgs) {
+    if (!pbpg->latch.try_lock_shared()) {
+      busy.push_back(pbpg);
+    } else if (!pbpg->is_dirty) {
+      pbpg->latch.unlock_shared();
+    } else {
+      latched.push_back(pbpg);
+    }
+  }
+  for (size_t i = 0; i < latched.size();) {
+    int table_id = latched[i]->table_id;
+    size_t begin = i;
+    lsn_t max_lsn = LSN_INVALID;
+    for (; i < latched.size() && latched[i]->table_id == table_id; i++) {
+      max_lsn = std::max(max_lsn, latched[i]->page_lsn);
+    }
+    bool logged = dmgr->flushLog(table_id, max_lsn);
+    for (size_t j = begin; j < i; j++) {
+      BufferedPage *pbpg = latched[j];
+      if (unlikely(!logged)) {
+        pbpg->latch.unlock_shared();
+        continue;
+      }
+      ios.push_back({pbpg->table_id, pbpg->page_number, pbpg->frame});
+      durable.push_back(pbpg);
+    }
+  }
+  dmgr->writePages(ios.data(), ios.size());
+  for (BufferedPage *pbpg : durable) {
+    pbpg->is_dirty = false;
+    ndirty -= 1;
+    pbpg->latch.unlock_shared();
+  }
 
-  if (unlikely(prev == nullptr)) {
-    /* lru_head == pbpg */
-    lru_head = next;
-  } else {
-    prev->lru_next = next;
+  uint64_t written = durable.size();
+  if (wait) {
+    for (BufferedPage *pbpg : busy) {
+      if (__flushBufferedPage(pbpg)) written += 1;
+    }
   }
+  return written;
+}
 
-  if (likely(next == nullptr)) {
-    /* lru_tail == pbpg */
-    lru_tail = prev;
-  } else {
-    next->lru_prev = prev;
+/**
+ * Write a dirty victim back with its dirty neighbors
+ *
+ * @param  pbpg Pinned buffered page
+ * @return whether it was dirty
+ * @note   The resident dirty pages adjacent to it are
+ *         written in the same batch, up to
+ *         BUFFER_WRITE_CLUSTER pages, so the evictions of
+ *         a bulk-loaded range become a few large writes.
+ *         Busy neighbors are skipped.
+ */
+bool BufferManager::__flushCluster(BufferedPage *pbpg) {
+  bool dirty = pbpg->is_dirty;
+  std::vector<BufferedPage *> cluster = {pbpg};
+  for (int dir = -1; dir <= 1; dir += 2) {
+    for (pagenum_t k = 1; cluster.size() < BUFFER_WRITE_CLUSTER; k++) {
+      if (dir < 0 && k >= pbpg->page_number) break;
+      BufferTag tag = {pbpg->table_id, pbpg->page_number + dir * k};
+      BufferPartition *part = __getBufferPartition(tag);
+      std::lock_guard<std::mutex> lock(part->latch);
+      frameid_t frame = part->table.find(tag.table_id, tag.page_number);
+      if (frame == FRAME_INVALID || !buffer_pool[frame].is_dirty) break;
+      buffer_pool[frame].pins += 1;
+      cluster.push_back(&buffer_pool[frame]);
+    }
   }
 
-  pbpg->lru_prev = nullptr;
-  pbpg->lru_next = nullptr;
+  __writeBack(cluster, false);
+  if (pbpg->is_dirty) {
+    __flushBufferedPage(pbpg);
+  }
+  for (BufferedPage *neighbor : cluster) {
+    if (neighbor != pbpg) __releaseBufferedPage(neighbor);
+  }
+  return dirty;
 }
 
 /**
- * Get the victim to drop from LRU cache
+ * Mark a buffered page dirty
  *
- * @return Buffered page to drop | nullptr
- * @note   Cache replacement policy: LRU
+ * @note Its exclusive latch must be held.
  */
-BufferManager::BufferedPage *BufferManager::__lruVictim() {
-  BufferedPage *pbpg = lru_tail;
-  while (unlikely(pbpg->pins > 0)) {
-    pbpg = pbpg->lru_prev;
-    if (unlikely(pbpg == nullptr)) {
-      break;
-    }
+void BufferManager::__markDirty(BufferedPage *pbpg) {
+  if (!pbpg->is_dirty.exchange(true)) {
+    ndirty += 1;
   }
-  return pbpg;
 }
 
+frameid_t BufferManager::__getFrameId(BufferedPage *pbpg) {
+  return static_cast<frameid_t>(pbpg - buffer_pool);
+}
+
+/**
+ * Open a table
+ *
+ * @note The header page of the table stays pinned, so
+ *       allocations update it in place without a lookup.
+ *       It is written back like any dirty page.
+ */
 int BufferManager::openDatabase(const std::string &path) {
   int table_id = dmgr->openDatabase(path);
-  {
-    Page pg;
-    readPage(table_id, PN_HEADER, &pg);
+  if (table_id < 0) {
+    return table_id;
+  }
+  if (static_cast<size_t>(table_id) >= headers.size()) {
+    headers.resize(table_id + 1, nullptr);
+  }
+  if (headers[table_id] == nullptr) {
+    headers[table_id] =
+        __acquireBufferedPage(table_id, PN_HEADER, ACCESS_NORMAL);
+  }
+  if (static_cast<size_t>(table_id) >= readaheads.size()) {
+    readaheads.resize(table_id + 1, nullptr);
+  }
+  if (readaheads[table_id] == nullptr) {
+    readaheads[table_id] = new ReadAheadState();
   }
   return table_id;
 }
 
+/**
+ * Latch the header page of a table exclusively
+ *
+ * @note The resident header is pinned for good, so it is
+ *       pinned again without the partition latch.
+ */
+BufferManager::WritePageGuard BufferManager::__fetchHeaderWrite(int table_id) {
+  if (likely(static_cast<size_t>(table_id) < headers.size() &&
+             headers[table_id] != nullptr)) {
+    BufferedPage *pbpg = headers[table_id];
+    pbpg->pins += 1;
+    return WritePageGuard(this, pbpg);
+  }
+  return fetchPageWrite(table_id, PN_HEADER);
+}
+
+/**
+ * Allocate a page
+ *
+ * @param table_id table id
+ * @return page number of the allocated page | PN_INVALID
+ * @note   The header page is held by a write guard during
+ *         the allocation, so it serializes allocations
+ *         and deallocations of the same table.
+ */
 pagenum_t BufferManager::allocPage(int table_id) {
-  Page hpg, fpg;
-  HeaderPage *phpg = hpg.getHeaderPage();
-  FreePage *pfpg = fpg.getFreePage();
+  WritePageGuard hguard = __fetchHeaderWrite(table_id);
+  if (unlikely(!hguard.isValid())) {
+    return PN_INVALID;
+  }
+  HeaderPage *phpg = hguard->getHeaderPage();
 
   /*
-   * Get a free page number
+   * The bitmap pages are buffered too. Eventhough it is
+   * buffered API, growth expands the disk space.
    */
-  readPage(table_id, PN_HEADER, &hpg);
-  pagenum_t free_page_number = phpg->free_page_number;
+  return FreeSpaceMap(this, table_id, phpg).alloc();
+}
 
-  if (unlikely(free_page_number == PN_EOFREE)) {
-    /*
-     * Expand file and set the free page number.
-     * Eventhough it is buffered API,
-     * it expands the disk space.
-     */
-    pagenum_t old_number_of_pages = phpg->number_of_pages;
-    pagenum_t new_number_of_pages = 2 * old_number_of_pages;
-    if (ftruncate(table_id, new_number_of_pages * PAGE_SIZE) < 0) {
-      return PN_INVALID;
+/**
+ * Deallocate a page
+ *
+ * @param table_id    table id
+ * @param page_number page number to deallocate
+ */
+void BufferManager::freePage(int table_id, pagenum_t page_number) {
+  WritePageGuard hguard = __fetchHeaderWrite(table_id);
+  if (unlikely(!hguard.isValid())) {
+    return;
+  }
+  FreeSpaceMap(this, table_id, hguard->getHeaderPage()).free(page_number);
+}
+
+/**
+ * Allocate pages
+ *
+ * @param table_id     [in]  table id
+ * @param n            [in]  number of pages
+ * @param page_numbers [out] allocated page numbers
+ * @return number of allocated pages
+ * @note   The header page is latched once for the batch.
+ */
+size_t BufferManager::allocPages(int table_id, size_t n,
+                                 pagenum_t *page_numbers) {
+  WritePageGuard hguard = __fetchHeaderWrite(table_id);
+  if (unlikely(!hguard.isValid())) {
+    return 0;
+  }
+  return FreeSpaceMap(this, table_id, hguard->getHeaderPage())
+      .allocMany(n, page_numbers);
+}
+
+/**
+ * Deallocate pages
+ *
+ * @param table_id     [in] table id
+ * @param page_numbers [in] page numbers to deallocate
+ * @param n            [in] number of pages
+ */
+void BufferManager::freePages(int table_id, const pagenum_t *page_numbers,
+                              size_t n) {
+  WritePageGuard hguard = __fetchHeaderWrite(table_id);
+  if (unlikely(!hguard.isValid())) {
+    return;
+  }
+  FreeSpaceMap(this, table_id, hguard->getHeaderPage())
+      .freeMany(page_numbers, n);
+}
+
+void BufferManager::readPage(int table_id, pagenum_t page_number, Page *dest) {
+  readPage(table_id, page_number, dest, ACCESS_NORMAL);
+}
+
+/**
+ * Read a page through the buffer
+ *
+ * @param hint ACCESS_NORMAL | ACCESS_SEQUENTIAL | ACCESS_ONCE
+ * @note  If every frame is pinned, the page can't be
+ *        buffered. Then it is read from disk directly.
+ */
+void BufferManager::readPage(int table_id, pagenum_t page_number, Page *dest,
+                             int hint) {
+  ReadPageGuard guard = fetchPageRead(table_id, page_number, hint);
+  if (unlikely(!guard.isValid())) {
+    dmgr->readPage(table_id, page_number, dest);
+    return;
+  }
+  memcpy(dest, guard->data, PAGE_SIZE);
+}
+
+/**
+ * Write a page through the buffer
+ *
+ * @note If every frame is pinned, the page can't be
+ *       buffered. Then it is logged and written to disk
+ *       directly, unless the log failed. direct_latch is
+ *       held from the log to the write, so a checkpoint
+ *       doesn't drop the record before the page is on disk.
+ */
+void BufferManager::writePage(int table_id, pagenum_t page_number,
+                              const Page *src) {
+  WritePageGuard guard = fetchPageWrite(table_id, page_number);
+  if (unlikely(!guard.isValid())) {
+    std::shared_lock<std::shared_mutex> direct_lock(direct_latch);
+    if (dmgr->flushLog(table_id, dmgr->logPage(table_id, page_number, src))) {
+      dmgr->writePage(table_id, page_number, src);
     }
-    fsync(table_id);
+    return;
+  }
+  memcpy(guard->data, src, PAGE_SIZE);
+}
 
-    for (pagenum_t i = old_number_of_pages; i < new_number_of_pages - 1; i++) {
-      pfpg->next_free_page_number = i + 1;
-      writePage(table_id, i, &fpg);
+/**
+ * Write pages around the buffer
+ *
+ * @note Buffered pages are written in their frames. The
+ *       others are logged and written to disk in one batch
+ *       without taking frames, so a load of many new pages
+ *       doesn't flush the working set out of the pool. A
+ *       page buffered while the batch is written is then
+ *       overwritten in its frame, which keeps the frame from
+ *       holding what it read before the write. The misses
+ *       are logged and written under direct_latch, like a
+ *       direct writePage.
+ */
+void BufferManager::writePages(const PageIO *ios, size_t n) {
+  std::vector<PageIO> misses;
+  for (size_t i = 0; i < n; i++) {
+    BufferedPage *pbpg = __findBufferedPage({ios[i].fd, ios[i].page_number});
+    if (pbpg != nullptr) {
+      WritePageGuard guard(this, pbpg);
+      memcpy(guard->data, ios[i].page, PAGE_SIZE);
+      continue;
     }
-    pfpg->next_free_page_number = PN_EOFREE;
-    writePage(table_id, new_number_of_pages - 1, &fpg);
+    misses.push_back(ios[i]);
+  }
+  if (misses.empty()) return;
 
-    phpg->number_of_pages = new_number_of_pages;
-    free_page_number = phpg->free_page_number = old_number_of_pages;
+  std::shared_lock<std::shared_mutex> direct_lock(direct_latch);
+  std::vector<lsn_t> lsns;
+  for (const PageIO &io : misses) {
+    lsns.push_back(dmgr->logPage(io.fd, io.page_number, io.page));
   }
 
   /*
-   * Set header page
+   * The log is durable before any page of the batch is
+   * written. Flushing up to an LSN already flushed returns
+   * at once, so this costs one flush per file. The pages of
+   * a file whose log failed are dropped.
    */
-  pagenum_t alloc_page_number = free_page_number;
-  readPage(table_id, free_page_number, &fpg);
-  phpg->free_page_number = pfpg->next_free_page_number;
-  writePage(table_id, PN_HEADER, &hpg);
+  std::vector<bool> logged(misses.size());
+  for (size_t i = misses.size(); i-- > 0;) {
+    logged[i] = dmgr->flushLog(misses[i].fd, lsns[i]);
+  }
+  std::vector<PageIO> durable;
+  for (size_t i = 0; i < misses.size(); i++) {
+    if (likely(logged[i])) durable.push_back(misses[i]);
+  }
+  dmgr->writePages(durable.data(), durable.size());
+  direct_lock.unlock();
 
-  return alloc_page_number;
+  for (const PageIO &io : misses) {
+    BufferedPage *pbpg = __findBufferedPage({io.fd, io.page_number});
+    if (unlikely(pbpg != nullptr)) {
+      WritePageGuard guard(this, pbpg);
+      memcpy(guard->data, io.page, PAGE_SIZE);
+    }
+  }
 }
 
-void BufferManager::freePage(int table_id, pagenum_t page_number) {
-  Page pg;
+void BufferManager::readPages(const PageIO *ios, size_t n) {
+  readPages(ios, n, ACCESS_NORMAL);
+}
 
-  /*
-   * Set header page
-   */
-  HeaderPage *phpg = pg.getHeaderPage();
-  readPage(table_id, PN_HEADER, &pg);
-  pagenum_t free_page_number = phpg->free_page_number;
-  phpg->free_page_number = page_number;
-  writePage(table_id, PN_HEADER, &pg);
+/**
+ * Read a batch of pages through the buffer
+ *
+ * @param ios  requests, fd being the table id
+ * @param n    number of requests
+ * @param hint ACCESS_NORMAL | ACCESS_SEQUENTIAL | ACCESS_ONCE
+ * @note  The misses are read from disk in one batch, so
+ *        they cost about one round trip together. A page
+ *        that can't be buffered is read directly.
+ */
+void BufferManager::readPages(const PageIO *ios, size_t n, int hint) {
+  std::vector<BufferTag> tags(n);
+  std::vector<BufferedPage *> pbpgs(n);
+  for (size_t i = 0; i < n; i++) {
+    tags[i] = {ios[i].fd, ios[i].page_number};
+  }
+  __acquireBufferedPages(tags.data(), n, hint, false, pbpgs.data());
+
+  for (size_t i = 0; i < n; i++) {
+    BufferedPage *pbpg = pbpgs[i];
+    if (unlikely(pbpg == nullptr)) {
+      dmgr->readPage(ios[i].fd, ios[i].page_number, ios[i].page);
+      continue;
+    }
+    {
+      std::shared_lock<std::shared_mutex> lock(pbpg->latch);
+      memcpy(ios[i].page, pbpg->frame->data, PAGE_SIZE);
+    }
+    __releaseBufferedPage(pbpg);
+  }
+}
+
+/**
+ * Load pages into the buffer ahead of reads
+ *
+ * @param table_id     table id
+ * @param page_numbers page numbers to load
+ * @param n            number of pages
+ * @note  The misses are read in one batch into free or
+ *        clean frames. It returns when they are buffered.
+ */
+void BufferManager::prefetchPages(int table_id, const pagenum_t *page_numbers,
+                                  size_t n) {
+  std::vector<BufferTag> tags(n);
+  std::vector<BufferedPage *> pbpgs(n);
+  for (size_t i = 0; i < n; i++) {
+    tags[i] = {table_id, page_numbers[i]};
+  }
+  __acquireBufferedPages(tags.data(), n, ACCESS_NORMAL, true, pbpgs.data());
+  for (BufferedPage *pbpg : pbpgs) {
+    if (pbpg != nullptr) __releaseBufferedPage(pbpg);
+  }
+}
+
+/**
+ * Fetch a page for reading without copying
+ *
+ * @param table_id    table id
+ * @param page_number page number to fetch
+ * @param hint        ACCESS_NORMAL | ACCESS_SEQUENTIAL | ACCESS_ONCE
+ * @return guard pinning the page (invalid if every frame is pinned)
+ * @note   The page is latched in shared mode. Sequential
+ *         reads trigger read-ahead if it is started.
+ */
+BufferManager::ReadPageGuard BufferManager::fetchPageRead(int table_id,
+                                                         pagenum_t page_number,
+                                                         int hint) {
+  if (readahead_enabled) {
+    __detectReadAhead(table_id, page_number, hint);
+  }
+  return ReadPageGuard(this,
+                       __acquireBufferedPage(table_id, page_number, hint));
+}
+
+/**
+ * Fetch a page for optimistic reading without copying
+ *
+ * @param table_id    table id
+ * @param page_number page number to fetch
+ * @return guard pinning the page (invalid if every frame is pinned)
+ * @note   The page is pinned but not latched, so writers may
+ *         change it while it is read. The reader must detect
+ *         that on its own, e.g. with a version stored in the
+ *         page, and retry.
+ */
+BufferManager::OptimisticPageGuard BufferManager::fetchPageOptimistic(
+    int table_id, pagenum_t page_number) {
+  return OptimisticPageGuard(
+      this, __acquireBufferedPage(table_id, page_number, ACCESS_NORMAL));
+}
+
+/**
+ * Fetch a page for writing without copying
+ *
+ * @param table_id    table id
+ * @param page_number page number to fetch
+ * @return guard pinning the page (invalid if every frame is pinned)
+ * @note   The page is latched in exclusive mode and
+ *         marked dirty.
+ */
+BufferManager::WritePageGuard BufferManager::fetchPageWrite(
+    int table_id, pagenum_t page_number) {
+  return WritePageGuard(
+      this, __acquireBufferedPage(table_id, page_number, ACCESS_NORMAL));
+}
+
+/**
+ * Fetch a page for reading only if it is buffered
+ *
+ * @param table_id    table id
+ * @param page_number page number to fetch
+ * @return guard latching the page (invalid on a miss)
+ * @note   A miss isn't loaded, and a hit isn't counted as
+ *         an access.
+ */
+BufferManager::ReadPageGuard BufferManager::fetchPageIfBuffered(
+    int table_id, pagenum_t page_number) {
+  return ReadPageGuard(this, __findBufferedPage({table_id, page_number}));
+}
+
+/**
+ * Start the background writer
+ *
+ * @param opts writer settings
+ * @note  The writer cleans dirty frames ahead of the
+ *        replacement policy, so that a miss almost always
+ *        finds a clean victim and doesn't wait for a write.
+ */
+void BufferManager::startBackgroundWriter(const BackgroundWriterOptions &opts) {
+  stopBackgroundWriter();
+  writer_opts = opts;
+  writer_stop = false;
+  writer = std::thread(&BufferManager::__runBackgroundWriter, this);
+}
+
+/**
+ * Stop the background writer
+ */
+void BufferManager::stopBackgroundWriter() {
+  {
+    std::lock_guard<std::mutex> lock(writer_latch);
+    writer_stop = true;
+  }
+  writer_cv.notify_all();
+  if (writer.joinable()) {
+    writer.join();
+  }
+}
+
+/**
+ * Main loop of the background writer
+ *
+ * @note It runs a round every interval, or earlier when
+ *       a miss had to write its victim back.
+ */
+void BufferManager::__runBackgroundWriter() {
+  bool flooding = false;
+
+  std::unique_lock<std::mutex> lock(writer_latch);
+  while (!writer_stop) {
+    lock.unlock();
+
+    /*
+     * Past the high watermark, keep cleaning along the
+     * whole replacement order down to the low watermark.
+     * They follow the capacity as the pool is resized.
+     */
+    uint64_t frames = capacity;
+    uint64_t low = static_cast<uint64_t>(writer_opts.low_watermark * frames);
+    uint64_t high = static_cast<uint64_t>(writer_opts.high_watermark * frames);
+    uint64_t dirty = ndirty;
+    if (dirty > high) {
+      flooding = true;
+    } else if (dirty <= low) {
+      flooding = false;
+    }
+    uint64_t lookahead = flooding ? frames : writer_opts.lookahead;
+    __cleanAhead(lookahead, writer_opts.max_pages);
+
+    lock.lock();
+    if (writer_stop) break;
+    writer_cv.wait_for(lock,
+                       std::chrono::milliseconds(writer_opts.interval_ms));
+  }
+}
+
+/**
+ * Write back dirty frames among the upcoming victims
+ *
+ * @param lookahead number of upcoming victims to check
+ * @param max_pages maximum number of pages to write
+ * @return number of written pages
+ */
+uint64_t BufferManager::__cleanAhead(uint64_t lookahead, uint64_t max_pages) {
+  std::vector<std::pair<frameid_t, BufferTag>> candidates;
+  replacer->peek(static_cast<frameid_t>(lookahead), [&](frameid_t frame) {
+    BufferedPage *pbpg = &buffer_pool[frame];
+    if (pbpg->is_dirty && pbpg->pins == 0) {
+      candidates.push_back({frame, {pbpg->table_id, pbpg->page_number}});
+    }
+    return candidates.size() < max_pages;
+  });
+
+  std::vector<BufferedPage *> pinned;
+  for (const auto &candidate : candidates) {
+    BufferedPage *pbpg = &buffer_pool[candidate.first];
+    const BufferTag &tag = candidate.second;
+    BufferPartition *part = __getBufferPartition(tag);
+    std::lock_guard<std::mutex> lock(part->latch);
+    if (part->table.find(tag.table_id, tag.page_number) == candidate.first) {
+      pbpg->pins += 1;
+      pinned.push_back(pbpg);
+    }
+  }
+  uint64_t written = __writeBack(pinned, false);
+  for (BufferedPage *pbpg : pinned) {
+    __releaseBufferedPage(pbpg);
+  }
+  nbackground_writes += written;
+  return written;
+}
+
+/**
+ * Write back the buffered pages of a table
+ *
+ * @param table_id table id
+ * @note  The dirty frames are written in one batch.
+ */
+void BufferManager::flush(int table_id) {
+  std::vector<BufferedPage *> pinned;
+  for (uint64_t i = 0; i < capacity; i++) {
+    BufferedPage *pbpg = &buffer_pool[i];
+    if (!pbpg->is_dirty) {
+      continue;
+    }
+    BufferTag tag;
+    {
+      std::shared_lock<std::shared_mutex> frame_lock(pbpg->latch);
+      tag = {pbpg->table_id, pbpg->page_number};
+    }
+    if (tag.table_id != table_id) {
+      continue;
+    }
+    BufferPartition *part = __getBufferPartition(tag);
+    std::lock_guard<std::mutex> lock(part->latch);
+    if (part->table.find(tag.table_id, tag.page_number) ==
+        static_cast<frameid_t>(i)) {
+      pbpg->pins += 1;
+      pinned.push_back(pbpg);
+    }
+  }
+
+  __writeBack(pinned, true);
+  for (BufferedPage *pbpg : pinned) {
+    __releaseBufferedPage(pbpg);
+  }
+  dmgr->flush(table_id);
+}
+
+/**
+ * Make the buffered pages of a table durable
+ *
+ * @param table_id table id
+ * @note  If the table is logged, the log is flushed
+ *        instead, and the pages are written back later.
+ */
+void BufferManager::sync(int table_id) {
+  if (dmgr->isLogged(table_id)) {
+    dmgr->flushLog(table_id, LSN_MAX);
+    return;
+  }
+  flush(table_id);
+  dmgr->sync(table_id);
+}
+
+/**
+ * Take a fuzzy checkpoint of a table
+ *
+ * @param table_id table id
+ * @note  The end of the log is taken first. Every page
+ *        dirtied before it is written back and made
+ *        durable while others keep updating the table.
+ *        Then the header page records it as the checkpoint
+ *        and the log before it is dropped, so recovery
+ *        only redoes what was logged since. Pages written
+ *        around the buffer and logged before the end are on
+ *        disk by then too, since the end is taken once
+ *        their writes finish.
+ */
+void BufferManager::checkpoint(int table_id) {
+  if (unlikely(static_cast<size_t>(table_id) >= headers.size() ||
+               headers[table_id] == nullptr)) {
+    return;
+  }
+  lsn_t checkpoint_lsn;
+  {
+    std::unique_lock<std::shared_mutex> direct_lock(direct_latch);
+    checkpoint_lsn = dmgr->getLogEnd(table_id);
+  }
+  flush(table_id);
+  dmgr->sync(table_id);
+
+  if (checkpoint_lsn != LSN_INVALID) {
+    {
+      WritePageGuard hguard = __fetchHeaderWrite(table_id);
+      hguard->getHeaderPage()->checkpoint_lsn = checkpoint_lsn;
+    }
+    BufferedPage *pbpg = headers[table_id];
+    pbpg->pins += 1;
+    bool written = __flushBufferedPage(pbpg);
+    __releaseBufferedPage(pbpg);
+    if (unlikely(!written)) {
+      /* The log failed, so the pages may not be on disk */
+      return;
+    }
+    dmgr->sync(table_id);
+    dmgr->truncateLog(table_id, checkpoint_lsn);
+  }
+  ncheckpoints += 1;
+}
+
+/**
+ * Resize the buffer pool online
+ *
+ * @param capacity number of frames, up to max_capacity
+ * @return number of frames after resizing
+ * @note   Growing adds free frames. Shrinking retires the
+ *         frames from the end of the pool, writing back
+ *         the dirty ones. It stops at the first frame in
+ *         use, so the result may be larger than asked.
+ */
+uint64_t BufferManager::resize(uint64_t capacity) {
+  std::lock_guard<std::mutex> resize_lock(resize_latch);
+  capacity = std::max<uint64_t>(1, std::min(capacity, max_capacity));
+  uint64_t current = this->capacity;
+
+  if (capacity > current) {
+    {
+      std::lock_guard<std::mutex> free_lock(free_latch);
+      for (uint64_t i = capacity; i-- > current;) {
+        free_frames.push_back(&buffer_pool[i]);
+      }
+    }
+    this->capacity = capacity;
+    return capacity;
+  }
 
   /*
-   * Free page
+   * Free frames are retired at once. They go back if a
+   * frame before them is in use.
    */
-  FreePage *pfpg = pg.getFreePage();
-  pfpg->next_free_page_number = free_page_number;
-  writePage(table_id, page_number, &pg);
+  std::vector<BufferedPage *> retired;
+  {
+    std::lock_guard<std::mutex> free_lock(free_latch);
+    auto end = std::remove_if(free_frames.begin(), free_frames.end(),
+                              [&](BufferedPage *pbpg) {
+                                return __getFrameId(pbpg) >= capacity;
+                              });
+    retired.assign(end, free_frames.end());
+    free_frames.erase(end, free_frames.end());
+  }
+
+  uint64_t reached = current;
+  for (; reached > capacity; reached--) {
+    BufferedPage *pbpg = &buffer_pool[reached - 1];
+    if (std::find(retired.begin(), retired.end(), pbpg) != retired.end()) {
+      continue;
+    }
+    if (!__retireBufferedPage(pbpg)) {
+      break;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> free_lock(free_latch);
+    for (BufferedPage *pbpg : retired) {
+      if (__getFrameId(pbpg) < reached) free_frames.push_back(pbpg);
+    }
+  }
+  this->capacity = reached;
+  return reached;
 }
 
-void BufferManager::readPage(int table_id, pagenum_t page_number, Page *dest) {
-  BufferedPage *pbpg = __acquireBufferedPage(table_id, page_number);
-  memcpy(dest, &pbpg->frame.data, PAGE_SIZE);
-  __releaseBufferedPage(pbpg);
+/**
+ * Take a mapped frame out of use
+ *
+ * @param  pbpg Buffered page
+ * @return whether it was retired
+ * @note   It fails if the frame is pinned or not mapped,
+ *         i.e. being loaded.
+ */
+bool BufferManager::__retireBufferedPage(BufferedPage *pbpg) {
+  BufferTag tag;
+  if (!pbpg->latch.try_lock_shared()) {
+    return false;
+  }
+  tag = {pbpg->table_id, pbpg->page_number};
+  pbpg->latch.unlock_shared();
+
+  BufferPartition *part = __getBufferPartition(tag);
+  {
+    std::lock_guard<std::mutex> lock(part->latch);
+    if (part->table.find(tag.table_id, tag.page_number) !=
+            __getFrameId(pbpg) ||
+        pbpg->pins > 0) {
+      return false;
+    }
+    pbpg->pins = 1;
+  }
+
+  __flushBufferedPage(pbpg);
+  {
+    std::lock_guard<std::mutex> lock(part->latch);
+    if (pbpg->pins != 1 || pbpg->is_dirty) {
+      pbpg->pins -= 1;
+      return false;
+    }
+    part->table.erase(tag.table_id, tag.page_number);
+  }
+  replacer->remove(__getFrameId(pbpg));
+  pbpg->in_ring = false;
+  if (pbpg->prefetched.exchange(false)) {
+    nprefetch_waste += 1;
+  }
+  pbpg->pins = 0;
+  return true;
 }
 
-void BufferManager::writePage(int table_id, pagenum_t page_number,
-                              const Page *src) {
-  BufferedPage *pbpg = __acquireBufferedPage(table_id, page_number);
-  pbpg->is_dirty = true;
-  memcpy(&pbpg->frame.data, src, PAGE_SIZE);
-  __releaseBufferedPage(pbpg);
+/**
+ * Start the checkpointer
+ *
+ * @param opts checkpointer settings
+ * @note  Tables must be opened before it starts, because
+ *        openDatabase must not race with it.
+ */
+void BufferManager::startCheckpointer(const CheckpointOptions &opts) {
+  stopCheckpointer();
+  checkpointer_opts = opts;
+  checkpointer_stop = false;
+  checkpointer = std::thread(&BufferManager::__runCheckpointer, this);
+}
+
+/**
+ * Stop the checkpointer
+ */
+void BufferManager::stopCheckpointer() {
+  {
+    std::lock_guard<std::mutex> lock(checkpointer_latch);
+    checkpointer_stop = true;
+  }
+  checkpointer_cv.notify_all();
+  if (checkpointer.joinable()) {
+    checkpointer.join();
+  }
+}
+
+/**
+ * Main loop of the checkpointer
+ */
+void BufferManager::__runCheckpointer() {
+  std::unique_lock<std::mutex> lock(checkpointer_latch);
+  while (!checkpointer_stop) {
+    checkpointer_cv.wait_for(
+        lock, std::chrono::milliseconds(checkpointer_opts.interval_ms));
+    if (checkpointer_stop) break;
+    lock.unlock();
+
+    for (size_t table_id = 0; table_id < headers.size(); table_id++) {
+      checkpoint(static_cast<int>(table_id));
+    }
+
+    lock.lock();
+  }
+}
+
+/**
+ * Start read-ahead
+ *
+ * @param opts read-ahead settings
+ * @note  Tables must be opened before it starts, because
+ *        openDatabase must not race with it.
+ */
+void BufferManager::startReadAhead(const ReadAheadOptions &opts) {
+  stopReadAhead();
+  readahead_opts = opts;
+  prefetcher_stop = false;
+  prefetcher = std::thread(&BufferManager::__runPrefetcher, this);
+  readahead_enabled = true;
+}
+
+/**
+ * Stop read-ahead
+ *
+ * @note Pending prefetches are dropped.
+ */
+void BufferManager::stopReadAhead() {
+  readahead_enabled = false;
+  {
+    std::lock_guard<std::mutex> lock(prefetcher_latch);
+    prefetcher_stop = true;
+    prefetch_queue.clear();
+  }
+  prefetcher_cv.notify_all();
+  if (prefetcher.joinable()) {
+    prefetcher.join();
+  }
+}
+
+/**
+ * Detect a sequential read and request a prefetch
+ *
+ * @param hint access hint of the read, used for prefetches
+ * @note  The pages past the end of the file aren't
+ *        prefetched. The end is read from the resident
+ *        header unless someone is latching it.
+ */
+void BufferManager::__detectReadAhead(int table_id, pagenum_t page_number,
+                                      int hint) {
+  if (unlikely(static_cast<size_t>(table_id) >= readaheads.size() ||
+               readaheads[table_id] == nullptr)) {
+    return;
+  }
+  const pagenum_t window = readahead_opts.window;
+  const pagenum_t trigger = readahead_opts.trigger;
+
+  ReadAheadState *ra = readaheads[table_id];
+  PrefetchRequest request;
+  {
+    std::lock_guard<std::mutex> lock(ra->latch);
+    if (page_number == ra->last_page + 1) {
+      ra->run += 1;
+    } else {
+      ra->run = 1;
+      ra->ahead = page_number + 1;
+    }
+    ra->last_page = page_number;
+    if (ra->run < trigger) {
+      return;
+    }
+    if (ra->ahead <= page_number) {
+      ra->ahead = page_number + 1;
+    }
+    if (ra->ahead - page_number > (window + 1) / 2) {
+      return;
+    }
+    request = {table_id, ra->ahead, page_number + 1 + window, hint};
+    ra->ahead = request.end;
+  }
+
+  BufferedPage *phdr = headers[table_id];
+  if (likely(phdr != nullptr) && phdr->latch.try_lock_shared()) {
+    pagenum_t number_of_pages = phdr->frame->getHeaderPage()->number_of_pages;
+    phdr->latch.unlock_shared();
+    request.end = std::min(request.end, number_of_pages);
+  }
+  if (request.begin >= request.end) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(prefetcher_latch);
+    if (prefetch_queue.size() >= PREFETCH_QUEUE_CAPACITY) {
+      return;
+    }
+    prefetch_queue.push_back(request);
+  }
+  prefetcher_cv.notify_one();
+}
+
+/**
+ * Main loop of the prefetcher
+ *
+ * @note The pages of a request are loaded in one batch.
+ *       Those that find no free or clean frame are
+ *       dropped.
+ */
+void BufferManager::__runPrefetcher() {
+  std::unique_lock<std::mutex> lock(prefetcher_latch);
+  while (!prefetcher_stop) {
+    if (prefetch_queue.empty()) {
+      prefetcher_cv.wait(lock);
+      continue;
+    }
+    PrefetchRequest request = prefetch_queue.front();
+    prefetch_queue.pop_front();
+    lock.unlock();
+
+    std::vector<BufferTag> tags;
+    for (pagenum_t page_number = request.begin; page_number < request.end;
+         page_number++) {
+      tags.push_back({request.table_id, page_number});
+    }
+    std::vector<BufferedPage *> pbpgs(tags.size());
+    __acquireBufferedPages(tags.data(), tags.size(), request.hint, true,
+                           pbpgs.data());
+    for (BufferedPage *pbpg : pbpgs) {
+      if (pbpg != nullptr) __releaseBufferedPage(pbpg);
+    }
+
+    lock.lock();
+  }
+}
+
+/**
+ * Get a snapshot of the buffer statistics
+ */
+BufferStats BufferManager::getStats() {
+  BufferStats stats;
+  stats.misses = nmisses;
+  stats.dirty_pages = ndirty;
+  stats.dirty_evictions = ndirty_evictions;
+  stats.background_writes = nbackground_writes;
+  stats.capacity = capacity;
+  stats.checkpoints = ncheckpoints;
+  stats.prefetches = nprefetches;
+  stats.prefetch_hits = nprefetch_hits;
+  stats.prefetch_waste = nprefetch_waste;
+  return stats;
 }
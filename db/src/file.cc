@@ -1,75 +1,321 @@
 #include "file.h"
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <vector>
+#include "fsm.h"
 #include "optimize.h"
 #include "page.h"
 
+/**
+ * Read a batch of pages
+ *
+ * @param ios [in] requests
+ * @param n   [in] number of requests
+ * @note  It reads them one by one by default.
+ */
+void PageManager::readPages(const PageIO *ios, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    readPage(ios[i].fd, ios[i].page_number, ios[i].page);
+  }
+}
+
+/**
+ * Write a batch of pages
+ *
+ * @param ios [in] requests
+ * @param n   [in] number of requests
+ * @note  It writes them one by one by default.
+ */
+void PageManager::writePages(const PageIO *ios, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    writePage(ios[i].fd, ios[i].page_number, ios[i].page);
+  }
+}
+
+/**
+ * Hint that pages will be read soon
+ *
+ * @param fd           file descriptor
+ * @param page_numbers page numbers to read
+ * @param n            number of pages
+ * @note  It does nothing by default.
+ */
+void PageManager::prefetchPages(int fd, const pagenum_t *page_numbers,
+                                size_t n) {}
+
+/**
+ * Allocate pages
+ *
+ * @param fd           [in]  file descriptor
+ * @param n            [in]  number of pages
+ * @param page_numbers [out] allocated page numbers
+ * @return number of allocated pages
+ * @note   It allocates them one by one by default.
+ */
+size_t PageManager::allocPages(int fd, size_t n, pagenum_t *page_numbers) {
+  for (size_t i = 0; i < n; i++) {
+    page_numbers[i] = allocPage(fd);
+    if (page_numbers[i] == PN_INVALID) return i;
+  }
+  return n;
+}
+
+/**
+ * Deallocate pages
+ *
+ * @param fd           [in] file descriptor
+ * @param page_numbers [in] page numbers to deallocate
+ * @param n            [in] number of pages
+ * @note  It deallocates them one by one by default.
+ */
+void PageManager::freePages(int fd, const pagenum_t *page_numbers, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    freePage(fd, page_numbers[i]);
+  }
+}
+
+/**
+ * Make the previous writes of a file durable before the
+ * next ones
+ *
+ * @param fd file descriptor
+ * @note  Nothing is ordered by default, e.g. a buffer
+ *        writes pages back in batches anyway.
+ */
+void PageManager::barrier(int fd) {}
+
+/**
+ * Get the alignment of pages for I/O
+ */
+size_t PageManager::getIOAlignment() const { return 1; }
+
+/**
+ * Log a page image before it is written
+ *
+ * @param fd          file descriptor
+ * @param page_number page number
+ * @param page        page image
+ * @return LSN of the record | LSN_INVALID if not logged
+ * @note   Nothing is logged by default.
+ */
+lsn_t PageManager::logPage(int fd, pagenum_t page_number, const Page *page) {
+  return LSN_INVALID;
+}
+
+/**
+ * Make the log of a file durable up to an LSN
+ *
+ * @param fd  file descriptor
+ * @param lsn LSN to make durable, or LSN_MAX for all
+ * @return false if the log failed, so pages relying on it
+ *         must not be written
+ */
+bool PageManager::flushLog(int fd, lsn_t lsn) { return true; }
+
+/**
+ * Whether the pages of a file are made durable by a log
+ */
+bool PageManager::isLogged(int fd) const { return false; }
+
+/**
+ * Get the LSN after the last logged record of a file
+ */
+lsn_t PageManager::getLogEnd(int fd) { return LSN_INVALID; }
+
+/**
+ * Drop the log records of a file before a checkpoint
+ *
+ * @param fd  file descriptor
+ * @param lsn LSN of the checkpoint
+ * @note  The checkpoint must be durable in the header page.
+ */
+void PageManager::truncateLog(int fd, lsn_t lsn) {}
+
+/**
+ * Get the page size a file was created with
+ *
+ * @note Files from before it was recorded have 0 there.
+ */
+static uint64_t __getPageSize(const HeaderPage *phpg) {
+  return phpg->page_size == 0 ? phpg->LEGACY_PAGE_SIZE : phpg->page_size;
+}
+
 bool DiskManager::__fileExists(const std::string &path) {
   struct stat buf;
   return (stat(path.c_str(), &buf) == 0);
 };
 
 int DiskManager::__openExistingDatabaseFile(const std::string &path) {
-  int fd = open(path.c_str(), O_RDWR | O_SYNC);
+  int fd = __open(path, O_RDWR);
   if (fd < 0) return fd;
 
   Page pg;
   HeaderPage *phpg = pg.getHeaderPage();
 
   readPage(fd, PN_HEADER, &pg);
+  if (phpg->magic_number == phpg->MAGIC_NUMBER_V1 ||
+      phpg->magic_number == phpg->MAGIC_NUMBER_V2) {
+    if (PAGE_SIZE != phpg->LEGACY_PAGE_SIZE) {
+      close(fd);
+      return F_VALIDATEFAIL;
+    }
+    /*
+     * Replace the free list with a free-space map
+     */
+    if (!FreeSpaceMap(this, fd, phpg).upgrade()) {
+      close(fd);
+      return F_TRUNCATEFAIL;
+    }
+    phpg->checkpoint_lsn = LSN_INVALID;
+    phpg->page_size = phpg->LEGACY_PAGE_SIZE;
+    phpg->root_page_number = PN_INVALID;
+    phpg->heap_first_page_number = PN_INVALID;
+    phpg->heap_last_page_number = PN_INVALID;
+    for (pagenum_t &page_number : phpg->heap_free_lists) {
+      page_number = PN_INVALID;
+    }
+    writePage(fd, PN_HEADER, &pg);
+    __barrier(fd);
+  }
   if (phpg->magic_number != phpg->MAGIC_NUMBER) {
     close(fd);
     return F_VALIDATEFAIL;
   }
+  if (__getPageSize(phpg) != PAGE_SIZE) {
+    close(fd);
+    return F_VALIDATEFAIL;
+  }
 
   return fd;
 }
 
 int DiskManager::__createDatabaseFile(const std::string &path) {
-  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_SYNC, 0644);
+  int fd = __open(path, O_RDWR | O_CREAT);
   if (fd < 0) return fd;
 
-  if (ftruncate(fd, INITIAL_PAGES_NUMBER * PAGE_SIZE) < 0) {
-    close(fd);
-    return F_TRUNCATEFAIL;
-  }
-
   Page pg;
+  memset(pg.data, 0, PAGE_SIZE);
 
   /*
-   * Initialize header page
+   * Initialize header page. The other pages are free in
+   * the map, so they aren't written.
    */
   HeaderPage *phpg = pg.getHeaderPage();
   phpg->magic_number = phpg->MAGIC_NUMBER;
-  phpg->number_of_pages = INITIAL_PAGES_NUMBER;
-  phpg->free_page_number = 1;
+  phpg->page_size = PAGE_SIZE;
+  if (!FreeSpaceMap(this, fd, phpg).init(INITIAL_PAGES_NUMBER)) {
+    close(fd);
+    return F_TRUNCATEFAIL;
+  }
   writePage(fd, PN_HEADER, &pg);
 
-  /*
-   * Initialize free pages
-   */
-  phpg->magic_number = 0;
-  phpg->number_of_pages = 0;
-  phpg->free_page_number = 0;
-  FreePage *pfpg = pg.getFreePage();
-  for (pagenum_t i = 1; i < INITIAL_PAGES_NUMBER - 1; i++) {
-    pfpg->next_free_page_number = i + 1;
-    writePage(fd, i, &pg);
-  }
-  pfpg->next_free_page_number = PN_EOFREE;
-  writePage(fd, INITIAL_PAGES_NUMBER - 1, &pg);
+  __barrier(fd);
+  return fd;
+}
+
+int DiskManager::__getOpenFlags() const {
+  int flags = sync_mode == SYNC_WRITE ? O_DSYNC : 0;
+  if (io_mode == IO_DIRECT) flags |= O_DIRECT;
+  return flags;
+}
 
+/**
+ * Open a database file in the I/O mode
+ *
+ * @note If the file system doesn't support O_DIRECT,
+ *       the file is opened through the page cache.
+ */
+int DiskManager::__open(const std::string &path, int flags) {
+  int fd = open(path.c_str(), flags | __getOpenFlags(), 0644);
+  if (fd < 0 && errno == EINVAL && io_mode == IO_DIRECT) {
+    fd = open(path.c_str(), flags | (__getOpenFlags() & ~O_DIRECT), 0644);
+  }
   return fd;
 }
 
-DiskManager::DiskManager() { fds.reserve(FDS_DEFAULT_CAPACITY); }
+bool DiskManager::__isAligned(const Page *page) const {
+  return reinterpret_cast<uintptr_t>(page) % getIOAlignment() == 0;
+}
+
+/**
+ * Make the previous writes durable before the next ones
+ *
+ * @note It orders the writes of a structural change, such
+ *       as free pages before the header linking them.
+ */
+void DiskManager::__barrier(int fd) {
+  if (sync_mode != SYNC_WRITE) {
+    fdatasync(fd);
+    nsyncs += 1;
+  }
+}
+
+/**
+ * Redo the log of a database file
+ *
+ * @param path path of the database file
+ * @return LSN the new log starts at, past the checkpoint
+ * @note   Records before the checkpoint in the header page
+ *         are skipped. If the header grew the file before
+ *         the crash, the file is grown again to match it.
+ *         A file of another page size is left untouched.
+ */
+lsn_t DiskManager::__recover(const std::string &path) {
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd < 0) return LSN_INVALID;
+
+  Page pg;
+  HeaderPage *phpg = pg.getHeaderPage();
+  lsn_t checkpoint_lsn = LSN_INVALID;
+  if (pread(fd, pg.data, PAGE_SIZE, 0) == PAGE_SIZE &&
+      phpg->magic_number == phpg->MAGIC_NUMBER) {
+    if (__getPageSize(phpg) != PAGE_SIZE) {
+      close(fd);
+      return LSN_INVALID;
+    }
+    checkpoint_lsn = phpg->checkpoint_lsn;
+  }
+
+  lsn_t lsn = LogManager::recover(path + ".wal", fd, checkpoint_lsn);
+  off_t file_size = lseek(fd, 0, SEEK_END);
+  if (pread(fd, pg.data, PAGE_SIZE, 0) == PAGE_SIZE &&
+      phpg->magic_number == phpg->MAGIC_NUMBER &&
+      file_size < static_cast<off_t>(phpg->number_of_pages * PAGE_SIZE)) {
+    ftruncate(fd, phpg->number_of_pages * PAGE_SIZE);
+    fdatasync(fd);
+  }
+  close(fd);
+  return std::max(lsn, checkpoint_lsn);
+}
+
+LogManager *DiskManager::__getLog(int fd) const {
+  auto it = logs.find(fd);
+  return it == logs.end() ? nullptr : it->second;
+}
+
+DiskManager::DiskManager(int sync_mode, int io_mode, int log_mode)
+    : sync_mode(sync_mode), io_mode(io_mode), log_mode(log_mode), nsyncs(0),
+      nerrors(0) {
+  fds.reserve(FDS_DEFAULT_CAPACITY);
+}
 
 DiskManager::~DiskManager() {
   for (int fd : fds) {
+    __barrier(fd);
     close(fd);
   }
+  for (auto &entry : sync_states) {
+    delete entry.second;
+  }
+  for (auto &entry : logs) {
+    delete entry.second;
+  }
 }
 
 /**
@@ -77,10 +323,27 @@ DiskManager::~DiskManager() {
  *
  * @param path path of file
  * @return file descriptor or status
+ * @note   With LOG_WAL, the log is replayed first and then
+ *         started over, continuing the LSNs.
  */
 int DiskManager::openDatabase(const std::string &path) {
-  int fd = __fileExists(path) ? __openExistingDatabaseFile(path)
-                              : __createDatabaseFile(path);
+  bool exists = __fileExists(path);
+  lsn_t base_lsn = LSN_INVALID;
+  if (log_mode == LOG_WAL && exists) {
+    base_lsn = __recover(path);
+  }
+
+  int fd = exists ? __openExistingDatabaseFile(path)
+                  : __createDatabaseFile(path);
+  if (log_mode == LOG_WAL && fd >= 0) {
+    LogManager *log = new LogManager(path + ".wal", base_lsn);
+    if (unlikely(!log->isOpen())) {
+      delete log;
+      close(fd);
+      return F_OPENFAIL;
+    }
+    logs[fd] = log;
+  }
   fds.push_back(fd);
   return fd;
 }
@@ -91,50 +354,21 @@ int DiskManager::openDatabase(const std::string &path) {
  * @param fd file descriptor
  * @return page number of the allocated page
  *
- * @note If there wasn't any free page, it expands
- *       the database size doubly. It guarantees that
- *       it always returns an allocated page.
+ * @note The lowest free page in the free-space map is
+ *       allocated. If there wasn't any free page, it
+ *       expands the database size doubly without writing
+ *       the new pages. It guarantees that it always
+ *       returns an allocated page.
  */
 pagenum_t DiskManager::allocPage(int fd) {
-  Page hpg, fpg;
+  Page hpg;
   HeaderPage *phpg = hpg.getHeaderPage();
-  FreePage *pfpg = fpg.getFreePage();
 
-  /*
-   * Get a free page number
-   */
   readPage(fd, PN_HEADER, &hpg);
-  pagenum_t free_page_number = phpg->free_page_number;
-
-  if (unlikely(free_page_number == PN_EOFREE)) {
-    /*
-     * Expand file and set the free page number
-     */
-    pagenum_t old_number_of_pages = phpg->number_of_pages;
-    pagenum_t new_number_of_pages = 2 * old_number_of_pages;
-    if (ftruncate(fd, new_number_of_pages * PAGE_SIZE) < 0) {
-      return PN_INVALID;
-    }
-
-    for (pagenum_t i = old_number_of_pages; i < new_number_of_pages - 1; i++) {
-      pfpg->next_free_page_number = i + 1;
-      writePage(fd, i, &fpg);
-    }
-    pfpg->next_free_page_number = PN_EOFREE;
-    writePage(fd, new_number_of_pages - 1, &fpg);
-
-    phpg->number_of_pages = new_number_of_pages;
-    free_page_number = phpg->free_page_number = old_number_of_pages;
+  pagenum_t alloc_page_number = FreeSpaceMap(this, fd, phpg).alloc();
+  if (likely(alloc_page_number != PN_INVALID)) {
+    writePage(fd, PN_HEADER, &hpg);
   }
-
-  /*
-   * Set header page
-   */
-  pagenum_t alloc_page_number = free_page_number;
-  readPage(fd, free_page_number, &fpg);
-  phpg->free_page_number = pfpg->next_free_page_number;
-  writePage(fd, PN_HEADER, &hpg);
-
   return alloc_page_number;
 }
 
@@ -145,23 +379,49 @@ pagenum_t DiskManager::allocPage(int fd) {
  * @param page_number page number to deallocate
  */
 void DiskManager::freePage(int fd, pagenum_t page_number) {
-  Page pg;
+  Page hpg;
+  HeaderPage *phpg = hpg.getHeaderPage();
 
-  /*
-   * Set header page
-   */
-  HeaderPage *phpg = pg.getHeaderPage();
-  readPage(fd, PN_HEADER, &pg);
-  pagenum_t free_page_number = phpg->free_page_number;
-  phpg->free_page_number = page_number;
-  writePage(fd, PN_HEADER, &pg);
+  readPage(fd, PN_HEADER, &hpg);
+  FreeSpaceMap(this, fd, phpg).free(page_number);
+  writePage(fd, PN_HEADER, &hpg);
+}
 
-  /*
-   * Free page
-   */
-  FreePage *pfpg = pg.getFreePage();
-  pfpg->next_free_page_number = free_page_number;
-  writePage(fd, page_number, &pg);
+/**
+ * Allocate pages with a single header update
+ *
+ * @param fd           [in]  file descriptor
+ * @param n            [in]  number of pages
+ * @param page_numbers [out] allocated page numbers
+ * @return number of allocated pages
+ * @note   Pages come in contiguous extents when possible.
+ */
+size_t DiskManager::allocPages(int fd, size_t n, pagenum_t *page_numbers) {
+  Page hpg;
+  HeaderPage *phpg = hpg.getHeaderPage();
+
+  readPage(fd, PN_HEADER, &hpg);
+  size_t nallocated = FreeSpaceMap(this, fd, phpg).allocMany(n, page_numbers);
+  if (likely(nallocated > 0)) {
+    writePage(fd, PN_HEADER, &hpg);
+  }
+  return nallocated;
+}
+
+/**
+ * Deallocate pages with a single header update
+ *
+ * @param fd           [in] file descriptor
+ * @param page_numbers [in] page numbers to deallocate
+ * @param n            [in] number of pages
+ */
+void DiskManager::freePages(int fd, const pagenum_t *page_numbers, size_t n) {
+  Page hpg;
+  HeaderPage *phpg = hpg.getHeaderPage();
+
+  readPage(fd, PN_HEADER, &hpg);
+  FreeSpaceMap(this, fd, phpg).freeMany(page_numbers, n);
+  writePage(fd, PN_HEADER, &hpg);
 }
 
 /**
@@ -172,6 +432,12 @@ void DiskManager::freePage(int fd, pagenum_t page_number) {
  * @param dest        [out] destination address to read a page
  */
 void DiskManager::readPage(int fd, pagenum_t page_number, Page *dest) {
+  if (unlikely(!__isAligned(dest))) {
+    Page bounce;
+    pread(fd, bounce.data, PAGE_SIZE, page_number * PAGE_SIZE);
+    memcpy(dest->data, bounce.data, PAGE_SIZE);
+    return;
+  }
   pread(fd, dest->data, PAGE_SIZE, page_number * PAGE_SIZE);
 }
 
@@ -183,5 +449,260 @@ void DiskManager::readPage(int fd, pagenum_t page_number, Page *dest) {
  * @param src         [in] source address to write a page
  */
 void DiskManager::writePage(int fd, pagenum_t page_number, const Page *src) {
+  if (unlikely(!__isAligned(src))) {
+    Page bounce;
+    memcpy(bounce.data, src->data, PAGE_SIZE);
+    pwrite(fd, bounce.data, PAGE_SIZE, page_number * PAGE_SIZE);
+    return;
+  }
   pwrite(fd, src->data, PAGE_SIZE, page_number * PAGE_SIZE);
 }
+
+/**
+ * Read or write a run of adjacent pages with preadv/pwritev
+ *
+ * @param fd          [in] file descriptor
+ * @param page_number [in] first page of the run
+ * @param iov         [in] a page per entry, consumed as it goes
+ * @param n           [in] number of pages
+ * @param write       [in] whether the pages are written
+ * @return false if the I/O failed
+ * @note   Short transfers are continued, and a read past the
+ *         end of the file fills the rest of the run with
+ *         zeros.
+ */
+static bool __transferRun(int fd, pagenum_t page_number, struct iovec *iov,
+                          size_t n, bool write) {
+  off_t offset = page_number * PAGE_SIZE;
+  while (n > 0) {
+    int     cnt = static_cast<int>(n);
+    ssize_t ret = write ? pwritev(fd, iov, cnt, offset)
+                        : preadv(fd, iov, cnt, offset);
+    if (unlikely(ret < 0)) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (unlikely(ret == 0)) {
+      if (write) return false;
+      for (size_t i = 0; i < n; i++) {
+        memset(iov[i].iov_base, 0, iov[i].iov_len);
+      }
+      return true;
+    }
+    offset += ret;
+    size_t done = static_cast<size_t>(ret);
+    while (n > 0 && done >= iov->iov_len) {
+      done -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (done > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+      iov->iov_len -= done;
+    }
+  }
+  return true;
+}
+
+/**
+ * Read or write a batch of pages with vectored I/O
+ *
+ * @param ios   [in] requests
+ * @param n     [in] number of requests
+ * @param write [in] whether the pages are written
+ * @note  The requests are sorted by page, and each run of
+ *        adjacent pages of a file is transferred by one
+ *        preadv or pwritev. Misaligned pages go one by one.
+ *        The pages of a run that fails are counted in
+ *        getIOErrorCount().
+ */
+void DiskManager::__transferPages(const PageIO *ios, size_t n, bool write) {
+  std::vector<const PageIO *> sorted(n);
+  for (size_t i = 0; i < n; i++) {
+    sorted[i] = &ios[i];
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const PageIO *a, const PageIO *b) {
+              return a->fd != b->fd ? a->fd < b->fd
+                                    : a->page_number < b->page_number;
+            });
+
+  std::vector<struct iovec> iov;
+  iov.reserve(std::min<size_t>(n, IOV_MAX));
+  for (size_t i = 0; i < n;) {
+    const PageIO *first = sorted[i];
+    if (unlikely(!__isAligned(first->page))) {
+      if (write) {
+        writePage(first->fd, first->page_number, first->page);
+      } else {
+        readPage(first->fd, first->page_number, first->page);
+      }
+      i += 1;
+      continue;
+    }
+    iov.clear();
+    iov.push_back({first->page->data, PAGE_SIZE});
+    size_t j = i + 1;
+    while (j < n && iov.size() < IOV_MAX && sorted[j]->fd == first->fd &&
+           sorted[j]->page_number == first->page_number + iov.size() &&
+           __isAligned(sorted[j]->page)) {
+      iov.push_back({sorted[j]->page->data, PAGE_SIZE});
+      j++;
+    }
+    if (unlikely(!__transferRun(first->fd, first->page_number, iov.data(),
+                                iov.size(), write))) {
+      nerrors += iov.size();
+    }
+    i = j;
+  }
+}
+
+/**
+ * Read a batch of pages
+ *
+ * @param ios [in] requests
+ * @param n   [in] number of requests
+ * @note  Adjacent pages are read together.
+ */
+void DiskManager::readPages(const PageIO *ios, size_t n) {
+  __transferPages(ios, n, false);
+}
+
+/**
+ * Write a batch of pages
+ *
+ * @param ios [in] requests
+ * @param n   [in] number of requests
+ * @note  Adjacent pages are written together, so a
+ *        freshly loaded range goes out in a few large
+ *        sequential writes.
+ */
+void DiskManager::writePages(const PageIO *ios, size_t n) {
+  __transferPages(ios, n, true);
+}
+
+/**
+ * Hint that pages will be read soon
+ *
+ * @param fd           file descriptor
+ * @param page_numbers page numbers to read
+ * @param n            number of pages
+ * @note  The page cache starts reading them in the
+ *        background. It does nothing with IO_DIRECT.
+ */
+void DiskManager::prefetchPages(int fd, const pagenum_t *page_numbers,
+                                size_t n) {
+  if (io_mode == IO_DIRECT) {
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    posix_fadvise(fd, page_numbers[i] * PAGE_SIZE, PAGE_SIZE,
+                  POSIX_FADV_WILLNEED);
+  }
+}
+
+size_t DiskManager::getIOAlignment() const {
+  return io_mode == IO_DIRECT ? PAGE_SIZE : 1;
+}
+
+/**
+ * Append a page image to the log of a file
+ *
+ * @param fd          file descriptor
+ * @param page_number page number
+ * @param page        page image
+ * @return LSN of the record | LSN_INVALID if not logged
+ */
+lsn_t DiskManager::logPage(int fd, pagenum_t page_number, const Page *page) {
+  LogManager *log = __getLog(fd);
+  if (log == nullptr) return LSN_INVALID;
+  return log->append(page_number, page);
+}
+
+/**
+ * Make the log of a file durable up to an LSN
+ *
+ * @param fd  file descriptor
+ * @param lsn LSN to make durable, or LSN_MAX for all
+ * @return false if the log failed
+ * @note  Concurrent calls are committed together. Once the
+ *        log failed, it is false even for LSN_INVALID, since
+ *        the latest changes couldn't be logged.
+ */
+bool DiskManager::flushLog(int fd, lsn_t lsn) {
+  LogManager *log = __getLog(fd);
+  if (log == nullptr) return true;
+  return log->flush(lsn);
+}
+
+bool DiskManager::isLogged(int fd) const { return __getLog(fd) != nullptr; }
+
+lsn_t DiskManager::getLogEnd(int fd) {
+  LogManager *log = __getLog(fd);
+  return log == nullptr ? LSN_INVALID : log->getNextLsn();
+}
+
+void DiskManager::truncateLog(int fd, lsn_t lsn) {
+  LogManager *log = __getLog(fd);
+  if (log != nullptr) log->truncate(lsn);
+}
+
+/**
+ * Write back the pages of a file
+ *
+ * @param fd file descriptor
+ * @note  Pages are written through, so there is nothing to
+ *        write back.
+ */
+void DiskManager::flush(int fd) {}
+
+/**
+ * Order the previous writes of a file before the next ones
+ *
+ * @param fd file descriptor
+ * @note  Unlike sync, it never waits for other callers.
+ */
+void DiskManager::barrier(int fd) { __barrier(fd); }
+
+/**
+ * Make the written pages of a file durable
+ *
+ * @param fd file descriptor
+ * @note  Group commit: a caller becomes the leader if no
+ *        fdatasync is running, and its fdatasync covers
+ *        every sync requested until then. The others wait
+ *        for a fdatasync that started after their request.
+ */
+void DiskManager::sync(int fd) {
+  if (sync_mode == SYNC_WRITE) {
+    return;
+  }
+
+  SyncState *state;
+  {
+    std::lock_guard<std::mutex> lock(sync_latch);
+    SyncState *&entry = sync_states[fd];
+    if (entry == nullptr) entry = new SyncState();
+    state = entry;
+  }
+
+  std::unique_lock<std::mutex> lock(state->latch);
+  uint64_t ticket = ++state->requested;
+  while (state->completed < ticket) {
+    if (state->syncing) {
+      state->cv.wait(lock);
+      continue;
+    }
+    state->syncing = true;
+    uint64_t covered = state->requested;
+    lock.unlock();
+
+    fdatasync(fd);
+    nsyncs += 1;
+
+    lock.lock();
+    state->completed = covered;
+    state->syncing = false;
+    state->cv.notify_all();
+  }
+}
@@ -0,0 +1,471 @@
+#include "fsm.h"
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "optimize.h"
+
+#define BIT_INVALID (UINT64_MAX)
+
+static inline bool __testBit(const uint64_t *bits, pagenum_t i) {
+  return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void __setBit(uint64_t *bits, pagenum_t i) {
+  bits[i / 64] |= 1ULL << (i % 64);
+}
+
+static inline void __clearBit(uint64_t *bits, pagenum_t i) {
+  bits[i / 64] &= ~(1ULL << (i % 64));
+}
+
+/**
+ * Find the first run of clear bits
+ *
+ * @param bits  bitmap
+ * @param begin first bit to look at
+ * @param end   end of the bitmap
+ * @param n     length of the run
+ * @return first bit of the run | BIT_INVALID
+ * @note   Full and empty words are skipped at once.
+ */
+static pagenum_t __findRun(const uint64_t *bits, pagenum_t begin,
+                           pagenum_t end, pagenum_t n) {
+  pagenum_t start = begin;
+  pagenum_t run = 0;
+  for (pagenum_t i = begin; i < end;) {
+    uint64_t word = bits[i / 64];
+    if (i % 64 == 0 && i + 64 <= end) {
+      if (word == UINT64_MAX) {
+        run = 0;
+        i += 64;
+        continue;
+      }
+      if (word == 0) {
+        if (run == 0) start = i;
+        run += 64;
+        i += 64;
+        if (run >= n) return start;
+        continue;
+      }
+    }
+    if ((word >> (i % 64)) & 1) {
+      run = 0;
+    } else {
+      if (run == 0) start = i;
+      run += 1;
+      if (run >= n) return start;
+    }
+    i += 1;
+  }
+  return BIT_INVALID;
+}
+
+FreeSpaceMap::FreeSpaceMap(PageManager *pmgr, int fd, HeaderPage *phpg)
+    : pmgr(pmgr), fd(fd), phpg(phpg) {}
+
+pagenum_t FreeSpaceMap::__getGroup(pagenum_t page_number) const {
+  if (page_number < FSM_INLINE_PAGES) return 0;
+  return 1 + (page_number - FSM_INLINE_PAGES) / FSM_GROUP_PAGES;
+}
+
+pagenum_t FreeSpaceMap::__getGroupBegin(pagenum_t group) const {
+  if (group == 0) return 0;
+  return FSM_INLINE_PAGES + (group - 1) * FSM_GROUP_PAGES;
+}
+
+/**
+ * Get the end of the existing pages of a group
+ */
+pagenum_t FreeSpaceMap::__getGroupEnd(pagenum_t group) const {
+  pagenum_t end = group == 0 ? FSM_INLINE_PAGES
+                             : __getGroupBegin(group) + FSM_GROUP_PAGES;
+  return end < phpg->number_of_pages ? end : phpg->number_of_pages;
+}
+
+/**
+ * Get the bitmap of a group
+ *
+ * @param group group
+ * @param pg    [out] page to read the bitmap page into
+ * @return bitmap, indexed from the beginning of the group
+ */
+uint64_t *FreeSpaceMap::__loadBitmap(pagenum_t group, Page *pg) {
+  if (group == 0) {
+    return phpg->fsm_inline;
+  }
+  pmgr->readPage(fd, phpg->fsm_pages[group], pg);
+  return reinterpret_cast<uint64_t *>(pg->data);
+}
+
+void FreeSpaceMap::__storeBitmap(pagenum_t group, Page *pg) {
+  if (group != 0) {
+    pmgr->writePage(fd, phpg->fsm_pages[group], pg);
+  }
+}
+
+/**
+ * Allocate an extent in a group
+ *
+ * @return first page number of the extent | PN_INVALID
+ */
+pagenum_t FreeSpaceMap::__allocInGroup(pagenum_t group, pagenum_t npages) {
+  if (phpg->fsm_free[group] < npages) {
+    return PN_INVALID;
+  }
+  pagenum_t begin = group == phpg->fsm_cursor ? phpg->fsm_hint : 0;
+  pagenum_t end = __getGroupEnd(group) - __getGroupBegin(group);
+
+  Page pg;
+  uint64_t *bits = __loadBitmap(group, &pg);
+  pagenum_t first = __findRun(bits, begin, end, npages);
+  if (first == BIT_INVALID) {
+    return PN_INVALID;
+  }
+  for (pagenum_t i = first; i < first + npages; i++) {
+    __setBit(bits, i);
+  }
+  __storeBitmap(group, &pg);
+
+  phpg->fsm_free[group] -= static_cast<uint32_t>(npages);
+  if (group == phpg->fsm_cursor && (npages == 1 || first == begin)) {
+    phpg->fsm_hint = first + npages;
+  }
+  return __getGroupBegin(group) + first;
+}
+
+/**
+ * Extend the file and its map
+ *
+ * @param number_of_pages new number of pages
+ * @return false if the file can't be extended
+ * @note   The first page of a new group is reserved for
+ *         its bitmap, or for the header in group 0. The
+ *         growth and the new bitmap pages are made durable
+ *         before the caller writes the header linking them,
+ *         so a crash can't leave a zeroed bitmap page that
+ *         marks itself free.
+ */
+bool FreeSpaceMap::__extend(pagenum_t number_of_pages) {
+  pagenum_t old_number_of_pages = phpg->number_of_pages;
+  if (unlikely(number_of_pages > FSM_MAX_PAGES)) {
+    return false;
+  }
+  pagenum_t last = __getGroup(number_of_pages - 1);
+  if (ftruncate(fd, number_of_pages * PAGE_SIZE) < 0) {
+    return false;
+  }
+
+  phpg->number_of_pages = number_of_pages;
+  pagenum_t group = old_number_of_pages == 0
+                        ? 0
+                        : __getGroup(old_number_of_pages - 1);
+  for (; group <= last; group++) {
+    pagenum_t begin = __getGroupBegin(group);
+    pagenum_t end = __getGroupEnd(group);
+    if (group < phpg->fsm_groups) {
+      phpg->fsm_free[group] +=
+          static_cast<uint32_t>(end - old_number_of_pages);
+      if (group < phpg->fsm_cursor && end > old_number_of_pages) {
+        phpg->fsm_cursor = group;
+        phpg->fsm_hint = old_number_of_pages - begin;
+      }
+      continue;
+    }
+    if (group == 0) {
+      __setBit(phpg->fsm_inline, 0);
+    } else {
+      Page pg;
+      memset(pg.data, 0, PAGE_SIZE);
+      __setBit(reinterpret_cast<uint64_t *>(pg.data), 0);
+      pmgr->writePage(fd, begin, &pg);
+      phpg->fsm_pages[group] = begin;
+    }
+    phpg->fsm_free[group] = static_cast<uint32_t>(end - begin - 1);
+  }
+  phpg->fsm_groups = last + 1;
+  pmgr->barrier(fd);
+  return true;
+}
+
+/**
+ * Initialize the map of a new file
+ *
+ * @param number_of_pages initial number of pages
+ * @return false if the file can't be extended
+ */
+bool FreeSpaceMap::init(pagenum_t number_of_pages) {
+  phpg->free_page_number = PN_EOFREE;
+  phpg->number_of_pages = 0;
+  phpg->high_water_mark = 0;
+  phpg->fsm_groups = 0;
+  phpg->fsm_cursor = 0;
+  phpg->fsm_hint = 0;
+  memset(phpg->fsm_inline, 0, sizeof(phpg->fsm_inline));
+  memset(phpg->fsm_pages, 0, sizeof(phpg->fsm_pages));
+  memset(phpg->fsm_free, 0, sizeof(phpg->fsm_free));
+  return __extend(number_of_pages);
+}
+
+/**
+ * Build the map of a file with a free list
+ *
+ * @return false if the file can't be extended
+ * @note   Pages below the high-water mark are allocated
+ *         unless they are chained. The bitmap pages are
+ *         appended to the file, since the first pages of
+ *         the groups may be in use. They are made durable
+ *         before the caller writes the header.
+ */
+bool FreeSpaceMap::upgrade() {
+  pagenum_t number_of_pages = phpg->number_of_pages;
+  pagenum_t high_water_mark = phpg->magic_number == phpg->MAGIC_NUMBER_V1
+                                  ? number_of_pages
+                                  : phpg->high_water_mark;
+
+  std::vector<bool> allocated(number_of_pages, false);
+  for (pagenum_t i = 0; i < high_water_mark && i < number_of_pages; i++) {
+    allocated[i] = true;
+  }
+  {
+    Page pg;
+    pagenum_t page_number = phpg->free_page_number;
+    for (pagenum_t i = 0; page_number != PN_EOFREE && i < number_of_pages;
+         i++) {
+      if (page_number >= number_of_pages) break;
+      allocated[page_number] = false;
+      pmgr->readPage(fd, page_number, &pg);
+      page_number = pg.getFreePage()->next_free_page_number;
+    }
+  }
+  allocated[PN_HEADER] = true;
+
+  /*
+   * Append a bitmap page per group
+   */
+  pagenum_t nbitmaps = 0;
+  for (;;) {
+    pagenum_t ngroups = __getGroup(number_of_pages + nbitmaps - 1) + 1;
+    if (ngroups - 1 == nbitmaps) break;
+    nbitmaps = ngroups - 1;
+  }
+  pagenum_t new_number_of_pages = number_of_pages + nbitmaps;
+  if (unlikely(nbitmaps >= FSM_MAX_GROUPS)) {
+    return false;
+  }
+  if (ftruncate(fd, new_number_of_pages * PAGE_SIZE) < 0) {
+    return false;
+  }
+  allocated.resize(new_number_of_pages, true);
+
+  phpg->magic_number = phpg->MAGIC_NUMBER;
+  phpg->free_page_number = PN_EOFREE;
+  phpg->number_of_pages = new_number_of_pages;
+  phpg->high_water_mark = 0;
+  phpg->fsm_groups = nbitmaps + 1;
+  phpg->fsm_cursor = 0;
+  phpg->fsm_hint = 0;
+  memset(phpg->fsm_inline, 0, sizeof(phpg->fsm_inline));
+  memset(phpg->fsm_pages, 0, sizeof(phpg->fsm_pages));
+  memset(phpg->fsm_free, 0, sizeof(phpg->fsm_free));
+
+  for (pagenum_t group = 0; group < phpg->fsm_groups; group++) {
+    Page pg;
+    memset(pg.data, 0, PAGE_SIZE);
+    if (group != 0) {
+      phpg->fsm_pages[group] = number_of_pages + group - 1;
+    }
+    uint64_t *bits = group == 0 ? phpg->fsm_inline
+                                : reinterpret_cast<uint64_t *>(pg.data);
+    pagenum_t begin = __getGroupBegin(group);
+    pagenum_t end = __getGroupEnd(group);
+    uint32_t nfree = 0;
+    for (pagenum_t i = begin; i < end; i++) {
+      if (allocated[i]) {
+        __setBit(bits, i - begin);
+      } else {
+        nfree += 1;
+      }
+    }
+    phpg->fsm_free[group] = nfree;
+    __storeBitmap(group, &pg);
+  }
+  pmgr->barrier(fd);
+  return true;
+}
+
+/**
+ * Allocate an extent in the existing groups
+ *
+ * @return first page number of the extent | PN_INVALID
+ */
+pagenum_t FreeSpaceMap::__allocExisting(pagenum_t npages) {
+  while (phpg->fsm_cursor < phpg->fsm_groups &&
+         phpg->fsm_free[phpg->fsm_cursor] == 0) {
+    phpg->fsm_cursor += 1;
+    phpg->fsm_hint = 0;
+  }
+  for (pagenum_t group = phpg->fsm_cursor; group < phpg->fsm_groups;
+       group++) {
+    pagenum_t page_number = __allocInGroup(group, npages);
+    if (page_number != PN_INVALID) {
+      return page_number;
+    }
+  }
+  return PN_INVALID;
+}
+
+/**
+ * Allocate an extent of contiguous pages
+ *
+ * @param npages number of pages
+ * @return first page number of the extent | PN_INVALID
+ * @note   The file doubles until it reaches FSM_MAX_PAGES.
+ */
+pagenum_t FreeSpaceMap::alloc(pagenum_t npages) {
+  if (unlikely(npages == 0 || npages >= FSM_GROUP_PAGES)) {
+    return PN_INVALID;
+  }
+  for (;;) {
+    pagenum_t page_number = __allocExisting(npages);
+    if (page_number != PN_INVALID) {
+      return page_number;
+    }
+    pagenum_t number_of_pages =
+        std::min<pagenum_t>(2 * phpg->number_of_pages, FSM_MAX_PAGES);
+    if (number_of_pages <= phpg->number_of_pages ||
+        !__extend(number_of_pages)) {
+      return PN_INVALID;
+    }
+  }
+}
+
+/**
+ * Deallocate an extent of contiguous pages
+ *
+ * @param page_number first page number of the extent
+ * @param npages      number of pages
+ * @note  The header and bitmap pages are never freed. The
+ *        bitmap pages of an upgraded file are appended to
+ *        it, so they may be in any group.
+ */
+void FreeSpaceMap::free(pagenum_t page_number, pagenum_t npages) {
+  pagenum_t end = page_number + npages;
+  if (unlikely(end > phpg->number_of_pages)) {
+    end = phpg->number_of_pages;
+  }
+  while (page_number < end) {
+    pagenum_t group = __getGroup(page_number);
+    pagenum_t begin = __getGroupBegin(group);
+    pagenum_t group_end = __getGroupEnd(group);
+    pagenum_t stop = end < group_end ? end : group_end;
+
+    Page pg;
+    uint64_t *bits = __loadBitmap(group, &pg);
+    std::vector<pagenum_t> bitmaps;
+    for (pagenum_t g = 1; g < phpg->fsm_groups; g++) {
+      if (phpg->fsm_pages[g] >= page_number && phpg->fsm_pages[g] < stop) {
+        bitmaps.push_back(phpg->fsm_pages[g]);
+      }
+    }
+    uint32_t nfreed = 0;
+    pagenum_t lowest = BIT_INVALID;
+    for (pagenum_t i = page_number; i < stop; i++) {
+      if (i == PN_HEADER || !__testBit(bits, i - begin) ||
+          std::find(bitmaps.begin(), bitmaps.end(), i) != bitmaps.end()) {
+        continue;
+      }
+      __clearBit(bits, i - begin);
+      nfreed += 1;
+      if (lowest == BIT_INVALID) lowest = i - begin;
+    }
+    if (nfreed > 0) {
+      __storeBitmap(group, &pg);
+      phpg->fsm_free[group] += nfreed;
+      if (group < phpg->fsm_cursor) {
+        phpg->fsm_cursor = group;
+        phpg->fsm_hint = lowest;
+      } else if (group == phpg->fsm_cursor && lowest < phpg->fsm_hint) {
+        phpg->fsm_hint = lowest;
+      }
+    }
+    page_number = stop;
+  }
+}
+
+/**
+ * Allocate pages in as few extents as possible
+ *
+ * @param n            number of pages
+ * @param page_numbers [out] allocated page numbers
+ * @return number of allocated pages
+ * @note   An extent that doesn't fit is split in halves.
+ *         The free pages of the file are used up first, in
+ *         smaller extents if they are fragmented, and the
+ *         file only grows for the rest.
+ */
+size_t FreeSpaceMap::allocMany(size_t n, pagenum_t *page_numbers) {
+  size_t nallocated = 0;
+  pagenum_t extent = FSM_GROUP_PAGES - 1;
+  bool extend = false;
+  while (nallocated < n) {
+    pagenum_t npages = n - nallocated;
+    if (npages > extent) npages = extent;
+    pagenum_t first = extend ? alloc(npages) : __allocExisting(npages);
+    if (first == PN_INVALID) {
+      if (npages > 1) {
+        extent = npages / 2;
+      } else if (!extend) {
+        extend = true;
+        extent = FSM_GROUP_PAGES - 1;
+      } else {
+        break;
+      }
+      continue;
+    }
+    for (pagenum_t i = 0; i < npages; i++) {
+      page_numbers[nallocated++] = first + i;
+    }
+  }
+  return nallocated;
+}
+
+/**
+ * Deallocate pages
+ *
+ * @note Contiguous pages are freed as one extent.
+ */
+void FreeSpaceMap::freeMany(const pagenum_t *page_numbers, size_t n) {
+  std::vector<pagenum_t> sorted(page_numbers, page_numbers + n);
+  std::sort(sorted.begin(), sorted.end());
+  for (size_t i = 0; i < sorted.size();) {
+    size_t j = i + 1;
+    while (j < sorted.size() && sorted[j] == sorted[j - 1] + 1) j++;
+    free(sorted[i], j - i);
+    i = j;
+  }
+}
+
+/**
+ * Check whether a page is allocated
+ */
+bool FreeSpaceMap::isAllocated(pagenum_t page_number) {
+  if (page_number >= phpg->number_of_pages) {
+    return false;
+  }
+  pagenum_t group = __getGroup(page_number);
+  Page pg;
+  const uint64_t *bits = __loadBitmap(group, &pg);
+  return __testBit(bits, page_number - __getGroupBegin(group));
+}
+
+/**
+ * Count the free pages of the file
+ */
+pagenum_t FreeSpaceMap::getFreePages() const {
+  pagenum_t nfree = 0;
+  for (pagenum_t group = 0; group < phpg->fsm_groups; group++) {
+    nfree += phpg->fsm_free[group];
+  }
+  return nfree;
+}
@@ -0,0 +1,690 @@
+#include "heap.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "optimize.h"
+
+using ReadPageGuard = BufferManager::ReadPageGuard;
+using WritePageGuard = BufferManager::WritePageGuard;
+using OptimisticPageGuard = BufferManager::OptimisticPageGuard;
+using Slot = SlottedPage::Slot;
+
+static_assert(sizeof(RecordId) <= SlottedPage::MIN_RECORD_SIZE,
+              "A forwarding address must fit in any record");
+
+/**
+ * Bytes taken by a record of a length
+ */
+static inline uint32_t __recordSize(uint32_t length) {
+  return std::max(length, SlottedPage::MIN_RECORD_SIZE);
+}
+
+/**
+ * Free space class of a page
+ *
+ * @note A page of class c has at least c / HEAP_FREE_CLASSES
+ *       of a page free.
+ */
+static inline uint32_t __freeClass(uint32_t free_space) {
+  return std::min<uint32_t>(HEAP_FREE_CLASSES - 1,
+                            free_space * HEAP_FREE_CLASSES / PAGE_SIZE);
+}
+
+static inline bool __isRecord(const SlottedPage *page, uint32_t slot) {
+  return slot < std::min(page->number_of_slots, SlottedPage::MAX_SLOTS) &&
+         page->slots[slot].offset != 0;
+}
+
+/**
+ * Move the records of a page to its end
+ *
+ * @note The holes between the records are gathered into the
+ *       gap before free_space_offset. Slots are kept.
+ */
+static void __compact(SlottedPage *page) {
+  Page copy;
+  memcpy(copy.data, page, PAGE_SIZE);
+  const SlottedPage *src = copy.getSlottedPage();
+  uint32_t offset = PAGE_SIZE;
+  for (uint32_t i = 0; i < page->number_of_slots; i++) {
+    Slot *slot = &page->slots[i];
+    if (slot->offset == 0) continue;
+    uint32_t size = __recordSize(slot->length);
+    offset -= size;
+    memcpy(reinterpret_cast<char *>(page) + offset, src->getRecord(i), size);
+    slot->offset = offset;
+  }
+  page->free_space_offset = offset;
+}
+
+/**
+ * Make room for a record in the gap of a page
+ *
+ * @param page    page
+ * @param size    bytes of the record
+ * @param nslots  number of slots once it is placed
+ * @return offset of the record
+ * @note   The page must have enough free space.
+ */
+static uint32_t __reserve(SlottedPage *page, uint32_t size, uint32_t nslots) {
+  uint32_t directory_end = SlottedPage::HEADER_SIZE + nslots * sizeof(Slot);
+  if (page->free_space_offset < directory_end + size) {
+    __compact(page);
+  }
+  assert(page->free_space_offset >= directory_end + size);
+  page->free_space_offset -= size;
+  page->free_space -= size;
+  return page->free_space_offset;
+}
+
+/**
+ * Whether a record fits in a page
+ */
+static inline bool __fits(const SlottedPage *page, uint32_t length) {
+  uint32_t need = __recordSize(length);
+  if (page->number_of_free_slots == 0) {
+    need += sizeof(Slot);
+  }
+  return page->free_space >= need;
+}
+
+/**
+ * Place a record in a page
+ *
+ * @return slot of the record
+ * @note   The page must have room for it. A free slot is
+ *         reused before the directory grows.
+ */
+static uint32_t __placeRecord(SlottedPage *page, const char *data,
+                              uint32_t length, uint16_t flags) {
+  assert(__fits(page, length));
+  uint32_t i = page->number_of_slots;
+  uint32_t nslots = i;
+  if (page->number_of_free_slots > 0) {
+    for (i = 0; page->slots[i].offset != 0; i++) {
+    }
+    page->number_of_free_slots -= 1;
+  } else {
+    nslots += 1;
+    page->free_space -= sizeof(Slot);
+  }
+  /*
+   * The directory grows once the gap is made, since a new
+   * slot may cover a record until the page is compacted
+   */
+  uint32_t offset = __reserve(page, __recordSize(length), nslots);
+  page->number_of_slots = nslots;
+  memcpy(reinterpret_cast<char *>(page) + offset, data, length);
+  page->slots[i] = {static_cast<uint16_t>(offset),
+                    static_cast<uint16_t>(length), flags, 0};
+  return i;
+}
+
+/**
+ * Replace a record of a page in place
+ *
+ * @return false if it doesn't fit in the page
+ * @note   A shrunk record stays where it is. A grown one is
+ *         moved within the page. The flags are kept.
+ */
+static bool __resizeRecord(SlottedPage *page, uint32_t i, const char *data,
+                           uint32_t length) {
+  Slot *slot = &page->slots[i];
+  uint32_t old_size = __recordSize(slot->length);
+  uint32_t size = __recordSize(length);
+  if (size <= old_size) {
+    memcpy(page->getRecord(i), data, length);
+    slot->length = length;
+    page->free_space += old_size - size;
+    return true;
+  }
+  if (page->free_space + old_size < size) {
+    return false;
+  }
+
+  page->free_space += old_size;
+  slot->offset = 0;
+  uint32_t offset = __reserve(page, size, page->number_of_slots);
+  memcpy(reinterpret_cast<char *>(page) + offset, data, length);
+  slot->offset = offset;
+  slot->length = length;
+  return true;
+}
+
+/**
+ * Remove a record of a page
+ *
+ * @note Free slots at the end of the directory are dropped.
+ */
+static void __eraseRecord(SlottedPage *page, uint32_t i) {
+  page->free_space += __recordSize(page->slots[i].length);
+  page->slots[i] = {0, 0, 0, 0};
+  page->number_of_free_slots += 1;
+  while (page->number_of_slots > 0 &&
+         page->slots[page->number_of_slots - 1].offset == 0) {
+    page->number_of_slots -= 1;
+    page->number_of_free_slots -= 1;
+    page->free_space += sizeof(Slot);
+  }
+}
+
+/**
+ * Open the heap file of a table
+ *
+ * @param bmgr     buffer manager the table is open in
+ * @param table_id table id
+ */
+HeapFile::HeapFile(BufferManager *bmgr, int table_id)
+    : bmgr(bmgr), table_id(table_id) {
+  assert(bmgr != nullptr);
+}
+
+/**
+ * Append a new page to the heap file
+ *
+ * @param  page_number [out] page number of the new page
+ * @return HEAP_SUCCESS | HEAP_ALLOCFAIL | HEAP_NOFRAME
+ * @note   The pages it links are pinned first, so it fails
+ *         before any of them changes.
+ */
+int HeapFile::__newPage(pagenum_t *page_number) {
+  pagenum_t pn = bmgr->allocPage(table_id);
+  if (unlikely(pn == PN_INVALID)) {
+    return HEAP_ALLOCFAIL;
+  }
+  uint32_t free_class = __freeClass(PAGE_SIZE - SlottedPage::HEADER_SIZE);
+  pagenum_t last = PN_INVALID;
+  pagenum_t head = PN_INVALID;
+  std::vector<OptimisticPageGuard> pins;
+  {
+    ReadPageGuard hguard = bmgr->fetchPageRead(table_id, PN_HEADER);
+    if (likely(hguard.isValid())) {
+      last = hguard->getHeaderPage()->heap_last_page_number;
+      head = hguard->getHeaderPage()->heap_free_lists[free_class];
+      pins.push_back(bmgr->fetchPageOptimistic(table_id, PN_HEADER));
+    }
+  }
+  for (pagenum_t p : {pn, last, head}) {
+    if (!pins.empty() && pins.back().isValid() && p != PN_INVALID) {
+      pins.push_back(bmgr->fetchPageOptimistic(table_id, p));
+    }
+  }
+  if (unlikely(pins.empty() || !pins.back().isValid())) {
+    pins.clear();
+    bmgr->freePage(table_id, pn);
+    return HEAP_NOFRAME;
+  }
+
+  {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, pn);
+    assert(guard.isValid());
+    SlottedPage *page = guard->getSlottedPage();
+    page->next_page_number = PN_INVALID;
+    page->prev_free_number = PN_INVALID;
+    page->next_free_number = PN_INVALID;
+    page->number_of_slots = 0;
+    page->number_of_free_slots = 0;
+    page->free_space_offset = PAGE_SIZE;
+    page->free_space = PAGE_SIZE - SlottedPage::HEADER_SIZE;
+    page->free_class = free_class;
+    page->reserved = 0;
+  }
+  {
+    WritePageGuard hguard = bmgr->fetchPageWrite(table_id, PN_HEADER);
+    assert(hguard.isValid());
+    HeaderPage *phpg = hguard->getHeaderPage();
+    phpg->heap_last_page_number = pn;
+    if (last == PN_INVALID) {
+      phpg->heap_first_page_number = pn;
+    }
+  }
+  if (last != PN_INVALID) {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, last);
+    assert(guard.isValid());
+    guard->getSlottedPage()->next_page_number = pn;
+  }
+  __link(pn, free_class);
+  *page_number = pn;
+  return HEAP_SUCCESS;
+}
+
+/**
+ * Read the first page of each free space class
+ *
+ * @param  heads [out] HEAP_FREE_CLASSES page numbers
+ * @return HEAP_SUCCESS | HEAP_NOFRAME
+ */
+int HeapFile::__readHeads(pagenum_t *heads) {
+  ReadPageGuard hguard = bmgr->fetchPageRead(table_id, PN_HEADER);
+  if (unlikely(!hguard.isValid())) {
+    return HEAP_NOFRAME;
+  }
+  memcpy(heads, hguard->getHeaderPage()->heap_free_lists,
+         HEAP_FREE_CLASSES * sizeof(pagenum_t));
+  return HEAP_SUCCESS;
+}
+
+/**
+ * Pin the pages that moving a page to another class changes
+ *
+ * @param  page_number page to move
+ * @param  page        the page, still in its old class
+ * @param  head        first page of the new class
+ * @param  pins        [out] guards pinning the pages
+ * @return false if every frame is pinned
+ * @note   They are the header, the page, its neighbours in
+ *         its list and the head of the new list. Pinned
+ *         pages stay buffered, so __reclassify can latch
+ *         them one at a time without running out of frames
+ *         halfway through the links.
+ */
+bool HeapFile::__pinLinks(pagenum_t page_number, const SlottedPage *page,
+                          pagenum_t head,
+                          std::vector<OptimisticPageGuard> *pins) {
+  pins->push_back(bmgr->fetchPageOptimistic(table_id, PN_HEADER));
+  for (pagenum_t p : {page_number, page->prev_free_number,
+                      page->next_free_number, head}) {
+    if (!pins->back().isValid()) break;
+    if (p != PN_INVALID) {
+      pins->push_back(bmgr->fetchPageOptimistic(table_id, p));
+    }
+  }
+  return pins->back().isValid();
+}
+
+/**
+ * Push a page onto the list of a free space class
+ *
+ * @note The pages it changes must be pinned.
+ */
+void HeapFile::__link(pagenum_t page_number, uint32_t free_class) {
+  pagenum_t head;
+  {
+    WritePageGuard hguard = bmgr->fetchPageWrite(table_id, PN_HEADER);
+    assert(hguard.isValid());
+    HeaderPage *phpg = hguard->getHeaderPage();
+    head = phpg->heap_free_lists[free_class];
+    phpg->heap_free_lists[free_class] = page_number;
+  }
+  {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, page_number);
+    assert(guard.isValid());
+    SlottedPage *page = guard->getSlottedPage();
+    page->prev_free_number = PN_INVALID;
+    page->next_free_number = head;
+    page->free_class = free_class;
+  }
+  if (head != PN_INVALID) {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, head);
+    assert(guard.isValid());
+    guard->getSlottedPage()->prev_free_number = page_number;
+  }
+}
+
+/**
+ * Take a page off the list of its free space class
+ *
+ * @note The pages it changes must be pinned.
+ */
+void HeapFile::__unlink(pagenum_t page_number) {
+  pagenum_t prev, next;
+  uint32_t free_class;
+  {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, page_number);
+    assert(guard.isValid());
+    SlottedPage *page = guard->getSlottedPage();
+    prev = page->prev_free_number;
+    next = page->next_free_number;
+    free_class = page->free_class;
+    page->prev_free_number = PN_INVALID;
+    page->next_free_number = PN_INVALID;
+  }
+  if (prev != PN_INVALID) {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, prev);
+    assert(guard.isValid());
+    guard->getSlottedPage()->next_free_number = next;
+  } else {
+    WritePageGuard hguard = bmgr->fetchPageWrite(table_id, PN_HEADER);
+    assert(hguard.isValid());
+    hguard->getHeaderPage()->heap_free_lists[free_class] = next;
+  }
+  if (next != PN_INVALID) {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, next);
+    assert(guard.isValid());
+    guard->getSlottedPage()->prev_free_number = prev;
+  }
+}
+
+/**
+ * Move a page to the list of another free space class
+ */
+void HeapFile::__reclassify(pagenum_t page_number, uint32_t free_class) {
+  __unlink(page_number);
+  __link(page_number, free_class);
+}
+
+/**
+ * Insert a record under the heap latch
+ *
+ * @note It takes the first page of the smallest class whose
+ *       pages all have room for the record, or a new page.
+ *       A record larger than that takes the first page of
+ *       the last class if it fits.
+ */
+int HeapFile::__insert(const char *data, uint32_t length, uint16_t flags,
+                       RecordId *rid) {
+  uint32_t need = __recordSize(length) + sizeof(Slot);
+  pagenum_t page_number = PN_INVALID;
+  {
+    ReadPageGuard hguard = bmgr->fetchPageRead(table_id, PN_HEADER);
+    if (unlikely(!hguard.isValid())) {
+      return HEAP_NOFRAME;
+    }
+    const HeaderPage *phpg = hguard->getHeaderPage();
+    uint32_t c = (need * HEAP_FREE_CLASSES + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (c >= HEAP_FREE_CLASSES) {
+      page_number = phpg->heap_free_lists[HEAP_FREE_CLASSES - 1];
+    }
+    for (; c < HEAP_FREE_CLASSES && page_number == PN_INVALID; c++) {
+      page_number = phpg->heap_free_lists[c];
+    }
+  }
+  /*
+   * No class is sure to have room for a record of more than
+   * the last class, so the head of the last one is tried.
+   */
+  if (page_number != PN_INVALID &&
+      need * HEAP_FREE_CLASSES > (HEAP_FREE_CLASSES - 1) * PAGE_SIZE) {
+    ReadPageGuard guard = bmgr->fetchPageRead(table_id, page_number);
+    if (unlikely(!guard.isValid())) {
+      return HEAP_NOFRAME;
+    }
+    if (!__fits(guard->getSlottedPage(), length)) {
+      page_number = PN_INVALID;
+    }
+  }
+  if (page_number == PN_INVALID) {
+    int ret = __newPage(&page_number);
+    if (ret != HEAP_SUCCESS) {
+      return ret;
+    }
+  }
+
+  pagenum_t heads[HEAP_FREE_CLASSES];
+  int ret = __readHeads(heads);
+  if (unlikely(ret != HEAP_SUCCESS)) {
+    return ret;
+  }
+  std::vector<OptimisticPageGuard> pins;
+  uint32_t new_class;
+  {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, page_number);
+    if (unlikely(!guard.isValid())) {
+      return HEAP_NOFRAME;
+    }
+    SlottedPage *page = guard->getSlottedPage();
+    Page old;
+    memcpy(old.data, guard->data, PAGE_SIZE);
+    uint32_t slot = __placeRecord(page, data, length, flags);
+    new_class = __freeClass(page->free_space);
+    if (new_class != page->free_class &&
+        unlikely(!__pinLinks(page_number, page, heads[new_class], &pins))) {
+      memcpy(guard->data, old.data, PAGE_SIZE);
+      return HEAP_NOFRAME;
+    }
+    rid->page_number = page_number;
+    rid->slot = slot;
+  }
+  if (!pins.empty()) {
+    __reclassify(page_number, new_class);
+  }
+  return HEAP_SUCCESS;
+}
+
+/**
+ * Insert a record
+ *
+ * @param  data   record
+ * @param  length length of the record
+ * @param  rid    [out] address of the record
+ * @return HEAP_SUCCESS | HEAP_TOOLARGE | HEAP_ALLOCFAIL
+ *         | HEAP_NOFRAME
+ */
+int HeapFile::insertRecord(const char *data, uint32_t length,
+                           RecordId *rid) {
+  if (length > MAX_RECORD_SIZE) {
+    return HEAP_TOOLARGE;
+  }
+  std::lock_guard<std::mutex> lock(latch);
+  return __insert(data, length, 0, rid);
+}
+
+/**
+ * Read a record
+ *
+ * @param  rid    address of the record
+ * @param  record [out] record
+ * @return HEAP_SUCCESS | HEAP_NOTFOUND | HEAP_NOFRAME
+ * @note   A forwarded record is read from where it moved,
+ *         with its forwarding page still latched.
+ */
+int HeapFile::getRecord(const RecordId &rid, std::string *record) {
+  if (rid.page_number == PN_INVALID) {
+    return HEAP_NOTFOUND;
+  }
+  ReadPageGuard guard = bmgr->fetchPageRead(table_id, rid.page_number);
+  if (unlikely(!guard.isValid())) {
+    return HEAP_NOFRAME;
+  }
+  const SlottedPage *page = guard->getSlottedPage();
+  if (!__isRecord(page, rid.slot) ||
+      (page->slots[rid.slot].flags & SlottedPage::SLOT_MOVED)) {
+    return HEAP_NOTFOUND;
+  }
+  if (!(page->slots[rid.slot].flags & SlottedPage::SLOT_FORWARD)) {
+    record->assign(page->getRecord(rid.slot), page->slots[rid.slot].length);
+    return HEAP_SUCCESS;
+  }
+
+  RecordId forward;
+  memcpy(&forward, page->getRecord(rid.slot), sizeof(forward));
+  ReadPageGuard fguard = bmgr->fetchPageRead(table_id, forward.page_number);
+  if (unlikely(!fguard.isValid())) {
+    return HEAP_NOFRAME;
+  }
+  const SlottedPage *fpage = fguard->getSlottedPage();
+  if (unlikely(!__isRecord(fpage, forward.slot))) {
+    return HEAP_NOTFOUND;
+  }
+  record->assign(fpage->getRecord(forward.slot),
+                 fpage->slots[forward.slot].length);
+  return HEAP_SUCCESS;
+}
+
+/**
+ * Replace a record in its page under the heap latch
+ *
+ * @param  rid    address of the record in its page
+ * @param  data   new record
+ * @param  length length of the new record
+ * @param  flags  new flags of the slot
+ * @return HEAP_SUCCESS | HEAP_TOOLARGE if it doesn't fit in
+ *         the page | HEAP_NOFRAME
+ */
+int HeapFile::__replace(const RecordId &rid, const char *data,
+                        uint32_t length, uint16_t flags) {
+  pagenum_t heads[HEAP_FREE_CLASSES];
+  int ret = __readHeads(heads);
+  if (unlikely(ret != HEAP_SUCCESS)) {
+    return ret;
+  }
+  std::vector<OptimisticPageGuard> pins;
+  uint32_t new_class;
+  {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, rid.page_number);
+    if (unlikely(!guard.isValid())) {
+      return HEAP_NOFRAME;
+    }
+    SlottedPage *page = guard->getSlottedPage();
+    Page old;
+    memcpy(old.data, guard->data, PAGE_SIZE);
+    if (!__resizeRecord(page, rid.slot, data, length)) {
+      return HEAP_TOOLARGE;
+    }
+    page->slots[rid.slot].flags = flags;
+    new_class = __freeClass(page->free_space);
+    if (new_class != page->free_class &&
+        unlikely(!__pinLinks(rid.page_number, page, heads[new_class], &pins))) {
+      memcpy(guard->data, old.data, PAGE_SIZE);
+      return HEAP_NOFRAME;
+    }
+  }
+  if (!pins.empty()) {
+    __reclassify(rid.page_number, new_class);
+  }
+  return HEAP_SUCCESS;
+}
+
+/**
+ * Remove a record from its page under the heap latch
+ *
+ * @return HEAP_SUCCESS | HEAP_NOFRAME
+ * @note   An emptied page stays in the heap file, in the
+ *         class of empty pages.
+ */
+int HeapFile::__erase(const RecordId &rid) {
+  pagenum_t heads[HEAP_FREE_CLASSES];
+  int ret = __readHeads(heads);
+  if (unlikely(ret != HEAP_SUCCESS)) {
+    return ret;
+  }
+  std::vector<OptimisticPageGuard> pins;
+  uint32_t new_class;
+  {
+    WritePageGuard guard = bmgr->fetchPageWrite(table_id, rid.page_number);
+    if (unlikely(!guard.isValid())) {
+      return HEAP_NOFRAME;
+    }
+    SlottedPage *page = guard->getSlottedPage();
+    Page old;
+    memcpy(old.data, guard->data, PAGE_SIZE);
+    __eraseRecord(page, rid.slot);
+    new_class = __freeClass(page->free_space);
+    if (new_class != page->free_class &&
+        unlikely(!__pinLinks(rid.page_number, page, heads[new_class], &pins))) {
+      memcpy(guard->data, old.data, PAGE_SIZE);
+      return HEAP_NOFRAME;
+    }
+  }
+  if (!pins.empty()) {
+    __reclassify(rid.page_number, new_class);
+  }
+  return HEAP_SUCCESS;
+}
+
+/**
+ * Find where a record is under the heap latch
+ *
+ * @param  rid     address of the record
+ * @param  forward [out] address it was forwarded to, or
+ *                 PN_INVALID if it is in its slot
+ * @return HEAP_SUCCESS | HEAP_NOTFOUND | HEAP_NOFRAME
+ */
+int HeapFile::__locate(const RecordId &rid, RecordId *forward) {
+  if (rid.page_number == PN_INVALID) {
+    return HEAP_NOTFOUND;
+  }
+  ReadPageGuard guard = bmgr->fetchPageRead(table_id, rid.page_number);
+  if (unlikely(!guard.isValid())) {
+    return HEAP_NOFRAME;
+  }
+  const SlottedPage *page = guard->getSlottedPage();
+  if (!__isRecord(page, rid.slot) ||
+      (page->slots[rid.slot].flags & SlottedPage::SLOT_MOVED)) {
+    return HEAP_NOTFOUND;
+  }
+  *forward = {PN_INVALID, 0};
+  if (page->slots[rid.slot].flags & SlottedPage::SLOT_FORWARD) {
+    memcpy(forward, page->getRecord(rid.slot), sizeof(*forward));
+  }
+  return HEAP_SUCCESS;
+}
+
+/**
+ * Replace a record
+ *
+ * @param  rid    address of the record
+ * @param  data   new record
+ * @param  length length of the new record
+ * @return HEAP_SUCCESS | HEAP_NOTFOUND | HEAP_TOOLARGE
+ *         | HEAP_ALLOCFAIL | HEAP_NOFRAME
+ * @note   A record that no longer fits in its page is moved
+ *         to another one and forwarded from its slot. A
+ *         forwarded record moves back once its page has room
+ *         again. The new copy is in place before the old one
+ *         is removed, so readers see one or the other.
+ */
+int HeapFile::updateRecord(const RecordId &rid, const char *data,
+                           uint32_t length) {
+  if (length > MAX_RECORD_SIZE) {
+    return HEAP_TOOLARGE;
+  }
+  std::lock_guard<std::mutex> lock(latch);
+  RecordId forward;
+  int ret = __locate(rid, &forward);
+  if (ret != HEAP_SUCCESS) {
+    return ret;
+  }
+
+  ret = __replace(rid, data, length, 0);
+  if (ret != HEAP_TOOLARGE) {
+    if (ret == HEAP_SUCCESS && forward.page_number != PN_INVALID) {
+      return __erase(forward);
+    }
+    return ret;
+  }
+  if (forward.page_number != PN_INVALID) {
+    ret = __replace(forward, data, length, SlottedPage::SLOT_MOVED);
+    if (ret != HEAP_TOOLARGE) {
+      return ret;
+    }
+  }
+
+  RecordId moved;
+  ret = __insert(data, length, SlottedPage::SLOT_MOVED, &moved);
+  if (ret != HEAP_SUCCESS) {
+    return ret;
+  }
+  ret = __replace(rid, reinterpret_cast<const char *>(&moved), sizeof(moved),
+                  SlottedPage::SLOT_FORWARD);
+  if (ret != HEAP_SUCCESS) {
+    return ret;
+  }
+  if (forward.page_number != PN_INVALID) {
+    return __erase(forward);
+  }
+  return HEAP_SUCCESS;
+}
+
+/**
+ * Remove a record
+ *
+ * @param  rid address of the record
+ * @return HEAP_SUCCESS | HEAP_NOTFOUND | HEAP_NOFRAME
+ * @note   The forwarding address of a moved record is
+ *         removed first, so readers don't reach the record
+ *         while it is removed.
+ */
+int HeapFile::deleteRecord(const RecordId &rid) {
+  std::lock_guard<std::mutex> lock(latch);
+  RecordId forward;
+  int ret = __locate(rid, &forward);
+  if (ret != HEAP_SUCCESS) {
+    return ret;
+  }
+  ret = __erase(rid);
+  if (ret == HEAP_SUCCESS && forward.page_number != PN_INVALID) {
+    ret = __erase(forward);
+  }
+  return ret;
+}
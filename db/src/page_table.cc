@@ -0,0 +1,220 @@
+#include "page_table.h"
+#include <cstring>
+#include "optimize.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SLOT_INVALID (SIZE_MAX)
+
+/**
+ * Match a control byte in a group
+ *
+ * @param group first control byte of the group
+ * @param b     control byte to match
+ * @return bitmask of the matched positions
+ */
+static inline uint32_t __matchByte(const int8_t *group, int8_t b) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return static_cast<uint32_t>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b))));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < 16; i++) {
+    if (group[i] == b) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * Match EMPTY or DELETED control bytes in a group
+ *
+ * @note Both have the sign bit set, but a full slot doesn't.
+ */
+static inline uint32_t __matchFree(const int8_t *group) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < 16; i++) {
+    if (group[i] < 0) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+uint64_t PageTable::hash(int table_id, pagenum_t page_number) {
+  uint64_t h = page_number * 0x9E3779B97F4A7C15ULL;
+  h ^= static_cast<uint64_t>(table_id) + (h >> 29);
+  return h * 0xBF58476D1CE4E5B9ULL;
+}
+
+PageTable::PageTable(size_t expected)
+    : ctrl(nullptr), entries(nullptr), capacity(0), size(0), tombstones(0) {
+  reserve(expected);
+}
+
+PageTable::~PageTable() {
+  delete[] ctrl;
+  delete[] entries;
+}
+
+/**
+ * Make room for the expected number of pages
+ *
+ * @note The load factor is kept under 7/8.
+ */
+void PageTable::reserve(size_t expected) {
+  size_t new_capacity = GROUP_WIDTH;
+  while (new_capacity * 7 / 8 < expected) new_capacity *= 2;
+  if (new_capacity > capacity) {
+    __rehash(new_capacity);
+  }
+}
+
+void PageTable::__init(size_t capacity) {
+  this->capacity = capacity;
+  ctrl = new int8_t[capacity + GROUP_WIDTH];
+  memset(ctrl, CTRL_EMPTY, capacity + GROUP_WIDTH);
+  entries = new Entry[capacity];
+  size = 0;
+  tombstones = 0;
+}
+
+void PageTable::__rehash(size_t capacity) {
+  int8_t *old_ctrl = ctrl;
+  Entry *old_entries = entries;
+  size_t old_capacity = this->capacity;
+
+  __init(capacity);
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old_ctrl[i] >= 0) {
+      const Entry &e = old_entries[i];
+      uint64_t h = hash(e.table_id, e.page_number);
+      size_t slot = __findInsertSlot(h);
+      __setCtrl(slot, static_cast<int8_t>(h & 0x7F));
+      entries[slot] = e;
+      size += 1;
+    }
+  }
+  delete[] old_ctrl;
+  delete[] old_entries;
+}
+
+/**
+ * Set a control byte
+ *
+ * @note The first GROUP_WIDTH bytes are cloned after the
+ *       end, so a group can be loaded at any slot without
+ *       wrapping around.
+ */
+void PageTable::__setCtrl(size_t i, int8_t h2) {
+  ctrl[i] = h2;
+  if (i < GROUP_WIDTH) {
+    ctrl[capacity + i] = h2;
+  }
+}
+
+/**
+ * Find the slot of a page
+ *
+ * @return slot | SLOT_INVALID
+ * @note   Groups are probed triangularly, which visits
+ *         every group since capacity is a power of two.
+ *         An EMPTY byte in a group ends the probe.
+ */
+size_t PageTable::__findSlot(uint64_t hash, int table_id,
+                             pagenum_t page_number) const {
+  if (unlikely(capacity == 0)) return SLOT_INVALID;
+  size_t mask = capacity - 1;
+  size_t pos = (hash >> 7) & mask;
+  int8_t h2 = static_cast<int8_t>(hash & 0x7F);
+
+  for (size_t index = 0; index <= capacity; index += GROUP_WIDTH) {
+    const int8_t *group = ctrl + pos;
+    uint32_t match = __matchByte(group, h2);
+    while (match != 0) {
+      size_t slot = (pos + __builtin_ctz(match)) & mask;
+      const Entry &e = entries[slot];
+      if (likely(e.page_number == page_number && e.table_id == table_id)) {
+        return slot;
+      }
+      match &= match - 1;
+    }
+    if (likely(__matchByte(group, CTRL_EMPTY) != 0)) {
+      return SLOT_INVALID;
+    }
+    pos = (pos + index + GROUP_WIDTH) & mask;
+  }
+  return SLOT_INVALID;
+}
+
+/**
+ * Find the first EMPTY or DELETED slot of the probe sequence
+ */
+size_t PageTable::__findInsertSlot(uint64_t hash) const {
+  size_t mask = capacity - 1;
+  size_t pos = (hash >> 7) & mask;
+
+  for (size_t index = 0;; index += GROUP_WIDTH) {
+    uint32_t match = __matchFree(ctrl + pos);
+    if (likely(match != 0)) {
+      return (pos + __builtin_ctz(match)) & mask;
+    }
+    pos = (pos + index + GROUP_WIDTH) & mask;
+  }
+}
+
+/**
+ * Find the frame of a page
+ *
+ * @return frame | FRAME_INVALID
+ */
+frameid_t PageTable::find(int table_id, pagenum_t page_number) const {
+  size_t slot = __findSlot(hash(table_id, page_number), table_id, page_number);
+  return slot != SLOT_INVALID ? entries[slot].frame : FRAME_INVALID;
+}
+
+/**
+ * Map a page to a frame
+ *
+ * @return false if the page is already mapped
+ */
+bool PageTable::insert(int table_id, pagenum_t page_number, frameid_t frame) {
+  uint64_t h = hash(table_id, page_number);
+  if (__findSlot(h, table_id, page_number) != SLOT_INVALID) {
+    return false;
+  }
+  if (unlikely((size + tombstones + 1) * 8 > capacity * 7)) {
+    /* Grow, or just drop tombstones if they fill it up */
+    size_t new_capacity = capacity < GROUP_WIDTH ? GROUP_WIDTH : capacity;
+    if ((size + 1) * 16 > new_capacity * 7) new_capacity *= 2;
+    __rehash(new_capacity);
+  }
+
+  size_t slot = __findInsertSlot(h);
+  if (ctrl[slot] == CTRL_DELETED) tombstones -= 1;
+  __setCtrl(slot, static_cast<int8_t>(h & 0x7F));
+  entries[slot] = {page_number, table_id, frame};
+  size += 1;
+  return true;
+}
+
+/**
+ * Unmap a page
+ *
+ * @return false if the page is not mapped
+ */
+bool PageTable::erase(int table_id, pagenum_t page_number) {
+  size_t slot = __findSlot(hash(table_id, page_number), table_id, page_number);
+  if (slot == SLOT_INVALID) {
+    return false;
+  }
+  __setCtrl(slot, CTRL_DELETED);
+  size -= 1;
+  tombstones += 1;
+  return true;
+}
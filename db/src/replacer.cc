@@ -0,0 +1,384 @@
+#include "replacer.h"
+#include <cassert>
+#include "optimize.h"
+
+/**
+ * Create a replacement policy
+ *
+ * @param type     REPLACER_LRU | REPLACER_CLOCK | REPLACER_2Q
+ * @param capacity number of frames
+ * @return replacement policy | nullptr
+ */
+Replacer *Replacer::create(int type, frameid_t capacity) {
+  switch (type) {
+    case REPLACER_LRU:
+      return new LRUReplacer(capacity);
+    case REPLACER_CLOCK:
+      return new ClockReplacer(capacity);
+    case REPLACER_2Q:
+      return new TwoQReplacer(capacity);
+    default:
+      return nullptr;
+  }
+}
+
+/*
+ * LRU
+ */
+
+LRUReplacer::LRUReplacer(frameid_t capacity)
+    : prev(capacity, FRAME_INVALID),
+      next(capacity, FRAME_INVALID),
+      linked(capacity, false),
+      head(FRAME_INVALID),
+      tail(FRAME_INVALID) {}
+
+/**
+ * Link a frame to the LRU list
+ *
+ * @param frame Frame to link
+ * @param cold  Link it to the tail instead of the head
+ * @note  Head means that the frame is most-recently used.
+ *        Tail means that it is least-recently used.
+ */
+void LRUReplacer::__link(frameid_t frame, bool cold) {
+  if (unlikely(head == FRAME_INVALID)) {
+    prev[frame] = next[frame] = FRAME_INVALID;
+    head = tail = frame;
+  } else if (cold) {
+    prev[frame] = tail;
+    next[frame] = FRAME_INVALID;
+    next[tail] = frame;
+    tail = frame;
+  } else {
+    prev[frame] = FRAME_INVALID;
+    next[frame] = head;
+    prev[head] = frame;
+    head = frame;
+  }
+  linked[frame] = true;
+}
+
+void LRUReplacer::__unlink(frameid_t frame) {
+  frameid_t p = prev[frame];
+  frameid_t n = next[frame];
+  if (p == FRAME_INVALID) {
+    head = n;
+  } else {
+    next[p] = n;
+  }
+  if (n == FRAME_INVALID) {
+    tail = p;
+  } else {
+    prev[n] = p;
+  }
+  prev[frame] = next[frame] = FRAME_INVALID;
+  linked[frame] = false;
+}
+
+void LRUReplacer::admit(frameid_t frame, uint64_t tag, bool cold) {
+  std::lock_guard<std::mutex> lock(latch);
+  if (linked[frame]) __unlink(frame);
+  __link(frame, cold);
+}
+
+void LRUReplacer::access(frameid_t frame) {
+  std::lock_guard<std::mutex> lock(latch);
+  if (unlikely(!linked[frame]) || frame == head) return;
+  __unlink(frame);
+  __link(frame, false);
+}
+
+/**
+ * Get the victim from the tail of the LRU list
+ *
+ * @param claim Callback to claim a frame
+ * @return Claimed frame | FRAME_INVALID
+ */
+frameid_t LRUReplacer::victim(const Claim &claim) {
+  std::lock_guard<std::mutex> lock(latch);
+  for (frameid_t frame = tail; frame != FRAME_INVALID; frame = prev[frame]) {
+    if (claim(frame)) {
+      __unlink(frame);
+      return frame;
+    }
+  }
+  return FRAME_INVALID;
+}
+
+/**
+ * Visit upcoming victims from the tail of the LRU list
+ *
+ * @param n     maximum number of frames to visit
+ * @param visit Callback returning false to stop
+ */
+void LRUReplacer::peek(frameid_t n, const Visit &visit) {
+  std::lock_guard<std::mutex> lock(latch);
+  for (frameid_t frame = tail; frame != FRAME_INVALID && n > 0;
+       frame = prev[frame], n--) {
+    if (!visit(frame)) return;
+  }
+}
+
+/**
+ * Forget a frame
+ *
+ * @note The frame must not be claimable, e.g. pinned.
+ */
+void LRUReplacer::remove(frameid_t frame) {
+  std::lock_guard<std::mutex> lock(latch);
+  if (linked[frame]) __unlink(frame);
+}
+
+/*
+ * CLOCK
+ */
+
+ClockReplacer::ClockReplacer(frameid_t capacity)
+    : present(capacity, false), hand(0), capacity(capacity) {
+  referenced = new std::atomic<uint8_t>[capacity];
+  for (frameid_t i = 0; i < capacity; i++) {
+    referenced[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+ClockReplacer::~ClockReplacer() { delete[] referenced; }
+
+void ClockReplacer::admit(frameid_t frame, uint64_t tag, bool cold) {
+  std::lock_guard<std::mutex> lock(latch);
+  referenced[frame].store(cold ? 0 : 1, std::memory_order_relaxed);
+  present[frame] = true;
+}
+
+/**
+ * Set the reference bit of a frame
+ *
+ * @note It reads the bit first, so that hot frames
+ *       don't bounce their cache line between cores.
+ */
+void ClockReplacer::access(frameid_t frame) {
+  if (referenced[frame].load(std::memory_order_relaxed) == 0) {
+    referenced[frame].store(1, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * Get the victim under the clock hand
+ *
+ * @param claim Callback to claim a frame
+ * @return Claimed frame | FRAME_INVALID
+ * @note   A referenced frame gets a second chance: its
+ *         bit is cleared and the hand moves on. After two
+ *         sweeps without a claim, every frame is pinned.
+ */
+frameid_t ClockReplacer::victim(const Claim &claim) {
+  std::lock_guard<std::mutex> lock(latch);
+  for (uint64_t i = 0; i < 2 * static_cast<uint64_t>(capacity); i++) {
+    frameid_t frame = hand;
+    hand = (hand + 1 == capacity) ? 0 : hand + 1;
+    if (!present[frame]) continue;
+    if (referenced[frame].load(std::memory_order_relaxed) != 0) {
+      referenced[frame].store(0, std::memory_order_relaxed);
+      continue;
+    }
+    if (claim(frame)) {
+      present[frame] = false;
+      return frame;
+    }
+  }
+  return FRAME_INVALID;
+}
+
+/**
+ * Visit upcoming victims from the clock hand
+ *
+ * @param n     maximum number of frames to visit
+ * @param visit Callback returning false to stop
+ * @note  Only unreferenced frames are visited, since the
+ *        referenced ones get a second chance. The hand
+ *        and the bits are left untouched.
+ */
+void ClockReplacer::peek(frameid_t n, const Visit &visit) {
+  std::lock_guard<std::mutex> lock(latch);
+  frameid_t frame = hand;
+  for (frameid_t i = 0; i < capacity && n > 0; i++) {
+    if (present[frame] &&
+        referenced[frame].load(std::memory_order_relaxed) == 0) {
+      if (!visit(frame)) return;
+      n--;
+    }
+    frame = (frame + 1 == capacity) ? 0 : frame + 1;
+  }
+}
+
+void ClockReplacer::remove(frameid_t frame) {
+  std::lock_guard<std::mutex> lock(latch);
+  present[frame] = false;
+}
+
+/*
+ * 2Q
+ */
+
+TwoQReplacer::TwoQReplacer(frameid_t capacity)
+    : prev(capacity, FRAME_INVALID),
+      next(capacity, FRAME_INVALID),
+      queue(capacity, QUEUE_NONE),
+      tags(capacity, 0),
+      heads{FRAME_INVALID, FRAME_INVALID, FRAME_INVALID},
+      tails{FRAME_INVALID, FRAME_INVALID, FRAME_INVALID},
+      sizes{0, 0, 0},
+      kin(capacity / 4 > 0 ? capacity / 4 : 1),
+      kout(capacity / 2 > 0 ? capacity / 2 : 1) {}
+
+/**
+ * Link a frame to a queue
+ *
+ * @param q     QUEUE_A1IN | QUEUE_AM
+ * @param frame Frame to link
+ * @param cold  Link it to the eviction end
+ */
+void TwoQReplacer::__link(int q, frameid_t frame, bool cold) {
+  if (heads[q] == FRAME_INVALID) {
+    prev[frame] = next[frame] = FRAME_INVALID;
+    heads[q] = tails[q] = frame;
+  } else if (cold) {
+    prev[frame] = tails[q];
+    next[frame] = FRAME_INVALID;
+    next[tails[q]] = frame;
+    tails[q] = frame;
+  } else {
+    prev[frame] = FRAME_INVALID;
+    next[frame] = heads[q];
+    prev[heads[q]] = frame;
+    heads[q] = frame;
+  }
+  queue[frame] = q;
+  sizes[q] += 1;
+}
+
+void TwoQReplacer::__unlink(frameid_t frame) {
+  int q = queue[frame];
+  frameid_t p = prev[frame];
+  frameid_t n = next[frame];
+  if (p == FRAME_INVALID) {
+    heads[q] = n;
+  } else {
+    next[p] = n;
+  }
+  if (n == FRAME_INVALID) {
+    tails[q] = p;
+  } else {
+    prev[n] = p;
+  }
+  prev[frame] = next[frame] = FRAME_INVALID;
+  queue[frame] = QUEUE_NONE;
+  sizes[q] -= 1;
+}
+
+/**
+ * Remember the tag of a page evicted from A1in
+ */
+void TwoQReplacer::__remember(uint64_t tag) {
+  a1out.push_back(tag);
+  a1out_counts[tag] += 1;
+  if (a1out.size() > kout) {
+    uint64_t oldest = a1out.front();
+    a1out.pop_front();
+    auto it = a1out_counts.find(oldest);
+    if (it != a1out_counts.end() && --it->second == 0) {
+      a1out_counts.erase(it);
+    }
+  }
+}
+
+/**
+ * Check whether a tag is remembered in A1out
+ *
+ * @note The entry itself stays in the FIFO and expires
+ *       with it, but it won't match again.
+ */
+bool TwoQReplacer::__forget(uint64_t tag) {
+  auto it = a1out_counts.find(tag);
+  if (it == a1out_counts.end()) return false;
+  if (--it->second == 0) a1out_counts.erase(it);
+  return true;
+}
+
+void TwoQReplacer::admit(frameid_t frame, uint64_t tag, bool cold) {
+  std::lock_guard<std::mutex> lock(latch);
+  if (queue[frame] != QUEUE_NONE) __unlink(frame);
+  tags[frame] = tag;
+  if (__forget(tag) && !cold) {
+    __link(QUEUE_AM, frame, false);
+  } else {
+    __link(QUEUE_A1IN, frame, cold);
+  }
+}
+
+void TwoQReplacer::access(frameid_t frame) {
+  std::lock_guard<std::mutex> lock(latch);
+  if (queue[frame] != QUEUE_AM || frame == heads[QUEUE_AM]) return;
+  __unlink(frame);
+  __link(QUEUE_AM, frame, false);
+}
+
+frameid_t TwoQReplacer::__victimFrom(int q, const Claim &claim) {
+  for (frameid_t frame = tails[q]; frame != FRAME_INVALID;
+       frame = prev[frame]) {
+    if (claim(frame)) {
+      __unlink(frame);
+      if (q == QUEUE_A1IN) __remember(tags[frame]);
+      return frame;
+    }
+  }
+  return FRAME_INVALID;
+}
+
+/**
+ * Get the victim
+ *
+ * @param claim Callback to claim a frame
+ * @return Claimed frame | FRAME_INVALID
+ * @note   A1in is reclaimed first once it outgrows Kin,
+ *         otherwise Am. The other queue is the fallback.
+ */
+frameid_t TwoQReplacer::victim(const Claim &claim) {
+  std::lock_guard<std::mutex> lock(latch);
+  int first = sizes[QUEUE_A1IN] > kin ? QUEUE_A1IN : QUEUE_AM;
+  int second = first == QUEUE_A1IN ? QUEUE_AM : QUEUE_A1IN;
+  frameid_t frame = __victimFrom(first, claim);
+  if (frame == FRAME_INVALID) {
+    frame = __victimFrom(second, claim);
+  }
+  return frame;
+}
+
+frameid_t TwoQReplacer::__peekFrom(int q, frameid_t n, const Visit &visit) {
+  for (frameid_t frame = tails[q]; frame != FRAME_INVALID && n > 0;
+       frame = prev[frame], n--) {
+    if (!visit(frame)) return 0;
+  }
+  return n;
+}
+
+/**
+ * Visit upcoming victims in the order victim() takes them
+ *
+ * @param n     maximum number of frames to visit
+ * @param visit Callback returning false to stop
+ */
+void TwoQReplacer::peek(frameid_t n, const Visit &visit) {
+  std::lock_guard<std::mutex> lock(latch);
+  int first = sizes[QUEUE_A1IN] > kin ? QUEUE_A1IN : QUEUE_AM;
+  int second = first == QUEUE_A1IN ? QUEUE_AM : QUEUE_A1IN;
+  n = __peekFrom(first, n, visit);
+  if (n > 0) {
+    __peekFrom(second, n, visit);
+  }
+}
+
+void TwoQReplacer::remove(frameid_t frame) {
+  std::lock_guard<std::mutex> lock(latch);
+  if (queue[frame] != QUEUE_NONE) __unlink(frame);
+}
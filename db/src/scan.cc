@@ -0,0 +1,381 @@
+#include "scan.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "optimize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+using ReadPageGuard = BufferManager::ReadPageGuard;
+
+static inline size_t __width(int type) {
+  return type == SCAN_INT64 ? sizeof(int64_t) : sizeof(int32_t);
+}
+
+/**
+ * Range filter without SIMD
+ *
+ * @note It is also the tail of the other kernels, so the
+ *       bitmap must start at the first row of a word.
+ */
+template <typename T>
+static void __filterScalar(const T *values, size_t n, T low, T high,
+                           uint64_t *bits) {
+  for (size_t i = 0; i < n; i += 64) {
+    size_t m = std::min<size_t>(64, n - i);
+    uint64_t word = 0;
+    for (size_t j = 0; j < m; j++) {
+      T v = values[i + j];
+      word |= static_cast<uint64_t>(v >= low && v <= high) << j;
+    }
+    bits[i / 64] &= word;
+  }
+}
+
+#ifdef SCAN_X86
+/*
+ * The SIMD kernels test !(low > v || v > high) on a vector
+ * at a time, and gather the sign bits of the lanes into the
+ * bitmap with a movemask.
+ */
+__attribute__((target("avx2"))) static void __filterInt32Avx2(
+    const int32_t *values, size_t n, int32_t low, int32_t high,
+    uint64_t *bits) {
+  const __m256i lo = _mm256_set1_epi32(low);
+  const __m256i hi = _mm256_set1_epi32(high);
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    uint64_t word = 0;
+    for (int j = 0; j < 8; j++) {
+      __m256i v = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(values + i + 8 * j));
+      __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(lo, v),
+                                    _mm256_cmpgt_epi32(v, hi));
+      uint64_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(out));
+      word |= (~mask & 0xff) << (8 * j);
+    }
+    bits[i / 64] &= word;
+  }
+  __filterScalar(values + i, n - i, low, high, bits + i / 64);
+}
+
+__attribute__((target("avx2"))) static void __filterInt64Avx2(
+    const int64_t *values, size_t n, int64_t low, int64_t high,
+    uint64_t *bits) {
+  const __m256i lo = _mm256_set1_epi64x(low);
+  const __m256i hi = _mm256_set1_epi64x(high);
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    uint64_t word = 0;
+    for (int j = 0; j < 16; j++) {
+      __m256i v = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(values + i + 4 * j));
+      __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(lo, v),
+                                    _mm256_cmpgt_epi64(v, hi));
+      uint64_t mask = _mm256_movemask_pd(_mm256_castsi256_pd(out));
+      word |= (~mask & 0xf) << (4 * j);
+    }
+    bits[i / 64] &= word;
+  }
+  __filterScalar(values + i, n - i, low, high, bits + i / 64);
+}
+
+__attribute__((target("sse4.2"))) static void __filterInt32Sse(
+    const int32_t *values, size_t n, int32_t low, int32_t high,
+    uint64_t *bits) {
+  const __m128i lo = _mm_set1_epi32(low);
+  const __m128i hi = _mm_set1_epi32(high);
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    uint64_t word = 0;
+    for (int j = 0; j < 16; j++) {
+      __m128i v = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(values + i + 4 * j));
+      __m128i out =
+          _mm_or_si128(_mm_cmpgt_epi32(lo, v), _mm_cmpgt_epi32(v, hi));
+      uint64_t mask = _mm_movemask_ps(_mm_castsi128_ps(out));
+      word |= (~mask & 0xf) << (4 * j);
+    }
+    bits[i / 64] &= word;
+  }
+  __filterScalar(values + i, n - i, low, high, bits + i / 64);
+}
+
+__attribute__((target("sse4.2"))) static void __filterInt64Sse(
+    const int64_t *values, size_t n, int64_t low, int64_t high,
+    uint64_t *bits) {
+  const __m128i lo = _mm_set1_epi64x(low);
+  const __m128i hi = _mm_set1_epi64x(high);
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    uint64_t word = 0;
+    for (int j = 0; j < 32; j++) {
+      __m128i v = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(values + i + 2 * j));
+      __m128i out =
+          _mm_or_si128(_mm_cmpgt_epi64(lo, v), _mm_cmpgt_epi64(v, hi));
+      uint64_t mask = _mm_movemask_pd(_mm_castsi128_pd(out));
+      word |= (~mask & 0x3) << (2 * j);
+    }
+    bits[i / 64] &= word;
+  }
+  __filterScalar(values + i, n - i, low, high, bits + i / 64);
+}
+#endif
+
+/**
+ * Best instruction set the CPU supports
+ *
+ * @return SIMD_SCALAR | SIMD_SSE | SIMD_AVX2
+ * @note   SIMD_SSE needs SSE4.2 for 64-bit comparisons.
+ */
+int ScanKernel::detect() {
+#ifdef SCAN_X86
+  static const int simd = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return SIMD_SSE;
+    return SIMD_SCALAR;
+  }();
+  return simd;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+/**
+ * Clear the rows whose value is out of a range
+ *
+ * @param simd   SIMD_SCALAR | SIMD_SSE | SIMD_AVX2, which
+ *               the CPU must support
+ * @param type   SCAN_INT32 | SCAN_INT64
+ * @param values values of a column
+ * @param n      number of values
+ * @param low    lowest value kept
+ * @param high   highest value kept
+ * @param bits   [in,out] bitmap of the rows kept, whose bits
+ *               past n are cleared
+ */
+void ScanKernel::filter(int simd, int type, const char *values, size_t n,
+                        int64_t low, int64_t high, uint64_t *bits) {
+  if (type == SCAN_INT32) {
+    low = std::max<int64_t>(low, INT32_MIN);
+    high = std::min<int64_t>(high, INT32_MAX);
+  }
+  if (low > high) {
+    memset(bits, 0, (n + 63) / 64 * sizeof(uint64_t));
+    return;
+  }
+
+  if (type == SCAN_INT32) {
+    const int32_t *v = reinterpret_cast<const int32_t *>(values);
+#ifdef SCAN_X86
+    if (simd == SIMD_AVX2) return __filterInt32Avx2(v, n, low, high, bits);
+    if (simd == SIMD_SSE) return __filterInt32Sse(v, n, low, high, bits);
+#endif
+    return __filterScalar<int32_t>(v, n, low, high, bits);
+  }
+  const int64_t *v = reinterpret_cast<const int64_t *>(values);
+#ifdef SCAN_X86
+  if (simd == SIMD_AVX2) return __filterInt64Avx2(v, n, low, high, bits);
+  if (simd == SIMD_SSE) return __filterInt64Sse(v, n, low, high, bits);
+#endif
+  return __filterScalar<int64_t>(v, n, low, high, bits);
+}
+
+/**
+ * Start a scan of the heap file of a table
+ *
+ * @param bmgr       buffer manager the table is open in
+ * @param table_id   table id
+ * @param columns    fields to read from the records
+ * @param predicates conditions a row must meet, on indexes
+ *                   into columns
+ * @param simd       instruction set of the filters, or
+ *                   SIMD_AUTO for the best one. It is lowered
+ *                   to what the CPU supports.
+ */
+HeapScan::HeapScan(BufferManager *bmgr, int table_id,
+                   const std::vector<ScanColumn>    &columns,
+                   const std::vector<ScanPredicate> &predicates, int simd)
+    : bmgr(bmgr),
+      table_id(table_id),
+      columns(columns),
+      predicates(predicates),
+      simd(simd == SIMD_AUTO ? ScanKernel::detect()
+                             : std::min(simd, ScanKernel::detect())),
+      min_length(0),
+      next_page_number(PN_INVALID),
+      started(false) {
+  assert(bmgr != nullptr);
+  for (const ScanColumn &column : columns) {
+    min_length = std::max<uint32_t>(min_length,
+                                    column.offset + __width(column.type));
+  }
+  for (const ScanPredicate &predicate : predicates) {
+    assert(predicate.column < columns.size());
+  }
+}
+
+/**
+ * Copy the fields of a record into the next row of a batch
+ */
+void HeapScan::__gather(const SlottedPage *page, uint32_t slot,
+                        const RecordId &rid, ColumnBatch *batch) {
+  if (page->slots[slot].length < min_length) {
+    return;
+  }
+  const char *record = page->getRecord(slot);
+  size_t row = batch->size++;
+  batch->rids[row] = rid;
+  for (size_t c = 0; c < columns.size(); c++) {
+    char *dest = batch->columns[c].data();
+    const char *src = record + columns[c].offset;
+    if (columns[c].type == SCAN_INT64) {
+      memcpy(dest + row * sizeof(int64_t), src, sizeof(int64_t));
+    } else {
+      memcpy(dest + row * sizeof(int32_t), src, sizeof(int32_t));
+    }
+  }
+}
+
+/**
+ * Copy the records of a page into a batch
+ *
+ * @return HEAP_SUCCESS | HEAP_NOFRAME
+ * @note   The page is latched while it is copied, and so is
+ *         the page of a forwarded record while it is read.
+ */
+int HeapScan::__gatherPage(pagenum_t page_number, ColumnBatch *batch) {
+  ReadPageGuard guard =
+      bmgr->fetchPageRead(table_id, page_number, ACCESS_SEQUENTIAL);
+  if (unlikely(!guard.isValid())) {
+    return HEAP_NOFRAME;
+  }
+  const SlottedPage *page = guard->getSlottedPage();
+  uint32_t nslots = std::min(page->number_of_slots, SlottedPage::MAX_SLOTS);
+  size_t capacity = batch->size + nslots;
+  if (batch->rids.size() < capacity) {
+    batch->rids.resize(std::max(capacity, 2 * batch->rids.size()));
+  }
+  /*
+   * A batch may come from a scan of other columns, so each
+   * column is sized on its own.
+   */
+  capacity = batch->rids.size();
+  for (size_t c = 0; c < columns.size(); c++) {
+    size_t size = capacity * __width(columns[c].type);
+    if (batch->columns[c].size() < size) {
+      batch->columns[c].resize(size);
+    }
+  }
+
+  for (uint32_t i = 0; i < nslots; i++) {
+    const SlottedPage::Slot &slot = page->slots[i];
+    if (slot.offset == 0 || (slot.flags & SlottedPage::SLOT_MOVED)) {
+      continue;
+    }
+    if (likely(!(slot.flags & SlottedPage::SLOT_FORWARD))) {
+      __gather(page, i, {page_number, i}, batch);
+      continue;
+    }
+
+    RecordId forward;
+    memcpy(&forward, page->getRecord(i), sizeof(forward));
+    ReadPageGuard fguard = bmgr->fetchPageRead(table_id, forward.page_number);
+    if (unlikely(!fguard.isValid())) {
+      return HEAP_NOFRAME;
+    }
+    const SlottedPage *fpage = fguard->getSlottedPage();
+    if (forward.slot < std::min(fpage->number_of_slots,
+                                SlottedPage::MAX_SLOTS) &&
+        fpage->slots[forward.slot].offset != 0) {
+      __gather(fpage, forward.slot, {page_number, i}, batch);
+    }
+  }
+  next_page_number = page->next_page_number;
+  return HEAP_SUCCESS;
+}
+
+/**
+ * Keep the rows of a batch that meet the predicates
+ *
+ * @return number of rows kept
+ * @note   Each predicate clears the rows out of its range in
+ *         a bitmap, and the rows left are moved to the front.
+ */
+size_t HeapScan::__filter(ColumnBatch *batch) {
+  size_t n = batch->size;
+  if (predicates.empty() || n == 0) {
+    return n;
+  }
+  bits.assign((n + 63) / 64, ~0ULL);
+  for (const ScanPredicate &predicate : predicates) {
+    int64_t low = predicate.value;
+    int64_t high = predicate.value;
+    if (predicate.op == PRED_LT) {
+      low = predicate.value == INT64_MIN ? 1 : INT64_MIN;
+      high = predicate.value == INT64_MIN ? 0 : predicate.value - 1;
+    } else if (predicate.op == PRED_BETWEEN) {
+      high = predicate.high;
+    }
+    ScanKernel::filter(simd, columns[predicate.column].type,
+                       batch->columns[predicate.column].data(), n, low, high,
+                       bits.data());
+  }
+
+  size_t k = 0;
+  for (size_t w = 0; w < bits.size(); w++) {
+    for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+      size_t i = w * 64 + __builtin_ctzll(word);
+      if (i != k) {
+        batch->rids[k] = batch->rids[i];
+        for (size_t c = 0; c < columns.size(); c++) {
+          size_t width = __width(columns[c].type);
+          char *data = batch->columns[c].data();
+          memcpy(data + k * width, data + i * width, width);
+        }
+      }
+      k += 1;
+    }
+  }
+  batch->size = k;
+  return k;
+}
+
+/**
+ * Read the next batch of rows
+ *
+ * @param  batch [out] rows that meet the predicates
+ * @return HEAP_SUCCESS | HEAP_NOTFOUND at the end of the
+ *         heap file | HEAP_NOFRAME
+ * @note   Whole pages are gathered until the batch holds at
+ *         least SCAN_BATCH_SIZE records, which are filtered
+ *         together. A batch is never empty.
+ */
+int HeapScan::next(ColumnBatch *batch) {
+  batch->size = 0;
+  batch->columns.resize(columns.size());
+  if (!started) {
+    ReadPageGuard hguard = bmgr->fetchPageRead(table_id, PN_HEADER);
+    if (unlikely(!hguard.isValid())) {
+      return HEAP_NOFRAME;
+    }
+    next_page_number = hguard->getHeaderPage()->heap_first_page_number;
+    started = true;
+  }
+
+  while (next_page_number != PN_INVALID) {
+    int ret = __gatherPage(next_page_number, batch);
+    if (unlikely(ret != HEAP_SUCCESS)) {
+      return ret;
+    }
+    if (batch->size >= SCAN_BATCH_SIZE && __filter(batch) > 0) {
+      return HEAP_SUCCESS;
+    }
+  }
+  return __filter(batch) > 0 ? HEAP_SUCCESS : HEAP_NOTFOUND;
+}
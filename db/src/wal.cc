@@ -0,0 +1,247 @@
+#include "wal.h"
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "optimize.h"
+
+/**
+ * Checksum of a page image
+ */
+uint64_t LogManager::__checksum(const char *data) {
+  uint64_t h = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < PAGE_SIZE; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    h = (h ^ word) * 0x100000001B3ULL;
+    h ^= h >> 32;
+  }
+  return h;
+}
+
+/**
+ * Bind the checksum of an image to its record
+ */
+uint64_t LogManager::__seal(uint64_t checksum, lsn_t lsn,
+                            pagenum_t page_number) {
+  uint64_t h = checksum ^ (lsn * 0x9E3779B97F4A7C15ULL);
+  h ^= page_number * 0xBF58476D1CE4E5B9ULL;
+  return h ^ (h >> 31);
+}
+
+/**
+ * Replay a log onto its database file
+ *
+ * @param path           path of the log
+ * @param data_fd        file descriptor of the database file
+ * @param checkpoint_lsn LSN of the last checkpoint
+ * @return LSN after the last valid record | LSN_INVALID
+ *         if there is no log
+ * @note   Replay starts at the checkpoint and stops at the
+ *         first torn or corrupted record. The replayed
+ *         pages are made durable.
+ */
+lsn_t LogManager::recover(const std::string &path, int data_fd,
+                          lsn_t checkpoint_lsn) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return LSN_INVALID;
+
+  LogFileHeader header;
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic_number != MAGIC_NUMBER) {
+    close(fd);
+    return LSN_INVALID;
+  }
+
+  lsn_t lsn = std::max(header.base_lsn, checkpoint_lsn);
+  off_t offset = sizeof(LogFileHeader) + (lsn - header.base_lsn);
+  uint64_t nreplayed = 0;
+  Page pg;
+  for (;;) {
+    LogRecord record;
+    if (pread(fd, &record, sizeof(record), offset) != sizeof(record) ||
+        pread(fd, pg.data, PAGE_SIZE, offset + sizeof(record)) != PAGE_SIZE) {
+      break;
+    }
+    if (record.lsn != lsn + RECORD_SIZE ||
+        record.checksum !=
+            __seal(__checksum(pg.data), record.lsn, record.page_number)) {
+      break;
+    }
+    pwrite(data_fd, pg.data, PAGE_SIZE, record.page_number * PAGE_SIZE);
+    lsn = record.lsn;
+    offset += RECORD_SIZE;
+    nreplayed += 1;
+  }
+  if (nreplayed > 0) {
+    fdatasync(data_fd);
+  }
+  close(fd);
+  return lsn;
+}
+
+/**
+ * Create an empty log
+ *
+ * @param path     path of the log
+ * @param base_lsn LSN the log starts at
+ */
+LogManager::LogManager(const std::string &path, lsn_t base_lsn)
+    : flushing(false), failed(false) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  buffer.reserve(WAL_BUFFER_SIZE);
+  __reset(base_lsn);
+}
+
+LogManager::~LogManager() {
+  {
+    std::unique_lock<std::mutex> lock(latch);
+    __flush(lock, LSN_MAX);
+  }
+  if (fd >= 0) close(fd);
+}
+
+/**
+ * Empty the log and start it over at an LSN
+ */
+void LogManager::__reset(lsn_t base_lsn) {
+  this->base_lsn = base_lsn;
+  buffered_lsn = next_lsn = flushed_lsn = truncated_lsn = base_lsn;
+  buffer.clear();
+  if (unlikely(fd < 0)) return;
+
+  LogFileHeader header;
+  header.magic_number = MAGIC_NUMBER;
+  header.base_lsn = base_lsn;
+  if (ftruncate(fd, 0) < 0 ||
+      pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      fdatasync(fd) < 0) {
+    failed = true;
+  }
+}
+
+/**
+ * Append a full page image
+ *
+ * @param page_number page number
+ * @param page        page image
+ * @return LSN of the record | LSN_INVALID if the log failed
+ * @note   It doesn't wait for the device unless the log
+ *         buffer is full.
+ */
+lsn_t LogManager::append(pagenum_t page_number, const Page *page) {
+  uint64_t checksum = __checksum(page->data);
+
+  std::unique_lock<std::mutex> lock(latch);
+  while (buffer.size() + RECORD_SIZE > WAL_BUFFER_SIZE && !buffer.empty()) {
+    if (!__flush(lock, next_lsn)) break;
+  }
+  if (unlikely(failed)) {
+    return LSN_INVALID;
+  }
+
+  LogRecord record;
+  record.lsn = next_lsn + RECORD_SIZE;
+  record.page_number = page_number;
+  record.checksum = __seal(checksum, record.lsn, page_number);
+  const char *head = reinterpret_cast<const char *>(&record);
+  buffer.insert(buffer.end(), head, head + sizeof(record));
+  buffer.insert(buffer.end(), page->data, page->data + PAGE_SIZE);
+  next_lsn = record.lsn;
+  return record.lsn;
+}
+
+/**
+ * Write the log up to an LSN and make it durable
+ *
+ * @param lsn LSN to make durable, or LSN_MAX for all
+ * @return false if the log failed
+ */
+bool LogManager::flush(lsn_t lsn) {
+  std::unique_lock<std::mutex> lock(latch);
+  return __flush(lock, lsn);
+}
+
+/**
+ * Group commit
+ *
+ * @return false if the log failed
+ * @note   The first caller takes the whole buffer, writes
+ *         it with one pwrite and syncs it without the
+ *         latch. Callers behind it wait, and the next leader
+ *         takes everything appended in the meantime.
+ *         flushed_lsn only moves once the whole buffer is
+ *         written and synced.
+ */
+bool LogManager::__flush(std::unique_lock<std::mutex> &lock, lsn_t lsn) {
+  if (lsn > next_lsn) lsn = next_lsn;
+  while (!failed && flushed_lsn < lsn) {
+    if (flushing) {
+      cv.wait(lock);
+      continue;
+    }
+    flushing = true;
+    std::vector<char> out;
+    out.reserve(WAL_BUFFER_SIZE);
+    out.swap(buffer);
+    lsn_t begin = buffered_lsn;
+    lsn_t end = next_lsn;
+    buffered_lsn = end;
+    lock.unlock();
+
+    off_t offset = sizeof(LogFileHeader) + (begin - base_lsn);
+    size_t written = 0;
+    while (written < out.size()) {
+      ssize_t ret = pwrite(fd, out.data() + written, out.size() - written,
+                           offset + written);
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret <= 0) break;
+      written += ret;
+    }
+    bool durable = written == out.size() && fdatasync(fd) == 0;
+
+    lock.lock();
+    if (likely(durable)) {
+      flushed_lsn = end;
+    } else {
+      failed = true;
+    }
+    flushing = false;
+    cv.notify_all();
+  }
+  return !failed;
+}
+
+/**
+ * Drop the records before a checkpoint
+ *
+ * @param lsn LSN of the checkpoint
+ * @note  Their space is given back to the file system by
+ *        punching a hole, so the offsets of the remaining
+ *        records don't move. Only durable records can be
+ *        dropped.
+ */
+void LogManager::truncate(lsn_t lsn) {
+  off_t begin, end;
+  {
+    std::lock_guard<std::mutex> lock(latch);
+    lsn = std::min(lsn, flushed_lsn);
+    if (lsn <= truncated_lsn) return;
+    begin = sizeof(LogFileHeader) + (truncated_lsn - base_lsn);
+    end = sizeof(LogFileHeader) + (lsn - base_lsn);
+    truncated_lsn = lsn;
+  }
+  fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, begin, end - begin);
+}
+
+lsn_t LogManager::getNextLsn() {
+  std::lock_guard<std::mutex> lock(latch);
+  return next_lsn;
+}
+
+lsn_t LogManager::getFlushedLsn() {
+  std::lock_guard<std::mutex> lock(latch);
+  return flushed_lsn;
+}
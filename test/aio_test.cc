@@ -0,0 +1,159 @@
+#include "aio.h"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "buffer.h"
+#include "file.h"
+#include "page.h"
+
+#define DBFILENAME "test.db"
+
+class AioTest : public testing::TestWithParam<bool> {
+ protected:
+  // You can define per-test set-up logic as usual.
+  void SetUp() override {
+    dmgr = new AsyncDiskManager(AIO_QUEUE_DEPTH, GetParam());
+    fd = dmgr->openDatabase(path);
+    ASSERT_TRUE(fd > 0);
+  }
+
+  // You can define per-test tear-down logic as usual.
+  void TearDown() override {
+    fd = -1;
+    delete dmgr;
+    remove(path);
+  }
+
+  // Some expensive resource shared by all tests.
+  static AsyncDiskManager *dmgr;
+  static const char       *path;
+  static int               fd;
+};
+
+AsyncDiskManager *AioTest::dmgr = nullptr;
+const char       *AioTest::path = "test.db";
+int               AioTest::fd   = -1;
+
+TEST_P(AioTest, batchReadWrite) {
+  const int npages = 1000;
+  std::vector<pagenum_t> pns;
+  for (int i = 0; i < npages; i++) {
+    pns.push_back(dmgr->allocPage(fd));
+  }
+
+  std::vector<Page> pages(npages);
+  std::vector<PageIO> ios;
+  for (int i = 0; i < npages; i++) {
+    snprintf(pages[i].data, PAGE_SIZE, "page %d", i);
+    ios.push_back({fd, pns[i], &pages[i]});
+  }
+  dmgr->writePages(ios.data(), ios.size());
+
+  std::vector<Page> copies(npages);
+  for (int i = 0; i < npages; i++) {
+    ios[i].page = &copies[i];
+  }
+  dmgr->readPages(ios.data(), ios.size());
+  for (int i = 0; i < npages; i++) {
+    ASSERT_STREQ(copies[i].data, pages[i].data);
+  }
+
+  /* Batches go to the same file as single page I/O */
+  Page pg;
+  dmgr->readPage(fd, pns[npages / 2], &pg);
+  ASSERT_STREQ(pg.data, pages[npages / 2].data);
+}
+
+TEST_P(AioTest, submitAndWait) {
+  const int nbatches = 8;
+  const int npages = 64;
+  std::vector<pagenum_t> pns;
+  for (int i = 0; i < nbatches * npages; i++) {
+    pns.push_back(dmgr->allocPage(fd));
+  }
+
+  std::vector<Page> pages(nbatches * npages);
+  std::vector<PageIO> ios;
+  for (int i = 0; i < nbatches * npages; i++) {
+    memset(pages[i].data, 'a' + i % 26, PAGE_SIZE);
+    ios.push_back({fd, pns[i], &pages[i]});
+  }
+
+  std::vector<ioticket_t> tickets;
+  for (int i = 0; i < nbatches; i++) {
+    tickets.push_back(dmgr->submitWrites(&ios[i * npages], npages));
+  }
+  for (ioticket_t ticket : tickets) {
+    dmgr->wait(ticket);
+    ASSERT_TRUE(dmgr->poll(ticket));
+  }
+
+  std::vector<Page> copies(nbatches * npages);
+  for (int i = 0; i < nbatches * npages; i++) {
+    ios[i].page = &copies[i];
+  }
+  tickets.clear();
+  for (int i = 0; i < nbatches; i++) {
+    tickets.push_back(dmgr->submitReads(&ios[i * npages], npages));
+  }
+  for (ioticket_t ticket : tickets) {
+    dmgr->wait(ticket);
+  }
+  for (int i = 0; i < nbatches * npages; i++) {
+    ASSERT_EQ(memcmp(copies[i].data, pages[i].data, PAGE_SIZE), 0);
+  }
+
+  /* An empty batch is already complete */
+  ASSERT_TRUE(dmgr->poll(dmgr->submitReads(nullptr, 0)));
+}
+
+TEST_P(AioTest, shortTransfers) {
+  /* A page past the end of the file reads as zeros */
+  pagenum_t pn = dmgr->allocPage(fd);
+  off_t size = lseek(fd, 0, SEEK_END);
+  Page pg;
+  memset(pg.data, 'x', PAGE_SIZE);
+  PageIO io = {fd, static_cast<pagenum_t>(size / PAGE_SIZE + 10), &pg};
+  dmgr->readPages(&io, 1);
+  for (int i = 0; i < PAGE_SIZE; i++) {
+    ASSERT_EQ(pg.data[i], 0) << i;
+  }
+
+  /* Failed requests still complete their batch */
+  std::vector<Page> pages(8);
+  std::vector<PageIO> ios;
+  for (Page &page : pages) {
+    ios.push_back({-1, pn, &page});
+  }
+  dmgr->wait(dmgr->submitReads(ios.data(), ios.size()));
+  dmgr->wait(dmgr->submitWrites(ios.data(), ios.size()));
+}
+
+TEST_P(AioTest, bufferFlush) {
+  std::vector<pagenum_t> pns;
+  {
+    BufferManager bmgr(dmgr);
+    int table_id = bmgr.openDatabase(path);
+    ASSERT_TRUE(table_id > 0);
+    for (int i = 0; i < 100; i++) {
+      pagenum_t pn = bmgr.allocPage(table_id);
+      Page pg;
+      snprintf(pg.data, PAGE_SIZE, "page %d", i);
+      bmgr.writePage(table_id, pn, &pg);
+      pns.push_back(pn);
+    }
+  }
+
+  /* The buffer wrote its dirty frames back in one batch */
+  for (int i = 0; i < 100; i++) {
+    Page pg;
+    dmgr->readPage(fd, pns[i], &pg);
+    char expected[PAGE_SIZE];
+    snprintf(expected, PAGE_SIZE, "page %d", i);
+    ASSERT_STREQ(pg.data, expected);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, AioTest, testing::Values(true, false));
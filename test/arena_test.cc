@@ -0,0 +1,67 @@
+#include "arena.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "buffer.h"
+#include "file.h"
+#include "page.h"
+
+class ArenaTest : public testing::TestWithParam<int> {};
+
+TEST_P(ArenaTest, frames) {
+  const size_t nframes = 1000;
+  FrameArena arena(nframes, GetParam());
+  ASSERT_TRUE(arena.isValid());
+  ASSERT_EQ(arena.getFrameCount(), nframes);
+  if (!(GetParam() & ARENA_HUGE_PAGES)) {
+    ASSERT_EQ(arena.getBacking(), ARENA_BACKING_NORMAL);
+  }
+
+  /*
+   * The frames are contiguous and aligned for O_DIRECT
+   */
+  for (size_t i = 0; i < nframes; i++) {
+    Page *frame = arena.getFrame(i);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(frame) % PAGE_SIZE, 0);
+    ASSERT_EQ(frame, arena.getFrame(0) + i);
+    memset(frame->data, static_cast<int>(i % 251), PAGE_SIZE);
+  }
+  for (size_t i = 0; i < nframes; i++) {
+    Page *frame = arena.getFrame(i);
+    ASSERT_EQ(frame->data[0], static_cast<char>(i % 251));
+    ASSERT_EQ(frame->data[PAGE_SIZE - 1], static_cast<char>(i % 251));
+  }
+}
+
+TEST_P(ArenaTest, bufferManager) {
+  const char *path = "test.db";
+  remove(path);
+  PageManager *dmgr = new DiskManager();
+  PageManager *bmgr = new BufferManager(dmgr, REPLACER_CLOCK, 16, 64,
+                                        GetParam());
+  int table_id = bmgr->openDatabase(path);
+  ASSERT_TRUE(table_id > 0);
+
+  /*
+   * More pages than frames, so frames get reused
+   */
+  Page pg;
+  for (pagenum_t pn = 1; pn <= 100; pn++) {
+    std::string d = std::to_string(pn);
+    strncpy(pg.data, d.c_str(), d.size() + 1);
+    bmgr->writePage(table_id, pn, &pg);
+  }
+  for (pagenum_t pn = 1; pn <= 100; pn++) {
+    bmgr->readPage(table_id, pn, &pg);
+    ASSERT_EQ(std::stoul(std::string(pg.data)), pn);
+  }
+  delete bmgr;
+  delete dmgr;
+  remove(path);
+}
+
+INSTANTIATE_TEST_SUITE_P(Flags, ArenaTest,
+                         testing::Values(0, ARENA_HUGE_PAGES,
+                                         ARENA_HUGE_PAGES |
+                                             ARENA_NUMA_INTERLEAVE));
@@ -0,0 +1,447 @@
+#include "bpt.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+#include "buffer.h"
+#include "file.h"
+#include "fsm.h"
+#include "page.h"
+
+class BptTest : public testing::Test {
+ protected:
+  // You can define per-test set-up logic as usual.
+  void SetUp() override {
+    remove(path);
+    dmgr = new DiskManager();
+    bmgr = new BufferManager(dmgr);
+    table_id = bmgr->openDatabase(path);
+    ASSERT_TRUE(table_id > 0);
+    tree = new BPlusTree(bmgr, table_id);
+  }
+
+  // You can define per-test tear-down logic as usual.
+  void TearDown() override {
+    delete tree;
+    delete bmgr;
+    delete dmgr;
+    remove(path);
+  }
+
+  void reopen() {
+    delete tree;
+    delete bmgr;
+    delete dmgr;
+    dmgr = new DiskManager();
+    bmgr = new BufferManager(dmgr);
+    table_id = bmgr->openDatabase(path);
+    ASSERT_TRUE(table_id > 0);
+    tree = new BPlusTree(bmgr, table_id);
+  }
+
+  static PageManager   *dmgr;
+  static BufferManager *bmgr;
+  static BPlusTree     *tree;
+  static const char    *path;
+  static int            table_id;
+};
+
+PageManager   *BptTest::dmgr     = nullptr;
+BufferManager *BptTest::bmgr     = nullptr;
+BPlusTree     *BptTest::tree     = nullptr;
+const char    *BptTest::path     = "test.db";
+int            BptTest::table_id = -1;
+
+TEST_F(BptTest, emptyTree) {
+  bptval_t value;
+  std::vector<BptRecord> records;
+  ASSERT_EQ(tree->getHeight(), 0);
+  ASSERT_EQ(tree->find(1, &value), BPT_NOTFOUND);
+  ASSERT_EQ(tree->remove(1), BPT_NOTFOUND);
+  ASSERT_EQ(tree->scan(0, 100, &records), 0);
+}
+
+TEST_F(BptTest, insertFind) {
+  const int nkeys = 50000;
+  std::vector<bptkey_t> keys(nkeys);
+  std::iota(keys.begin(), keys.end(), -nkeys / 2);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+  for (bptkey_t key : keys) {
+    ASSERT_EQ(tree->insert(key, key * 7), BPT_SUCCESS);
+  }
+  ASSERT_EQ(tree->insert(keys[0], 0), BPT_DUPLICATE);
+  uint32_t height = tree->getHeight();
+  ASSERT_GE(height, 2);
+
+  bptval_t value;
+  for (bptkey_t key : keys) {
+    ASSERT_EQ(tree->find(key, &value), BPT_SUCCESS);
+    ASSERT_EQ(value, static_cast<bptval_t>(key * 7));
+  }
+  ASSERT_EQ(tree->find(nkeys, &value), BPT_NOTFOUND);
+
+  /*
+   * The root is kept in the header page
+   */
+  reopen();
+  ASSERT_EQ(tree->getHeight(), height);
+  for (bptkey_t key : keys) {
+    ASSERT_EQ(tree->find(key, &value), BPT_SUCCESS);
+    ASSERT_EQ(value, static_cast<bptval_t>(key * 7));
+  }
+}
+
+TEST_F(BptTest, scan) {
+  const int nkeys = 10000;
+  for (int i = nkeys; i > 0; i--) {
+    ASSERT_EQ(tree->insert(2 * i, i), BPT_SUCCESS);
+  }
+
+  std::vector<BptRecord> records;
+  ASSERT_EQ(tree->scan(101, 2000, &records), 950);
+  for (size_t i = 0; i < records.size(); i++) {
+    ASSERT_EQ(records[i].key, static_cast<bptkey_t>(102 + 2 * i));
+    ASSERT_EQ(records[i].value, static_cast<bptval_t>(51 + i));
+  }
+
+  records.clear();
+  ASSERT_EQ(tree->scan(INT64_MIN, INT64_MAX, &records), nkeys);
+  ASSERT_TRUE(std::is_sorted(
+      records.begin(), records.end(),
+      [](const BptRecord &a, const BptRecord &b) { return a.key < b.key; }));
+
+  records.clear();
+  ASSERT_EQ(tree->scan(3, 3, &records), 0);
+  ASSERT_EQ(tree->scan(10, 4, &records), 0);
+}
+
+TEST_F(BptTest, removeAll) {
+  const int nkeys = 50000;
+  Page hpg;
+  bmgr->readPage(table_id, PN_HEADER, &hpg);
+  pagenum_t free_pages =
+      FreeSpaceMap(bmgr, table_id, hpg.getHeaderPage()).getFreePages();
+
+  std::vector<bptkey_t> keys(nkeys);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::mt19937 gen(7);
+  std::shuffle(keys.begin(), keys.end(), gen);
+  for (bptkey_t key : keys) {
+    ASSERT_EQ(tree->insert(key, key), BPT_SUCCESS);
+  }
+
+  std::shuffle(keys.begin(), keys.end(), gen);
+  bptval_t value;
+  for (int i = 0; i < nkeys; i++) {
+    ASSERT_EQ(tree->remove(keys[i]), BPT_SUCCESS);
+    ASSERT_EQ(tree->remove(keys[i]), BPT_NOTFOUND);
+    if (i % 5000 == 0) {
+      for (int j = i + 1; j < nkeys; j += 97) {
+        ASSERT_EQ(tree->find(keys[j], &value), BPT_SUCCESS);
+      }
+    }
+  }
+  ASSERT_EQ(tree->getHeight(), 0);
+
+  /*
+   * Every node page was given back
+   */
+  bmgr->readPage(table_id, PN_HEADER, &hpg);
+  ASSERT_EQ(hpg.getHeaderPage()->root_page_number, PN_INVALID);
+  ASSERT_EQ(FreeSpaceMap(bmgr, table_id, hpg.getHeaderPage()).getFreePages(),
+            free_pages + hpg.getHeaderPage()->number_of_pages -
+                INITIAL_PAGES_NUMBER);
+  ASSERT_EQ(tree->insert(1, 1), BPT_SUCCESS);
+  ASSERT_EQ(tree->getHeight(), 1);
+}
+
+TEST_F(BptTest, pinnedFrames) {
+  const uint64_t nframes = 16;
+  const int nkeys = 4 * LeafPage::CAPACITY;
+  delete tree;
+  delete bmgr;
+  bmgr = new BufferManager(dmgr, REPLACER_CLOCK, nframes);
+  table_id = bmgr->openDatabase(path);
+  ASSERT_TRUE(table_id > 0);
+  tree = new BPlusTree(bmgr, table_id);
+  std::vector<pagenum_t> pinned(nframes);
+  ASSERT_EQ(bmgr->allocPages(table_id, nframes, pinned.data()), nframes);
+
+  /*
+   * Each key is inserted and removed with fewer and fewer
+   * frames pinned by others. A failure leaves the tree as
+   * it was.
+   */
+  std::vector<bptkey_t> keys(nkeys);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(5));
+  auto retry = [&](bptkey_t key, bool found, auto op) {
+    int nfailures = 0;
+    for (uint64_t npinned = nframes;; npinned--) {
+      std::vector<BufferManager::ReadPageGuard> guards;
+      for (uint64_t i = 0; i < npinned; i++) {
+        guards.push_back(bmgr->fetchPageRead(table_id, pinned[i]));
+      }
+      int ret = op();
+      guards.clear();
+      if (ret != BPT_NOFRAME) {
+        EXPECT_EQ(ret, BPT_SUCCESS);
+        return nfailures;
+      }
+      bptval_t value;
+      EXPECT_EQ(tree->find(key, &value), found ? BPT_SUCCESS : BPT_NOTFOUND);
+      nfailures += 1;
+    }
+  };
+  auto check = [&](int begin, int end) {
+    std::vector<BptRecord> records;
+    ASSERT_EQ(tree->scan(INT64_MIN, INT64_MAX, &records), end - begin);
+    std::vector<bptkey_t> expected(keys.begin() + begin, keys.begin() + end);
+    std::sort(expected.begin(), expected.end());
+    for (int i = 0; i < end - begin; i++) {
+      ASSERT_EQ(records[i].key, expected[i]);
+    }
+  };
+
+  bptval_t value;
+  int nfailures = 0;
+  for (int i = 0; i < nkeys; i++) {
+    nfailures +=
+        retry(keys[i], false, [&] { return tree->insert(keys[i], keys[i]); });
+    ASSERT_EQ(tree->find(keys[i], &value), BPT_SUCCESS);
+    if (i % 64 == 0) check(0, i + 1);
+  }
+  check(0, nkeys);
+  for (int i = 0; i < nkeys; i++) {
+    nfailures += retry(keys[i], true, [&] { return tree->remove(keys[i]); });
+    ASSERT_EQ(tree->find(keys[i], &value), BPT_NOTFOUND);
+    if (i % 64 == 0) check(i + 1, nkeys);
+  }
+  ASSERT_GT(nfailures, 0);
+  ASSERT_EQ(tree->getHeight(), 0);
+}
+
+TEST_F(BptTest, randomOperations) {
+  std::map<bptkey_t, bptval_t> model;
+  std::mt19937 gen(1234);
+  std::uniform_int_distribution<bptkey_t> dist(0, 20000);
+  bptval_t value;
+
+  for (int i = 0; i < 200000; i++) {
+    bptkey_t key = dist(gen);
+    switch (gen() % 3) {
+      case 0:
+        ASSERT_EQ(tree->insert(key, i),
+                  model.count(key) ? BPT_DUPLICATE : BPT_SUCCESS);
+        model.emplace(key, i);
+        break;
+      case 1:
+        ASSERT_EQ(tree->remove(key),
+                  model.erase(key) ? BPT_SUCCESS : BPT_NOTFOUND);
+        break;
+      default:
+        if (model.count(key)) {
+          ASSERT_EQ(tree->find(key, &value), BPT_SUCCESS);
+          ASSERT_EQ(value, model[key]);
+        } else {
+          ASSERT_EQ(tree->find(key, &value), BPT_NOTFOUND);
+        }
+    }
+  }
+
+  std::vector<BptRecord> records;
+  ASSERT_EQ(tree->scan(INT64_MIN, INT64_MAX, &records), model.size());
+  auto it = model.begin();
+  for (const BptRecord &record : records) {
+    ASSERT_EQ(record.key, it->first);
+    ASSERT_EQ(record.value, it->second);
+    ++it;
+  }
+}
+
+TEST_F(BptTest, concurrentReaders) {
+  const int nkeys = 20000;
+  const int nreaders = 3;
+
+  /*
+   * Even keys stay. Odd keys come and go, which splits and
+   * merges the leaves under the readers.
+   */
+  for (int i = 0; i < nkeys; i += 2) {
+    ASSERT_EQ(tree->insert(i, i + 1), BPT_SUCCESS);
+  }
+
+  std::atomic<bool> stop(false);
+  std::atomic<int> nerrors(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < nreaders; t++) {
+    readers.emplace_back([&, t]() {
+      std::mt19937 gen(t);
+      while (!stop) {
+        bptkey_t key = (gen() % (nkeys / 2)) * 2;
+        bptval_t value;
+        if (tree->find(key, &value) != BPT_SUCCESS ||
+            value != static_cast<bptval_t>(key + 1)) {
+          nerrors += 1;
+        }
+        std::vector<BptRecord> records;
+        tree->scan(key, key + 200, &records);
+        int nevens = 0;
+        for (size_t i = 0; i < records.size(); i++) {
+          if (i > 0 && records[i - 1].key >= records[i].key) nerrors += 1;
+          if (records[i].key % 2 == 0) nevens += 1;
+        }
+        if (nevens != std::min<bptkey_t>(101, (nkeys - key) / 2)) {
+          nerrors += 1;
+        }
+      }
+    });
+  }
+
+  for (int round = 0; round < 3; round++) {
+    for (int i = 1; i < nkeys; i += 2) {
+      ASSERT_EQ(tree->insert(i, i + 1), BPT_SUCCESS);
+    }
+    for (int i = 1; i < nkeys; i += 2) {
+      ASSERT_EQ(tree->remove(i), BPT_SUCCESS);
+    }
+  }
+  stop = true;
+  for (std::thread &reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(nerrors, 0);
+}
+
+TEST_F(BptTest, concurrentWriters) {
+  const int nthreads = 4;
+  const int nkeys = 10000;
+
+  std::vector<std::thread> writers;
+  for (int t = 0; t < nthreads; t++) {
+    writers.emplace_back([&, t]() {
+      for (int i = t; i < nkeys; i += nthreads) {
+        tree->insert(i, i);
+      }
+      for (int i = t; i < nkeys; i += 2 * nthreads) {
+        tree->remove(i);
+      }
+    });
+  }
+  for (std::thread &writer : writers) {
+    writer.join();
+  }
+
+  bptval_t value;
+  for (int i = 0; i < nkeys; i++) {
+    bool removed = i % (2 * nthreads) < nthreads;
+    ASSERT_EQ(tree->find(i, &value), removed ? BPT_NOTFOUND : BPT_SUCCESS);
+  }
+}
+
+TEST_F(BptTest, bulkLoad) {
+  const int nkeys = 100000;
+  std::vector<BptRecord> records(nkeys);
+  for (int i = 0; i < nkeys; i++) {
+    records[i] = {3 * i, static_cast<bptval_t>(i)};
+  }
+  BulkLoadOptions opts;
+  opts.fill_factor = 1.0;
+  ASSERT_EQ(tree->bulkLoad(records.data(), nkeys, opts), BPT_SUCCESS);
+  ASSERT_EQ(tree->bulkLoad(records.data(), nkeys, opts), BPT_NOTEMPTY);
+  ASSERT_GE(tree->getHeight(), 2);
+
+  /*
+   * Full leaves are allocated as one extent and chained in
+   * page order
+   */
+  std::vector<BptRecord> all;
+  ASSERT_EQ(tree->scan(INT64_MIN, INT64_MAX, &all), nkeys);
+  for (int i = 0; i < nkeys; i++) {
+    ASSERT_EQ(all[i].key, records[i].key);
+    ASSERT_EQ(all[i].value, records[i].value);
+  }
+  pagenum_t first_leaf = PN_INVALID;
+  size_t nleaves = 0;
+  {
+    Page pg;
+    bmgr->readPage(table_id, PN_HEADER, &pg);
+    pagenum_t pn = pg.getHeaderPage()->root_page_number;
+    for (bmgr->readPage(table_id, pn, &pg); !pg.getLeafPage()->is_leaf;
+         bmgr->readPage(table_id, pn, &pg)) {
+      pn = pg.getInternalPage()->children[0];
+    }
+    first_leaf = pn;
+    for (;;) {
+      ASSERT_EQ(pn, first_leaf + nleaves);
+      nleaves += 1;
+      pn = pg.getLeafPage()->right_sibling_number;
+      if (pn == PN_INVALID) break;
+      bmgr->readPage(table_id, pn, &pg);
+    }
+  }
+  ASSERT_EQ(nleaves, (nkeys + LeafPage::CAPACITY - 1) / LeafPage::CAPACITY);
+
+  /*
+   * The loaded tree takes inserts, removals and a reopen
+   */
+  bptval_t value;
+  for (int i = 0; i < nkeys; i += 7) {
+    ASSERT_EQ(tree->insert(3 * i + 1, i), BPT_SUCCESS);
+    ASSERT_EQ(tree->remove(3 * i), BPT_SUCCESS);
+  }
+  reopen();
+  for (int i = 0; i < nkeys; i++) {
+    if (i % 7 == 0) {
+      ASSERT_EQ(tree->find(3 * i, &value), BPT_NOTFOUND);
+      ASSERT_EQ(tree->find(3 * i + 1, &value), BPT_SUCCESS);
+    } else {
+      ASSERT_EQ(tree->find(3 * i, &value), BPT_SUCCESS);
+    }
+    ASSERT_EQ(value, static_cast<bptval_t>(i));
+  }
+}
+
+TEST_F(BptTest, bulkLoadUnsorted) {
+  const int nkeys = 30000;
+  std::vector<BptRecord> records(nkeys);
+  for (int i = 0; i < nkeys; i++) {
+    records[i] = {i, static_cast<bptval_t>(i * 2)};
+  }
+  std::shuffle(records.begin(), records.end(), std::mt19937(3));
+  records.push_back(records[0]);
+  ASSERT_EQ(tree->bulkLoad(records.data(), records.size()), BPT_DUPLICATE);
+  ASSERT_EQ(tree->getHeight(), 0);
+  records.pop_back();
+
+  /*
+   * Half-full nodes still make a valid tree
+   */
+  BulkLoadOptions opts;
+  opts.fill_factor = 0.5;
+  ASSERT_EQ(tree->bulkLoad(records.data(), nkeys, opts), BPT_SUCCESS);
+  std::vector<BptRecord> all;
+  ASSERT_EQ(tree->scan(INT64_MIN, INT64_MAX, &all), nkeys);
+  for (int i = 0; i < nkeys; i++) {
+    ASSERT_EQ(all[i].key, i);
+    ASSERT_EQ(all[i].value, static_cast<bptval_t>(i * 2));
+  }
+  for (int i = 0; i < nkeys; i++) {
+    ASSERT_EQ(tree->remove(i), BPT_SUCCESS);
+  }
+  ASSERT_EQ(tree->getHeight(), 0);
+
+  /*
+   * A tree emptied by removals can be loaded again
+   */
+  ASSERT_EQ(tree->bulkLoad(records.data(), nkeys), BPT_SUCCESS);
+  bptval_t value;
+  for (int i = 0; i < nkeys; i += 11) {
+    ASSERT_EQ(tree->find(i, &value), BPT_SUCCESS);
+    ASSERT_EQ(value, static_cast<bptval_t>(i * 2));
+  }
+}
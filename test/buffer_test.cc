@@ -1,8 +1,15 @@
 #include "buffer.h"
 #include <gtest/gtest.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <random>
 #include <string>
+#include <thread>
+#include <vector>
 #include "file.h"
+#include "fsm.h"
 #include "page.h"
 
 #define DBFILENAME "test.db"
@@ -83,7 +90,8 @@ TEST_F(BufferTest, bufferAllocPage) {
   alloc_page_number = bmgr->allocPage(table_id);
   ASSERT_EQ(alloc_page_number, INITIAL_PAGES_NUMBER);
   bmgr->readPage(table_id, PN_HEADER, &pg);
-  ASSERT_EQ(phpg->free_page_number, INITIAL_PAGES_NUMBER + 1);
+  ASSERT_EQ(phpg->free_page_number, PN_EOFREE);
+  ASSERT_EQ(phpg->fsm_free[0], INITIAL_PAGES_NUMBER - 1);
   ASSERT_EQ(lseek(table_id, 0, SEEK_END), 2 * INITIAL_PAGES_NUMBER * PAGE_SIZE);
 }
 
@@ -113,6 +121,7 @@ TEST_F(BufferTest, bufferFreePage) {
 
 TEST_F(BufferTest, stressTest) {
   const int nepoch = 10000;
+  std::vector<pagenum_t> page_numbers;
 
   /*
    * Write pages
@@ -125,6 +134,7 @@ TEST_F(BufferTest, stressTest) {
       std::string d = std::to_string(page_number);
       strncpy(pg.data, d.c_str(), d.size() + 1);
       bmgr->writePage(table_id, page_number, &pg);
+      page_numbers.push_back(page_number);
     }
   }
 
@@ -135,7 +145,7 @@ TEST_F(BufferTest, stressTest) {
     Page pg;
 
     for(int i = 1; i <= nepoch; i++) {
-      pagenum_t page_number = static_cast<pagenum_t>(i);
+      pagenum_t page_number = page_numbers[i - 1];
       bmgr->readPage(table_id, page_number, &pg);
       bmgr->freePage(table_id, page_number);
       pagenum_t d = std::stoull(std::string(pg.data));
@@ -187,4 +197,641 @@ TEST_F(BufferTest, restartTest) {
       ASSERT_EQ(page_number, d);
     }
   }
-}
\ No newline at end of file
+}
+
+TEST_F(BufferTest, fetchPageGuard) {
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  pagenum_t page_number = bmgr->allocPage(table_id);
+
+  /*
+   * Write in place
+   */
+  {
+    BufferManager::WritePageGuard guard =
+        pbmgr->fetchPageWrite(table_id, page_number);
+    ASSERT_TRUE(guard.isValid());
+    ASSERT_EQ(guard.getPageNumber(), page_number);
+    strncpy(guard->data, "guarded", 8);
+  }
+
+  /*
+   * Read in place and by copy
+   */
+  {
+    BufferManager::ReadPageGuard guard =
+        pbmgr->fetchPageRead(table_id, page_number);
+    ASSERT_TRUE(guard.isValid());
+    ASSERT_STREQ(guard->data, "guarded");
+    guard.release();
+    ASSERT_FALSE(guard.isValid());
+
+    Page pg;
+    bmgr->readPage(table_id, page_number, &pg);
+    ASSERT_STREQ(pg.data, "guarded");
+  }
+}
+
+TEST_F(BufferTest, fetchPageOptimistic) {
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  pagenum_t page_number = bmgr->allocPage(table_id);
+
+  /*
+   * The page is pinned but a writer isn't held off
+   */
+  BufferManager::OptimisticPageGuard guard =
+      pbmgr->fetchPageOptimistic(table_id, page_number);
+  ASSERT_TRUE(guard.isValid());
+  {
+    BufferManager::WritePageGuard wguard =
+        pbmgr->fetchPageWrite(table_id, page_number);
+    ASSERT_TRUE(wguard.isValid());
+    strncpy(wguard->data, "changed", 8);
+  }
+  ASSERT_STREQ(guard->data, "changed");
+  guard.release();
+  ASSERT_FALSE(guard.isValid());
+}
+
+TEST_F(BufferTest, fetchPagePinned) {
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  std::vector<BufferManager::ReadPageGuard> guards;
+
+  /*
+   * Pin every frame. One holds the resident header.
+   */
+  for (int i = 1; i < BUFFER_SIZE; i++) {
+    pagenum_t page_number = static_cast<pagenum_t>(i);
+    guards.push_back(pbmgr->fetchPageRead(table_id, page_number));
+    ASSERT_TRUE(guards.back().isValid());
+  }
+  ASSERT_FALSE(pbmgr->fetchPageRead(table_id, BUFFER_SIZE + 1).isValid());
+
+  /*
+   * Unbuffered access still works
+   */
+  {
+    Page pg;
+    strncpy(pg.data, "unbuffered", 11);
+    bmgr->writePage(table_id, BUFFER_SIZE + 1, &pg);
+    memset(pg.data, 0, sizeof(pg.data));
+    bmgr->readPage(table_id, BUFFER_SIZE + 1, &pg);
+    ASSERT_STREQ(pg.data, "unbuffered");
+  }
+
+  /*
+   * Pinned pages are kept in the buffer
+   */
+  for (int i = 1; i < BUFFER_SIZE; i++) {
+    ASSERT_EQ(guards[i - 1].getPageNumber(), static_cast<pagenum_t>(i));
+  }
+  guards.clear();
+  ASSERT_TRUE(pbmgr->fetchPageRead(table_id, BUFFER_SIZE + 1).isValid());
+}
+
+TEST_F(BufferTest, concurrentStressTest) {
+  const int nthreads = 4;
+  const int npages_per_thread = BUFFER_SIZE / 2;
+  const int nops = 4000;
+  const int nwords = 64;
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+
+  /*
+   * Allocate pages concurrently
+   */
+  std::vector<std::vector<pagenum_t>> allocated(nthreads);
+  {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; t++) {
+      threads.emplace_back([&, t]() {
+        Page pg;
+        memset(pg.data, 0, sizeof(pg.data));
+        for (int i = 0; i < npages_per_thread; i++) {
+          pagenum_t page_number = bmgr->allocPage(table_id);
+          bmgr->writePage(table_id, page_number, &pg);
+          allocated[t].push_back(page_number);
+        }
+      });
+    }
+    for (std::thread &thread : threads) thread.join();
+  }
+  std::vector<pagenum_t> pages;
+  for (const auto &v : allocated) pages.insert(pages.end(), v.begin(), v.end());
+  std::sort(pages.begin(), pages.end());
+  ASSERT_EQ(std::unique(pages.begin(), pages.end()), pages.end());
+
+  /*
+   * Update and verify pages concurrently. Every update
+   * bumps all words of a page, so a torn or lost update
+   * is visible to readers and in the final sum.
+   */
+  std::atomic<uint64_t> nupdates(0);
+  std::atomic<bool> torn(false);
+  pbmgr->startBackgroundWriter();
+  {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; t++) {
+      threads.emplace_back([&, t]() {
+        std::mt19937 rng(t);
+        for (int i = 0; i < nops; i++) {
+          pagenum_t page_number = pages[rng() % pages.size()];
+          if (rng() % 4 == 0) {
+            BufferManager::WritePageGuard guard =
+                pbmgr->fetchPageWrite(table_id, page_number);
+            uint64_t *words = reinterpret_cast<uint64_t *>(guard->data);
+            for (int w = 0; w < nwords; w++) words[w] += 1;
+            nupdates += 1;
+          } else {
+            BufferManager::ReadPageGuard guard =
+                pbmgr->fetchPageRead(table_id, page_number, rng() % 3);
+            const uint64_t *words =
+                reinterpret_cast<const uint64_t *>(guard->data);
+            for (int w = 1; w < nwords; w++) {
+              if (words[w] != words[0]) torn = true;
+            }
+          }
+        }
+      });
+    }
+    for (std::thread &thread : threads) thread.join();
+  }
+  pbmgr->stopBackgroundWriter();
+  ASSERT_FALSE(torn);
+
+  uint64_t sum = 0;
+  Page pg;
+  for (pagenum_t page_number : pages) {
+    bmgr->readPage(table_id, page_number, &pg);
+    sum += reinterpret_cast<uint64_t *>(pg.data)[0];
+  }
+  ASSERT_EQ(sum, nupdates);
+}
+
+TEST_F(BufferTest, replacerPolicies) {
+  const int nepoch = 3 * BUFFER_SIZE;
+  /*
+   * An unknown policy falls back to the default
+   */
+  const int policies[] = {REPLACER_LRU, REPLACER_CLOCK, REPLACER_2Q, -1};
+
+  for (int policy : policies) {
+    delete bmgr;
+    bmgr = new BufferManager(dmgr, policy);
+
+    Page pg;
+    for (int i = 1; i <= nepoch; i++) {
+      pagenum_t page_number = static_cast<pagenum_t>(i);
+      std::string d = std::to_string(page_number + policy);
+      strncpy(pg.data, d.c_str(), d.size() + 1);
+      bmgr->writePage(table_id, page_number, &pg);
+    }
+    for (int i = 1; i <= nepoch; i++) {
+      pagenum_t page_number = static_cast<pagenum_t>(i);
+      bmgr->readPage(table_id, page_number, &pg);
+      pagenum_t d = std::stoull(std::string(pg.data));
+      ASSERT_EQ(page_number + policy, d);
+    }
+  }
+}
+
+TEST_F(BufferTest, sequentialHint) {
+  const int nhot = 64;
+  const pagenum_t scan_begin = 1000;
+  const int nscan = 3 * BUFFER_SIZE;
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  Page pg;
+
+  /*
+   * Load hot pages, then change them on disk behind the
+   * buffer. A hot page reads "hot" as long as it stays
+   * buffered.
+   */
+  auto diskWrite = [&](pagenum_t page_number, const char *s) {
+    strncpy(pg.data, s, strlen(s) + 1);
+    ASSERT_EQ(pwrite(table_id, pg.data, PAGE_SIZE, page_number * PAGE_SIZE),
+              PAGE_SIZE);
+  };
+  for (int i = 1; i <= nhot; i++) {
+    diskWrite(i, "hot");
+    bmgr->readPage(table_id, i, &pg);
+    diskWrite(i, "evicted");
+  }
+
+  /*
+   * A sequential scan recycles the buffer ring
+   */
+  for (int i = 0; i < nscan; i++) {
+    pbmgr->readPage(table_id, scan_begin + i, &pg, ACCESS_SEQUENTIAL);
+  }
+  for (int i = 1; i <= nhot; i++) {
+    bmgr->readPage(table_id, i, &pg);
+    ASSERT_STREQ(pg.data, "hot");
+  }
+
+  /*
+   * A normal scan flushes the hot pages
+   */
+  for (int i = 0; i < nscan; i++) {
+    pbmgr->readPage(table_id, scan_begin + i, &pg, ACCESS_NORMAL);
+  }
+  for (int i = 1; i <= nhot; i++) {
+    bmgr->readPage(table_id, i, &pg);
+    ASSERT_STREQ(pg.data, "evicted");
+  }
+}
+
+TEST_F(BufferTest, backgroundWriter) {
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  BackgroundWriterOptions opts;
+  opts.interval_ms = 1;
+  opts.max_pages = 256;
+  opts.low_watermark = 0.05;
+  opts.high_watermark = 0.1;
+  const uint64_t low = static_cast<uint64_t>(opts.low_watermark * BUFFER_SIZE);
+  pbmgr->startBackgroundWriter(opts);
+
+  /*
+   * Dirty the whole pool, and let the writer clean it
+   */
+  Page pg;
+  for (int i = 1; i <= BUFFER_SIZE; i++) {
+    std::string d = std::to_string(i);
+    strncpy(pg.data, d.c_str(), d.size() + 1);
+    bmgr->writePage(table_id, i, &pg);
+  }
+  for (int i = 0; i < 10000 && pbmgr->getStats().dirty_pages > low; i++) {
+    usleep(1000);
+  }
+  BufferStats stats = pbmgr->getStats();
+  ASSERT_LE(stats.dirty_pages, low);
+  ASSERT_GT(stats.background_writes, 0);
+
+  /*
+   * Misses find clean victims
+   */
+  for (int i = BUFFER_SIZE + 1; i <= 2 * BUFFER_SIZE; i++) {
+    bmgr->readPage(table_id, i, &pg);
+  }
+  ASSERT_LE(pbmgr->getStats().dirty_evictions - stats.dirty_evictions, low);
+  pbmgr->stopBackgroundWriter();
+
+  for (int i = 1; i <= BUFFER_SIZE; i++) {
+    bmgr->readPage(table_id, i, &pg);
+    ASSERT_EQ(std::stoi(std::string(pg.data)), i);
+  }
+}
+
+TEST_F(BufferTest, flushTable) {
+  const int npages = 100;
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  Page pg;
+
+  for (int i = 1; i <= npages; i++) {
+    std::string d = std::to_string(i);
+    strncpy(pg.data, d.c_str(), d.size() + 1);
+    bmgr->writePage(table_id, i, &pg);
+  }
+  ASSERT_EQ(pbmgr->getStats().dirty_pages, npages);
+
+  /*
+   * The dirty pages reach the file without evictions
+   */
+  bmgr->sync(table_id);
+  ASSERT_EQ(pbmgr->getStats().dirty_pages, 0);
+  for (int i = 1; i <= npages; i++) {
+    ASSERT_EQ(pread(table_id, pg.data, PAGE_SIZE, i * PAGE_SIZE), PAGE_SIZE);
+    ASSERT_EQ(std::stoi(std::string(pg.data)), i);
+  }
+}
+
+TEST_F(BufferTest, directIO) {
+  const int npages = 2 * BUFFER_SIZE;
+  {
+    delete bmgr;
+    delete dmgr;
+    remove(path);
+    dmgr = new DiskManager(SYNC_GROUP, IO_DIRECT);
+    bmgr = new BufferManager(dmgr);
+    table_id = bmgr->openDatabase(path);
+    ASSERT_TRUE(table_id > 0);
+  }
+
+  /*
+   * Frames are written and read in place past the pool
+   */
+  Page pg;
+  for (int i = 1; i <= npages; i++) {
+    std::string d = std::to_string(i);
+    strncpy(pg.data, d.c_str(), d.size() + 1);
+    bmgr->writePage(table_id, i, &pg);
+  }
+  for (int i = 1; i <= npages; i++) {
+    bmgr->readPage(table_id, i, &pg);
+    ASSERT_EQ(std::stoi(std::string(pg.data)), i);
+  }
+}
+
+TEST_F(BufferTest, allocPages) {
+  const size_t npages = 3 * BUFFER_SIZE;
+  std::vector<pagenum_t> page_numbers(npages);
+  ASSERT_EQ(bmgr->allocPages(table_id, npages, page_numbers.data()), npages);
+  std::sort(page_numbers.begin(), page_numbers.end());
+  ASSERT_EQ(std::unique(page_numbers.begin(), page_numbers.end()),
+            page_numbers.end());
+
+  Page pg;
+  for (pagenum_t page_number : page_numbers) {
+    std::string d = std::to_string(page_number);
+    strncpy(pg.data, d.c_str(), d.size() + 1);
+    bmgr->writePage(table_id, page_number, &pg);
+  }
+
+  /*
+   * Allocated pages aren't handed out twice, and freed
+   * pages are handed out again
+   */
+  pagenum_t page_number = bmgr->allocPage(table_id);
+  ASSERT_FALSE(std::binary_search(page_numbers.begin(), page_numbers.end(),
+                                  page_number));
+  bmgr->freePages(table_id, page_numbers.data(), npages);
+  std::vector<pagenum_t> reused(npages);
+  ASSERT_EQ(bmgr->allocPages(table_id, npages, reused.data()), npages);
+  std::sort(reused.begin(), reused.end());
+  ASSERT_EQ(reused, page_numbers);
+  for (pagenum_t page_number : page_numbers) {
+    bmgr->readPage(table_id, page_number, &pg);
+    ASSERT_EQ(std::stoull(std::string(pg.data)), page_number);
+  }
+}
+
+TEST_F(BufferTest, residentHeader) {
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  Page pg;
+
+  /*
+   * A scan over the whole pool doesn't evict the header
+   */
+  for (int i = 1; i <= 2 * BUFFER_SIZE; i++) {
+    bmgr->readPage(table_id, i, &pg);
+  }
+  uint64_t misses = pbmgr->getStats().misses;
+  pagenum_t page_number = bmgr->allocPage(table_id);
+  bmgr->freePage(table_id, page_number);
+  ASSERT_EQ(pbmgr->getStats().misses, misses);
+
+  /*
+   * Its changes are written back on flush
+   */
+  page_number = bmgr->allocPage(table_id);
+  bmgr->flush(table_id);
+  Page fpg;
+  dmgr->readPage(table_id, PN_HEADER, &fpg);
+  FreeSpaceMap fsm(dmgr, table_id, fpg.getHeaderPage());
+  ASSERT_TRUE(fsm.isAllocated(page_number));
+}
+
+TEST_F(BufferTest, readAhead) {
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  ReadAheadOptions opts;
+  Page pg;
+
+  for (int i = 1; i <= 4 * opts.window; i++) {
+    std::string d = std::to_string(i);
+    strncpy(pg.data, d.c_str(), d.size() + 1);
+    bmgr->writePage(table_id, i, &pg);
+  }
+  delete bmgr;
+  delete dmgr;
+  dmgr = new DiskManager();
+  bmgr = pbmgr = new BufferManager(dmgr);
+  table_id = bmgr->openDatabase(path);
+  ASSERT_TRUE(table_id > 0);
+  pbmgr->startReadAhead(opts);
+
+  /*
+   * The window is prefetched once the reads are found
+   * sequential.
+   */
+  for (int i = 1; i <= opts.trigger; i++) {
+    bmgr->readPage(table_id, i, &pg);
+  }
+  uint64_t misses = pbmgr->getStats().misses;
+  for (int i = 0; i < 1000; i++) {
+    if (pbmgr->getStats().prefetches >= static_cast<uint64_t>(opts.window)) {
+      break;
+    }
+    usleep(1000);
+  }
+  ASSERT_EQ(pbmgr->getStats().prefetches, opts.window);
+  for (int i = opts.trigger + 1; i <= opts.trigger + opts.window; i++) {
+    bmgr->readPage(table_id, i, &pg);
+    ASSERT_EQ(std::stoi(std::string(pg.data)), i);
+  }
+  BufferStats stats = pbmgr->getStats();
+  ASSERT_EQ(stats.misses, misses);
+  ASSERT_EQ(stats.prefetch_hits, opts.window);
+  ASSERT_EQ(stats.prefetch_waste, 0);
+
+  /*
+   * A random read doesn't trigger it
+   */
+  pbmgr->stopReadAhead();
+  pbmgr->startReadAhead(opts);
+  bmgr->readPage(table_id, 3 * opts.window, &pg);
+  bmgr->readPage(table_id, opts.window, &pg);
+  usleep(10000);
+  ASSERT_EQ(pbmgr->getStats().prefetches, stats.prefetches);
+}
+
+TEST_F(BufferTest, readPagesBatch) {
+  const int npages = 64;
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  Page pg;
+
+  for (int i = 1; i <= npages; i++) {
+    std::string d = std::to_string(i);
+    strncpy(pg.data, d.c_str(), d.size() + 1);
+    bmgr->writePage(table_id, i, &pg);
+  }
+  delete bmgr;
+  delete dmgr;
+  dmgr = new DiskManager();
+  bmgr = pbmgr = new BufferManager(dmgr);
+  table_id = bmgr->openDatabase(path);
+  ASSERT_TRUE(table_id > 0);
+
+  /*
+   * Each missing page is read once, even if listed twice
+   */
+  bmgr->readPage(table_id, 1, &pg);
+  uint64_t misses = pbmgr->getStats().misses;
+  std::vector<pagenum_t> page_numbers;
+  for (int i = npages / 2; i >= 1; i--) {
+    page_numbers.push_back(i);
+  }
+  page_numbers.push_back(npages / 2);
+  std::vector<Page> pages(page_numbers.size());
+  std::vector<PageIO> ios;
+  for (size_t i = 0; i < page_numbers.size(); i++) {
+    ios.push_back({table_id, page_numbers[i], &pages[i]});
+  }
+  bmgr->readPages(ios.data(), ios.size());
+  for (size_t i = 0; i < page_numbers.size(); i++) {
+    ASSERT_EQ(std::stoul(std::string(pages[i].data)), page_numbers[i]);
+  }
+  ASSERT_EQ(pbmgr->getStats().misses, misses + npages / 2 - 1);
+
+  /*
+   * Prefetched pages are hits
+   */
+  page_numbers.clear();
+  for (int i = npages / 2 + 1; i <= npages; i++) {
+    page_numbers.push_back(i);
+  }
+  pbmgr->prefetchPages(table_id, page_numbers.data(), page_numbers.size());
+  misses = pbmgr->getStats().misses;
+  for (int i = npages / 2 + 1; i <= npages; i++) {
+    bmgr->readPage(table_id, i, &pg);
+    ASSERT_EQ(std::stoi(std::string(pg.data)), i);
+  }
+  BufferStats stats = pbmgr->getStats();
+  ASSERT_EQ(stats.misses, misses);
+  ASSERT_EQ(stats.prefetches, npages / 2);
+  ASSERT_EQ(stats.prefetch_hits, npages / 2);
+}
+
+TEST_F(BufferTest, writeCoalescing) {
+  class CountingDiskManager : public DiskManager {
+   public:
+    std::atomic<uint64_t> nwrites{0};
+    std::atomic<uint64_t> npages{0};
+    void writePage(int fd, pagenum_t page_number, const Page *src) override {
+      nwrites += 1;
+      npages += 1;
+      DiskManager::writePage(fd, page_number, src);
+    }
+    void writePages(const PageIO *ios, size_t n) override {
+      nwrites += (n > 0);
+      npages += n;
+      DiskManager::writePages(ios, n);
+    }
+  };
+  delete bmgr;
+  delete dmgr;
+  remove(path);
+  CountingDiskManager *cdmgr = new CountingDiskManager();
+  dmgr = cdmgr;
+  bmgr = new BufferManager(dmgr);
+  table_id = bmgr->openDatabase(path);
+  ASSERT_TRUE(table_id > 0);
+
+  /*
+   * Evictions of a sequentially written range go out
+   * in clusters of adjacent pages.
+   */
+  const int npages = 2 * BUFFER_SIZE;
+  Page pg;
+  for (int i = 1; i <= npages; i++) {
+    std::string d = std::to_string(i);
+    strncpy(pg.data, d.c_str(), d.size() + 1);
+    bmgr->writePage(table_id, i, &pg);
+  }
+  uint64_t evicted = cdmgr->npages;
+  ASSERT_GE(evicted, BUFFER_SIZE / 2);
+  ASSERT_LE(cdmgr->nwrites, evicted / (BUFFER_WRITE_CLUSTER / 2));
+
+  bmgr->flush(table_id);
+  for (int i = 1; i <= npages; i++) {
+    ASSERT_EQ(pread(table_id, pg.data, PAGE_SIZE, i * PAGE_SIZE), PAGE_SIZE);
+    ASSERT_EQ(std::stoi(std::string(pg.data)), i);
+  }
+}
+
+TEST_F(BufferTest, writePagesAround) {
+  const int npages = 32;
+  BufferManager *pbmgr = static_cast<BufferManager *>(bmgr);
+  Page pg;
+  strncpy(pg.data, "old", 4);
+  bmgr->writePage(table_id, 1, &pg);
+
+  std::vector<Page> pages(npages);
+  std::vector<PageIO> ios;
+  for (int i = 0; i < npages; i++) {
+    std::string d = std::to_string(i + 1);
+    strncpy(pages[i].data, d.c_str(), d.size() + 1);
+    ios.push_back({table_id, static_cast<pagenum_t>(i + 1), &pages[i]});
+  }
+  bmgr->writePages(ios.data(), ios.size());
+
+  /*
+   * The buffered page is written in its frame, and the
+   * others go to disk without taking frames
+   */
+  {
+    BufferManager::ReadPageGuard guard =
+        pbmgr->fetchPageIfBuffered(table_id, 1);
+    ASSERT_TRUE(guard.isValid());
+    ASSERT_STREQ(guard->data, "1");
+  }
+  for (int i = 2; i <= npages; i++) {
+    ASSERT_FALSE(pbmgr->fetchPageIfBuffered(table_id, i).isValid());
+    ASSERT_EQ(pread(table_id, pg.data, PAGE_SIZE, i * PAGE_SIZE), PAGE_SIZE);
+    ASSERT_EQ(std::stoi(std::string(pg.data)), i);
+  }
+  for (int i = 1; i <= npages; i++) {
+    bmgr->readPage(table_id, i, &pg);
+    ASSERT_EQ(std::stoi(std::string(pg.data)), i);
+  }
+}
+
+TEST_F(BufferTest, resizePool) {
+  const uint64_t capacity = 64;
+  delete bmgr;
+  BufferManager *pbmgr = new BufferManager(dmgr, REPLACER_CLOCK, capacity,
+                                           4 * capacity);
+  bmgr = pbmgr;
+  ASSERT_EQ(pbmgr->getStats().capacity, capacity);
+
+  /*
+   * The pool holds at most its capacity
+   */
+  Page pg;
+  for (uint64_t i = 1; i <= 2 * capacity; i++) {
+    std::string d = std::to_string(i);
+    strncpy(pg.data, d.c_str(), d.size() + 1);
+    bmgr->writePage(table_id, i, &pg);
+  }
+  ASSERT_LE(pbmgr->getStats().dirty_pages, capacity);
+  ASSERT_GT(pbmgr->getStats().dirty_evictions, 0);
+
+  /*
+   * After growing, the pages stay buffered
+   */
+  ASSERT_EQ(pbmgr->resize(4 * capacity), 4 * capacity);
+  for (uint64_t i = 1; i <= 2 * capacity; i++) {
+    bmgr->readPage(table_id, i, &pg);
+  }
+  uint64_t misses = pbmgr->getStats().misses;
+  for (uint64_t i = 1; i <= 2 * capacity; i++) {
+    bmgr->readPage(table_id, i, &pg);
+    ASSERT_EQ(std::stoul(std::string(pg.data)), i);
+  }
+  ASSERT_EQ(pbmgr->getStats().misses, misses);
+
+  /*
+   * Shrinking writes back the retired frames, and stops
+   * at a frame in use.
+   */
+  for (uint64_t i = 1; i <= 2 * capacity; i++) {
+    bmgr->writePage(table_id, i, &pg);
+  }
+  {
+    BufferManager::ReadPageGuard guard = pbmgr->fetchPageRead(table_id, 1);
+    ASSERT_GT(pbmgr->resize(capacity / 2), capacity / 2);
+  }
+  ASSERT_EQ(pbmgr->resize(capacity / 2), capacity / 2);
+  ASSERT_LE(pbmgr->getStats().dirty_pages, capacity / 2);
+  for (uint64_t i = 1; i <= 2 * capacity; i++) {
+    bmgr->readPage(table_id, i, &pg);
+  }
+  ASSERT_EQ(pbmgr->getStats().capacity, capacity / 2);
+}
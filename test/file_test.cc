@@ -1,7 +1,11 @@
 #include "file.h"
 #include <gtest/gtest.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <cstring>
 #include <string>
+#include <thread>
+#include <vector>
 #include "page.h"
 
 #define DBFILENAME "test.db"
@@ -76,7 +80,8 @@ TEST_F(FileTest, fileAllocPage) {
   alloc_page_number = dmgr->allocPage(fd);
   ASSERT_EQ(alloc_page_number, INITIAL_PAGES_NUMBER);
   dmgr->readPage(fd, PN_HEADER, &pg);
-  ASSERT_EQ(phpg->free_page_number, INITIAL_PAGES_NUMBER + 1);
+  ASSERT_EQ(phpg->free_page_number, PN_EOFREE);
+  ASSERT_EQ(phpg->fsm_free[0], INITIAL_PAGES_NUMBER - 1);
   ASSERT_EQ(lseek(fd, 0, SEEK_END), 2 * INITIAL_PAGES_NUMBER * PAGE_SIZE);
 }
 
@@ -106,6 +111,7 @@ TEST_F(FileTest, fileFreePage) {
 
 TEST_F(FileTest, stressTest) {
   const int nepoch = 10000;
+  std::vector<pagenum_t> page_numbers;
 
   /*
    * Write pages
@@ -118,6 +124,7 @@ TEST_F(FileTest, stressTest) {
       std::string d = std::to_string(page_number);
       strncpy(pg.data, d.c_str(), d.size() + 1);
       dmgr->writePage(fd, page_number, &pg);
+      page_numbers.push_back(page_number);
     }
   }
 
@@ -128,7 +135,7 @@ TEST_F(FileTest, stressTest) {
     Page pg;
 
     for (int i = 1; i <= nepoch; i++) {
-      pagenum_t page_number = static_cast<pagenum_t>(i);
+      pagenum_t page_number = page_numbers[i - 1];
       dmgr->readPage(fd, page_number, &pg);
       dmgr->freePage(fd, page_number);
       pagenum_t d = std::stoull(std::string(pg.data));
@@ -179,3 +186,268 @@ TEST_F(FileTest, restartTest) {
     }
   }
 }
+
+TEST_F(FileTest, syncTest) {
+  DiskManager *disk = static_cast<DiskManager *>(dmgr);
+  uint64_t nsyncs = disk->getSyncCount();
+
+  Page pg;
+  pagenum_t page_number = dmgr->allocPage(fd);
+  strncpy(pg.data, "durable", PAGE_SIZE);
+  dmgr->writePage(fd, page_number, &pg);
+  dmgr->sync(fd);
+  ASSERT_EQ(disk->getSyncCount(), nsyncs + 1);
+
+  /* Every write is durable on return with SYNC_WRITE */
+  {
+    delete dmgr;
+    dmgr = new DiskManager(SYNC_WRITE);
+    fd = dmgr->openDatabase(path);
+    ASSERT_TRUE(fd > 0);
+  }
+  dmgr->readPage(fd, page_number, &pg);
+  ASSERT_STREQ(pg.data, "durable");
+  dmgr->sync(fd);
+  ASSERT_EQ(static_cast<DiskManager *>(dmgr)->getSyncCount(), 0);
+}
+
+TEST_F(FileTest, groupCommitTest) {
+  const int nthreads = 4;
+  const int nepoch = 200;
+  DiskManager *disk = static_cast<DiskManager *>(dmgr);
+
+  std::vector<pagenum_t> page_numbers;
+  for (int i = 0; i < nthreads; i++) {
+    page_numbers.push_back(dmgr->allocPage(fd));
+  }
+  uint64_t nsyncs = disk->getSyncCount();
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < nthreads; i++) {
+    threads.emplace_back([&, i]() {
+      Page pg;
+      for (int j = 0; j < nepoch; j++) {
+        std::string d = std::to_string(j);
+        strncpy(pg.data, d.c_str(), d.size() + 1);
+        dmgr->writePage(fd, page_numbers[i], &pg);
+        dmgr->sync(fd);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  /* Concurrent syncs never need more fdatasyncs than calls */
+  ASSERT_LE(disk->getSyncCount() - nsyncs,
+            static_cast<uint64_t>(nthreads * nepoch));
+  for (int i = 0; i < nthreads; i++) {
+    Page pg;
+    dmgr->readPage(fd, page_numbers[i], &pg);
+    ASSERT_EQ(std::stoi(std::string(pg.data)), nepoch - 1);
+  }
+}
+
+TEST_F(FileTest, directIOTest) {
+  {
+    delete dmgr;
+    dmgr = new DiskManager(SYNC_GROUP, IO_DIRECT);
+    fd = dmgr->openDatabase(path);
+    ASSERT_TRUE(fd > 0);
+  }
+  ASSERT_EQ(dmgr->getIOAlignment(), PAGE_SIZE);
+
+  pagenum_t page_number = dmgr->allocPage(fd);
+  Page pg;
+  strncpy(pg.data, "aligned", PAGE_SIZE);
+  dmgr->writePage(fd, page_number, &pg);
+  memset(pg.data, 0, PAGE_SIZE);
+  dmgr->readPage(fd, page_number, &pg);
+  ASSERT_STREQ(pg.data, "aligned");
+
+  /*
+   * A misaligned page goes through a bounce page
+   */
+  std::vector<char> buf(2 * PAGE_SIZE + 8);
+  Page *misaligned = reinterpret_cast<Page *>(buf.data() + 8);
+  if (reinterpret_cast<uintptr_t>(misaligned) % PAGE_SIZE == 0) {
+    misaligned = reinterpret_cast<Page *>(buf.data() + 16);
+  }
+  strncpy(misaligned->data, "misaligned", PAGE_SIZE);
+  dmgr->writePage(fd, page_number, misaligned);
+  dmgr->readPage(fd, page_number, &pg);
+  ASSERT_STREQ(pg.data, "misaligned");
+  memset(misaligned->data, 0, PAGE_SIZE);
+  dmgr->readPage(fd, page_number, misaligned);
+  ASSERT_STREQ(misaligned->data, "misaligned");
+}
+
+TEST_F(FileTest, legacyFreeListTest) {
+  const pagenum_t npages = 16;
+  if (PAGE_SIZE != HeaderPage::LEGACY_PAGE_SIZE) {
+    GTEST_SKIP() << "Legacy files have 4096-byte pages";
+  }
+
+  /*
+   * Write a file with every free page chained
+   */
+  {
+    fd = -1;
+    delete dmgr;
+    remove(path);
+    int legacy = open(path, O_RDWR | O_CREAT, 0644);
+    ASSERT_TRUE(legacy > 0);
+    Page pg;
+    /* Legacy headers leave the rest of the page uninitialized */
+    memset(pg.data, 0xa5, PAGE_SIZE);
+    HeaderPage *phpg = pg.getHeaderPage();
+    phpg->magic_number = phpg->MAGIC_NUMBER_V1;
+    phpg->free_page_number = 1;
+    phpg->number_of_pages = npages;
+    ASSERT_EQ(pwrite(legacy, pg.data, PAGE_SIZE, 0), PAGE_SIZE);
+    FreePage *pfpg = pg.getFreePage();
+    for (pagenum_t i = 1; i < npages; i++) {
+      pfpg->next_free_page_number = i + 1 < npages ? i + 1 : PN_EOFREE;
+      ASSERT_EQ(pwrite(legacy, pg.data, PAGE_SIZE, i * PAGE_SIZE), PAGE_SIZE);
+    }
+    close(legacy);
+
+    dmgr = new DiskManager();
+    fd = dmgr->openDatabase(path);
+    ASSERT_TRUE(fd > 0);
+  }
+
+  /*
+   * The chain is used up before the file grows
+   */
+  for (pagenum_t i = 1; i <= npages; i++) {
+    ASSERT_EQ(dmgr->allocPage(fd), i);
+  }
+  Page pg;
+  HeaderPage *phpg = pg.getHeaderPage();
+  dmgr->readPage(fd, PN_HEADER, &pg);
+  ASSERT_EQ(phpg->magic_number, phpg->MAGIC_NUMBER);
+  ASSERT_EQ(phpg->number_of_pages, 2 * npages);
+  ASSERT_EQ(phpg->fsm_free[0], npages - 1);
+}
+
+TEST_F(FileTest, allocPagesTest) {
+  const size_t npages = 1000;
+  std::vector<pagenum_t> page_numbers(npages);
+
+  /*
+   * A batch comes in one contiguous extent
+   */
+  ASSERT_EQ(dmgr->allocPages(fd, npages, page_numbers.data()), npages);
+  for (size_t i = 0; i < npages; i++) {
+    ASSERT_EQ(page_numbers[i], page_numbers[0] + i);
+  }
+  Page pg;
+  HeaderPage *phpg = pg.getHeaderPage();
+  dmgr->readPage(fd, PN_HEADER, &pg);
+  ASSERT_GE(phpg->number_of_pages, page_numbers[0] + npages);
+
+  /*
+   * Freed pages are reused
+   */
+  dmgr->freePages(fd, page_numbers.data(), npages / 2);
+  std::vector<pagenum_t> reused(npages / 2);
+  ASSERT_EQ(dmgr->allocPages(fd, npages / 2, reused.data()), npages / 2);
+  ASSERT_EQ(reused, std::vector<pagenum_t>(page_numbers.begin(),
+                                           page_numbers.begin() + npages / 2));
+}
+
+TEST_F(FileTest, readPagesTest) {
+  const int npages = 40;
+  Page pg;
+  for (int i = 1; i <= npages; i++) {
+    memset(pg.data, i, PAGE_SIZE);
+    dmgr->writePage(fd, i, &pg);
+  }
+
+  /*
+   * Runs of adjacent pages and scattered ones in any order
+   */
+  std::vector<pagenum_t> page_numbers = {7, 3, 1, 2, 20, 5, 4, 40, 21, 22};
+  std::vector<Page> pages(page_numbers.size());
+  std::vector<PageIO> ios;
+  for (size_t i = 0; i < page_numbers.size(); i++) {
+    ios.push_back({fd, page_numbers[i], &pages[i]});
+  }
+  dmgr->readPages(ios.data(), ios.size());
+  for (size_t i = 0; i < page_numbers.size(); i++) {
+    ASSERT_EQ(pages[i].data[0], static_cast<char>(page_numbers[i]));
+    ASSERT_EQ(pages[i].data[PAGE_SIZE - 1], static_cast<char>(page_numbers[i]));
+  }
+}
+
+TEST_F(FileTest, readPagesPastEnd) {
+  DiskManager *disk = static_cast<DiskManager *>(dmgr);
+  pagenum_t    end = lseek(fd, 0, SEEK_END) / PAGE_SIZE;
+  Page         pg;
+  memset(pg.data, 1, PAGE_SIZE);
+  dmgr->writePage(fd, end - 1, &pg);
+
+  /*
+   * The pages past the end of the file read as zeros
+   */
+  std::vector<Page>   pages(4);
+  std::vector<PageIO> ios;
+  for (size_t i = 0; i < pages.size(); i++) {
+    memset(pages[i].data, 0x5a, PAGE_SIZE);
+    ios.push_back({fd, end - 1 + i, &pages[i]});
+  }
+  dmgr->readPages(ios.data(), ios.size());
+  ASSERT_EQ(pages[0].data[0], 1);
+  ASSERT_EQ(pages[0].data[PAGE_SIZE - 1], 1);
+  for (size_t i = 1; i < pages.size(); i++) {
+    for (size_t j = 0; j < PAGE_SIZE; j++) {
+      ASSERT_EQ(pages[i].data[j], 0);
+    }
+  }
+  ASSERT_EQ(disk->getIOErrorCount(), 0);
+
+  /*
+   * A failed write is counted per page
+   */
+  int raw = open(path, O_RDONLY);
+  ASSERT_TRUE(raw > 0);
+  for (PageIO &io : ios) {
+    io.fd = raw;
+  }
+  dmgr->writePages(ios.data(), ios.size());
+  close(raw);
+  ASSERT_EQ(disk->getIOErrorCount(), ios.size());
+}
+
+TEST_F(FileTest, pageSizeTest) {
+  Page pg;
+  HeaderPage *phpg = pg.getHeaderPage();
+  dmgr->readPage(fd, PN_HEADER, &pg);
+  ASSERT_EQ(phpg->page_size, PAGE_SIZE);
+
+  /*
+   * A file of another page size isn't opened
+   */
+  phpg->page_size = 2 * PAGE_SIZE;
+  dmgr->writePage(fd, PN_HEADER, &pg);
+  fd = -1;
+  delete dmgr;
+  dmgr = new DiskManager();
+  ASSERT_EQ(dmgr->openDatabase(path), F_VALIDATEFAIL);
+
+  /*
+   * Files from before it was recorded have 4096-byte pages
+   */
+  int raw = open(path, O_RDWR);
+  ASSERT_TRUE(raw > 0);
+  phpg->page_size = 0;
+  ASSERT_EQ(pwrite(raw, pg.data, PAGE_SIZE, 0), PAGE_SIZE);
+  close(raw);
+  fd = dmgr->openDatabase(path);
+  if (PAGE_SIZE == HeaderPage::LEGACY_PAGE_SIZE) {
+    ASSERT_TRUE(fd > 0);
+  } else {
+    ASSERT_EQ(fd, F_VALIDATEFAIL);
+  }
+}
@@ -0,0 +1,276 @@
+#include "fsm.h"
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <set>
+#include <vector>
+#include "file.h"
+#include "page.h"
+
+class FsmTest : public testing::Test {
+ protected:
+  // You can define per-test set-up logic as usual.
+  void SetUp() override {
+    dmgr = new DiskManager();
+    fd = dmgr->openDatabase(path);
+    ASSERT_TRUE(fd > 0);
+    dmgr->readPage(fd, PN_HEADER, &hpg);
+    fsm = new FreeSpaceMap(dmgr, fd, hpg.getHeaderPage());
+  }
+
+  // You can define per-test tear-down logic as usual.
+  void TearDown() override {
+    delete fsm;
+    delete dmgr;
+    remove(path);
+  }
+
+  /*
+   * Replace the file with a legacy one of npages pages and
+   * open it, which upgrades it. Every odd page below the
+   * high-water mark at npages / 2 is in the free list.
+   */
+  void openLegacy(pagenum_t npages) {
+    delete fsm;
+    delete dmgr;
+    remove(path);
+    int legacy = open(path, O_RDWR | O_CREAT, 0644);
+    ASSERT_TRUE(legacy > 0);
+    ASSERT_EQ(ftruncate(legacy, npages * PAGE_SIZE), 0);
+    Page pg;
+    /* Legacy headers leave the rest of the page uninitialized */
+    memset(pg.data, 0xa5, PAGE_SIZE);
+    HeaderPage *phpg = pg.getHeaderPage();
+    phpg->magic_number = phpg->MAGIC_NUMBER_V2;
+    phpg->free_page_number = 1;
+    phpg->number_of_pages = npages;
+    phpg->high_water_mark = npages / 2;
+    ASSERT_EQ(pwrite(legacy, pg.data, PAGE_SIZE, 0), PAGE_SIZE);
+    FreePage *pfpg = pg.getFreePage();
+    for (pagenum_t i = 1; i < npages / 2; i += 2) {
+      pfpg->next_free_page_number = i + 2 < npages / 2 ? i + 2 : PN_EOFREE;
+      ASSERT_EQ(pwrite(legacy, pg.data, PAGE_SIZE, i * PAGE_SIZE), PAGE_SIZE);
+    }
+    close(legacy);
+
+    dmgr = new DiskManager();
+    fd = dmgr->openDatabase(path);
+    ASSERT_TRUE(fd > 0);
+    dmgr->readPage(fd, PN_HEADER, &hpg);
+    fsm = new FreeSpaceMap(dmgr, fd, hpg.getHeaderPage());
+  }
+
+  // Some expensive resource shared by all tests.
+  static PageManager  *dmgr;
+  static FreeSpaceMap *fsm;
+  static Page          hpg;
+  static const char   *path;
+  static int           fd;
+};
+
+PageManager  *FsmTest::dmgr = nullptr;
+FreeSpaceMap *FsmTest::fsm = nullptr;
+Page          FsmTest::hpg;
+const char   *FsmTest::path = "test.db";
+int           FsmTest::fd = -1;
+
+TEST_F(FsmTest, allocFree) {
+  HeaderPage *phpg = hpg.getHeaderPage();
+  ASSERT_EQ(fsm->getFreePages(), INITIAL_PAGES_NUMBER - 1);
+  ASSERT_TRUE(fsm->isAllocated(PN_HEADER));
+
+  for (pagenum_t i = 1; i < INITIAL_PAGES_NUMBER; i++) {
+    ASSERT_EQ(fsm->alloc(), i);
+    ASSERT_TRUE(fsm->isAllocated(i));
+  }
+  ASSERT_EQ(fsm->getFreePages(), 0);
+
+  /*
+   * The lowest freed page is reused first
+   */
+  fsm->free(100);
+  fsm->free(10);
+  ASSERT_FALSE(fsm->isAllocated(10));
+  ASSERT_EQ(fsm->alloc(), 10);
+  ASSERT_EQ(fsm->alloc(), 100);
+
+  /* The header is never freed */
+  fsm->free(PN_HEADER);
+  ASSERT_TRUE(fsm->isAllocated(PN_HEADER));
+
+  ASSERT_EQ(fsm->alloc(), INITIAL_PAGES_NUMBER);
+  ASSERT_EQ(phpg->number_of_pages, 2 * INITIAL_PAGES_NUMBER);
+  ASSERT_EQ(lseek(fd, 0, SEEK_END), 2 * INITIAL_PAGES_NUMBER * PAGE_SIZE);
+}
+
+TEST_F(FsmTest, allocExtent) {
+  ASSERT_EQ(fsm->alloc(), 1);
+  ASSERT_EQ(fsm->alloc(), 2);
+  ASSERT_EQ(fsm->alloc(), 3);
+  fsm->free(2);
+
+  /*
+   * An extent skips holes that are too small
+   */
+  pagenum_t first = fsm->alloc(8);
+  ASSERT_EQ(first, 4);
+  for (pagenum_t i = first; i < first + 8; i++) {
+    ASSERT_TRUE(fsm->isAllocated(i));
+  }
+  ASSERT_EQ(fsm->alloc(), 2);
+
+  /*
+   * A freed extent is reused as a whole
+   */
+  fsm->free(first, 8);
+  ASSERT_EQ(fsm->alloc(8), first);
+
+  /* An extent larger than the file grows it */
+  pagenum_t large = fsm->alloc(INITIAL_PAGES_NUMBER);
+  ASSERT_NE(large, PN_INVALID);
+  ASSERT_GE(hpg.getHeaderPage()->number_of_pages, large + INITIAL_PAGES_NUMBER);
+  ASSERT_EQ(fsm->alloc(0), PN_INVALID);
+  ASSERT_EQ(fsm->alloc(FSM_GROUP_PAGES), PN_INVALID);
+}
+
+TEST_F(FsmTest, allocManyFragmented) {
+  HeaderPage *phpg = hpg.getHeaderPage();
+  DiskManager *disk = static_cast<DiskManager *>(dmgr);
+  for (pagenum_t i = 1; i < INITIAL_PAGES_NUMBER; i++) {
+    ASSERT_EQ(fsm->alloc(), i);
+  }
+  for (pagenum_t i = 1; i < INITIAL_PAGES_NUMBER; i += 2) {
+    fsm->free(i);
+  }
+
+  /*
+   * Fragmented free pages are used before the file grows
+   */
+  uint64_t nsyncs = disk->getSyncCount();
+  std::vector<pagenum_t> page_numbers(INITIAL_PAGES_NUMBER);
+  ASSERT_EQ(fsm->allocMany(100, page_numbers.data()), 100);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(page_numbers[i], 2 * i + 1);
+  }
+  ASSERT_EQ(phpg->number_of_pages, INITIAL_PAGES_NUMBER);
+  ASSERT_EQ(disk->getSyncCount(), nsyncs);
+
+  /* The rest comes from a single growth with one barrier */
+  size_t nfree = fsm->getFreePages();
+  ASSERT_EQ(fsm->allocMany(INITIAL_PAGES_NUMBER, page_numbers.data()),
+            INITIAL_PAGES_NUMBER);
+  std::set<pagenum_t> unique(page_numbers.begin(), page_numbers.end());
+  ASSERT_EQ(unique.size(), INITIAL_PAGES_NUMBER);
+  for (size_t i = 0; i < nfree; i++) {
+    ASSERT_LT(page_numbers[i], INITIAL_PAGES_NUMBER);
+  }
+  ASSERT_EQ(phpg->number_of_pages, 2 * INITIAL_PAGES_NUMBER);
+  ASSERT_EQ(disk->getSyncCount(), nsyncs + 1);
+}
+
+TEST_F(FsmTest, bitmapPages) {
+  HeaderPage *phpg = hpg.getHeaderPage();
+
+  /*
+   * Allocate past the inlined group
+   */
+  std::set<pagenum_t> allocated;
+  for (int i = 0; i < FSM_INLINE_PAGES + 100; i++) {
+    pagenum_t page_number = fsm->alloc();
+    ASSERT_NE(page_number, PN_INVALID);
+    ASSERT_TRUE(allocated.insert(page_number).second);
+  }
+  ASSERT_EQ(phpg->fsm_groups, 2);
+  ASSERT_EQ(phpg->fsm_pages[1], FSM_INLINE_PAGES);
+  ASSERT_EQ(allocated.count(phpg->fsm_pages[1]), 0);
+  ASSERT_TRUE(fsm->isAllocated(phpg->fsm_pages[1]));
+
+  /*
+   * The map survives a restart
+   */
+  dmgr->writePage(fd, PN_HEADER, &hpg);
+  delete fsm;
+  delete dmgr;
+  dmgr = new DiskManager();
+  fd = dmgr->openDatabase(path);
+  dmgr->readPage(fd, PN_HEADER, &hpg);
+  fsm = new FreeSpaceMap(dmgr, fd, phpg);
+  for (pagenum_t page_number : allocated) {
+    ASSERT_TRUE(fsm->isAllocated(page_number));
+  }
+  fsm->free(FSM_INLINE_PAGES + 1);
+  ASSERT_EQ(fsm->alloc(), FSM_INLINE_PAGES + 1);
+}
+
+TEST_F(FsmTest, growToLimit) {
+  HeaderPage *phpg = hpg.getHeaderPage();
+
+  /*
+   * A group's worth of pages at a time, until the last
+   * growth stops at the limit
+   */
+  while (fsm->alloc(FSM_GROUP_PAGES - 1) != PN_INVALID) {
+  }
+  ASSERT_EQ(phpg->number_of_pages, FSM_MAX_PAGES);
+  ASSERT_EQ(phpg->fsm_groups, FSM_MAX_GROUPS);
+  ASSERT_EQ(lseek(fd, 0, SEEK_END),
+            static_cast<off_t>(FSM_MAX_PAGES) * PAGE_SIZE);
+
+  /* The free pages left are still used */
+  pagenum_t nfree = fsm->getFreePages();
+  ASSERT_GT(nfree, 0);
+  for (pagenum_t i = 0; i < nfree; i++) {
+    ASSERT_NE(fsm->alloc(), PN_INVALID);
+  }
+  ASSERT_EQ(fsm->alloc(), PN_INVALID);
+  ASSERT_EQ(phpg->number_of_pages, FSM_MAX_PAGES);
+}
+
+TEST_F(FsmTest, upgradeFreeList) {
+  const pagenum_t npages = 2 * FSM_INLINE_PAGES;
+  if (PAGE_SIZE != HeaderPage::LEGACY_PAGE_SIZE) {
+    GTEST_SKIP() << "Legacy files have 4096-byte pages";
+  }
+  openLegacy(npages);
+
+  HeaderPage *phpg = hpg.getHeaderPage();
+  ASSERT_EQ(phpg->magic_number, phpg->MAGIC_NUMBER);
+  ASSERT_EQ(phpg->fsm_groups, 2);
+  ASSERT_EQ(phpg->fsm_pages[1], npages);
+  ASSERT_EQ(phpg->number_of_pages, npages + 1);
+  for (pagenum_t i = 1; i < npages / 2; i++) {
+    ASSERT_EQ(fsm->isAllocated(i), i % 2 == 0);
+  }
+  ASSERT_EQ(fsm->getFreePages(), npages / 4 + npages / 2);
+  ASSERT_EQ(fsm->alloc(), 1);
+  ASSERT_EQ(fsm->alloc(2), npages / 2);
+}
+
+TEST_F(FsmTest, upgradeBitmapPages) {
+  const pagenum_t npages = FSM_INLINE_PAGES + FSM_GROUP_PAGES;
+  if (PAGE_SIZE != HeaderPage::LEGACY_PAGE_SIZE) {
+    GTEST_SKIP() << "Legacy files have 4096-byte pages";
+  }
+  openLegacy(npages);
+
+  /*
+   * The bitmap page of group 1 is appended in group 2, and
+   * is never freed from there
+   */
+  HeaderPage *phpg = hpg.getHeaderPage();
+  ASSERT_EQ(phpg->fsm_groups, 3);
+  ASSERT_EQ(phpg->fsm_pages[1], npages);
+  ASSERT_EQ(phpg->fsm_pages[2], npages + 1);
+  pagenum_t nfree = fsm->getFreePages();
+  fsm->free(npages, 2);
+  fsm->free(phpg->fsm_pages[1]);
+  ASSERT_TRUE(fsm->isAllocated(npages));
+  ASSERT_TRUE(fsm->isAllocated(npages + 1));
+  ASSERT_EQ(fsm->getFreePages(), nfree);
+  for (pagenum_t i = 0; i < nfree; i++) {
+    pagenum_t page_number = fsm->alloc();
+    ASSERT_NE(page_number, npages);
+    ASSERT_NE(page_number, npages + 1);
+  }
+}
@@ -0,0 +1,469 @@
+#include "heap.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "buffer.h"
+#include "file.h"
+#include "page.h"
+
+class HeapTest : public testing::Test {
+ protected:
+  // You can define per-test set-up logic as usual.
+  void SetUp() override {
+    remove(path);
+    dmgr = new DiskManager();
+    bmgr = new BufferManager(dmgr);
+    table_id = bmgr->openDatabase(path);
+    ASSERT_TRUE(table_id > 0);
+    heap = new HeapFile(bmgr, table_id);
+  }
+
+  // You can define per-test tear-down logic as usual.
+  void TearDown() override {
+    delete heap;
+    delete bmgr;
+    delete dmgr;
+    remove(path);
+  }
+
+  void reopen() {
+    delete heap;
+    delete bmgr;
+    delete dmgr;
+    dmgr = new DiskManager();
+    bmgr = new BufferManager(dmgr);
+    table_id = bmgr->openDatabase(path);
+    ASSERT_TRUE(table_id > 0);
+    heap = new HeapFile(bmgr, table_id);
+  }
+
+  /*
+   * Walk the heap pages, checking the free space of each
+   * page against its records and its class list. Returns
+   * the number of pages.
+   */
+  size_t checkPages() {
+    Page hpg, pg;
+    bmgr->readPage(table_id, PN_HEADER, &hpg);
+    const HeaderPage *phpg = hpg.getHeaderPage();
+    std::map<pagenum_t, uint32_t> classes;
+    for (uint32_t c = 0; c < HEAP_FREE_CLASSES; c++) {
+      pagenum_t prev = PN_INVALID;
+      for (pagenum_t pn = phpg->heap_free_lists[c]; pn != PN_INVALID;) {
+        bmgr->readPage(table_id, pn, &pg);
+        EXPECT_EQ(pg.getSlottedPage()->prev_free_number, prev);
+        EXPECT_TRUE(classes.emplace(pn, c).second);
+        prev = pn;
+        pn = pg.getSlottedPage()->next_free_number;
+      }
+    }
+
+    size_t npages = 0;
+    pagenum_t last = PN_INVALID;
+    for (pagenum_t pn = phpg->heap_first_page_number; pn != PN_INVALID;) {
+      bmgr->readPage(table_id, pn, &pg);
+      const SlottedPage *page = pg.getSlottedPage();
+      uint32_t used = SlottedPage::HEADER_SIZE +
+                      page->number_of_slots * sizeof(SlottedPage::Slot);
+      uint32_t nfree = 0;
+      for (uint32_t i = 0; i < page->number_of_slots; i++) {
+        if (page->slots[i].offset == 0) {
+          nfree += 1;
+        } else {
+          used += std::max<uint32_t>(page->slots[i].length,
+                                     SlottedPage::MIN_RECORD_SIZE);
+        }
+      }
+      EXPECT_EQ(page->free_space, PAGE_SIZE - used);
+      EXPECT_EQ(page->number_of_free_slots, nfree);
+      EXPECT_EQ(classes[pn], page->free_class);
+      EXPECT_EQ(page->free_class,
+                std::min<uint32_t>(HEAP_FREE_CLASSES - 1,
+                                   page->free_space * HEAP_FREE_CLASSES /
+                                       PAGE_SIZE));
+      npages += 1;
+      last = pn;
+      pn = page->next_page_number;
+    }
+    EXPECT_EQ(phpg->heap_last_page_number, last);
+    EXPECT_EQ(classes.size(), npages);
+    return npages;
+  }
+
+  static std::string makeRecord(uint64_t id, size_t length) {
+    std::string record(length, static_cast<char>('a' + id % 26));
+    memcpy(&record[0], &id, std::min(length, sizeof(id)));
+    return record;
+  }
+
+  static PageManager   *dmgr;
+  static BufferManager *bmgr;
+  static HeapFile      *heap;
+  static const char    *path;
+  static int            table_id;
+};
+
+PageManager   *HeapTest::dmgr     = nullptr;
+BufferManager *HeapTest::bmgr     = nullptr;
+HeapFile      *HeapTest::heap     = nullptr;
+const char    *HeapTest::path     = "test.db";
+int            HeapTest::table_id = -1;
+
+TEST_F(HeapTest, insertGet) {
+  const int nrecords = 20000;
+  std::mt19937 gen(5);
+  std::vector<RecordId> rids(nrecords);
+  std::vector<std::string> records(nrecords);
+  size_t total = 0;
+  for (int i = 0; i < nrecords; i++) {
+    records[i] = makeRecord(i, gen() % 300);
+    total += records[i].size();
+    ASSERT_EQ(heap->insertRecord(records[i].data(), records[i].size(),
+                                 &rids[i]),
+              HEAP_SUCCESS);
+  }
+
+  std::string record;
+  for (int i = 0; i < nrecords; i++) {
+    ASSERT_EQ(heap->getRecord(rids[i], &record), HEAP_SUCCESS);
+    ASSERT_EQ(record, records[i]);
+  }
+  ASSERT_EQ(heap->getRecord({rids[0].page_number, 100000}, &record),
+            HEAP_NOTFOUND);
+  ASSERT_EQ(heap->getRecord({PN_INVALID, 0}, &record), HEAP_NOTFOUND);
+
+  /*
+   * Inserts fill the pages before taking new ones
+   */
+  size_t npages = checkPages();
+  size_t per_record = SlottedPage::MIN_RECORD_SIZE + sizeof(SlottedPage::Slot);
+  ASSERT_LE(npages, (total + nrecords * per_record) / (PAGE_SIZE * 3 / 4) + 1);
+
+  reopen();
+  for (int i = 0; i < nrecords; i++) {
+    ASSERT_EQ(heap->getRecord(rids[i], &record), HEAP_SUCCESS);
+    ASSERT_EQ(record, records[i]);
+  }
+
+  std::string large(HeapFile::MAX_RECORD_SIZE + 1, 'x');
+  RecordId rid;
+  ASSERT_EQ(heap->insertRecord(large.data(), large.size(), &rid),
+            HEAP_TOOLARGE);
+  large.pop_back();
+  ASSERT_EQ(heap->insertRecord(large.data(), large.size(), &rid), HEAP_SUCCESS);
+  ASSERT_EQ(heap->getRecord(rid, &record), HEAP_SUCCESS);
+  ASSERT_EQ(record, large);
+  checkPages();
+}
+
+TEST_F(HeapTest, updateRecord) {
+  const int nrecords = 1000;
+  std::vector<RecordId> rids(nrecords);
+  for (int i = 0; i < nrecords; i++) {
+    std::string record = makeRecord(i, 100);
+    ASSERT_EQ(heap->insertRecord(record.data(), record.size(), &rids[i]),
+              HEAP_SUCCESS);
+  }
+
+  /*
+   * Shrinking and growing within the page keeps the record
+   * in place, compacting the page if needed
+   */
+  std::string record;
+  std::string small = makeRecord(1, 20);
+  std::string grown = makeRecord(1, 180);
+  ASSERT_EQ(heap->updateRecord(rids[1], small.data(), small.size()),
+            HEAP_SUCCESS);
+  ASSERT_EQ(heap->updateRecord(rids[1], grown.data(), grown.size()),
+            HEAP_SUCCESS);
+  ASSERT_EQ(heap->getRecord(rids[1], &record), HEAP_SUCCESS);
+  ASSERT_EQ(record, grown);
+  checkPages();
+
+  /*
+   * A record that outgrows its full page is forwarded, and
+   * keeps its RecordId wherever it goes
+   */
+  std::string large = makeRecord(2, PAGE_SIZE / 2);
+  std::string larger = makeRecord(2, PAGE_SIZE * 3 / 4);
+  ASSERT_EQ(heap->updateRecord(rids[2], large.data(), large.size()),
+            HEAP_SUCCESS);
+  ASSERT_EQ(heap->getRecord(rids[2], &record), HEAP_SUCCESS);
+  ASSERT_EQ(record, large);
+  ASSERT_EQ(heap->updateRecord(rids[2], larger.data(), larger.size()),
+            HEAP_SUCCESS);
+  ASSERT_EQ(heap->getRecord(rids[2], &record), HEAP_SUCCESS);
+  ASSERT_EQ(record, larger);
+  checkPages();
+
+  /*
+   * It comes back when it fits again
+   */
+  std::string tiny = makeRecord(2, 8);
+  ASSERT_EQ(heap->updateRecord(rids[2], tiny.data(), tiny.size()),
+            HEAP_SUCCESS);
+  ASSERT_EQ(heap->getRecord(rids[2], &record), HEAP_SUCCESS);
+  ASSERT_EQ(record, tiny);
+  {
+    Page pg;
+    bmgr->readPage(table_id, rids[2].page_number, &pg);
+    ASSERT_EQ(pg.getSlottedPage()->slots[rids[2].slot].flags, 0);
+  }
+
+  ASSERT_EQ(heap->updateRecord(rids[3], larger.data(), larger.size()),
+            HEAP_SUCCESS);
+  ASSERT_EQ(heap->deleteRecord(rids[3]), HEAP_SUCCESS);
+  ASSERT_EQ(heap->getRecord(rids[3], &record), HEAP_NOTFOUND);
+  ASSERT_EQ(heap->updateRecord(rids[3], tiny.data(), tiny.size()),
+            HEAP_NOTFOUND);
+  checkPages();
+
+  reopen();
+  for (int i = 0; i < nrecords; i++) {
+    if (i == 3) continue;
+    ASSERT_EQ(heap->getRecord(rids[i], &record), HEAP_SUCCESS);
+    if (i == 1) {
+      ASSERT_EQ(record, grown);
+    } else if (i == 2) {
+      ASSERT_EQ(record, tiny);
+    } else {
+      ASSERT_EQ(record, makeRecord(i, 100));
+    }
+  }
+}
+
+TEST_F(HeapTest, deleteRecord) {
+  const int nrecords = 5000;
+  std::vector<RecordId> rids(nrecords);
+  std::string record = makeRecord(0, 200);
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < nrecords; i++) {
+      ASSERT_EQ(heap->insertRecord(record.data(), record.size(), &rids[i]),
+                HEAP_SUCCESS);
+    }
+    size_t npages = checkPages();
+    for (int i = 0; i < nrecords; i++) {
+      ASSERT_EQ(heap->deleteRecord(rids[i]), HEAP_SUCCESS);
+      ASSERT_EQ(heap->deleteRecord(rids[i]), HEAP_NOTFOUND);
+    }
+
+    /*
+     * Emptied pages are reused by the next round
+     */
+    ASSERT_EQ(checkPages(), npages);
+  }
+
+  Page pg;
+  bmgr->readPage(table_id, rids[0].page_number, &pg);
+  ASSERT_EQ(pg.getSlottedPage()->number_of_slots, 0);
+  ASSERT_EQ(pg.getSlottedPage()->free_class, HEAP_FREE_CLASSES - 1);
+}
+
+TEST_F(HeapTest, largeRecords) {
+  /*
+   * A record of more than the last class reuses an emptied
+   * page instead of growing the heap
+   */
+  RecordId rid;
+  for (uint32_t length :
+       {uint32_t{PAGE_SIZE * 15 / 16}, HeapFile::MAX_RECORD_SIZE}) {
+    std::string record = makeRecord(length, length);
+    for (int i = 0; i < 100; i++) {
+      ASSERT_EQ(heap->insertRecord(record.data(), record.size(), &rid),
+                HEAP_SUCCESS);
+      ASSERT_EQ(heap->deleteRecord(rid), HEAP_SUCCESS);
+    }
+    ASSERT_EQ(checkPages(), 1);
+  }
+
+  /*
+   * The first page of the last class is skipped when it
+   * has no room
+   */
+  std::string small = makeRecord(0, PAGE_SIZE / 4);
+  ASSERT_EQ(heap->insertRecord(small.data(), small.size(), &rid),
+            HEAP_SUCCESS);
+  std::string large = makeRecord(1, HeapFile::MAX_RECORD_SIZE);
+  ASSERT_EQ(heap->insertRecord(large.data(), large.size(), &rid),
+            HEAP_SUCCESS);
+  ASSERT_EQ(checkPages(), 2);
+}
+
+TEST_F(HeapTest, randomOperations) {
+  std::vector<std::pair<RecordId, std::string>> model;
+  std::mt19937 gen(99);
+  std::string record;
+
+  for (int i = 0; i < 50000; i++) {
+    size_t length = gen() % 8 == 0 ? gen() % (PAGE_SIZE / 2) : gen() % 120;
+    switch (model.empty() ? 0 : gen() % 4) {
+      case 0: {
+        RecordId rid;
+        std::string r = makeRecord(i, length);
+        ASSERT_EQ(heap->insertRecord(r.data(), r.size(), &rid), HEAP_SUCCESS);
+        model.push_back({rid, r});
+        break;
+      }
+      case 1: {
+        auto &entry = model[gen() % model.size()];
+        entry.second = makeRecord(i, length);
+        ASSERT_EQ(heap->updateRecord(entry.first, entry.second.data(),
+                                     entry.second.size()),
+                  HEAP_SUCCESS);
+        break;
+      }
+      case 2: {
+        size_t j = gen() % model.size();
+        ASSERT_EQ(heap->deleteRecord(model[j].first), HEAP_SUCCESS);
+        model[j] = model.back();
+        model.pop_back();
+        break;
+      }
+      default: {
+        auto &entry = model[gen() % model.size()];
+        ASSERT_EQ(heap->getRecord(entry.first, &record), HEAP_SUCCESS);
+        ASSERT_EQ(record, entry.second);
+      }
+    }
+  }
+  checkPages();
+
+  reopen();
+  for (const auto &entry : model) {
+    ASSERT_EQ(heap->getRecord(entry.first, &record), HEAP_SUCCESS);
+    ASSERT_EQ(record, entry.second);
+  }
+}
+
+TEST_F(HeapTest, pinnedFrames) {
+  const uint64_t nframes = 16;
+  delete heap;
+  delete bmgr;
+  bmgr = new BufferManager(dmgr, REPLACER_CLOCK, nframes);
+  table_id = bmgr->openDatabase(path);
+  ASSERT_TRUE(table_id > 0);
+  heap = new HeapFile(bmgr, table_id);
+  std::vector<pagenum_t> pinned(nframes);
+  ASSERT_EQ(bmgr->allocPages(table_id, nframes, pinned.data()), nframes);
+
+  /*
+   * Another thread keeps taking every free frame for a
+   * while, so any fetch may fail. A failure changes
+   * nothing.
+   */
+  std::atomic<bool> stop(false);
+  std::thread hog([&] {
+    while (!stop) {
+      std::vector<BufferManager::ReadPageGuard> guards;
+      for (pagenum_t pn : pinned) {
+        guards.push_back(bmgr->fetchPageRead(table_id, pn));
+      }
+      std::this_thread::yield();
+      guards.clear();
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+  });
+  auto retry = [&](auto op) {
+    int nfailures = 0;
+    for (;;) {
+      int ret = op();
+      if (ret != HEAP_NOFRAME) {
+        EXPECT_EQ(ret, HEAP_SUCCESS);
+        return nfailures;
+      }
+      nfailures += 1;
+    }
+  };
+
+  std::vector<std::pair<RecordId, std::string>> model;
+  std::mt19937 gen(13);
+  std::string record;
+  int nfailures = 0;
+  for (int i = 0; i < 2000; i++) {
+    if (model.empty() || gen() % 3 != 0) {
+      RecordId rid;
+      std::string r = makeRecord(i, gen() % (PAGE_SIZE / 3));
+      nfailures += retry(
+          [&] { return heap->insertRecord(r.data(), r.size(), &rid); });
+      model.push_back({rid, r});
+    } else {
+      size_t j = gen() % model.size();
+      nfailures += retry([&] { return heap->deleteRecord(model[j].first); });
+      model[j] = model.back();
+      model.pop_back();
+    }
+  }
+  stop = true;
+  hog.join();
+  ASSERT_GT(nfailures, 0);
+  checkPages();
+  for (const auto &entry : model) {
+    ASSERT_EQ(heap->getRecord(entry.first, &record), HEAP_SUCCESS);
+    ASSERT_EQ(record, entry.second);
+  }
+
+  /*
+   * No failure left a record behind
+   */
+  for (const auto &entry : model) {
+    ASSERT_EQ(heap->deleteRecord(entry.first), HEAP_SUCCESS);
+  }
+  Page hpg, pg;
+  bmgr->readPage(table_id, PN_HEADER, &hpg);
+  for (pagenum_t pn = hpg.getHeaderPage()->heap_first_page_number;
+       pn != PN_INVALID; pn = pg.getSlottedPage()->next_page_number) {
+    bmgr->readPage(table_id, pn, &pg);
+    ASSERT_EQ(pg.getSlottedPage()->number_of_slots, 0);
+  }
+  checkPages();
+}
+
+TEST_F(HeapTest, concurrentReaders) {
+  const int nrecords = 2000;
+  const int nreaders = 3;
+  std::vector<RecordId> rids(nrecords);
+  for (int i = 0; i < nrecords; i++) {
+    std::string r = makeRecord(i, 50);
+    ASSERT_EQ(heap->insertRecord(r.data(), r.size(), &rids[i]), HEAP_SUCCESS);
+  }
+
+  /*
+   * Records change size, and move between pages, under the
+   * readers. A reader sees some whole version of a record.
+   */
+  std::atomic<bool> stop(false);
+  std::atomic<int> nerrors(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < nreaders; t++) {
+    readers.emplace_back([&, t]() {
+      std::mt19937 gen(t);
+      std::string record;
+      while (!stop) {
+        int i = gen() % nrecords;
+        if (heap->getRecord(rids[i], &record) != HEAP_SUCCESS ||
+            record != makeRecord(i, record.size())) {
+          nerrors += 1;
+        }
+      }
+    });
+  }
+
+  std::mt19937 gen(42);
+  for (int round = 0; round < 20000; round++) {
+    int i = gen() % nrecords;
+    size_t length = gen() % 4 == 0 ? PAGE_SIZE / 3 : 8 + gen() % 100;
+    std::string r = makeRecord(i, length);
+    ASSERT_EQ(heap->updateRecord(rids[i], r.data(), r.size()), HEAP_SUCCESS);
+  }
+  stop = true;
+  for (std::thread &reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(nerrors, 0);
+  checkPages();
+}
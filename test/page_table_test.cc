@@ -0,0 +1,75 @@
+#include "page_table.h"
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <utility>
+
+TEST(PageTableTest, insertFindErase) {
+  PageTable table(BUFFER_SIZE);
+
+  ASSERT_TRUE(table.insert(3, 1, 10));
+  ASSERT_TRUE(table.insert(4, 1, 11));
+  ASSERT_FALSE(table.insert(3, 1, 12));
+  ASSERT_EQ(table.getSize(), 2);
+
+  ASSERT_EQ(table.find(3, 1), 10);
+  ASSERT_EQ(table.find(4, 1), 11);
+  ASSERT_EQ(table.find(3, 2), FRAME_INVALID);
+
+  ASSERT_TRUE(table.erase(3, 1));
+  ASSERT_FALSE(table.erase(3, 1));
+  ASSERT_EQ(table.find(3, 1), FRAME_INVALID);
+  ASSERT_EQ(table.find(4, 1), 11);
+  ASSERT_EQ(table.getSize(), 1);
+}
+
+TEST(PageTableTest, grow) {
+  const int npages = 10000;
+  PageTable table;
+
+  for (int i = 0; i < npages; i++) {
+    ASSERT_TRUE(table.insert(3, i, static_cast<frameid_t>(i)));
+  }
+  ASSERT_EQ(table.getSize(), npages);
+  for (int i = 0; i < npages; i++) {
+    ASSERT_EQ(table.find(3, i), static_cast<frameid_t>(i));
+  }
+}
+
+TEST(PageTableTest, randomOperations) {
+  const int nops = 200000;
+  PageTable table(64);
+  std::map<std::pair<int, pagenum_t>, frameid_t> expected;
+  std::mt19937 rng(0);
+
+  /*
+   * Churn a small key space, so that tombstones pile up
+   * and get cleaned by rehashing.
+   */
+  for (int i = 0; i < nops; i++) {
+    int table_id = 3 + rng() % 2;
+    pagenum_t page_number = rng() % 512;
+    auto key = std::make_pair(table_id, page_number);
+    switch (rng() % 3) {
+      case 0: {
+        frameid_t frame = static_cast<frameid_t>(i);
+        bool inserted = expected.find(key) == expected.end();
+        ASSERT_EQ(table.insert(table_id, page_number, frame), inserted);
+        if (inserted) expected[key] = frame;
+        break;
+      }
+      case 1: {
+        bool erased = expected.erase(key) > 0;
+        ASSERT_EQ(table.erase(table_id, page_number), erased);
+        break;
+      }
+      default: {
+        auto it = expected.find(key);
+        frameid_t frame = it != expected.end() ? it->second : FRAME_INVALID;
+        ASSERT_EQ(table.find(table_id, page_number), frame);
+        break;
+      }
+    }
+    ASSERT_EQ(table.getSize(), expected.size());
+  }
+}
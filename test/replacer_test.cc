@@ -0,0 +1,72 @@
+#include "replacer.h"
+#include <gtest/gtest.h>
+
+static bool claimAll(frameid_t frame) { return true; }
+
+TEST(ReplacerTest, lruOrder) {
+  LRUReplacer replacer(4);
+  for (frameid_t i = 0; i < 4; i++) replacer.admit(i, i, false);
+  replacer.access(0);
+
+  ASSERT_EQ(replacer.victim(claimAll), 1);
+  ASSERT_EQ(replacer.victim(claimAll), 2);
+  ASSERT_EQ(replacer.victim(claimAll), 3);
+  ASSERT_EQ(replacer.victim(claimAll), 0);
+  ASSERT_EQ(replacer.victim(claimAll), FRAME_INVALID);
+}
+
+TEST(ReplacerTest, lruCold) {
+  LRUReplacer replacer(4);
+  for (frameid_t i = 0; i < 3; i++) replacer.admit(i, i, false);
+  replacer.admit(3, 3, true);
+
+  ASSERT_EQ(replacer.victim(claimAll), 3);
+  ASSERT_EQ(replacer.victim(claimAll), 0);
+}
+
+TEST(ReplacerTest, clockSecondChance) {
+  ClockReplacer replacer(4);
+  for (frameid_t i = 0; i < 4; i++) replacer.admit(i, i, true);
+  replacer.access(0);
+  replacer.access(2);
+
+  ASSERT_EQ(replacer.victim(claimAll), 1);
+  ASSERT_EQ(replacer.victim(claimAll), 3);
+  ASSERT_EQ(replacer.victim(claimAll), 0);
+  ASSERT_EQ(replacer.victim(claimAll), 2);
+  ASSERT_EQ(replacer.victim(claimAll), FRAME_INVALID);
+}
+
+TEST(ReplacerTest, clockPinned) {
+  ClockReplacer replacer(4);
+  for (frameid_t i = 0; i < 4; i++) replacer.admit(i, i, false);
+
+  auto claimOdd = [](frameid_t frame) { return frame % 2 == 1; };
+  ASSERT_EQ(replacer.victim(claimOdd), 1);
+  ASSERT_EQ(replacer.victim(claimOdd), 3);
+  ASSERT_EQ(replacer.victim(claimOdd), FRAME_INVALID);
+}
+
+TEST(ReplacerTest, twoQScanResistance) {
+  const frameid_t capacity = 16;
+  TwoQReplacer replacer(capacity);
+
+  /*
+   * Load a hot page twice, so that it reaches Am
+   */
+  replacer.admit(0, 1000, false);
+  replacer.access(0);
+  for (frameid_t i = 1; i < capacity; i++) replacer.admit(i, i, false);
+  ASSERT_EQ(replacer.victim(claimAll), 0);
+  replacer.admit(0, 1000, false);
+
+  /*
+   * A long scan only recycles A1in frames
+   */
+  for (uint64_t tag = 100; tag < 200; tag++) {
+    frameid_t frame = replacer.victim(claimAll);
+    ASSERT_NE(frame, 0);
+    ASSERT_NE(frame, FRAME_INVALID);
+    replacer.admit(frame, tag, false);
+  }
+}
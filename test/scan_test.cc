@@ -0,0 +1,222 @@
+#include "scan.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "buffer.h"
+#include "file.h"
+#include "heap.h"
+#include "page.h"
+
+TEST(ScanKernelTest, filter) {
+  std::mt19937_64 gen(17);
+  const int64_t bounds[] = {INT64_MIN, INT32_MIN, -1000, -1, 0,
+                            1,         999,       INT32_MAX, INT64_MAX};
+
+  for (int simd = SIMD_SCALAR; simd <= ScanKernel::detect(); simd++) {
+    for (size_t n : {1, 63, 64, 65, 1000, 1024}) {
+      std::vector<int32_t> ints(n);
+      std::vector<int64_t> longs(n);
+      for (size_t i = 0; i < n; i++) {
+        ints[i] = static_cast<int32_t>(gen() % 4000) - 2000;
+        longs[i] = gen() % 3 == 0 ? static_cast<int64_t>(gen())
+                                  : static_cast<int64_t>(gen() % 4000) - 2000;
+      }
+      ints[0] = INT32_MIN;
+      longs[0] = INT64_MAX;
+
+      for (int64_t low : bounds) {
+        for (int64_t high : bounds) {
+          std::vector<uint64_t> bits32((n + 63) / 64, ~0ULL);
+          std::vector<uint64_t> bits64((n + 63) / 64, ~0ULL);
+          ScanKernel::filter(simd, SCAN_INT32,
+                             reinterpret_cast<const char *>(ints.data()), n,
+                             low, high, bits32.data());
+          ScanKernel::filter(simd, SCAN_INT64,
+                             reinterpret_cast<const char *>(longs.data()), n,
+                             low, high, bits64.data());
+          for (size_t i = 0; i < (n + 63) / 64 * 64; i++) {
+            bool in32 = i < n && ints[i] >= low && ints[i] <= high;
+            bool in64 = i < n && longs[i] >= low && longs[i] <= high;
+            ASSERT_EQ((bits32[i / 64] >> (i % 64)) & 1, in32)
+                << "simd " << simd << " n " << n << " row " << i;
+            ASSERT_EQ((bits64[i / 64] >> (i % 64)) & 1, in64)
+                << "simd " << simd << " n " << n << " row " << i;
+          }
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Records hold an int32 at offset 0 and an int64 at offset
+ * 4, followed by a variable-length tail
+ */
+class ScanTest : public testing::TestWithParam<int> {
+ protected:
+  // You can define per-test set-up logic as usual.
+  void SetUp() override {
+    remove(path);
+    dmgr = new DiskManager();
+    bmgr = new BufferManager(dmgr);
+    table_id = bmgr->openDatabase(path);
+    ASSERT_TRUE(table_id > 0);
+    heap = new HeapFile(bmgr, table_id);
+  }
+
+  // You can define per-test tear-down logic as usual.
+  void TearDown() override {
+    delete heap;
+    delete bmgr;
+    delete dmgr;
+    remove(path);
+  }
+
+  static std::string makeRecord(int32_t a, int64_t b, size_t tail) {
+    std::string record(12 + tail, 'x');
+    memcpy(&record[0], &a, sizeof(a));
+    memcpy(&record[4], &b, sizeof(b));
+    return record;
+  }
+
+  /*
+   * Scan with the predicates, checking the rows against the
+   * records. Returns the record ids of the rows by a.
+   */
+  std::map<int32_t, RecordId> scan(
+      const std::vector<ScanPredicate> &predicates) {
+    HeapScan scan(bmgr, table_id, {{4, SCAN_INT64}, {0, SCAN_INT32}},
+                  predicates, GetParam());
+    EXPECT_EQ(scan.getSimd(), std::min(GetParam(), ScanKernel::detect()));
+    std::map<int32_t, RecordId> rows;
+    ColumnBatch batch;
+    std::string record;
+    while (scan.next(&batch) == HEAP_SUCCESS) {
+      EXPECT_GT(batch.size, 0);
+      for (size_t i = 0; i < batch.size; i++) {
+        int32_t a = batch.getInt32(1)[i];
+        EXPECT_EQ(heap->getRecord(batch.rids[i], &record), HEAP_SUCCESS);
+        EXPECT_EQ(memcmp(&record[0], &a, sizeof(a)), 0);
+        EXPECT_EQ(memcmp(&record[4], &batch.getInt64(0)[i], sizeof(int64_t)),
+                  0);
+        EXPECT_TRUE(rows.emplace(a, batch.rids[i]).second);
+      }
+    }
+    EXPECT_EQ(scan.next(&batch), HEAP_NOTFOUND);
+    return rows;
+  }
+
+  static PageManager   *dmgr;
+  static BufferManager *bmgr;
+  static HeapFile      *heap;
+  static const char    *path;
+  static int            table_id;
+};
+
+PageManager   *ScanTest::dmgr     = nullptr;
+BufferManager *ScanTest::bmgr     = nullptr;
+HeapFile      *ScanTest::heap     = nullptr;
+const char    *ScanTest::path     = "test.db";
+int            ScanTest::table_id = -1;
+
+TEST_P(ScanTest, predicates) {
+  const int nrecords = 20000;
+  std::mt19937 gen(8);
+  std::vector<RecordId> rids(nrecords);
+  std::vector<int64_t> bs(nrecords);
+  for (int i = 0; i < nrecords; i++) {
+    bs[i] = static_cast<int64_t>(gen() % 1000) - 500;
+    std::string record = makeRecord(i, bs[i], gen() % 64);
+    ASSERT_EQ(heap->insertRecord(record.data(), record.size(), &rids[i]),
+              HEAP_SUCCESS);
+  }
+
+  /*
+   * Short records are skipped, removed ones aren't seen and
+   * moved ones are seen once under their record id
+   */
+  RecordId rid;
+  ASSERT_EQ(heap->insertRecord("short", 5, &rid), HEAP_SUCCESS);
+  std::vector<bool> removed(nrecords, false);
+  for (int i = 0; i < nrecords; i += 10) {
+    ASSERT_EQ(heap->deleteRecord(rids[i]), HEAP_SUCCESS);
+    removed[i] = true;
+  }
+  for (int i = 5; i < nrecords; i += 100) {
+    std::string record = makeRecord(i, bs[i], PAGE_SIZE / 2);
+    ASSERT_EQ(heap->updateRecord(rids[i], record.data(), record.size()),
+              HEAP_SUCCESS);
+  }
+
+  auto check = [&](const std::vector<ScanPredicate> &predicates,
+                   auto keep) {
+    std::map<int32_t, RecordId> rows = scan(predicates);
+    size_t expected = 0;
+    for (int i = 0; i < nrecords; i++) {
+      if (removed[i] || !keep(i)) continue;
+      expected += 1;
+      auto it = rows.find(i);
+      ASSERT_NE(it, rows.end()) << i;
+      ASSERT_EQ(it->second.page_number, rids[i].page_number);
+      ASSERT_EQ(it->second.slot, rids[i].slot);
+    }
+    ASSERT_EQ(rows.size(), expected);
+  };
+
+  check({}, [](int) { return true; });
+  check({{1, PRED_EQ, 777, 0}}, [](int i) { return i == 777; });
+  check({{0, PRED_LT, -250, 0}}, [&](int i) { return bs[i] < -250; });
+  check({{0, PRED_BETWEEN, -10, 10}},
+        [&](int i) { return bs[i] >= -10 && bs[i] <= 10; });
+  check({{1, PRED_BETWEEN, 1000, 5000}, {0, PRED_LT, 0, 0}},
+        [&](int i) { return i >= 1000 && i <= 5000 && bs[i] < 0; });
+  check({{0, PRED_LT, INT64_MIN, 0}}, [](int) { return false; });
+  check({{1, PRED_EQ, INT64_MAX, 0}}, [](int) { return false; });
+}
+
+TEST_P(ScanTest, emptyHeap) {
+  HeapScan scan(bmgr, table_id, {{0, SCAN_INT32}}, {}, GetParam());
+  ColumnBatch batch;
+  ASSERT_EQ(scan.next(&batch), HEAP_NOTFOUND);
+  ASSERT_EQ(batch.size, 0);
+}
+
+TEST_P(ScanTest, reusedBatch) {
+  const int nrecords = 5000;
+  for (int i = 0; i < nrecords; i++) {
+    std::string record = makeRecord(i, -i, 0);
+    RecordId rid;
+    ASSERT_EQ(heap->insertRecord(record.data(), record.size(), &rid),
+              HEAP_SUCCESS);
+  }
+
+  /*
+   * The batch grows for one int32 column first, so the
+   * int64 column of the next scan must be sized again
+   */
+  ColumnBatch batch;
+  HeapScan narrow(bmgr, table_id, {{0, SCAN_INT32}}, {}, GetParam());
+  int nrows = 0;
+  while (narrow.next(&batch) == HEAP_SUCCESS) {
+    nrows += batch.size;
+  }
+  ASSERT_EQ(nrows, nrecords);
+
+  HeapScan wide(bmgr, table_id, {{0, SCAN_INT32}, {4, SCAN_INT64}}, {},
+                GetParam());
+  nrows = 0;
+  while (wide.next(&batch) == HEAP_SUCCESS) {
+    ASSERT_GE(batch.columns[1].size(), batch.size * sizeof(int64_t));
+    for (size_t i = 0; i < batch.size; i++) {
+      ASSERT_EQ(batch.getInt64(1)[i], -batch.getInt32(0)[i]);
+    }
+    nrows += batch.size;
+  }
+  ASSERT_EQ(nrows, nrecords);
+}
+
+INSTANTIATE_TEST_SUITE_P(Simd, ScanTest,
+                         testing::Values(SIMD_SCALAR, SIMD_SSE, SIMD_AVX2));
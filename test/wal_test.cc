@@ -0,0 +1,351 @@
+#include "wal.h"
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "buffer.h"
+#include "file.h"
+#include "fsm.h"
+#include "page.h"
+
+class WalTest : public testing::Test {
+ protected:
+  // You can define per-test set-up logic as usual.
+  void SetUp() override {
+    remove(path);
+    remove(log_path);
+  }
+
+  // You can define per-test tear-down logic as usual.
+  void TearDown() override {
+    remove(path);
+    remove(log_path);
+  }
+
+  static const char *path;
+  static const char *log_path;
+};
+
+const char *WalTest::path = "test.db";
+const char *WalTest::log_path = "test.db.wal";
+
+TEST_F(WalTest, crashRecovery) {
+  const int npages = 50;
+
+  /*
+   * The child syncs through the log and crashes without
+   * writing any buffered page back.
+   */
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    PageManager *dmgr = new DiskManager(SYNC_GROUP, IO_BUFFERED, LOG_WAL);
+    PageManager *bmgr = new BufferManager(dmgr);
+    int table_id = bmgr->openDatabase(path);
+    Page pg;
+    for (int i = 0; i < npages; i++) {
+      pagenum_t pn = bmgr->allocPage(table_id);
+      std::string d = std::to_string(pn);
+      strncpy(pg.data, d.c_str(), d.size() + 1);
+      bmgr->writePage(table_id, pn, &pg);
+    }
+    bmgr->sync(table_id);
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+
+  std::vector<pagenum_t> page_numbers;
+  {
+    PageManager *dmgr = new DiskManager();
+    int fd = dmgr->openDatabase(path);
+    ASSERT_TRUE(fd > 0);
+    Page hpg;
+    dmgr->readPage(fd, PN_HEADER, &hpg);
+    ASSERT_EQ(FreeSpaceMap(dmgr, fd, hpg.getHeaderPage()).getFreePages(),
+              INITIAL_PAGES_NUMBER - 1);
+    delete dmgr;
+  }
+
+  /*
+   * Recovery redoes the header and the pages
+   */
+  {
+    PageManager *dmgr = new DiskManager(SYNC_GROUP, IO_BUFFERED, LOG_WAL);
+    int fd = dmgr->openDatabase(path);
+    ASSERT_TRUE(fd > 0);
+    Page hpg;
+    dmgr->readPage(fd, PN_HEADER, &hpg);
+    FreeSpaceMap fsm(dmgr, fd, hpg.getHeaderPage());
+    ASSERT_EQ(fsm.getFreePages(), INITIAL_PAGES_NUMBER - 1 - npages);
+
+    Page pg;
+    int nfound = 0;
+    for (pagenum_t pn = 1; pn < INITIAL_PAGES_NUMBER; pn++) {
+      if (!fsm.isAllocated(pn)) continue;
+      dmgr->readPage(fd, pn, &pg);
+      ASSERT_EQ(std::stoul(std::string(pg.data)), pn);
+      nfound += 1;
+    }
+    ASSERT_EQ(nfound, npages);
+    delete dmgr;
+  }
+}
+
+TEST_F(WalTest, tornTail) {
+  int data_fd = open(path, O_RDWR | O_CREAT, 0644);
+  ASSERT_TRUE(data_fd > 0);
+
+  lsn_t lsn;
+  {
+    LogManager log(log_path, LSN_INVALID);
+    ASSERT_TRUE(log.isOpen());
+    Page pg;
+    for (pagenum_t pn = 1; pn <= 3; pn++) {
+      memset(pg.data, static_cast<int>(pn), PAGE_SIZE);
+      lsn = log.append(pn, &pg);
+    }
+    log.flush(lsn);
+    ASSERT_EQ(log.getFlushedLsn(), lsn);
+  }
+
+  /*
+   * Tear the last record
+   */
+  int log_fd = open(log_path, O_RDONLY);
+  off_t log_size = lseek(log_fd, 0, SEEK_END);
+  close(log_fd);
+  ASSERT_EQ(truncate(log_path, log_size - PAGE_SIZE / 2), 0);
+
+  lsn_t recovered = LogManager::recover(log_path, data_fd);
+  ASSERT_GT(recovered, LSN_INVALID);
+  ASSERT_LT(recovered, lsn);
+
+  Page pg;
+  for (pagenum_t pn = 1; pn <= 2; pn++) {
+    ASSERT_EQ(pread(data_fd, pg.data, PAGE_SIZE, pn * PAGE_SIZE), PAGE_SIZE);
+    ASSERT_EQ(pg.data[0], static_cast<char>(pn));
+    ASSERT_EQ(pg.data[PAGE_SIZE - 1], static_cast<char>(pn));
+  }
+  ASSERT_EQ(lseek(data_fd, 0, SEEK_END), 3 * PAGE_SIZE);
+
+  /*
+   * The LSNs continue after a reset
+   */
+  {
+    LogManager log(log_path, recovered);
+    ASSERT_EQ(log.getNextLsn(), recovered);
+    memset(pg.data, 9, PAGE_SIZE);
+    log.flush(log.append(1, &pg));
+  }
+  ASSERT_GT(LogManager::recover(log_path, data_fd), recovered);
+  ASSERT_EQ(pread(data_fd, pg.data, PAGE_SIZE, PAGE_SIZE), PAGE_SIZE);
+  ASSERT_EQ(pg.data[0], 9);
+  close(data_fd);
+}
+
+TEST_F(WalTest, writeFailure) {
+  LogManager log(log_path, LSN_INVALID);
+  ASSERT_TRUE(log.isOpen());
+  Page pg;
+  memset(pg.data, 1, PAGE_SIZE);
+  lsn_t durable = log.append(1, &pg);
+  ASSERT_TRUE(log.flush(durable));
+
+  /*
+   * A write cut short by the file size limit fails the log
+   */
+  struct rlimit old_limit, limit;
+  ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &old_limit), 0);
+  limit = old_limit;
+  limit.rlim_cur = 2 * durable;
+  sighandler_t old_handler = signal(SIGXFSZ, SIG_IGN);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+  lsn_t lsn = LSN_INVALID;
+  for (pagenum_t pn = 2; pn <= 4; pn++) {
+    lsn = log.append(pn, &pg);
+  }
+  bool flushed = log.flush(lsn);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &old_limit), 0);
+  signal(SIGXFSZ, old_handler);
+
+  ASSERT_FALSE(flushed);
+  ASSERT_EQ(log.getFlushedLsn(), durable);
+
+  /* It stays failed and takes no more records */
+  ASSERT_FALSE(log.flush(durable));
+  ASSERT_FALSE(log.flush(LSN_INVALID));
+  ASSERT_EQ(log.append(5, &pg), LSN_INVALID);
+  ASSERT_EQ(log.getFlushedLsn(), durable);
+}
+
+TEST_F(WalTest, checkpoint) {
+  const int npages = 50;
+
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    PageManager *dmgr = new DiskManager(SYNC_GROUP, IO_BUFFERED, LOG_WAL);
+    BufferManager *bmgr = new BufferManager(dmgr);
+    int table_id = bmgr->openDatabase(path);
+    Page pg;
+    for (int i = 1; i <= npages; i++) {
+      memset(pg.data, 1, PAGE_SIZE);
+      bmgr->writePage(table_id, i, &pg);
+    }
+    bmgr->checkpoint(table_id);
+    if (bmgr->getStats().dirty_pages != 0) _exit(1);
+
+    /*
+     * Only these are redone after the crash
+     */
+    for (int i = 1; i <= npages / 2; i++) {
+      memset(pg.data, 2, PAGE_SIZE);
+      bmgr->writePage(table_id, i, &pg);
+    }
+    bmgr->sync(table_id);
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+
+  /*
+   * The records before the checkpoint are dropped
+   */
+  struct stat st;
+  ASSERT_EQ(stat(log_path, &st), 0);
+  ASSERT_LT(st.st_blocks * 512, st.st_size);
+
+  PageManager *dmgr = new DiskManager(SYNC_GROUP, IO_BUFFERED, LOG_WAL);
+  int fd = dmgr->openDatabase(path);
+  ASSERT_TRUE(fd > 0);
+  Page pg;
+  dmgr->readPage(fd, PN_HEADER, &pg);
+  ASSERT_GT(pg.getHeaderPage()->checkpoint_lsn, LSN_INVALID);
+  ASSERT_GE(dmgr->getLogEnd(fd), pg.getHeaderPage()->checkpoint_lsn);
+  for (int i = 1; i <= npages; i++) {
+    dmgr->readPage(fd, i, &pg);
+    ASSERT_EQ(pg.data[0], i <= npages / 2 ? 2 : 1);
+  }
+  delete dmgr;
+}
+
+TEST_F(WalTest, otherPageSize) {
+  PageManager *dmgr = new DiskManager();
+  ASSERT_TRUE(dmgr->openDatabase(path) > 0);
+  delete dmgr;
+
+  /*
+   * A file of another page size with a log to redo
+   */
+  Page pg;
+  int  raw = open(path, O_RDWR);
+  ASSERT_TRUE(raw > 0);
+  ASSERT_EQ(pread(raw, pg.data, PAGE_SIZE, 0), PAGE_SIZE);
+  pg.getHeaderPage()->page_size = 2 * PAGE_SIZE;
+  ASSERT_EQ(pwrite(raw, pg.data, PAGE_SIZE, 0), PAGE_SIZE);
+  close(raw);
+  {
+    LogManager log(log_path, LSN_INVALID);
+    memset(pg.data, 1, PAGE_SIZE);
+    ASSERT_TRUE(log.flush(log.append(1, &pg)));
+  }
+
+  /*
+   * It isn't opened, and the log isn't redone onto it
+   */
+  dmgr = new DiskManager(SYNC_GROUP, IO_BUFFERED, LOG_WAL);
+  ASSERT_EQ(dmgr->openDatabase(path), F_VALIDATEFAIL);
+  delete dmgr;
+  raw = open(path, O_RDONLY);
+  ASSERT_TRUE(raw > 0);
+  ASSERT_EQ(pread(raw, pg.data, PAGE_SIZE, PAGE_SIZE), PAGE_SIZE);
+  close(raw);
+  ASSERT_EQ(pg.data[0], 0);
+  struct stat st;
+  ASSERT_EQ(stat(log_path, &st), 0);
+  ASSERT_GT(st.st_size, 0);
+}
+
+TEST_F(WalTest, checkpointer) {
+  PageManager *dmgr = new DiskManager(SYNC_GROUP, IO_BUFFERED, LOG_WAL);
+  BufferManager *bmgr = new BufferManager(dmgr);
+  int table_id = bmgr->openDatabase(path);
+  Page pg;
+  memset(pg.data, 1, PAGE_SIZE);
+  for (int i = 1; i <= 10; i++) {
+    bmgr->writePage(table_id, i, &pg);
+  }
+
+  CheckpointOptions opts;
+  opts.interval_ms = 1;
+  bmgr->startCheckpointer(opts);
+  for (int i = 0; i < 1000 && bmgr->getStats().checkpoints == 0; i++) {
+    usleep(1000);
+  }
+  bmgr->stopCheckpointer();
+  ASSERT_GT(bmgr->getStats().checkpoints, 0);
+  ASSERT_EQ(bmgr->getStats().dirty_pages, 0);
+  delete bmgr;
+  delete dmgr;
+}
+
+/*
+ * DiskManager whose first batch write stalls
+ */
+class StallingDiskManager : public DiskManager {
+ public:
+  std::atomic<bool> stalled{false};
+
+ public:
+  StallingDiskManager() : DiskManager(SYNC_GROUP, IO_BUFFERED, LOG_WAL) {}
+  void writePages(const PageIO *ios, size_t n) override {
+    if (!stalled.exchange(true)) {
+      usleep(100000);
+    }
+    DiskManager::writePages(ios, n);
+  }
+};
+
+TEST_F(WalTest, checkpointWaitsForDirectWrites) {
+  StallingDiskManager *dmgr = new StallingDiskManager();
+  BufferManager *bmgr = new BufferManager(dmgr);
+  int table_id = bmgr->openDatabase(path);
+  pagenum_t pn = bmgr->allocPage(table_id);
+
+  /*
+   * A page written around the buffer is logged, then
+   * stalls before reaching the file
+   */
+  Page pg;
+  memset(pg.data, 7, PAGE_SIZE);
+  std::thread writer([&]() {
+    PageIO io = {table_id, pn, &pg};
+    bmgr->writePages(&io, 1);
+  });
+  while (!dmgr->stalled) {
+    std::this_thread::yield();
+  }
+
+  /* The checkpoint drops its record only once it is written */
+  bmgr->checkpoint(table_id);
+  int fd = open(path, O_RDONLY);
+  Page on_disk;
+  ASSERT_EQ(pread(fd, on_disk.data, PAGE_SIZE, pn * PAGE_SIZE), PAGE_SIZE);
+  close(fd);
+  writer.join();
+  ASSERT_EQ(memcmp(on_disk.data, pg.data, PAGE_SIZE), 0);
+  delete bmgr;
+  delete dmgr;
+}